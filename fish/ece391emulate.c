@@ -176,6 +176,14 @@ ece391_vidmap (uint8_t** screen_start)
     return 0;
 }
 
+int32_t 
+ece391_brk (void* addr)
+{
+    if (NULL != addr && 0 != brk (addr))
+        return -1;
+    return (int32_t)sbrk (0);
+}
+
 int32_t 
 ece391_read (int32_t fd, void* buf, int32_t nbytes)
 {
@@ -51,3 +51,244 @@ ece391_strncmp (const uint8_t* s1, const uint8_t* s2, uint32_t n)
     return ((int32_t)*s1) - ((int32_t)*s2);
 }
 
+
+/*
+ * Heap allocator on top of ece391_brk.
+ *
+ * Requests up to HEAP_MAX_SMALL bytes are rounded up to a power-of-two size
+ * class.  Each class gets pages of its own, carved into equal objects that
+ * sit on a per-class free list, so small malloc/free is a list pop/push with
+ * no per-object header.  The free lists are kept together in one cache in
+ * front of the page-level allocator, which is the only part that would need
+ * a lock if a per-thread cache were added.  Larger requests get a run of
+ * whole pages (a span).  What each page is used for is recorded in a page
+ * map indexed by page number.
+ */
+#define HEAP_PAGE_SIZE   4096
+#define HEAP_MAX_PAGES   2048   /* the kernel lets the heap grow up to 8MB */
+#define HEAP_MIN_SHIFT   4      /* smallest class holds 16 bytes */
+#define HEAP_NUM_CLASSES 8      /* 16, 32, ..., 2048 bytes */
+#define HEAP_MAX_SMALL   (1 << (HEAP_MIN_SHIFT + HEAP_NUM_CLASSES - 1))
+
+#define HEAP_PAGE_UNUSED 0      /* beyond the top, or inside a span */
+#define HEAP_PAGE_SMALL  1      /* holds objects of one size class */
+#define HEAP_PAGE_LARGE  2      /* first page of an allocated span */
+#define HEAP_PAGE_FREE   3      /* first page of a free span */
+
+typedef struct ece391_heap_page {
+    uint8_t kind;
+    uint8_t size_class;
+    uint16_t npages;            /* span length, on the first page of a span */
+} ece391_heap_page_t;
+
+/* A free object or a free span, linked through its first word */
+typedef struct ece391_heap_obj {
+    struct ece391_heap_obj* next;
+} ece391_heap_obj_t;
+
+typedef struct ece391_heap_cache {
+    ece391_heap_obj_t* free_list[HEAP_NUM_CLASSES];
+} ece391_heap_cache_t;
+
+static uint8_t* heap_base;      /* first heap page, 0 until the first call */
+static uint8_t* heap_top;       /* current break */
+static ece391_heap_obj_t* heap_free_spans;
+static ece391_heap_page_t heap_map[HEAP_MAX_PAGES];
+static ece391_heap_cache_t heap_cache;
+
+void*
+ece391_sbrk (int32_t increment)
+{
+    int32_t old = ece391_brk (0);
+
+    if (-1 == old)
+        return (void*)-1;
+    if (0 != increment && -1 == ece391_brk ((void*)(old + increment)))
+        return (void*)-1;
+    return (void*)old;
+}
+
+/* Set the break to the end of page idx, return 0 on success or -1 */
+static int32_t
+ece391_heap_set_top (uint32_t idx)
+{
+    if (idx > HEAP_MAX_PAGES ||
+        -1 == ece391_brk (heap_base + idx * HEAP_PAGE_SIZE))
+        return -1;
+    heap_top = heap_base + idx * HEAP_PAGE_SIZE;
+    return 0;
+}
+
+/* Return the span starting at page idx to the free spans or to the kernel */
+static void
+ece391_span_free (uint32_t idx)
+{
+    uint32_t npages = heap_map[idx].npages;
+    uint32_t next = idx + npages;
+    ece391_heap_obj_t** prev;
+
+    /* Merge with a free span right after it. */
+    if (heap_base + next * HEAP_PAGE_SIZE < heap_top &&
+        HEAP_PAGE_FREE == heap_map[next].kind) {
+        for (prev = &heap_free_spans; 0 != *prev; prev = &(*prev)->next) {
+            if ((uint8_t*)*prev == heap_base + next * HEAP_PAGE_SIZE) {
+                *prev = (*prev)->next;
+                break;
+            }
+        }
+        npages += heap_map[next].npages;
+        heap_map[next].kind = HEAP_PAGE_UNUSED;
+    }
+
+    /* Give the pages back if the span is at the top of the heap. */
+    if (heap_base + (idx + npages) * HEAP_PAGE_SIZE == heap_top &&
+        0 == ece391_heap_set_top (idx)) {
+        heap_map[idx].kind = HEAP_PAGE_UNUSED;
+        return;
+    }
+
+    heap_map[idx].kind = HEAP_PAGE_FREE;
+    heap_map[idx].npages = npages;
+    ((ece391_heap_obj_t*)(heap_base + idx * HEAP_PAGE_SIZE))->next = heap_free_spans;
+    heap_free_spans = (ece391_heap_obj_t*)(heap_base + idx * HEAP_PAGE_SIZE);
+}
+
+/* Allocate npages consecutive pages, return 0 if out of memory */
+static uint8_t*
+ece391_span_alloc (uint32_t npages)
+{
+    ece391_heap_obj_t** prev;
+    uint32_t idx, have;
+    int32_t brk;
+
+    if (0 == heap_base) {
+        if (-1 == (brk = ece391_brk (0)))
+            return 0;
+        heap_base = (uint8_t*)((brk + HEAP_PAGE_SIZE - 1) & ~(HEAP_PAGE_SIZE - 1));
+        if (-1 == ece391_heap_set_top (0)) {
+            heap_base = 0;
+            return 0;
+        }
+    }
+
+    /* First fit among the free spans, the rest of the span stays free. */
+    for (prev = &heap_free_spans; 0 != *prev; prev = &(*prev)->next) {
+        idx = ((uint8_t*)*prev - heap_base) / HEAP_PAGE_SIZE;
+        have = heap_map[idx].npages;
+        if (have < npages)
+            continue;
+        *prev = (*prev)->next;
+        heap_map[idx].kind = HEAP_PAGE_LARGE;
+        heap_map[idx].npages = npages;
+        if (have > npages) {
+            heap_map[idx + npages].kind = HEAP_PAGE_LARGE;
+            heap_map[idx + npages].npages = have - npages;
+            ece391_span_free (idx + npages);
+        }
+        return heap_base + idx * HEAP_PAGE_SIZE;
+    }
+
+    /* Otherwise grow the heap. */
+    idx = (heap_top - heap_base) / HEAP_PAGE_SIZE;
+    if (-1 == ece391_heap_set_top (idx + npages))
+        return 0;
+    heap_map[idx].kind = HEAP_PAGE_LARGE;
+    heap_map[idx].npages = npages;
+    return heap_base + idx * HEAP_PAGE_SIZE;
+}
+
+/* Carve a new page into objects of size class c, return 0 on success or -1 */
+static int32_t
+ece391_heap_refill (int32_t c)
+{
+    uint32_t size = 1 << (HEAP_MIN_SHIFT + c);
+    uint32_t off = HEAP_PAGE_SIZE;
+    ece391_heap_obj_t* obj;
+    uint8_t* page;
+
+    if (0 == (page = ece391_span_alloc (1)))
+        return -1;
+    heap_map[(page - heap_base) / HEAP_PAGE_SIZE].kind = HEAP_PAGE_SMALL;
+    heap_map[(page - heap_base) / HEAP_PAGE_SIZE].size_class = c;
+
+    /* Push from the end so that objects are handed out in address order. */
+    while (off >= size) {
+        off -= size;
+        obj = (ece391_heap_obj_t*)(page + off);
+        obj->next = heap_cache.free_list[c];
+        heap_cache.free_list[c] = obj;
+    }
+    return 0;
+}
+
+void*
+ece391_malloc (uint32_t size)
+{
+    ece391_heap_obj_t* obj;
+    int32_t c;
+
+    if (0 == size || size > HEAP_MAX_PAGES * HEAP_PAGE_SIZE)
+        return 0;
+    if (size > HEAP_MAX_SMALL)
+        return ece391_span_alloc ((size + HEAP_PAGE_SIZE - 1) / HEAP_PAGE_SIZE);
+
+    for (c = 0; (1 << (HEAP_MIN_SHIFT + c)) < size; c++);
+    if (0 == heap_cache.free_list[c] && -1 == ece391_heap_refill (c))
+        return 0;
+    obj = heap_cache.free_list[c];
+    heap_cache.free_list[c] = obj->next;
+    return obj;
+}
+
+void
+ece391_free (void* ptr)
+{
+    ece391_heap_obj_t* obj = ptr;
+    uint32_t idx;
+
+    if ((uint8_t*)ptr < heap_base || (uint8_t*)ptr >= heap_top)
+        return;
+    idx = ((uint8_t*)ptr - heap_base) / HEAP_PAGE_SIZE;
+
+    if (HEAP_PAGE_SMALL == heap_map[idx].kind) {
+        obj->next = heap_cache.free_list[heap_map[idx].size_class];
+        heap_cache.free_list[heap_map[idx].size_class] = obj;
+    } else if (HEAP_PAGE_LARGE == heap_map[idx].kind &&
+               (uint8_t*)ptr == heap_base + idx * HEAP_PAGE_SIZE) {
+        ece391_span_free (idx);
+    }
+}
+
+void*
+ece391_realloc (void* ptr, uint32_t size)
+{
+    uint32_t idx, old_size, npages, i;
+    uint8_t* new;
+
+    if ((uint8_t*)ptr < heap_base || (uint8_t*)ptr >= heap_top)
+        return ece391_malloc (size);
+    idx = ((uint8_t*)ptr - heap_base) / HEAP_PAGE_SIZE;
+
+    if (HEAP_PAGE_SMALL == heap_map[idx].kind) {
+        old_size = 1 << (HEAP_MIN_SHIFT + heap_map[idx].size_class);
+    } else {
+        old_size = heap_map[idx].npages * HEAP_PAGE_SIZE;
+        npages = (size + HEAP_PAGE_SIZE - 1) / HEAP_PAGE_SIZE;
+        /* A span at the top of the heap just grows in place. */
+        if (size > old_size && size <= HEAP_MAX_PAGES * HEAP_PAGE_SIZE &&
+            heap_base + (idx + heap_map[idx].npages) * HEAP_PAGE_SIZE == heap_top &&
+            0 == ece391_heap_set_top (idx + npages)) {
+            heap_map[idx].npages = npages;
+            return ptr;
+        }
+    }
+    if (size <= old_size)
+        return ptr;
+
+    if (0 == (new = ece391_malloc (size)))
+        return 0;
+    for (i = 0; i < old_size; i++)
+        new[i] = ((uint8_t*)ptr)[i];
+    ece391_free (ptr);
+    return new;
+}
@@ -7,4 +7,16 @@ extern void ece391_fdputs (int32_t fd, const uint8_t* s);
 extern int32_t ece391_strcmp (const uint8_t* s1, const uint8_t* s2);
 extern int32_t ece391_strncmp (const uint8_t* s1, const uint8_t* s2, uint32_t n);
 
+/*
+ * Heap.  ece391_malloc returns 0 when out of memory, and the memory it
+ * returns is not cleared.  ece391_realloc keeps the old contents and may
+ * move the block.  ece391_sbrk moves the end of the heap by increment bytes
+ * and returns the old end, or (void*)-1 on failure; don't mix it with
+ * ece391_malloc, which expects to own the end of the heap.
+ */
+extern void* ece391_sbrk (int32_t increment);
+extern void* ece391_malloc (uint32_t size);
+extern void* ece391_realloc (void* ptr, uint32_t size);
+extern void ece391_free (void* ptr);
+
 #endif /* ECE391SUPPORT_H */
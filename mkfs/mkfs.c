@@ -0,0 +1,495 @@
+/* mkfs.c - Build a file system image from a directory tree
+ *
+ * Writes the same image format as createfs. Directories with more than 63
+ * entries get the hashed directory extension described in
+ * student-distrib/file_system.h, and files of more than 1021 blocks get
+ * indirect blocks. Subdirectories become directory inodes holding their
+ * dentries. createfs can produce none of these. The data blocks of every
+ * file are contiguous, so the kernel copies each run of them at once.
+ * With -z, data blocks are LZ4 compressed one by one; the kernel then
+ * decompresses them as they are read.
+ *
+ * Build on the host with
+ *     gcc -Wall -O2 -o mkfs mkfs.c
+ * and run
+ *     ./mkfs -i ../fsdir -o ../student-distrib/filesys_img [-z]
+ */
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BLOCK_SIZE 4096
+#define FILE_NAME_MAX_LENGTH 32
+#define BOOT_BLOCK_DENTRIES 63
+#define INODE_MAX_BLOCKS 1023
+
+#define RTC_FILE 0
+#define DIRECTORY_FILE 1
+#define REGULAR_FILE 2
+
+// Must match file_system.h.
+#define DIR_EXT_MAGIC 0x48534944
+#define DIR_HASH_SIZE 1024
+#define DIR_NO_ENTRY 0xffffffff
+#define DIR_HASH_OFFSET_BASIS 2166136261U
+#define DIR_HASH_PRIME 16777619U
+#define INODE_FLAG_INDIRECT 0x1
+#define DIRECT_BLOCKS 1021
+#define SINGLE_INDIRECT 1021
+#define DOUBLE_INDIRECT 1022
+#define INDIRECT_ENTRIES 1024
+#define MAX_FILE_SIZE 0xfffff000U
+#define PACK_MAGIC 0x4b434150
+#define MAX_DEPTH 16
+
+// LZ4 block format, see lz4.c in the kernel. Matches are found through a hash table of
+//  the last position of every 4-byte sequence. As the format requires, the last
+//  LZ4_END_LITERALS bytes are literals and no match starts in the last LZ4_MATCH_LIMIT.
+#define LZ4_HASH_BITS 12
+#define LZ4_HASH_PRIME 2654435761U
+#define LZ4_MIN_MATCH 4
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_END_LITERALS 5
+#define LZ4_MATCH_LIMIT 12
+#define LZ4_MORE_LENGTH 15
+#define LZ4_BYTE_MAX 255
+
+// Free inodes and data blocks left for files created at run time, unless given.
+#define DEFAULT_SPARE_INODES 16
+#define DEFAULT_SPARE_BLOCKS 64
+
+typedef struct dentry {
+    uint8_t file_name[FILE_NAME_MAX_LENGTH];
+    uint32_t file_type;
+    uint32_t inode_idx;
+    uint32_t hash_next;
+    uint8_t reserved[20];
+} dentry_t;
+
+typedef struct boot_block {
+    uint32_t num_dentry;
+    uint32_t num_inode;
+    uint32_t num_data_block;
+    uint32_t dir_magic;
+    uint32_t dir_inode;
+    uint32_t dir_hash_size;
+    uint32_t inode_flags;
+    uint32_t pack_magic;
+    uint32_t pack_index_blocks;
+    uint8_t reserved[28];
+    dentry_t dentry[BOOT_BLOCK_DENTRIES];
+} boot_block_t;
+
+typedef struct inode {
+    uint32_t length;
+    uint32_t data_block_idx[INODE_MAX_BLOCKS];
+} inode_t;
+
+// A regular file or subdirectory to be put into the image, the data of a subdirectory is
+//  the array of its dentries.
+typedef struct source_file {
+    char path[PATH_MAX];
+    uint8_t *data;
+    uint32_t length;
+} source_file_t;
+
+// Bucket of a file name, same function as dir_hash() in file_system.c.
+static uint32_t dir_hash(const uint8_t *name) {
+    uint32_t hash = DIR_HASH_OFFSET_BASIS;
+    uint32_t i;
+
+    for(i = 0; i < FILE_NAME_MAX_LENGTH && name[i] != '\0'; ++i)
+        hash = (hash ^ name[i]) * DIR_HASH_PRIME;
+    return hash & (DIR_HASH_SIZE - 1);
+}
+
+// Number of pointer blocks needed by a file of num_blocks blocks.
+static uint32_t table_blocks(uint32_t num_blocks) {
+    uint32_t n;
+
+    if(num_blocks <= DIRECT_BLOCKS)
+        return 0;
+    if(num_blocks <= DIRECT_BLOCKS + INDIRECT_ENTRIES)
+        return 1;
+    n = num_blocks - DIRECT_BLOCKS - INDIRECT_ENTRIES;
+    return 2 + (n + INDIRECT_ENTRIES - 1) / INDIRECT_ENTRIES;
+}
+
+// Point file block j of inode at data block idx. Pointer blocks are taken from *next_block
+//  when their first entry is filled in.
+static void map_block(uint8_t *data, inode_t *inode, uint32_t j, uint32_t idx, uint32_t *next_block) {
+    uint32_t n, *outer, *table;
+
+    if(j < DIRECT_BLOCKS) {
+        inode->data_block_idx[j] = idx;
+        return;
+    }
+    n = j - DIRECT_BLOCKS;
+    if(n < INDIRECT_ENTRIES) {
+        if(n == 0)
+            inode->data_block_idx[SINGLE_INDIRECT] = (*next_block)++;
+        table = (uint32_t *)(data + inode->data_block_idx[SINGLE_INDIRECT] * BLOCK_SIZE);
+        table[n] = idx;
+        return;
+    }
+    n -= INDIRECT_ENTRIES;
+    if(n == 0)
+        inode->data_block_idx[DOUBLE_INDIRECT] = (*next_block)++;
+    outer = (uint32_t *)(data + inode->data_block_idx[DOUBLE_INDIRECT] * BLOCK_SIZE);
+    if(n % INDIRECT_ENTRIES == 0)
+        outer[n / INDIRECT_ENTRIES] = (*next_block)++;
+    table = (uint32_t *)(data + outer[n / INDIRECT_ENTRIES] * BLOCK_SIZE);
+    table[n % INDIRECT_ENTRIES] = idx;
+}
+
+static uint32_t read32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Write a length continued past a LZ4_MORE_LENGTH nibble.
+static uint8_t *put_length(uint8_t *op, uint32_t length) {
+    for(; length >= LZ4_BYTE_MAX; length -= LZ4_BYTE_MAX)
+        *op++ = LZ4_BYTE_MAX;
+    *op++ = length;
+    return op;
+}
+
+// Emit one sequence: literals [lit, lit + lit_len), then a match of match_len bytes at
+//  offset back, if match_len is not 0.
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *lit, uint32_t lit_len,
+                             uint32_t offset, uint32_t match_len) {
+    uint8_t *token = op++;
+    uint32_t m = match_len ? match_len - LZ4_MIN_MATCH : 0;
+
+    *token = (lit_len < LZ4_MORE_LENGTH ? lit_len : LZ4_MORE_LENGTH) << 4;
+    if(lit_len >= LZ4_MORE_LENGTH)
+        op = put_length(op, lit_len - LZ4_MORE_LENGTH);
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    if(match_len == 0)
+        return op;
+
+    *token |= m < LZ4_MORE_LENGTH ? m : LZ4_MORE_LENGTH;
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    if(m >= LZ4_MORE_LENGTH)
+        op = put_length(op, m - LZ4_MORE_LENGTH);
+    return op;
+}
+
+// Compress len bytes of src into dst, which must hold at least len + len / 255 + 16 bytes.
+//  Return the compressed length.
+static uint32_t lz4_compress(const uint8_t *src, uint32_t len, uint8_t *dst) {
+    int32_t table[1 << LZ4_HASH_BITS];
+    uint32_t anchor = 0, i = 0;
+    uint8_t *op = dst;
+
+    memset(table, 0xff, sizeof(table));
+    while(i + LZ4_MATCH_LIMIT <= len) {
+        uint32_t seq = read32(src + i);
+        uint32_t hash = (seq * LZ4_HASH_PRIME) >> (32 - LZ4_HASH_BITS);
+        int32_t cand = table[hash];
+        uint32_t match_len;
+
+        table[hash] = i;
+        if(cand < 0 || i - cand > LZ4_MAX_OFFSET || read32(src + cand) != seq) {
+            i++;
+            continue;
+        }
+        match_len = LZ4_MIN_MATCH;
+        while(i + match_len < len - LZ4_END_LITERALS && src[cand + match_len] == src[i + match_len])
+            match_len++;
+        op = put_sequence(op, src + anchor, i - anchor, i - cand, match_len);
+        i += match_len;
+        anchor = i;
+    }
+
+    return put_sequence(op, src + anchor, len - anchor, 0, 0) - dst;
+}
+
+// Replace the data blocks of image with their compressed form. Return the new image size
+//  in bytes, the image is reallocated.
+static uint32_t pack_image(uint8_t **image, uint32_t num_inode, uint32_t num_data_block) {
+    boot_block_t *boot_block = (boot_block_t *)*image;
+    uint32_t index_blocks = ((num_data_block + 1) * sizeof(uint32_t) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32_t header = (1 + num_inode + index_blocks) * BLOCK_SIZE;
+    uint8_t *data = *image + (1 + num_inode) * BLOCK_SIZE;
+    uint8_t *packed = calloc(1, header + num_data_block * (BLOCK_SIZE + BLOCK_SIZE / 255 + 16));
+    uint32_t *index = (uint32_t *)(packed + (1 + num_inode) * BLOCK_SIZE);
+    uint8_t zero[BLOCK_SIZE] = {0};
+    uint32_t i, size, offset = 0;
+
+    boot_block->pack_magic = PACK_MAGIC;
+    boot_block->pack_index_blocks = index_blocks;
+    memcpy(packed, *image, (1 + num_inode) * BLOCK_SIZE);
+
+    // Zero blocks take no space, blocks that do not shrink are stored as they are.
+    for(i = 0; i < num_data_block; ++i) {
+        const uint8_t *block = data + i * BLOCK_SIZE;
+        uint8_t *out = packed + header + offset;
+
+        index[i] = offset;
+        if(memcmp(block, zero, BLOCK_SIZE) == 0)
+            continue;
+        size = lz4_compress(block, BLOCK_SIZE, out);
+        if(size >= BLOCK_SIZE) {
+            memcpy(out, block, BLOCK_SIZE);
+            size = BLOCK_SIZE;
+        }
+        offset += size;
+    }
+    index[num_data_block] = offset;
+
+    free(*image);
+    *image = packed;
+    return header + offset;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(const char **)a, *(const char **)b);
+}
+
+// Read a whole file. Return 0 on success, -1 on failure.
+static int read_file(source_file_t *file) {
+    FILE *fp = fopen(file->path, "rb");
+    long length;
+
+    if(fp == NULL || fseek(fp, 0, SEEK_END) != 0 || (length = ftell(fp)) < 0) {
+        if(fp != NULL)
+            fclose(fp);
+        return -1;
+    }
+    rewind(fp);
+
+    file->length = length;
+    file->data = malloc(length + 1);
+    if(file->data == NULL || fread(file->data, 1, length, fp) != (size_t)length) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    return 0;
+}
+
+// Inodes of the image, in the order their files are found.
+static source_file_t *files;
+static uint32_t num_files, files_capacity;
+
+// Collect the regular files and subdirectories of path, sorted so that images are
+//  reproducible. Each gets an inode, a subdirectory before the files below it. Fill
+//  *dentries with one dentry per entry. Return their number, -1 on failure.
+static int collect_dir(const char *path, uint32_t depth, dentry_t **dentries) {
+    char **names = NULL;
+    uint32_t num_names = 0, capacity = 0, i, count = 0;
+    struct dirent *entry;
+    struct stat st;
+    DIR *dir;
+
+    dir = opendir(path);
+    if(dir == NULL) {
+        perror(path);
+        return -1;
+    }
+    while((entry = readdir(dir)) != NULL) {
+        char child[PATH_MAX];
+        if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        if(stat(child, &st) != 0 || (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)))
+            continue;
+        if(num_names == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            names = realloc(names, capacity * sizeof(char *));
+        }
+        names[num_names++] = strdup(entry->d_name);
+    }
+    closedir(dir);
+    qsort(names, num_names, sizeof(char *), compare_names);
+
+    *dentries = calloc(num_names ? num_names : 1, sizeof(dentry_t));
+    for(i = 0; i < num_names; ++i) {
+        uint32_t name_length = strlen(names[i]), index;
+        source_file_t *file;
+        dentry_t *children;
+        int num_children;
+
+        if(num_files == files_capacity) {
+            files_capacity = files_capacity ? files_capacity * 2 : 64;
+            files = realloc(files, files_capacity * sizeof(source_file_t));
+        }
+        index = num_files++;
+        file = &files[index];
+        memset(file, 0, sizeof(source_file_t));
+        snprintf(file->path, sizeof(file->path), "%s/%s", path, names[i]);
+        if(name_length > FILE_NAME_MAX_LENGTH)
+            fprintf(stderr, "warning: %s truncated to %d characters\n", file->path, FILE_NAME_MAX_LENGTH);
+
+        if(stat(file->path, &st) == 0 && S_ISDIR(st.st_mode)) {
+            if(depth + 1 >= MAX_DEPTH) {
+                fprintf(stderr, "%s: nested too deep\n", file->path);
+                return -1;
+            }
+            // files moves as it grows, so neither file nor its path stay valid.
+            char child[PATH_MAX];
+            strcpy(child, file->path);
+            num_children = collect_dir(child, depth + 1, &children);
+            if(num_children < 0)
+                return -1;
+            file = &files[index];
+            file->data = (uint8_t *)children;
+            file->length = num_children * sizeof(dentry_t);
+            (*dentries)[count].file_type = DIRECTORY_FILE;
+        }
+        else {
+            if(read_file(file) != 0) {
+                perror(file->path);
+                return -1;
+            }
+            if(file->length > MAX_FILE_SIZE) {
+                fprintf(stderr, "%s: too large\n", file->path);
+                return -1;
+            }
+            (*dentries)[count].file_type = REGULAR_FILE;
+        }
+        memcpy((*dentries)[count].file_name, names[i],
+               name_length < FILE_NAME_MAX_LENGTH ? name_length : FILE_NAME_MAX_LENGTH);
+        (*dentries)[count].inode_idx = index;
+        count++;
+        free(names[i]);
+    }
+    free(names);
+
+    return count;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s -i <source dir> -o <image> [-n <spare inodes>] [-b <spare data blocks>] [-z]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    const char *in_dir = NULL, *out_path = NULL;
+    uint32_t spare_inodes = DEFAULT_SPARE_INODES, spare_blocks = DEFAULT_SPARE_BLOCKS;
+    dentry_t *dentries, *top;
+    uint32_t num_dentry, num_inode, num_data_block, used_blocks, dir_length = 0;
+    uint32_t heads[DIR_HASH_SIZE];
+    int hashed, compress = 0, opt;
+    uint32_t i, j;
+
+    while((opt = getopt(argc, argv, "i:o:n:b:z")) != -1) {
+        switch(opt) {
+            case 'i': in_dir = optarg; break;
+            case 'o': out_path = optarg; break;
+            case 'n': spare_inodes = strtoul(optarg, NULL, 0); break;
+            case 'b': spare_blocks = strtoul(optarg, NULL, 0); break;
+            case 'z': compress = 1; break;
+            default: usage(argv[0]);
+        }
+    }
+    if(in_dir == NULL || out_path == NULL)
+        usage(argv[0]);
+
+    // Collect the tree, then ".", "rtc" and the top level entries make up the root.
+    int num_top = collect_dir(in_dir, 0, &top);
+    if(num_top < 0)
+        return 1;
+    used_blocks = 0;
+    for(i = 0; i < num_files; ++i) {
+        used_blocks += (files[i].length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        used_blocks += table_blocks((files[i].length + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    }
+
+    num_dentry = num_top + 2;
+    dentries = calloc(num_dentry, sizeof(dentry_t));
+    strcpy((char *)dentries[0].file_name, ".");
+    dentries[0].file_type = DIRECTORY_FILE;
+    strcpy((char *)dentries[1].file_name, "rtc");
+    dentries[1].file_type = RTC_FILE;
+    memcpy(&dentries[2], top, num_top * sizeof(dentry_t));
+
+    // Past the boot block, the directory gets inode num_files: hash table, then dentries.
+    hashed = num_dentry > BOOT_BLOCK_DENTRIES;
+    if(hashed) {
+        for(i = 0; i < DIR_HASH_SIZE; ++i)
+            heads[i] = DIR_NO_ENTRY;
+        for(i = 0; i < num_dentry; ++i) {
+            uint32_t bucket = dir_hash(dentries[i].file_name);
+            dentries[i].hash_next = heads[bucket];
+            heads[bucket] = i;
+        }
+        dir_length = sizeof(heads) + (num_dentry - BOOT_BLOCK_DENTRIES) * sizeof(dentry_t);
+        used_blocks += (dir_length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        used_blocks += table_blocks((dir_length + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    }
+    num_inode = num_files + hashed + spare_inodes;
+    num_data_block = used_blocks + spare_blocks;
+
+    // Lay the image out in memory: boot block, inodes, data blocks.
+    uint8_t *image = calloc(1 + num_inode + num_data_block, BLOCK_SIZE);
+    boot_block_t *boot_block = (boot_block_t *)image;
+    uint8_t *data = image + (1 + num_inode) * BLOCK_SIZE;
+    uint32_t next_block = 0;
+
+    boot_block->num_dentry = num_dentry;
+    boot_block->num_inode = num_inode;
+    boot_block->num_data_block = num_data_block;
+    boot_block->inode_flags = INODE_FLAG_INDIRECT;
+    for(i = 0; i < num_dentry && i < BOOT_BLOCK_DENTRIES; ++i)
+        boot_block->dentry[i] = dentries[i];
+
+    // The data blocks of a file are laid out in one run, followed by its pointer blocks.
+    for(i = 0; i < num_files + hashed; ++i) {
+        inode_t *inode = (inode_t *)(image + (1 + i) * BLOCK_SIZE);
+        uint32_t first_block = next_block, num_blocks;
+        uint8_t *content;
+
+        if(i < num_files) {
+            inode->length = files[i].length;
+            content = files[i].data;
+        }
+        else {
+            inode->length = dir_length;
+            content = calloc(1, dir_length);
+            memcpy(content, heads, sizeof(heads));
+            memcpy(content + sizeof(heads), &dentries[BOOT_BLOCK_DENTRIES],
+                   (num_dentry - BOOT_BLOCK_DENTRIES) * sizeof(dentry_t));
+            boot_block->dir_magic = DIR_EXT_MAGIC;
+            boot_block->dir_inode = i;
+            boot_block->dir_hash_size = DIR_HASH_SIZE;
+        }
+
+        num_blocks = (inode->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        for(j = 0; j < num_blocks; ++j) {
+            uint32_t chunk = inode->length - j * BLOCK_SIZE;
+            if(chunk > BLOCK_SIZE)
+                chunk = BLOCK_SIZE;
+            memcpy(data + (first_block + j) * BLOCK_SIZE, content + j * BLOCK_SIZE, chunk);
+        }
+        next_block += num_blocks;
+        for(j = 0; j < num_blocks; ++j)
+            map_block(data, inode, j, first_block + j, &next_block);
+    }
+
+    uint32_t image_size = (1 + num_inode + num_data_block) * BLOCK_SIZE;
+    if(compress)
+        image_size = pack_image(&image, num_inode, num_data_block);
+
+    FILE *out = fopen(out_path, "wb");
+    if(out == NULL || fwrite(image, 1, image_size, out) != image_size) {
+        perror(out_path);
+        return 1;
+    }
+    fclose(out);
+
+    printf("%s: %u dentries%s, %u inodes, %u data blocks (%u used), %u bytes%s\n", out_path, num_dentry,
+           hashed ? " (hashed)" : "", num_inode, num_data_block, used_blocks, image_size,
+           compress ? " compressed" : "");
+
+    return 0;
+}
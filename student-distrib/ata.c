@@ -0,0 +1,517 @@
+#include "ata.h"
+#include "block_device.h"
+#include "pci.h"
+#include "i8259.h"
+#include "idt.h"
+#include "process.h"
+#include "lib.h"
+
+// Task file registers of the primary channel.
+#define ATA_DATA 0x1F0
+#define ATA_SECTOR_COUNT 0x1F2
+#define ATA_LBA_LOW 0x1F3
+#define ATA_LBA_MID 0x1F4
+#define ATA_LBA_HIGH 0x1F5
+#define ATA_DRIVE_HEAD 0x1F6
+#define ATA_STATUS 0x1F7
+#define ATA_COMMAND 0x1F7
+#define ATA_ALT_STATUS 0x3F6
+#define ATA_CONTROL 0x3F6
+
+#define ATA_STATUS_ERR 0x01
+#define ATA_STATUS_DRQ 0x08
+#define ATA_STATUS_DF 0x20
+#define ATA_STATUS_BSY 0x80
+#define ATA_STATUS_FLOATING 0xFF
+#define ATA_CONTROL_NIEN 0x02
+
+// Drive/head register: LBA mode and the slave drive, bits 24-27 of the LBA go below.
+#define ATA_SELECT_SLAVE 0xF0
+#define ATA_LBA_TOP_SHIFT 24
+#define ATA_LBA_TOP_MASK 0x0F
+#define ATA_LBA_MID_SHIFT 8
+#define ATA_LBA_HIGH_SHIFT 16
+#define ATA_BYTE_MASK 0xFF
+
+#define ATA_CMD_READ_PIO 0x20
+#define ATA_CMD_WRITE_PIO 0x30
+#define ATA_CMD_READ_DMA 0xC8
+#define ATA_CMD_WRITE_DMA 0xCA
+#define ATA_CMD_IDENTIFY 0xEC
+
+// Interesting words of the IDENTIFY data.
+#define ATA_IDENTIFY_WORDS 256
+#define ATA_IDENTIFY_CAPABILITIES 49
+#define ATA_CAPABILITY_DMA 0x100
+#define ATA_IDENTIFY_SECTORS_LOW 60
+#define ATA_IDENTIFY_SECTORS_HIGH 61
+#define ATA_WORD_SHIFT 16
+
+#define ATA_SECTOR_WORDS (BLOCK_SECTOR_SIZE / 2)
+#define ATA_DELAY_READS 4
+#define ATA_POLL_LIMIT 100000
+// Requests ata_read()/ata_write() keep queued at once.
+#define ATA_SYNC_DEPTH 4
+
+// Bus master IDE registers of the primary channel, relative to BAR4.
+#define BM_COMMAND 0x0
+#define BM_STATUS 0x2
+#define BM_PRDT 0x4
+#define BM_COMMAND_START 0x01
+#define BM_COMMAND_TO_MEMORY 0x08
+#define BM_STATUS_ERROR 0x02
+#define BM_STATUS_IRQ 0x04
+
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+
+// A PRD entry may not cross a 64KB boundary, a byte count of 0 means 64KB.
+#define PRD_BOUNDARY 0x10000
+#define PRD_COUNT_MASK 0xFFFF
+#define PRD_END_OF_TABLE 0x8000
+#define ATA_PRD_ENTRIES 32
+#define ATA_PRD_TABLE_SIZE (ATA_PRD_ENTRIES * 8)
+
+// Physical region descriptor read by the bus master.
+typedef struct prd {
+    uint32_t addr;
+    uint16_t count;
+    uint16_t flags;
+} prd_t;
+
+// Aligned to its size so that it never crosses a 64KB boundary.
+static prd_t prd_table[ATA_PRD_ENTRIES] __attribute__((aligned(ATA_PRD_TABLE_SIZE)));
+
+static int32_t drive_present = 0;
+// Base port of the bus master registers, 0 if the drive is used with PIO only.
+static uint32_t bm_base = 0;
+
+// Pending requests sorted by lba, and the batch of merged requests the drive is working on.
+static block_request_t *queue = NULL;
+static block_request_t *active = NULL;
+static int32_t active_dma;
+// Elevator position, the sector right after the last batch.
+static uint32_t head_lba = 0;
+// PIO progress: request being transferred and sectors of it done so far.
+static block_request_t *pio_req;
+static uint32_t pio_done;
+
+static block_device_t ata_device = {(int8_t *)"ata0", 0, ata_read, ata_write, ata_submit, ata_poll};
+
+// Give the drive 400ns after selecting it before looking at the status.
+static void ata_delay() {
+    int32_t i;
+    for(i = 0; i < ATA_DELAY_READS; ++i)
+        (void)inb(ATA_ALT_STATUS);
+}
+
+// Poll until the drive is not busy and has all bits in mask set. Return 0, or -1 on error or timeout.
+static int32_t ata_wait_status(uint8_t mask) {
+    int32_t i;
+    uint8_t status;
+
+    for(i = 0; i < ATA_POLL_LIMIT; ++i) {
+        status = inb(ATA_ALT_STATUS);
+        if(status & ATA_STATUS_BSY)
+            continue;
+        if(status & (ATA_STATUS_ERR | ATA_STATUS_DF))
+            return -1;
+        if((status & mask) == mask)
+            return 0;
+    }
+    return -1;
+}
+
+// Number of PRD entries needed for the buffer of req.
+static uint32_t prd_entries(block_request_t *req) {
+    uint32_t start = (uint32_t)req->buf;
+    uint32_t end = start + req->count * BLOCK_SECTOR_SIZE - 1;
+    return end / PRD_BOUNDARY - start / PRD_BOUNDARY + 1;
+}
+
+// Describe the buffers of the active batch to the bus master, in order.
+static void fill_prd_table() {
+    block_request_t *req;
+    uint32_t n = 0, addr, remaining, len;
+
+    for(req = active; req != NULL; req = req->next) {
+        addr = (uint32_t)req->buf;
+        remaining = req->count * BLOCK_SECTOR_SIZE;
+        while(remaining > 0) {
+            len = PRD_BOUNDARY - addr % PRD_BOUNDARY;
+            if(len > remaining)
+                len = remaining;
+            prd_table[n].addr = addr;
+            prd_table[n].count = len & PRD_COUNT_MASK;
+            prd_table[n].flags = 0;
+            addr += len;
+            remaining -= len;
+            n++;
+        }
+    }
+    prd_table[n - 1].flags = PRD_END_OF_TABLE;
+}
+
+// Move one sector between the drive and the request being transferred by PIO.
+static void pio_sector() {
+    uint16_t *data = (uint16_t *)pio_req->buf + pio_done * ATA_SECTOR_WORDS;
+    int32_t i;
+
+    if(pio_req->write) {
+        for(i = 0; i < ATA_SECTOR_WORDS; ++i)
+            outw(data[i], ATA_DATA);
+    }
+    else {
+        for(i = 0; i < ATA_SECTOR_WORDS; ++i)
+            data[i] = inw(ATA_DATA);
+    }
+
+    if(++pio_done == pio_req->count) {
+        pio_req = pio_req->next;
+        pio_done = 0;
+    }
+}
+
+static void ata_dispatch();
+
+// Finish the active batch with status and start the next one. Interrupts must be off.
+static void ata_complete(int32_t status) {
+    block_request_t *req = active, *next;
+
+    active = NULL;
+    while(req != NULL) {
+        next = req->next;
+        block_complete(req, status);
+        req = next;
+    }
+
+    ata_dispatch();
+}
+
+/*
+ *   ata_dispatch
+ *   DESCRIPTION: start the next batch if the drive is idle. Requests are served in
+ *                ascending sector order from the last position (C-LOOK), and queued
+ *                requests that continue each other on the disk are merged into one command.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must be called with interrupts disabled
+ */
+static void ata_dispatch() {
+    block_request_t **first, *last;
+    uint32_t lba, count, entries;
+    uint8_t command;
+
+    if(active != NULL || queue == NULL)
+        return;
+
+    // Wrap around to the lowest sector once nothing is left ahead.
+    for(first = &queue; *first != NULL && (*first)->lba < head_lba; first = &(*first)->next);
+    if(*first == NULL)
+        first = &queue;
+
+    lba = (*first)->lba;
+    last = *first;
+    count = last->count;
+    entries = prd_entries(last);
+    while(last->next != NULL && last->next->lba == lba + count && last->next->write == last->write &&
+          count + last->next->count <= ATA_MAX_SECTORS &&
+          entries + prd_entries(last->next) <= ATA_PRD_ENTRIES) {
+        last = last->next;
+        count += last->count;
+        entries += prd_entries(last);
+    }
+    active = *first;
+    *first = last->next;
+    last->next = NULL;
+    head_lba = lba + count;
+
+    active_dma = (bm_base != 0);
+    if(active_dma) {
+        fill_prd_table();
+        outl((uint32_t)prd_table, bm_base + BM_PRDT);
+        outb(active->write ? 0 : BM_COMMAND_TO_MEMORY, bm_base + BM_COMMAND);
+        outb(BM_STATUS_IRQ | BM_STATUS_ERROR, bm_base + BM_STATUS);
+        command = active->write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA;
+    }
+    else {
+        pio_req = active;
+        pio_done = 0;
+        command = active->write ? ATA_CMD_WRITE_PIO : ATA_CMD_READ_PIO;
+    }
+
+    outb(ATA_SELECT_SLAVE | ((lba >> ATA_LBA_TOP_SHIFT) & ATA_LBA_TOP_MASK), ATA_DRIVE_HEAD);
+    ata_delay();
+    // A count of ATA_MAX_SECTORS still fits in the 8-bit register.
+    outb(count, ATA_SECTOR_COUNT);
+    outb(lba & ATA_BYTE_MASK, ATA_LBA_LOW);
+    outb((lba >> ATA_LBA_MID_SHIFT) & ATA_BYTE_MASK, ATA_LBA_MID);
+    outb((lba >> ATA_LBA_HIGH_SHIFT) & ATA_BYTE_MASK, ATA_LBA_HIGH);
+    outb(command, ATA_COMMAND);
+
+    if(active_dma) {
+        outb((active->write ? 0 : BM_COMMAND_TO_MEMORY) | BM_COMMAND_START, bm_base + BM_COMMAND);
+    }
+    else if(active->write) {
+        // The first sector goes out right away, the drive interrupts after each one.
+        if(ata_wait_status(ATA_STATUS_DRQ) == -1) {
+            ata_complete(-1);
+        }
+        else {
+            pio_sector();
+            ata_delay();
+        }
+    }
+}
+
+/*
+ *   ata_init
+ *   DESCRIPTION: identify the slave drive of the primary channel, set up bus master
+ *                DMA if the IDE controller supports it, and register the drive as "ata0"
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: enables IRQ 14 if a drive is found
+ */
+void ata_init() {
+    uint16_t identify[ATA_IDENTIFY_WORDS];
+    pci_device_t ide;
+    uint32_t bar4;
+    uint8_t status;
+    int32_t i;
+
+    // The probe is polled.
+    outb(ATA_CONTROL_NIEN, ATA_CONTROL);
+    outb(ATA_SELECT_SLAVE, ATA_DRIVE_HEAD);
+    ata_delay();
+    outb(0, ATA_SECTOR_COUNT);
+    outb(0, ATA_LBA_LOW);
+    outb(0, ATA_LBA_MID);
+    outb(0, ATA_LBA_HIGH);
+    outb(ATA_CMD_IDENTIFY, ATA_COMMAND);
+
+    // Nothing attached reads as 0, or all ones on an empty channel.
+    status = inb(ATA_STATUS);
+    if(status == 0 || status == ATA_STATUS_FLOATING)
+        return;
+    if(ata_wait_status(0) == -1)
+        return;
+    // ATAPI and SATA drives set these, only plain ATA disks are supported.
+    if(inb(ATA_LBA_MID) != 0 || inb(ATA_LBA_HIGH) != 0)
+        return;
+    if(ata_wait_status(ATA_STATUS_DRQ) == -1)
+        return;
+    for(i = 0; i < ATA_IDENTIFY_WORDS; ++i)
+        identify[i] = inw(ATA_DATA);
+
+    ata_device.num_sectors = identify[ATA_IDENTIFY_SECTORS_LOW] |
+                            ((uint32_t)identify[ATA_IDENTIFY_SECTORS_HIGH] << ATA_WORD_SHIFT);
+    if(ata_device.num_sectors == 0)
+        return;
+    drive_present = 1;
+
+    if((identify[ATA_IDENTIFY_CAPABILITIES] & ATA_CAPABILITY_DMA) &&
+       pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &ide) == 0) {
+        bar4 = pci_config_read(&ide, PCI_BAR4);
+        if(bar4 & PCI_BAR_IO) {
+            bm_base = bar4 & PCI_BAR_IO_MASK;
+            pci_enable_bus_master(&ide);
+        }
+    }
+
+    interrupt_handler[ATA_VEC_NUM] = ata_handler;
+    outb(0, ATA_CONTROL);
+    (void)inb(ATA_STATUS);
+    enable_irq(ATA_IRQ);
+
+    register_block_device(&ata_device);
+}
+
+/*
+ *   ata_service
+ *   DESCRIPTION: make progress on the active batch according to the drive status. Only
+ *                the state of the drive is trusted, so a late interrupt of an earlier
+ *                batch or a poll before the drive is ready does nothing.
+ *   INPUTS: status -- value read from the status register
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must be called with interrupts disabled
+ */
+static void ata_service(uint8_t status) {
+    uint8_t bm_status;
+
+    if(active == NULL)
+        return;
+
+    if(active_dma) {
+        // The bus master latches the interrupt of the batch it is working on.
+        bm_status = inb(bm_base + BM_STATUS);
+        if(!(bm_status & (BM_STATUS_IRQ | BM_STATUS_ERROR)))
+            return;
+        outb(active->write ? 0 : BM_COMMAND_TO_MEMORY, bm_base + BM_COMMAND);
+        outb(BM_STATUS_IRQ | BM_STATUS_ERROR, bm_base + BM_STATUS);
+        ata_complete(((status & (ATA_STATUS_ERR | ATA_STATUS_DF)) || (bm_status & BM_STATUS_ERROR)) ? -1 : 0);
+        return;
+    }
+
+    if(status & ATA_STATUS_BSY)
+        return;
+    if(status & (ATA_STATUS_ERR | ATA_STATUS_DF)) {
+        ata_complete(-1);
+        return;
+    }
+    // The last sector of a write has been taken by the drive.
+    if(pio_req == NULL) {
+        ata_complete(0);
+        return;
+    }
+    if(!(status & ATA_STATUS_DRQ))
+        return;
+
+    pio_sector();
+    if(active->write)
+        ata_delay();
+    else if(pio_req == NULL)
+        ata_complete(0);
+}
+
+/*
+ *   ata_handler
+ *   DESCRIPTION: interrupt handler of the primary channel
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: wakes up processes whose requests are done
+ */
+void ata_handler() {
+    // Reading the status acknowledges the interrupt on the drive.
+    uint8_t status = inb(ATA_STATUS);
+    send_eoi(ATA_IRQ);
+    ata_service(status);
+}
+
+/*
+ *   ata_poll
+ *   DESCRIPTION: do the work of the interrupt handler if the drive is ready, for callers
+ *                that cannot take the interrupt
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may complete requests
+ */
+void ata_poll() {
+    uint32_t flags;
+
+    cli_and_save(flags);
+    ata_service(inb(ATA_STATUS));
+    restore_flags(flags);
+}
+
+/*
+ *   ata_present
+ *   DESCRIPTION: whether the data drive was found
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if present, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t ata_present() {
+    return drive_present;
+}
+
+/*
+ *   ata_submit
+ *   DESCRIPTION: add a request to the queue and start it if the drive is idle.
+ *                Requests for overlapping sectors that are queued at the same time
+ *                may be served in any order.
+ *   INPUTS: req -- request with lba, count, buf and write filled in
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if there is no drive or the request is invalid
+ *   SIDE EFFECTS: none
+ */
+int32_t ata_submit(block_request_t *req) {
+    block_request_t **pos;
+    uint32_t flags;
+
+    if(!drive_present || req == NULL || req->count == 0 || req->count > ATA_MAX_SECTORS)
+        return -1;
+    if(req->lba >= ata_device.num_sectors || req->count > ata_device.num_sectors - req->lba)
+        return -1;
+    // Words are moved by PIO and DMA alike.
+    if(((uint32_t)req->buf & 1) || !is_dma_buffer(req->buf, req->count * BLOCK_SECTOR_SIZE))
+        return -1;
+
+    req->status = BLOCK_REQUEST_PENDING;
+    req->waiters = 0;
+
+    cli_and_save(flags);
+    for(pos = &queue; *pos != NULL && (*pos)->lba <= req->lba; pos = &(*pos)->next);
+    req->next = *pos;
+    *pos = req;
+    ata_dispatch();
+    restore_flags(flags);
+
+    return 0;
+}
+
+// Split a transfer into requests and keep up to ATA_SYNC_DEPTH of them queued.
+static int32_t ata_transfer(uint32_t lba, uint32_t count, uint8_t *buf, int32_t write) {
+    block_request_t reqs[ATA_SYNC_DEPTH];
+    int32_t i, n, ret = 0;
+
+    while(count > 0 && ret == 0) {
+        for(n = 0; n < ATA_SYNC_DEPTH && count > 0; ++n) {
+            reqs[n].lba = lba;
+            reqs[n].count = (count > ATA_MAX_SECTORS) ? ATA_MAX_SECTORS : count;
+            reqs[n].buf = buf;
+            reqs[n].write = write;
+            reqs[n].done = NULL;
+            lba += reqs[n].count;
+            count -= reqs[n].count;
+            buf += reqs[n].count * BLOCK_SECTOR_SIZE;
+        }
+
+        for(i = 0; i < n; ++i) {
+            if(ata_submit(&reqs[i]) == -1) {
+                n = i;
+                ret = -1;
+                break;
+            }
+        }
+        for(i = 0; i < n; ++i) {
+            if(block_wait(&ata_device, &reqs[i]) == -1)
+                ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ *   ata_read
+ *   DESCRIPTION: read sectors from the drive
+ *   INPUTS: lba -- first sector
+ *           count -- number of sectors
+ *           buf -- kernel buffer of count * BLOCK_SECTOR_SIZE bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: may block the current process
+ */
+int32_t ata_read(uint32_t lba, uint32_t count, void *buf) {
+    return ata_transfer(lba, count, buf, 0);
+}
+
+/*
+ *   ata_write
+ *   DESCRIPTION: write sectors to the drive
+ *   INPUTS: lba -- first sector
+ *           count -- number of sectors
+ *           buf -- kernel buffer of count * BLOCK_SECTOR_SIZE bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: may block the current process
+ */
+int32_t ata_write(uint32_t lba, uint32_t count, const void *buf) {
+    return ata_transfer(lba, count, (uint8_t *)buf, 1);
+}
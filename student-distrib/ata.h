@@ -0,0 +1,37 @@
+#ifndef _ATA_H_
+#define _ATA_H_
+
+#include "types.h"
+#include "block_device.h"
+
+// The data disk is the slave drive of the primary channel (qemu -hdb), the
+//  master drive is the boot image.
+#define ATA_IRQ 14
+
+// Largest transfer issued to the drive at once, requests up to this size are merged.
+#define ATA_MAX_SECTORS 128
+
+#ifndef ASM
+
+// Probe the drive and register it as block device "ata0" if present.
+extern void ata_init();
+
+// Interrupt handler, moves the next PIO sector or completes the batch in flight.
+extern void ata_handler();
+
+// Whether a drive was found by ata_init().
+extern int32_t ata_present();
+
+// Queue req without waiting for it. Return 0, or -1 if the request is invalid.
+extern int32_t ata_submit(block_request_t *req);
+
+// Look at the drive and make progress as the interrupt handler would.
+extern void ata_poll();
+
+// Synchronous transfers of any length, used as the block device interface.
+extern int32_t ata_read(uint32_t lba, uint32_t count, void *buf);
+extern int32_t ata_write(uint32_t lba, uint32_t count, const void *buf);
+
+#endif
+
+#endif
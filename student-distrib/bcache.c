@@ -0,0 +1,378 @@
+#include "bcache.h"
+#include "memory.h"
+#include "lib.h"
+
+#define NO_BLOCK 0xffffffff
+#define BCACHE_DEV_SHIFT 8
+
+static buffer_t buffers[BCACHE_NUM_BUFFERS];
+static uint32_t num_buffers = 0;
+// Hash chains keyed by (dev, block), and every buffer in LRU order.
+static buffer_t *hash_table[BCACHE_HASH_SIZE];
+static buffer_t *lru_head = NULL;
+static buffer_t *lru_tail = NULL;
+
+static bcache_stats_t stats;
+static uint32_t ticks_since_flush = 0;
+// Last block read from each device, to detect sequential reads.
+static uint32_t last_block[MAX_BLOCK_DEVICES];
+
+// Everything below that is static runs with interrupts disabled.
+
+static uint32_t bcache_hash(int32_t dev, uint32_t block) {
+    return (block ^ ((uint32_t)dev << BCACHE_DEV_SHIFT)) & (BCACHE_HASH_SIZE - 1);
+}
+
+static buffer_t *bcache_lookup(int32_t dev, uint32_t block) {
+    buffer_t *buf;
+
+    for(buf = hash_table[bcache_hash(dev, block)]; buf != NULL; buf = buf->hash_next) {
+        if(buf->dev == dev && buf->block == block)
+            return buf;
+    }
+    return NULL;
+}
+
+// Move buf to the most recently used end of the LRU list.
+static void bcache_touch(buffer_t *buf) {
+    if(buf == lru_head)
+        return;
+
+    buf->lru_prev->lru_next = buf->lru_next;
+    if(buf->lru_next != NULL)
+        buf->lru_next->lru_prev = buf->lru_prev;
+    else
+        lru_tail = buf->lru_prev;
+
+    buf->lru_prev = NULL;
+    buf->lru_next = lru_head;
+    lru_head->lru_prev = buf;
+    lru_head = buf;
+}
+
+// Let buf hold block of dev from now on, its data is not valid yet.
+static void bcache_assign(buffer_t *buf, int32_t dev, uint32_t block) {
+    buffer_t **pos;
+
+    if(buf->dev != -1) {
+        for(pos = &hash_table[bcache_hash(buf->dev, buf->block)]; *pos != buf; pos = &(*pos)->hash_next);
+        *pos = buf->hash_next;
+        if(buf->flags & BUF_VALID)
+            stats.evictions++;
+    }
+
+    buf->dev = dev;
+    buf->block = block;
+    buf->flags = 0;
+    buf->hash_next = hash_table[bcache_hash(dev, block)];
+    hash_table[bcache_hash(dev, block)] = buf;
+}
+
+// Completion callback of every transfer.
+static void bcache_io_done(block_request_t *req) {
+    buffer_t *buf = req->private;
+
+    if(req->status != 0)
+        buf->flags |= BUF_ERROR | (req->write ? BUF_DIRTY : 0);
+    else if(!req->write)
+        buf->flags |= BUF_VALID;
+    buf->flags &= ~BUF_IO;
+}
+
+// Start reading or writing buf without waiting. Return 0, or -1 if the device refused.
+static int32_t bcache_start_io(buffer_t *buf, int32_t write) {
+    block_device_t *dev = get_block_device(buf->dev);
+
+    buf->req.lba = buf->block * BCACHE_SECTORS_PER_BLOCK;
+    buf->req.count = BCACHE_SECTORS_PER_BLOCK;
+    buf->req.buf = buf->data;
+    buf->req.write = write;
+    buf->req.done = bcache_io_done;
+    buf->req.private = buf;
+
+    // Changes made while the write is in flight mark the buffer dirty again.
+    buf->flags = (buf->flags | BUF_IO) & ~(BUF_ERROR | (write ? BUF_DIRTY : 0));
+    if(write)
+        stats.writebacks++;
+
+    if(dev == NULL || dev->submit(&buf->req) == -1) {
+        buf->flags = (buf->flags & ~BUF_IO) | BUF_ERROR | (write ? BUF_DIRTY : 0);
+        return -1;
+    }
+    return 0;
+}
+
+// Wait for the transfer in flight on buf, if any.
+static void bcache_wait(buffer_t *buf) {
+    while(buf->flags & BUF_IO)
+        (void)block_wait(get_block_device(buf->dev), &buf->req);
+}
+
+/*
+ *   bcache_victim
+ *   DESCRIPTION: find the least recently used buffer that can be reused right away
+ *   INPUTS: may_write -- whether dirty buffers may be written back, and transfers
+ *                        in flight waited for, to make room
+ *   OUTPUTS: none
+ *   RETURN VALUE: an unreferenced clean buffer, NULL if there is none
+ *   SIDE EFFECTS: may block the current process when may_write is set
+ */
+static buffer_t *bcache_victim(int32_t may_write) {
+    buffer_t *buf;
+
+    while(1) {
+        for(buf = lru_tail; buf != NULL; buf = buf->lru_prev) {
+            if(buf->refcount == 0 && !(buf->flags & (BUF_IO | BUF_DIRTY)))
+                return buf;
+        }
+        if(!may_write)
+            return NULL;
+
+        // Everything unreferenced is dirty or busy. Settle the oldest one and look again,
+        //  other processes may have used the cache in the meantime.
+        for(buf = lru_tail; buf != NULL && buf->refcount != 0; buf = buf->lru_prev);
+        if(buf == NULL)
+            return NULL;
+        if(!(buf->flags & BUF_IO) && bcache_start_io(buf, 1) == -1)
+            return NULL;
+        bcache_wait(buf);
+        if(buf->flags & BUF_ERROR)
+            return NULL;
+    }
+}
+
+/*
+ *   bcache_readahead
+ *   DESCRIPTION: when block directly follows the last block read from dev, start
+ *                reading the next BCACHE_READAHEAD blocks that are not cached yet
+ *   INPUTS: dev -- device id
+ *           block -- block just read
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none, the reads complete in the background
+ */
+static void bcache_readahead(int32_t dev, uint32_t block) {
+    uint32_t num_blocks = get_block_device(dev)->num_sectors / BCACHE_SECTORS_PER_BLOCK;
+    int32_t sequential = (last_block[dev] != NO_BLOCK && block == last_block[dev] + 1);
+    uint32_t i, next;
+    buffer_t *buf;
+
+    last_block[dev] = block;
+    if(!sequential)
+        return;
+
+    for(i = 1; i <= BCACHE_READAHEAD; ++i) {
+        next = block + i;
+        if(next >= num_blocks)
+            break;
+        if(bcache_lookup(dev, next) != NULL)
+            continue;
+        // Only worth it if it costs no write-back.
+        buf = bcache_victim(0);
+        if(buf == NULL)
+            break;
+        bcache_assign(buf, dev, next);
+        bcache_touch(buf);
+        if(bcache_start_io(buf, 0) == -1)
+            break;
+        stats.prefetches++;
+    }
+}
+
+/*
+ *   bcache_init
+ *   DESCRIPTION: give every buffer a frame from the frame pool and put it on the LRU list
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: takes up to BCACHE_NUM_BUFFERS frames
+ */
+void bcache_init() {
+    uint32_t i, phys;
+    buffer_t *buf;
+
+    memset(&stats, 0, sizeof(stats));
+    for(i = 0; i < BCACHE_HASH_SIZE; ++i)
+        hash_table[i] = NULL;
+    for(i = 0; i < MAX_BLOCK_DEVICES; ++i)
+        last_block[i] = NO_BLOCK;
+
+    for(num_buffers = 0; num_buffers < BCACHE_NUM_BUFFERS; ++num_buffers) {
+        phys = alloc_page_frame();
+        if(phys == 0)
+            break;
+
+        buf = &buffers[num_buffers];
+        buf->dev = -1;
+        buf->block = NO_BLOCK;
+        buf->data = (uint8_t *)phys;
+        buf->refcount = 0;
+        buf->flags = 0;
+        buf->req.status = 0;
+        buf->hash_next = NULL;
+        buf->lru_prev = lru_tail;
+        buf->lru_next = NULL;
+        if(lru_tail != NULL)
+            lru_tail->lru_next = buf;
+        else
+            lru_head = buf;
+        lru_tail = buf;
+    }
+}
+
+/*
+ *   bread
+ *   DESCRIPTION: get a block of a device through the cache
+ *   INPUTS: dev -- device id
+ *           block -- block number, in BCACHE_BLOCK_SIZE units
+ *   OUTPUTS: none
+ *   RETURN VALUE: buffer holding the block, NULL if it cannot be read
+ *   SIDE EFFECTS: may block the current process, may start read ahead
+ */
+buffer_t *bread(int32_t dev, uint32_t block) {
+    block_device_t *device = get_block_device(dev);
+    buffer_t *buf, *victim;
+    uint32_t flags;
+
+    if(device == NULL || block >= device->num_sectors / BCACHE_SECTORS_PER_BLOCK)
+        return NULL;
+
+    cli_and_save(flags);
+    buf = bcache_lookup(dev, block);
+    if(buf != NULL && (buf->flags & (BUF_VALID | BUF_IO))) {
+        stats.hits++;
+    }
+    else {
+        stats.misses++;
+        if(buf == NULL) {
+            victim = bcache_victim(1);
+            if(victim == NULL) {
+                restore_flags(flags);
+                return NULL;
+            }
+            // bcache_victim() may have slept while someone else brought the block in.
+            buf = bcache_lookup(dev, block);
+            if(buf == NULL) {
+                buf = victim;
+                bcache_assign(buf, dev, block);
+            }
+        }
+        if(!(buf->flags & (BUF_VALID | BUF_IO)) && bcache_start_io(buf, 0) == -1) {
+            restore_flags(flags);
+            return NULL;
+        }
+    }
+
+    buf->refcount++;
+    bcache_touch(buf);
+    bcache_readahead(dev, block);
+
+    // A write-back in flight does not keep readers from valid data.
+    if(!(buf->flags & BUF_VALID))
+        bcache_wait(buf);
+    if(!(buf->flags & BUF_VALID)) {
+        buf->refcount--;
+        restore_flags(flags);
+        return NULL;
+    }
+    restore_flags(flags);
+
+    return buf;
+}
+
+/*
+ *   brelse
+ *   DESCRIPTION: release a buffer obtained from bread()
+ *   INPUTS: buf -- the buffer
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the buffer may be evicted from now on
+ */
+void brelse(buffer_t *buf) {
+    uint32_t flags;
+
+    cli_and_save(flags);
+    buf->refcount--;
+    restore_flags(flags);
+}
+
+/*
+ *   bdirty
+ *   DESCRIPTION: mark a buffer as modified
+ *   INPUTS: buf -- a buffer the caller holds
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the block is written back by the next flush or before eviction
+ */
+void bdirty(buffer_t *buf) {
+    uint32_t flags;
+
+    cli_and_save(flags);
+    buf->flags |= BUF_DIRTY;
+    restore_flags(flags);
+}
+
+/*
+ *   bcache_sync
+ *   DESCRIPTION: write back every dirty buffer and wait until all writes are done
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if a buffer could not be written
+ *   SIDE EFFECTS: may block the current process
+ */
+int32_t bcache_sync() {
+    uint32_t flags, i;
+    int32_t ret = 0;
+
+    cli_and_save(flags);
+    for(i = 0; i < num_buffers; ++i) {
+        if((buffers[i].flags & (BUF_DIRTY | BUF_IO)) == BUF_DIRTY)
+            (void)bcache_start_io(&buffers[i], 1);
+    }
+    for(i = 0; i < num_buffers; ++i) {
+        bcache_wait(&buffers[i]);
+        if((buffers[i].flags & (BUF_DIRTY | BUF_ERROR)) == (BUF_DIRTY | BUF_ERROR))
+            ret = -1;
+    }
+    restore_flags(flags);
+
+    return ret;
+}
+
+/*
+ *   bcache_tick
+ *   DESCRIPTION: called from the PIT handler, every BCACHE_FLUSH_TICKS ticks start
+ *                writing back all dirty buffers that are not busy
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the writes complete in the background
+ */
+void bcache_tick() {
+    uint32_t i;
+
+    if(++ticks_since_flush < BCACHE_FLUSH_TICKS)
+        return;
+    ticks_since_flush = 0;
+
+    for(i = 0; i < num_buffers; ++i) {
+        if((buffers[i].flags & (BUF_DIRTY | BUF_IO)) == BUF_DIRTY)
+            (void)bcache_start_io(&buffers[i], 1);
+    }
+}
+
+/*
+ *   bcache_get_stats
+ *   DESCRIPTION: read the cache counters
+ *   INPUTS: none
+ *   OUTPUTS: stats_out -- filled with hits, misses, evictions, prefetches and write-backs
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void bcache_get_stats(bcache_stats_t *stats_out) {
+    uint32_t flags;
+
+    cli_and_save(flags);
+    memcpy(stats_out, &stats, sizeof(bcache_stats_t));
+    restore_flags(flags);
+}
@@ -0,0 +1,81 @@
+#ifndef _BCACHE_H_
+#define _BCACHE_H_
+
+#include "types.h"
+#include "block_device.h"
+
+// Blocks are cached 4KB at a time, the block size of the file system.
+#define BCACHE_BLOCK_SIZE 4096
+#define BCACHE_SECTORS_PER_BLOCK (BCACHE_BLOCK_SIZE / BLOCK_SECTOR_SIZE)
+// One page frame per buffer.
+#define BCACHE_NUM_BUFFERS 256
+#define BCACHE_HASH_SIZE 64
+// Blocks read ahead once a device is read sequentially.
+#define BCACHE_READAHEAD 8
+// Dirty buffers are written back every 5 seconds of 50Hz PIT ticks.
+#define BCACHE_FLUSH_TICKS 250
+
+// Buffer flags.
+#define BUF_VALID 0x1   // data holds the block
+#define BUF_DIRTY 0x2   // data is newer than the device
+#define BUF_IO 0x4      // a read or write is in flight
+#define BUF_ERROR 0x8   // the last transfer failed
+
+#ifndef ASM
+
+/*
+    A cached block.
+        dev, block - device id and block number the buffer holds
+        data - BCACHE_BLOCK_SIZE bytes in a frame of the frame pool
+        refcount - number of users between bread() and brelse(), never evicted while nonzero
+        flags - BUF_* flags
+        req - request used for the transfer in flight
+        hash_next - chain of the hash bucket of (dev, block)
+        lru_prev, lru_next - position in the LRU list, most recently used first
+*/
+typedef struct buffer {
+    int32_t dev;
+    uint32_t block;
+    uint8_t *data;
+    int32_t refcount;
+    volatile uint32_t flags;
+    block_request_t req;
+    struct buffer *hash_next;
+    struct buffer *lru_prev;
+    struct buffer *lru_next;
+} buffer_t;
+
+// Counters since boot.
+typedef struct bcache_stats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t prefetches;
+    uint32_t writebacks;
+} bcache_stats_t;
+
+// Allocate buffers from the frame pool. Must run after memory_init().
+extern void bcache_init();
+
+// Get block of device dev, reading it if it is not cached. Return NULL on failure.
+//  The buffer stays valid until brelse().
+extern buffer_t *bread(int32_t dev, uint32_t block);
+
+// Drop a reference obtained from bread().
+extern void brelse(buffer_t *buf);
+
+// Mark a buffer as modified, it will be written back later.
+extern void bdirty(buffer_t *buf);
+
+// Write every dirty buffer and wait for it. Return 0 on success, -1 if any write failed.
+extern int32_t bcache_sync();
+
+// Called on every PIT tick, starts the periodic write-back.
+extern void bcache_tick();
+
+// Copy the counters into stats.
+extern void bcache_get_stats(bcache_stats_t *stats);
+
+#endif
+
+#endif
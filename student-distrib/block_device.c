@@ -0,0 +1,150 @@
+#include "block_device.h"
+#include "memory.h"
+#include "process.h"
+#include "lib.h"
+
+// Registered devices, ids are indices.
+static block_device_t *block_devices[MAX_BLOCK_DEVICES];
+static int32_t num_block_devices = 0;
+
+static int32_t block_polling = 0;
+
+/*
+ *   register_block_device
+ *   DESCRIPTION: add a block device to the device table
+ *   INPUTS: dev -- device, must stay valid forever
+ *   OUTPUTS: none
+ *   RETURN VALUE: id of the device, -1 if the table is full
+ *   SIDE EFFECTS: none
+ */
+int32_t register_block_device(block_device_t *dev) {
+    if(dev == NULL || num_block_devices >= MAX_BLOCK_DEVICES)
+        return -1;
+
+    block_devices[num_block_devices] = dev;
+    return num_block_devices++;
+}
+
+/*
+ *   get_block_device
+ *   DESCRIPTION: look up a block device by id
+ *   INPUTS: id -- value returned by register_block_device()
+ *   OUTPUTS: none
+ *   RETURN VALUE: the device, NULL if id is invalid
+ *   SIDE EFFECTS: none
+ */
+block_device_t *get_block_device(int32_t id) {
+    if(id < 0 || id >= num_block_devices)
+        return NULL;
+    return block_devices[id];
+}
+
+/*
+ *   find_block_device
+ *   DESCRIPTION: look up a block device by name
+ *   INPUTS: name -- name of the device
+ *   OUTPUTS: none
+ *   RETURN VALUE: the device, NULL if there is none with that name
+ *   SIDE EFFECTS: none
+ */
+block_device_t *find_block_device(const int8_t *name) {
+    int32_t i;
+
+    for(i = 0; i < num_block_devices; ++i) {
+        if(strncmp(block_devices[i]->name, name, strlen(block_devices[i]->name) + 1) == 0)
+            return block_devices[i];
+    }
+    return NULL;
+}
+
+/*
+ *   is_dma_buffer
+ *   DESCRIPTION: check that a buffer lies in kernel memory whose virtual address equals
+ *                its physical address, that is the first 8MB or the frame pool
+ *   INPUTS: buf -- start of the buffer
+ *           len -- length in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if devices can transfer to and from it directly, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t is_dma_buffer(const void *buf, uint32_t len) {
+    uint32_t start = (uint32_t)buf;
+
+    if(start + len < start)
+        return 0;
+    if(start + len <= KERNEL_MEMORY_BOT)
+        return 1;
+    return start >= FRAME_POOL_START && start + len <= FRAME_POOL_END;
+}
+
+/*
+ *   block_wait
+ *   DESCRIPTION: wait for a submitted request. The calling process sleeps until the
+ *                completion interrupt, during boot the CPU halts instead, and in polling
+ *                mode the driver is asked to check the device.
+ *   INPUTS: dev -- device the request was submitted to
+ *           req -- the request
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: may block the current process
+ */
+int32_t block_wait(block_device_t *dev, block_request_t *req) {
+    uint32_t flags;
+
+    cli_and_save(flags);
+    while(req->status == BLOCK_REQUEST_PENDING) {
+        if(block_polling) {
+            dev->poll();
+            continue;
+        }
+        // No process to put to sleep during boot, halt until the interrupt instead.
+        if(get_process_count() == 0) {
+            asm volatile("sti; hlt; cli" : : : "memory");
+            continue;
+        }
+        req->waiters |= 1 << get_current_pcb()->pid;
+        sleep_current_process();
+        cli();
+    }
+    restore_flags(flags);
+
+    return req->status;
+}
+
+/*
+ *   block_complete
+ *   DESCRIPTION: mark a request done, run its callback and wake up every process waiting on it
+ *   INPUTS: req -- the request
+ *           status -- 0 on success, -1 on failure
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must be called with interrupts disabled
+ */
+void block_complete(block_request_t *req, int32_t status) {
+    uint32_t waiters = req->waiters;
+    uint32_t pid;
+
+    req->next = NULL;
+    req->waiters = 0;
+    req->status = status;
+    // The owner may reuse req from here on, only the copy of waiters is used below.
+    if(req->done != NULL)
+        req->done(req);
+
+    for(pid = 0; pid < MAX_PROCESS_NUMBER; ++pid) {
+        if(waiters & (1 << pid))
+            wake_process(pid);
+    }
+}
+
+/*
+ *   block_set_polling
+ *   DESCRIPTION: switch block_wait() between sleeping and polling
+ *   INPUTS: polling -- 1 to poll, 0 to sleep
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void block_set_polling(int32_t polling) {
+    block_polling = polling;
+}
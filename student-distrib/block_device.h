@@ -0,0 +1,82 @@
+#ifndef _BLOCK_DEVICE_H_
+#define _BLOCK_DEVICE_H_
+
+#include "types.h"
+
+// All block devices transfer whole 512-byte sectors.
+#define BLOCK_SECTOR_SIZE 512
+#define MAX_BLOCK_DEVICES 4
+
+// Status of a block_request_t that has not completed yet.
+#define BLOCK_REQUEST_PENDING 1
+
+#ifndef ASM
+
+/*
+    A transfer queued on a block device. The request is owned by the caller, which
+    must keep it alive until it completes.
+        lba, count - first sector and number of sectors, at most the driver's limit
+        buf - kernel buffer, see is_dma_buffer()
+        write - 1 to write buf to the device, 0 to read into buf
+        status - BLOCK_REQUEST_PENDING, then 0 on success or -1 on failure
+        waiters - bitmask of pids sleeping in block_wait() on this request
+        done - called with interrupts off when the request completes, may be NULL
+        private - free for the owner, e.g. for use in done
+        next - used by the driver to queue the request
+*/
+typedef struct block_request {
+    uint32_t lba;
+    uint32_t count;
+    void *buf;
+    int32_t write;
+    volatile int32_t status;
+    uint32_t waiters;
+    void (*done)(struct block_request *req);
+    void *private;
+    struct block_request *next;
+} block_request_t;
+
+/*
+    Interface a disk driver exposes to the file system layer.
+        name - short name, e.g. "ata0"
+        num_sectors - capacity in sectors
+        read - read count sectors starting at lba into buf, return 0 or -1
+        write - write count sectors starting at lba from buf, return 0 or -1
+        submit - queue a request without waiting for it, return 0 or -1 if it is invalid
+        poll - complete finished requests without waiting for the interrupt
+    buf must be a kernel address that is mapped one to one to physical memory,
+    i.e. below 8MB or in the frame pool, so that drivers can DMA into it directly.
+    read and write block the calling process until the transfer is done.
+*/
+typedef struct block_device {
+    const int8_t *name;
+    uint32_t num_sectors;
+    int32_t (*read)(uint32_t lba, uint32_t count, void *buf);
+    int32_t (*write)(uint32_t lba, uint32_t count, const void *buf);
+    int32_t (*submit)(block_request_t *req);
+    void (*poll)();
+} block_device_t;
+
+// Make dev available to the rest of the kernel. Return its id, -1 if the table is full.
+extern int32_t register_block_device(block_device_t *dev);
+
+// Look up a registered device by id or by name. Return NULL if there is none.
+extern block_device_t *get_block_device(int32_t id);
+extern block_device_t *find_block_device(const int8_t *name);
+
+// Whether [buf, buf + len) is kernel memory a device can DMA into.
+extern int32_t is_dma_buffer(const void *buf, uint32_t len);
+
+// Block until req, submitted to dev, is done. Return 0 on success, -1 on failure.
+extern int32_t block_wait(block_device_t *dev, block_request_t *req);
+
+// Called by drivers with interrupts off: finish req with status and wake up its waiters.
+extern void block_complete(block_request_t *req, int32_t status);
+
+// While set, block_wait() polls the device instead of sleeping. Used where the caller
+//  runs inside an interrupt handler and can neither sleep nor take the completion interrupt.
+extern void block_set_polling(int32_t polling);
+
+#endif
+
+#endif
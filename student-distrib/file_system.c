@@ -1,9 +1,13 @@
 #include "file_system.h"
 #include "process.h"
+#include "bcache.h"
+#include "memory.h"
+#include "lz4.h"
+#include "vfs.h"
+#include "fpu.h"
 
 #include "lib.h"
 
-#define DENTRY_START_OFFSET 64
 #define PROGRAM_IMAGE_START_ADDRESS 0x08048000
 
 #define NUM_MAGIC_NUMBER 4
@@ -13,14 +17,731 @@
 #define MAGIC_NUM_3 0x46
 #define MAGIC_NUMBER_ADDRESS_OFFSET 24
 
-// Starting address for file system in kernel memory.
+#define BITMAP_WORD_BITS 32
+#define NO_DATA_BLOCK 0xffffffff
+#define PACK_CACHE_SIZE 8
+#define SUBDIR_READ_ENTRIES 8
+
+// States of a dentry cache slot.
+#define DCACHE_EMPTY 0
+#define DCACHE_POSITIVE 1
+#define DCACHE_NEGATIVE 2
+
+// Starting address for file system in kernel memory, NULL when mounted from a disk.
 static uint32_t file_system_base_address = NULL;
-// Pointer to boot block in file system.
+// Block device the file system was mounted from, -1 when it lives in memory.
+static int32_t fs_device = -1;
+// Pointer to boot block in file system. When mounted from a disk, the block stays
+//  held in boot_block_buffer for as long as the file system is mounted.
 static boot_block_t *boot_block = NULL;
+static buffer_t *boot_block_buffer = NULL;
+
+// Allocation bitmaps, 1 means in use. Built by file_system_init() from the inodes
+//  that dentries point to. Inodes and blocks beyond the maximums are never handed out.
+static uint32_t inode_bitmap[FS_MAX_INODES / BITMAP_WORD_BITS];
+static uint32_t data_block_bitmap[FS_MAX_DATA_BLOCKS / BITMAP_WORD_BITS];
+// Changes whenever data blocks are freed, and so whenever a cached block run may be stale.
+static uint32_t block_map_generation = 1;
+
+// Compressed images only. Blocks that are read get decompressed into a small cache, whose
+//  slots are reused in turn. A block about to be modified is unpacked into a frame of its
+//  own instead, where it stays until it is freed.
+static data_block_t *pack_cache[PACK_CACHE_SIZE];
+static uint32_t pack_cache_block[PACK_CACHE_SIZE];
+static uint32_t pack_cache_next;
+static data_block_t *unpacked_block[FS_MAX_DATA_BLOCKS];
+
+/*
+    A slot of the dentry cache, which remembers what a name in a directory resolved to,
+    including that there is no such name. Slots are picked by a hash of (dir, name) and
+    simply overwritten on a collision.
+        state - DCACHE_EMPTY, DCACHE_POSITIVE or DCACHE_NEGATIVE
+        dir - FS_ROOT_DIR or inode of the directory
+        dentry - the dentry found, only its file_name is valid for a negative slot
+*/
+typedef struct dcache_entry {
+    uint32_t state;
+    uint32_t dir;
+    dentry_t dentry;
+} dcache_entry_t;
+
+static dcache_entry_t dcache[DCACHE_SIZE];
+static dcache_stats_t dcache_stats;
+
+static int32_t bitmap_test(uint32_t *bitmap, uint32_t idx) {
+    return (bitmap[idx / BITMAP_WORD_BITS] >> (idx % BITMAP_WORD_BITS)) & 1;
+}
+
+static void bitmap_set(uint32_t *bitmap, uint32_t idx) {
+    bitmap[idx / BITMAP_WORD_BITS] |= 1 << (idx % BITMAP_WORD_BITS);
+}
+
+static void bitmap_clear(uint32_t *bitmap, uint32_t idx) {
+    bitmap[idx / BITMAP_WORD_BITS] &= ~(1 << (idx % BITMAP_WORD_BITS));
+}
+
+// Pointer to 4KB block blk of the image, NULL on failure. When mounted from a disk the
+//  block comes from the buffer cache and is held in *handle until put_fs_block().
+static void *get_fs_block(uint32_t blk, buffer_t **handle) {
+    *handle = NULL;
+    if(fs_device == -1)
+        return (void *)(file_system_base_address + blk * sizeof(data_block_t));
+
+    *handle = bread(fs_device, blk);
+    if(*handle == NULL)
+        return NULL;
+    return (*handle)->data;
+}
+
+// Release a block from get_fs_block(), marking it modified if dirty is set.
+static void put_fs_block(buffer_t *handle, int32_t dirty) {
+    if(handle == NULL)
+        return;
+    if(dirty)
+        bdirty(handle);
+    brelse(handle);
+}
+
+// The boot block is never released, changes only need to be marked.
+static void boot_block_dirty() {
+    if(boot_block_buffer != NULL)
+        bdirty(boot_block_buffer);
+}
+
+// Pointer to inode inode_index, which must be valid. NULL if it cannot be read.
+static inode_t *get_inode(uint32_t inode_index, buffer_t **handle) {
+    return (inode_t *)get_fs_block(1 + inode_index, handle);
+}
+
+// Whether data blocks are compressed.
+static int32_t is_packed() {
+    return boot_block->pack_magic == PACK_MAGIC;
+}
+
+// Decompress data block idx of a compressed image into block. Return 0 on success, -1 on failure.
+static int32_t unpack_block(uint32_t idx, data_block_t *block) {
+    const uint32_t *index = (const uint32_t *)(file_system_base_address + (1 + boot_block->num_inode) * sizeof(data_block_t));
+    const uint8_t *packed = (const uint8_t *)index + boot_block->pack_index_blocks * sizeof(data_block_t);
+    uint32_t start, size;
+
+    if(idx + 1 >= boot_block->pack_index_blocks * sizeof(data_block_t) / sizeof(uint32_t))
+        return -1;
+    start = index[idx];
+    if(index[idx + 1] < start)
+        return -1;
+    size = index[idx + 1] - start;
+
+    if(size == 0)
+        memset(block, 0, sizeof(data_block_t));
+    else if(size == sizeof(data_block_t))
+        memcpy(block, packed + start, sizeof(data_block_t));
+    else if(lz4_decompress(packed + start, size, block->data, sizeof(data_block_t)) != sizeof(data_block_t))
+        return -1;
+
+    return 0;
+}
+
+// Data block idx of a compressed image, decompressed. NULL on failure.
+static data_block_t *get_packed_block(uint32_t idx) {
+    uint32_t i;
+
+    if(idx < FS_MAX_DATA_BLOCKS && unpacked_block[idx] != NULL)
+        return unpacked_block[idx];
+    for(i = 0; i < PACK_CACHE_SIZE; ++i) {
+        if(pack_cache[i] != NULL && pack_cache_block[i] == idx)
+            return pack_cache[i];
+    }
+
+    // Callers hold at most a few blocks at a time, far fewer than the cache has slots.
+    i = pack_cache_next;
+    pack_cache_next = (i + 1) % PACK_CACHE_SIZE;
+    if(pack_cache[i] == NULL) {
+        pack_cache[i] = (data_block_t *)alloc_page_frame();
+        if(pack_cache[i] == NULL)
+            return NULL;
+    }
+    pack_cache_block[i] = NO_DATA_BLOCK;
+    if(unpack_block(idx, pack_cache[i]) == -1)
+        return NULL;
+    pack_cache_block[i] = idx;
+
+    return pack_cache[i];
+}
+
+// Pointer to data block data_block_index, NULL if it is invalid or cannot be read.
+//  Only for reading, blocks to be modified come from get_data_block_rw().
+static data_block_t *get_data_block(uint32_t data_block_index, buffer_t **handle) {
+    *handle = NULL;
+    if(data_block_index >= boot_block->num_data_block)
+        return NULL;
+    if(is_packed())
+        return get_packed_block(data_block_index);
+    return (data_block_t *)get_fs_block(1 + boot_block->num_inode + data_block_index, handle);
+}
+
+// Same as get_data_block(), for a block that is about to be modified.
+static data_block_t *get_data_block_rw(uint32_t data_block_index, buffer_t **handle) {
+    data_block_t *block;
+    uint32_t i;
+
+    if(!is_packed())
+        return get_data_block(data_block_index, handle);
+
+    *handle = NULL;
+    if(data_block_index >= boot_block->num_data_block || data_block_index >= FS_MAX_DATA_BLOCKS)
+        return NULL;
+    if(unpacked_block[data_block_index] != NULL)
+        return unpacked_block[data_block_index];
+
+    block = (data_block_t *)alloc_page_frame();
+    if(block == NULL)
+        return NULL;
+    if(unpack_block(data_block_index, block) == -1) {
+        free_page_frame((uint32_t)block);
+        return NULL;
+    }
+    // The cached copy would go stale.
+    for(i = 0; i < PACK_CACHE_SIZE; ++i) {
+        if(pack_cache_block[i] == data_block_index)
+            pack_cache_block[i] = NO_DATA_BLOCK;
+    }
+    unpacked_block[data_block_index] = block;
+
+    return block;
+}
+
+// Allocate a zero-filled data block, preferring the one right after prev so that
+//  the blocks of a file stay sequential. Return the block index or NO_DATA_BLOCK.
+static uint32_t alloc_data_block(uint32_t prev) {
+    uint32_t num_blocks = boot_block->num_data_block;
+    uint32_t start, i, idx;
+    data_block_t *block;
+    buffer_t *handle;
+
+    if(num_blocks > FS_MAX_DATA_BLOCKS)
+        num_blocks = FS_MAX_DATA_BLOCKS;
+    start = (prev == NO_DATA_BLOCK) ? 0 : prev + 1;
+
+    for(i = 0; i < num_blocks; ++i) {
+        idx = (start + i) % num_blocks;
+        if(!bitmap_test(data_block_bitmap, idx)) {
+            block = get_data_block_rw(idx, &handle);
+            if(block == NULL)
+                return NO_DATA_BLOCK;
+            bitmap_set(data_block_bitmap, idx);
+            memset(block, 0, sizeof(data_block_t));
+            put_fs_block(handle, 1);
+            return idx;
+        }
+    }
+
+    return NO_DATA_BLOCK;
+}
+
+// Give back a data block. Indices from a corrupt inode are ignored.
+static void free_data_block(uint32_t idx) {
+    if(idx >= FS_MAX_DATA_BLOCKS)
+        return;
+    bitmap_clear(data_block_bitmap, idx);
+    if(unpacked_block[idx] != NULL) {
+        free_page_frame((uint32_t)unpacked_block[idx]);
+        unpacked_block[idx] = NULL;
+    }
+}
+
+// Allocate an empty inode. Return its index, -1 if none is left.
+static int32_t alloc_inode() {
+    uint32_t num_inodes = boot_block->num_inode;
+    uint32_t i;
+    inode_t *inode;
+    buffer_t *handle;
+
+    if(num_inodes > FS_MAX_INODES)
+        num_inodes = FS_MAX_INODES;
+    for(i = 0; i < num_inodes; ++i) {
+        if(bitmap_test(inode_bitmap, i))
+            continue;
+        inode = get_inode(i, &handle);
+        if(inode == NULL)
+            return -1;
+        bitmap_set(inode_bitmap, i);
+        inode->length = 0;
+        put_fs_block(handle, 1);
+        return i;
+    }
+
+    return -1;
+}
+
+// Whether inodes end with indirect block pointers.
+static int32_t is_indirect() {
+    return boot_block->inode_flags & INODE_FLAG_INDIRECT;
+}
+
+static uint32_t max_file_size() {
+    return is_indirect() ? FS_MAX_FILE_SIZE : FS_LEGACY_MAX_FILE_SIZE;
+}
+
+// Number of data blocks of a file of length bytes.
+static uint32_t num_file_blocks(uint32_t length) {
+    return length / sizeof(data_block_t) + (length % sizeof(data_block_t) != 0);
+}
+
+// Table of block indices holding the entry of file block block_num: the inode itself for
+//  direct blocks, an indirect block otherwise. The entry is at *pos. With append set,
+//  block_num is the first block past the end of the file and missing pointer blocks are
+//  allocated. Return NULL on failure, the table is held in *handle until put_fs_block().
+static uint32_t *get_block_table(inode_t *inode, uint32_t block_num, int32_t append,
+                                 uint32_t *pos, buffer_t **handle) {
+    uint32_t n, *slot;
+    uint32_t new_outer = NO_DATA_BLOCK;
+    buffer_t *outer_handle = NULL;
+    data_block_t *table;
+
+    *handle = NULL;
+    if(!is_indirect() || block_num < FS_DIRECT_BLOCKS) {
+        if(block_num >= VAL_1023)
+            return NULL;
+        *pos = block_num;
+        return inode->date_block_idx;
+    }
+
+    n = block_num - FS_DIRECT_BLOCKS;
+    if(n < FS_INDIRECT_ENTRIES) {
+        slot = &inode->date_block_idx[FS_SINGLE_INDIRECT];
+    }
+    else {
+        n -= FS_INDIRECT_ENTRIES;
+        if(n >= FS_INDIRECT_ENTRIES * FS_INDIRECT_ENTRIES)
+            return NULL;
+        slot = &inode->date_block_idx[FS_DOUBLE_INDIRECT];
+        if(append && n == 0) {
+            new_outer = alloc_data_block(NO_DATA_BLOCK);
+            if(new_outer == NO_DATA_BLOCK)
+                return NULL;
+            *slot = new_outer;
+        }
+        table = append ? get_data_block_rw(*slot, &outer_handle) : get_data_block(*slot, &outer_handle);
+        if(table == NULL) {
+            free_data_block(new_outer);
+            return NULL;
+        }
+        slot = (uint32_t *)table + n / FS_INDIRECT_ENTRIES;
+        n %= FS_INDIRECT_ENTRIES;
+    }
+
+    // Pointer blocks come from the start of the disk, away from the runs of data blocks.
+    if(append && n == 0 && (*slot = alloc_data_block(NO_DATA_BLOCK)) == NO_DATA_BLOCK) {
+        put_fs_block(outer_handle, 0);
+        free_data_block(new_outer);
+        return NULL;
+    }
+    table = append ? get_data_block_rw(*slot, handle) : get_data_block(*slot, handle);
+    put_fs_block(outer_handle, append && n == 0);
+    if(table == NULL)
+        return NULL;
+
+    *pos = n;
+    return (uint32_t *)table;
+}
+
+// Find file block block_num of an inode with num_blocks blocks. Fill run with the data
+//  block it maps to and how many of the next file blocks follow it on the image, as far
+//  as the same table tells. Return 0 on success, -1 past the end or on failure.
+static int32_t map_block(inode_t *inode, uint32_t block_num, uint32_t num_blocks, block_run_t *run) {
+    uint32_t *table, pos, limit;
+    buffer_t *handle;
+
+    if(block_num >= num_blocks)
+        return -1;
+    table = get_block_table(inode, block_num, 0, &pos, &handle);
+    if(table == NULL)
+        return -1;
+
+    if(table != inode->date_block_idx)
+        limit = FS_INDIRECT_ENTRIES;
+    else
+        limit = is_indirect() ? FS_DIRECT_BLOCKS : VAL_1023;
+    run->generation = block_map_generation;
+    run->file_block = block_num;
+    run->data_block = table[pos];
+    run->count = 1;
+    while(pos + run->count < limit && block_num + run->count < num_blocks &&
+          run->data_block + run->count < boot_block->num_data_block &&
+          table[pos + run->count] == run->data_block + run->count)
+        run->count++;
+    put_fs_block(handle, 0);
+
+    return 0;
+}
+
+// Point file block block_num, the first past the end of the file, at data block idx.
+//  Return 0 on success, -1 on failure.
+static int32_t append_block(inode_t *inode, uint32_t block_num, uint32_t idx) {
+    uint32_t *table, pos;
+    buffer_t *handle;
+
+    table = get_block_table(inode, block_num, 1, &pos, &handle);
+    if(table == NULL)
+        return -1;
+    table[pos] = idx;
+    put_fs_block(handle, 1);
+
+    return 0;
+}
+
+// Data block of file block block_num, NO_DATA_BLOCK on failure.
+static uint32_t lookup_block(inode_t *inode, uint32_t block_num) {
+    block_run_t run;
+
+    if(map_block(inode, block_num, block_num + 1, &run) == -1)
+        return NO_DATA_BLOCK;
+    return run.data_block;
+}
+
+// Free file blocks [from, to) of an inode, and the pointer blocks that only they needed.
+static void free_file_blocks(inode_t *inode, uint32_t from, uint32_t to) {
+    block_run_t run;
+    uint32_t i, j, start;
+    const uint32_t *outer;
+    buffer_t *handle;
+
+    for(i = from; i < to && map_block(inode, i, to, &run) == 0; i += run.count) {
+        for(j = 0; j < run.count; ++j)
+            free_data_block(run.data_block + j);
+    }
+    block_map_generation++;
+
+    if(!is_indirect() || to <= FS_DIRECT_BLOCKS)
+        return;
+    if(from <= FS_DIRECT_BLOCKS)
+        free_data_block(inode->date_block_idx[FS_SINGLE_INDIRECT]);
+
+    start = FS_DIRECT_BLOCKS + FS_INDIRECT_ENTRIES;
+    if(to <= start)
+        return;
+    outer = (const uint32_t *)get_data_block(inode->date_block_idx[FS_DOUBLE_INDIRECT], &handle);
+    if(outer != NULL) {
+        for(j = 0; start + j * FS_INDIRECT_ENTRIES < to; ++j) {
+            if(start + j * FS_INDIRECT_ENTRIES >= from)
+                free_data_block(outer[j]);
+        }
+        put_fs_block(handle, 0);
+    }
+    if(from <= start)
+        free_data_block(inode->date_block_idx[FS_DOUBLE_INDIRECT]);
+}
+
+// Whether the directory has the hashed extension.
+static int32_t is_dir_hashed() {
+    return boot_block->dir_magic == DIR_EXT_MAGIC;
+}
+
+// Bucket of a file name: FNV-1a over its at most 32 characters. The image builder
+//  computes the same value.
+static uint32_t dir_hash(const uint8_t *name) {
+    uint32_t hash = DIR_HASH_OFFSET_BASIS;
+    uint32_t i;
+
+    for(i = 0; i < FILE_NAME_MAX_LENGTH && name[i] != '\0'; ++i)
+        hash = (hash ^ name[i]) * DIR_HASH_PRIME;
+    return hash & (boot_block->dir_hash_size - 1);
+}
+
+// Offset of dentry index, at least VAL_63, in the data of the directory inode.
+static uint32_t dir_entry_offset(uint32_t index) {
+    return boot_block->dir_hash_size * sizeof(uint32_t) + (index - VAL_63) * sizeof(dentry_t);
+}
+
+// Store dentry at index, at most num_dentry. Return 0 on success, -1 on failure.
+static int32_t dir_write_entry(uint32_t index, const dentry_t *dentry) {
+    if(index < VAL_63) {
+        memcpy(&boot_block->dentry[index], dentry, sizeof(dentry_t));
+        boot_block_dirty();
+        return 0;
+    }
+    if(!is_dir_hashed())
+        return -1;
+    if(write_data(boot_block->dir_inode, dir_entry_offset(index), (const uint8_t *)dentry, sizeof(dentry_t)) != sizeof(dentry_t))
+        return -1;
+    return 0;
+}
+
+// First dentry of a hash bucket, DIR_NO_ENTRY if it is empty or cannot be read.
+static uint32_t dir_bucket_head(uint32_t bucket) {
+    uint32_t head;
+
+    if(read_data(boot_block->dir_inode, bucket * sizeof(uint32_t), (uint8_t *)&head, sizeof(uint32_t)) != sizeof(uint32_t))
+        return DIR_NO_ENTRY;
+    return head;
+}
+
+static int32_t dir_set_bucket_head(uint32_t bucket, uint32_t index) {
+    if(write_data(boot_block->dir_inode, bucket * sizeof(uint32_t), (const uint8_t *)&index, sizeof(uint32_t)) != sizeof(uint32_t))
+        return -1;
+    return 0;
+}
+
+// In the chain of bucket, let whatever refers to dentry from refer to to instead.
+//  Return 0 on success, -1 if from is not in the chain.
+static int32_t dir_relink(uint32_t bucket, uint32_t from, uint32_t to) {
+    uint32_t index = dir_bucket_head(bucket);
+    uint32_t steps;
+    dentry_t dentry;
+
+    if(index == from)
+        return dir_set_bucket_head(bucket, to);
+
+    // A broken chain must not loop forever.
+    for(steps = 0; index != DIR_NO_ENTRY && steps < boot_block->num_dentry; ++steps) {
+        if(read_dentry_by_index(index, &dentry) == -1)
+            return -1;
+        if(dentry.hash_next == from) {
+            dentry.hash_next = to;
+            return dir_write_entry(index, &dentry);
+        }
+        index = dentry.hash_next;
+    }
+
+    return -1;
+}
+
+// Look up a dentry by name. Return its index, -1 if there is none.
+static int32_t dir_find(const uint8_t *fname, dentry_t *dentry) {
+    uint32_t index, steps;
+
+    if(!is_dir_hashed()) {
+        for(index = 0; index < boot_block->num_dentry && index < VAL_63; ++index) {
+            if(strncmp((int8_t *)fname, (int8_t *)boot_block->dentry[index].file_name, FILE_NAME_MAX_LENGTH) == 0) {
+                memcpy(dentry, &boot_block->dentry[index], sizeof(dentry_t));
+                return index;
+            }
+        }
+        return -1;
+    }
+
+    index = dir_bucket_head(dir_hash(fname));
+    for(steps = 0; index != DIR_NO_ENTRY && steps < boot_block->num_dentry; ++steps) {
+        if(read_dentry_by_index(index, dentry) == -1)
+            return -1;
+        if(strncmp((int8_t *)fname, (int8_t *)dentry->file_name, FILE_NAME_MAX_LENGTH) == 0)
+            return index;
+        index = dentry->hash_next;
+    }
+
+    return -1;
+}
+
+// Switch to the hashed directory once the boot block is full: allocate the directory inode,
+//  write an empty hash table and chain the dentries already in the boot block.
+//  Return 0 on success, -1 on failure.
+static int32_t dir_extend() {
+    uint32_t empty[VAL_32];
+    uint32_t i, bucket;
+    int32_t inode_index, ret = 0;
+    dentry_t dentry;
+
+    inode_index = alloc_inode();
+    if(inode_index == -1)
+        return -1;
+    boot_block->dir_inode = inode_index;
+    boot_block->dir_hash_size = DIR_HASH_SIZE;
+
+    memset(empty, 0xff, sizeof(empty));
+    for(i = 0; i < DIR_HASH_SIZE && ret == 0; i += VAL_32) {
+        if(write_data(inode_index, i * sizeof(uint32_t), (uint8_t *)empty, sizeof(empty)) != sizeof(empty))
+            ret = -1;
+    }
+    for(i = 0; i < boot_block->num_dentry && ret == 0; ++i) {
+        memcpy(&dentry, &boot_block->dentry[i], sizeof(dentry_t));
+        bucket = dir_hash(dentry.file_name);
+        dentry.hash_next = dir_bucket_head(bucket);
+        if(dir_write_entry(i, &dentry) == -1 || dir_set_bucket_head(bucket, i) == -1)
+            ret = -1;
+    }
+    if(ret == -1) {
+        (void)truncate_data(inode_index, 0);
+        bitmap_clear(inode_bitmap, inode_index);
+        return -1;
+    }
+
+    boot_block->dir_magic = DIR_EXT_MAGIC;
+    boot_block_dirty();
+
+    return 0;
+}
+
+// Whether dentry, found in directory dir, is a subdirectory rather than "." of the root.
+static int32_t is_subdir(uint32_t dir, const dentry_t *dentry) {
+    return dentry->file_type == DIRECTORY_FILE &&
+           (dir != FS_ROOT_DIR || strncmp((int8_t *)dentry->file_name, ".", FILE_NAME_MAX_LENGTH) != 0);
+}
+
+// Number of dentries of directory dir.
+static uint32_t dir_num_entries(uint32_t dir) {
+    int32_t length;
+
+    if(dir == FS_ROOT_DIR)
+        return boot_block->num_dentry;
+    length = get_file_length(dir);
+    return (length == -1) ? 0 : length / sizeof(dentry_t);
+}
+
+// Read dentry index of directory dir. Return 0 on success, -1 on failure.
+static int32_t dir_read_entry(uint32_t dir, uint32_t index, dentry_t *dentry) {
+    if(dir == FS_ROOT_DIR)
+        return read_dentry_by_index(index, dentry);
+    if(read_data(dir, index * sizeof(dentry_t), (uint8_t *)dentry, sizeof(dentry_t)) != sizeof(dentry_t))
+        return -1;
+    return 0;
+}
+
+// Look up a name in a subdirectory, reading its dentries a few at a time. Return its index,
+//  -1 if there is none.
+static int32_t subdir_find(uint32_t dir, const uint8_t *name, dentry_t *dentry) {
+    dentry_t entries[SUBDIR_READ_ENTRIES];
+    uint32_t num_entries = dir_num_entries(dir);
+    uint32_t i, j, count;
+
+    for(i = 0; i < num_entries; i += count) {
+        count = num_entries - i;
+        if(count > SUBDIR_READ_ENTRIES)
+            count = SUBDIR_READ_ENTRIES;
+        if(read_data(dir, i * sizeof(dentry_t), (uint8_t *)entries, count * sizeof(dentry_t)) != count * sizeof(dentry_t))
+            return -1;
+        for(j = 0; j < count; ++j) {
+            if(strncmp((int8_t *)name, (int8_t *)entries[j].file_name, FILE_NAME_MAX_LENGTH) == 0) {
+                memcpy(dentry, &entries[j], sizeof(dentry_t));
+                return i + j;
+            }
+        }
+    }
+
+    return -1;
+}
+
+// Dentry cache slot of name in directory dir.
+static dcache_entry_t *dcache_slot(uint32_t dir, const uint8_t *name) {
+    uint32_t hash = (DIR_HASH_OFFSET_BASIS ^ dir) * DIR_HASH_PRIME;
+    uint32_t i;
+
+    for(i = 0; i < FILE_NAME_MAX_LENGTH && name[i] != '\0'; ++i)
+        hash = (hash ^ name[i]) * DIR_HASH_PRIME;
+    return &dcache[hash & (DCACHE_SIZE - 1)];
+}
+
+// Whether slot holds name of directory dir.
+static int32_t dcache_match(const dcache_entry_t *slot, uint32_t dir, const uint8_t *name) {
+    return slot->state != DCACHE_EMPTY && slot->dir == dir &&
+           strncmp((int8_t *)name, (int8_t *)slot->dentry.file_name, FILE_NAME_MAX_LENGTH) == 0;
+}
+
+// Forget name of directory dir, once it was created or removed.
+static void dcache_invalidate(uint32_t dir, const uint8_t *name) {
+    dcache_entry_t *slot = dcache_slot(dir, name);
+
+    if(dcache_match(slot, dir, name))
+        slot->state = DCACHE_EMPTY;
+}
+
+// Forget every name of directory dir, once it was removed and its inode may be reused.
+static void dcache_forget_dir(uint32_t dir) {
+    uint32_t i;
+
+    for(i = 0; i < DCACHE_SIZE; ++i) {
+        if(dcache[i].dir == dir)
+            dcache[i].state = DCACHE_EMPTY;
+    }
+}
+
+// Look up a name of at most FILE_NAME_MAX_LENGTH characters in directory dir, through the
+//  dentry cache. The dentry of "." of the root gets FS_ROOT_DIR as its inode.
+//  Return 0 on success, -1 if there is no such name.
+static int32_t dir_lookup(uint32_t dir, const uint8_t *name, dentry_t *dentry) {
+    dcache_entry_t *slot = dcache_slot(dir, name);
+    int32_t index;
+
+    if(dcache_match(slot, dir, name)) {
+        dcache_stats.hits++;
+        if(slot->state == DCACHE_NEGATIVE)
+            return -1;
+        memcpy(dentry, &slot->dentry, sizeof(dentry_t));
+        return 0;
+    }
+    dcache_stats.misses++;
+
+    index = (dir == FS_ROOT_DIR) ? dir_find(name, dentry) : subdir_find(dir, name, dentry);
+    if(index != -1 && dentry->file_type == DIRECTORY_FILE && !is_subdir(dir, dentry))
+        dentry->inode_idx = FS_ROOT_DIR;
+
+    slot->dir = dir;
+    if(index == -1) {
+        slot->state = DCACHE_NEGATIVE;
+        memset(slot->dentry.file_name, 0, FILE_NAME_MAX_LENGTH);
+        memcpy(slot->dentry.file_name, name, strlen((int8_t *)name));
+        return -1;
+    }
+    slot->state = DCACHE_POSITIVE;
+    memcpy(&slot->dentry, dentry, sizeof(dentry_t));
+
+    return 0;
+}
+
+// Copy the next component of path into name, which has room for FILE_NAME_MAX_LENGTH
+//  characters and a NUL. name is left empty at the end of path. Return the rest of path,
+//  NULL if the component is too long.
+static const uint8_t *path_next(const uint8_t *path, uint8_t *name) {
+    uint32_t length = 0;
+
+    while(*path == '/')
+        path++;
+    while(path[length] != '\0' && path[length] != '/') {
+        if(length == FILE_NAME_MAX_LENGTH)
+            return NULL;
+        name[length] = path[length];
+        length++;
+    }
+    name[length] = '\0';
+
+    return path + length;
+}
+
+// Walk path up to its last component. Fill dir with the directory holding it and name with
+//  the component. Return 0 on success, -1 if path is empty, too long, or goes through
+//  something that is not a directory.
+static int32_t path_parent(const uint8_t *path, uint32_t *dir, uint8_t *name) {
+    uint8_t next[FILE_NAME_MAX_LENGTH + 1];
+    dentry_t dentry;
+    uint32_t depth;
+
+    if(path == NULL || strlen((int8_t *)path) > FS_MAX_PATH_LENGTH)
+        return -1;
+
+    *dir = FS_ROOT_DIR;
+    path = path_next(path, name);
+    if(path == NULL || name[0] == '\0')
+        return -1;
+
+    for(depth = 0; ; ++depth) {
+        path = path_next(path, next);
+        if(path == NULL)
+            return -1;
+        if(next[0] == '\0')
+            return 0;
+
+        // There is more to come, so name has to be a directory.
+        if(depth == FS_MAX_DEPTH || dir_lookup(*dir, name, &dentry) == -1 || dentry.file_type != DIRECTORY_FILE)
+            return -1;
+        *dir = dentry.inode_idx;
+        memcpy(name, next, sizeof(next));
+    }
+}
 
 /*read_dentry_by_name
 * DISCRIPTION: fill in the dentry t block passed as their second argument with the file name, file
-               type, and inode number for the file, then return 0.
+               type, and inode number for the file, then return 0. fname is a path from the root
+               directory. Every component is looked up through the dentry cache first, so a
+               directory is only searched the first time a name is looked up in it.
 * INPUT:    const uint8_t fname
             dentry_t dentry
 * OUTPUT: NONE
@@ -29,26 +750,28 @@ static boot_block_t *boot_block = NULL;
 */
 
 int32_t read_dentry_by_name(const uint8_t *fname, dentry_t *dentry) {
-    if(file_system_base_address == NULL)
+    uint8_t name[FILE_NAME_MAX_LENGTH + 1];
+    uint32_t dir;
+
+    if(boot_block == NULL)
         return -1;
-    
-    if(strlen((int8_t*)fname) > FILE_NAME_MAX_LENGTH)
+
+    if(path_parent(fname, &dir, name) == -1)
         return -1;
 
-    dentry_t *source;
+    return dir_lookup(dir, name, dentry);
+}
 
-    int i;
-    for(i = 0; i < boot_block->num_dentry; ++i) {
-        source = (dentry_t *)((char *)file_system_base_address 
-                                + DENTRY_START_OFFSET + i * sizeof(dentry_t));
-        if(strncmp((int8_t*)fname, (int8_t*)source->file_name, 
-                                                FILE_NAME_MAX_LENGTH) == 0) {
-            read_dentry_by_index(i, dentry);
-            return 0;
-        }
-    }
+/*get_dcache_stats
+* DISCRIPTION: copy the hit and miss counters of the dentry cache.
+* INPUT:    dcache_stats_t *stats
+* OUTPUT: NONE
+* RETURN VALUE: NONE
+* SIDE EFFECTS: NONE
+*/
 
-    return -1;
+void get_dcache_stats(dcache_stats_t *stats) {
+    memcpy(stats, &dcache_stats, sizeof(dcache_stats_t));
 }
 
 /*read_dentry_by_index
@@ -62,15 +785,21 @@ int32_t read_dentry_by_name(const uint8_t *fname, dentry_t *dentry) {
 */
 
 int32_t read_dentry_by_index(uint32_t index, dentry_t *dentry) {
-    if(file_system_base_address == NULL)
+    if(boot_block == NULL)
         return -1;
 
     if(index >= boot_block->num_dentry)
         return -1;
 
-    dentry_t *source = (dentry_t *)((char *)file_system_base_address 
-                                        + DENTRY_START_OFFSET + index * sizeof(dentry_t));
-    memcpy((void *)dentry, (void *)source, sizeof(dentry_t));
+    if(index < VAL_63) {
+        memcpy((void *)dentry, (void *)&boot_block->dentry[index], sizeof(dentry_t));
+        return 0;
+    }
+
+    // Past the boot block, the dentry lives in the directory inode.
+    if(!is_dir_hashed() ||
+       read_data(boot_block->dir_inode, dir_entry_offset(index), (uint8_t *)dentry, sizeof(dentry_t)) != sizeof(dentry_t))
+        return -1;
 
     return 0;
 }
@@ -87,39 +816,441 @@ int32_t read_dentry_by_index(uint32_t index, dentry_t *dentry) {
 */
 
 int32_t read_data(uint32_t inode_index, uint32_t offset, uint8_t *buf, uint32_t length) {
-    if(file_system_base_address == NULL)
+    block_run_t run;
+
+    run.count = 0;
+    return read_data_cached(inode_index, offset, buf, length, &run);
+}
+
+/*read_data_cached
+* DISCRIPTION: same as read_data(). Data blocks are looked up in the block run cached in *run
+               first, only a block outside of it walks the inode and its indirect blocks. The
+               run found last is left in *run for the next call. With the image in memory, a
+               run is copied with a single memcpy instead of one per block.
+* INPUT:    uint32_t inode_index
+            uint32_t offset
+            uint8_t *buf
+            uint32_t length
+            block_run_t *run -- empty or filled by an earlier call
+* OUTPUT: NONE
+* RETURN VALUE: byte_count on success, -1 on failure
+* SIDE EFFECTS: updates *run
+*/
+
+int32_t read_data_cached(uint32_t inode_index, uint32_t offset, uint8_t *buf, uint32_t length,
+                         block_run_t *run) {
+    if(boot_block == NULL)
         return -1;
 
     if(inode_index >= boot_block->num_inode)
         return -1;
 
-    const inode_t *inode= (inode_t *)((char *)file_system_base_address 
-                                        + sizeof(boot_block_t) + inode_index * sizeof(inode_t));
+    buffer_t *inode_handle, *block_handle;
+    inode_t *inode = get_inode(inode_index, &inode_handle);
+    if(inode == NULL)
+        return -1;
+
+    if(run->inode != inode_index || run->generation != block_map_generation)
+        run->count = 0;
 
-    int byte_count;
+    uint32_t num_blocks = num_file_blocks(inode->length);
+    uint32_t byte_count = 0;
+    while(byte_count < length && offset + byte_count < inode->length) {
+        uint32_t position = offset + byte_count;
+        uint32_t block_offset = position % sizeof(data_block_t);
 
-    int curr_byte;
-    uint32_t cur_data_block_idx;
-    data_block_t *cur_data_block;
-    for(byte_count = 0, curr_byte = offset; 
-                byte_count < length && curr_byte < inode->length; ++byte_count, ++curr_byte) {
-        // Update current data block at the beginning and whenever enters a new block.
-        if(byte_count == 0 || curr_byte % sizeof(data_block_t) == 0) {
-            cur_data_block_idx = inode->date_block_idx[curr_byte / sizeof(data_block_t)];
-            if(cur_data_block_idx > boot_block->num_data_block)
+        uint32_t block_num = position / sizeof(data_block_t);
+        if(block_num < run->file_block || block_num - run->file_block >= run->count) {
+            if(map_block(inode, block_num, num_blocks, run) == -1) {
+                run->count = 0;
+                put_fs_block(inode_handle, 0);
                 return -1;
-            cur_data_block = 
-                (data_block_t *)((char *)file_system_base_address + sizeof(boot_block_t) 
-                                    + (boot_block->num_inode) * sizeof(inode_t) 
-                                    + cur_data_block_idx * sizeof(data_block_t));
+            }
+            run->inode = inode_index;
         }
+        uint32_t run_index = block_num - run->file_block;
+
+        // Copy up to the end of the current data block at once. The blocks of a run are
+        //  next to each other in an image in memory, there one copy covers the whole run.
+        uint32_t span = (fs_device == -1 && !is_packed()) ? run->count - run_index : 1;
+        uint32_t chunk = span * sizeof(data_block_t) - block_offset;
+        if(chunk > length - byte_count)
+            chunk = length - byte_count;
+        if(chunk > inode->length - position)
+            chunk = inode->length - position;
+
+        const data_block_t *block = get_data_block(run->data_block + run_index, &block_handle);
+        if(block == NULL) {
+            put_fs_block(inode_handle, 0);
+            return -1;
+        }
+        // Long runs, such as program images, bypass the cache.
+        memcpy_stream(buf + byte_count, block->data + block_offset, chunk);
+        put_fs_block(block_handle, 0);
 
-        buf[byte_count] = cur_data_block->data[curr_byte % sizeof(data_block_t)];
+        byte_count += chunk;
     }
+    put_fs_block(inode_handle, 0);
 
     return byte_count;
 }
 
+/*get_file_length
+* DISCRIPTION: get the length in bytes of the file with inode number inode_index.
+* INPUT:    uint32_t inode_index
+* OUTPUT: NONE
+* RETURN VALUE: file length on success, -1 on failure
+* SIDE EFFECTS: NONE
+*/
+
+int32_t get_file_length(uint32_t inode_index) {
+    if(boot_block == NULL)
+        return -1;
+
+    if(inode_index >= boot_block->num_inode)
+        return -1;
+
+    buffer_t *handle;
+    const inode_t *inode = get_inode(inode_index, &handle);
+    if(inode == NULL)
+        return -1;
+
+    int32_t length = inode->length;
+    put_fs_block(handle, 0);
+
+    return length;
+}
+
+/*get_data_block_address
+* DISCRIPTION: find the data block holding byte offset of the file with inode number inode_index,
+               inside the file system image. Data blocks are 4KB aligned, so the block can be
+               mapped as a page. A file system mounted from a disk has no image in memory,
+               callers copy through read_data() instead.
+* INPUT:    uint32_t inode_index
+            uint32_t offset
+* OUTPUT: NONE
+* RETURN VALUE: address of the data block on success, 0 on failure or if not in memory
+* SIDE EFFECTS: NONE
+*/
+
+uint32_t get_data_block_address(uint32_t inode_index, uint32_t offset) {
+    if(file_system_base_address == NULL || fs_device != -1 || is_packed())
+        return 0;
+
+    if(inode_index >= boot_block->num_inode)
+        return 0;
+
+    buffer_t *handle;
+    inode_t *inode = get_inode(inode_index, &handle);
+    if(inode == NULL)
+        return 0;
+
+    if(offset >= inode->length) {
+        put_fs_block(handle, 0);
+        return 0;
+    }
+
+    uint32_t data_block_idx = lookup_block(inode, offset / sizeof(data_block_t));
+    put_fs_block(handle, 0);
+    if(data_block_idx >= boot_block->num_data_block)
+        return 0;
+
+    return file_system_base_address + sizeof(boot_block_t) 
+                + (boot_block->num_inode) * sizeof(inode_t) 
+                + data_block_idx * sizeof(data_block_t);
+}
+
+/*write_data
+* DISCRIPTION: write length bytes from buf into the file with inode number inode_index, starting at
+               position offset. The file grows as needed, new blocks are allocated next to the
+               previous block of the file whenever possible.
+* INPUT:    uint32_t inode_index
+            uint32_t offset -- must not be past the end of file
+            const uint8_t *buf
+            uint32_t length
+* OUTPUT: NONE
+* RETURN VALUE: number of bytes written, -1 on failure
+* SIDE EFFECTS: may allocate data blocks
+*/
+
+int32_t write_data(uint32_t inode_index, uint32_t offset, const uint8_t *buf, uint32_t length) {
+    if(boot_block == NULL)
+        return -1;
+
+    if(inode_index >= boot_block->num_inode || !bitmap_test(inode_bitmap, inode_index))
+        return -1;
+
+    buffer_t *inode_handle, *block_handle;
+    inode_t *inode = get_inode(inode_index, &inode_handle);
+    if(inode == NULL)
+        return -1;
+    if(offset > inode->length || offset >= max_file_size()) {
+        put_fs_block(inode_handle, 0);
+        return -1;
+    }
+    if(length > max_file_size() - offset)
+        length = max_file_size() - offset;
+
+    uint32_t written = 0;
+    uint32_t idx = NO_DATA_BLOCK;
+    while(written < length) {
+        uint32_t position = offset + written;
+        uint32_t block_num = position / sizeof(data_block_t);
+        uint32_t block_offset = position % sizeof(data_block_t);
+
+        // Past the last block of the file, append a new one.
+        uint32_t num_blocks = num_file_blocks(inode->length);
+        if(block_num >= num_blocks) {
+            uint32_t prev = idx;
+            if(prev == NO_DATA_BLOCK && block_num > 0)
+                prev = lookup_block(inode, block_num - 1);
+            idx = alloc_data_block(prev);
+            if(idx == NO_DATA_BLOCK)
+                break;
+            if(append_block(inode, block_num, idx) == -1) {
+                free_data_block(idx);
+                break;
+            }
+        }
+        else {
+            idx = lookup_block(inode, block_num);
+        }
+
+        uint32_t chunk = sizeof(data_block_t) - block_offset;
+        if(chunk > length - written)
+            chunk = length - written;
+
+        data_block_t *block = get_data_block_rw(idx, &block_handle);
+        if(block == NULL)
+            break;
+        memcpy(block->data + block_offset, buf + written, chunk);
+        put_fs_block(block_handle, 1);
+        written += chunk;
+        if(position + chunk > inode->length)
+            inode->length = position + chunk;
+    }
+    vfs_set_length(&image_fs_ops, inode_index, inode->length);
+    put_fs_block(inode_handle, 1);
+
+    if(written == 0 && length > 0)
+        return -1;
+
+    return written;
+}
+
+/*truncate_data
+* DISCRIPTION: set the length of the file with inode number inode_index. Blocks past the new end
+               are freed, growing the file fills it with zeros.
+* INPUT:    uint32_t inode_index
+            uint32_t length
+* OUTPUT: NONE
+* RETURN VALUE: 0 on success, -1 on failure
+* SIDE EFFECTS: may allocate or free data blocks
+*/
+
+int32_t truncate_data(uint32_t inode_index, uint32_t length) {
+    if(boot_block == NULL)
+        return -1;
+
+    if(inode_index >= boot_block->num_inode || !bitmap_test(inode_bitmap, inode_index))
+        return -1;
+    if(length > max_file_size())
+        return -1;
+
+    buffer_t *inode_handle, *block_handle;
+    inode_t *inode = get_inode(inode_index, &inode_handle);
+    if(inode == NULL)
+        return -1;
+    uint32_t old_blocks = num_file_blocks(inode->length);
+    uint32_t new_blocks = num_file_blocks(length);
+    uint32_t i, idx;
+
+    if(length <= inode->length) {
+        if(new_blocks < old_blocks)
+            free_file_blocks(inode, new_blocks, old_blocks);
+        inode->length = length;
+        put_fs_block(inode_handle, 1);
+        vfs_set_length(&image_fs_ops, inode_index, length);
+        return 0;
+    }
+
+    // Clear the stale tail of the last block, then add zero-filled blocks.
+    if(inode->length % sizeof(data_block_t) != 0) {
+        uint32_t tail = inode->length % sizeof(data_block_t);
+        data_block_t *block = get_data_block_rw(lookup_block(inode, old_blocks - 1), &block_handle);
+        if(block == NULL) {
+            put_fs_block(inode_handle, 0);
+            return -1;
+        }
+        memset(block->data + tail, 0, sizeof(data_block_t) - tail);
+        put_fs_block(block_handle, 1);
+    }
+    idx = (old_blocks == 0) ? NO_DATA_BLOCK : lookup_block(inode, old_blocks - 1);
+    for(i = old_blocks; i < new_blocks; ++i) {
+        idx = alloc_data_block(idx);
+        if(idx == NO_DATA_BLOCK || append_block(inode, i, idx) == -1) {
+            // Give back what was added so far.
+            if(idx != NO_DATA_BLOCK)
+                free_data_block(idx);
+            free_file_blocks(inode, old_blocks, i);
+            put_fs_block(inode_handle, 1);
+            return -1;
+        }
+    }
+    inode->length = length;
+    put_fs_block(inode_handle, 1);
+    vfs_set_length(&image_fs_ops, inode_index, length);
+
+    return 0;
+}
+
+// Add an empty file of type at path. In the root, the dentry goes to the end of the directory,
+//  which is extended into its own inode with a hash table once the boot block is full. In a
+//  subdirectory, it goes to the end of the inode of the directory.
+//  Return 0 on success, -1 on failure.
+static int32_t dir_add(const uint8_t *path, uint32_t type) {
+    uint8_t name[FILE_NAME_MAX_LENGTH + 1];
+    dentry_t dentry;
+    uint32_t dir, index, bucket = 0;
+    int32_t inode_index;
+
+    if(boot_block == NULL || path_parent(path, &dir, name) == -1)
+        return -1;
+    if(dir_lookup(dir, name, &dentry) == 0)
+        return -1;
+    if(dir == FS_ROOT_DIR && boot_block->num_dentry >= VAL_63 && !is_dir_hashed() && dir_extend() == -1)
+        return -1;
+
+    inode_index = alloc_inode();
+    if(inode_index == -1)
+        return -1;
+
+    memset(&dentry, 0, sizeof(dentry_t));
+    memcpy(dentry.file_name, name, strlen((int8_t *)name));
+    dentry.file_type = type;
+    dentry.inode_idx = inode_index;
+    dcache_invalidate(dir, name);
+
+    if(dir != FS_ROOT_DIR) {
+        // Dentries never straddle a data block, so this is all or nothing.
+        if(write_data(dir, dir_num_entries(dir) * sizeof(dentry_t), (const uint8_t *)&dentry, sizeof(dentry_t)) != sizeof(dentry_t)) {
+            bitmap_clear(inode_bitmap, inode_index);
+            return -1;
+        }
+        return 0;
+    }
+
+    index = boot_block->num_dentry;
+    if(is_dir_hashed()) {
+        bucket = dir_hash(dentry.file_name);
+        dentry.hash_next = dir_bucket_head(bucket);
+    }
+    if(dir_write_entry(index, &dentry) == -1 ||
+       (is_dir_hashed() && dir_set_bucket_head(bucket, index) == -1)) {
+        bitmap_clear(inode_bitmap, inode_index);
+        return -1;
+    }
+    boot_block->num_dentry++;
+    boot_block_dirty();
+
+    return 0;
+}
+
+/*file_create
+* DISCRIPTION: create an empty regular file. fname is a path, every directory on the way must
+               already exist.
+* INPUT:    const uint8_t *fname
+* OUTPUT: NONE
+* RETURN VALUE: 0 on success, -1 if the name is invalid or taken, or the directory or inodes are full
+* SIDE EFFECTS: allocates an inode
+*/
+
+int32_t file_create(const uint8_t *fname) {
+    return dir_add(fname, REGULAR_FILE);
+}
+
+/*file_mkdir
+* DISCRIPTION: create an empty directory. fname is a path, every directory on the way must
+               already exist.
+* INPUT:    const uint8_t *fname
+* OUTPUT: NONE
+* RETURN VALUE: 0 on success, -1 if the name is invalid or taken, or the directory or inodes are full
+* SIDE EFFECTS: allocates an inode
+*/
+
+int32_t file_mkdir(const uint8_t *fname) {
+    return dir_add(fname, DIRECTORY_FILE);
+}
+
+/*file_unlink
+* DISCRIPTION: remove a regular file or an empty directory and free its inode and data blocks.
+               In the root, later dentries move up one slot so that directory order is kept,
+               in a hashed root or in a subdirectory the last dentry moves into the freed slot
+               instead.
+* INPUT:    const uint8_t *fname
+* OUTPUT: NONE
+* RETURN VALUE: 0 on success, -1 if there is no such regular file or empty directory
+* SIDE EFFECTS: none
+*/
+
+int32_t file_unlink(const uint8_t *fname) {
+    uint8_t name[FILE_NAME_MAX_LENGTH + 1];
+    dentry_t dentry, last;
+    int32_t index;
+    uint32_t i, dir, last_index;
+
+    if(boot_block == NULL || path_parent(fname, &dir, name) == -1)
+        return -1;
+
+    index = (dir == FS_ROOT_DIR) ? dir_find(name, &dentry) : subdir_find(dir, name, &dentry);
+    if(index == -1)
+        return -1;
+    if(dentry.file_type != REGULAR_FILE &&
+       (!is_subdir(dir, &dentry) || dir_num_entries(dentry.inode_idx) != 0))
+        return -1;
+
+    if(truncate_data(dentry.inode_idx, 0) == -1)
+        return -1;
+    bitmap_clear(inode_bitmap, dentry.inode_idx);
+    if(dentry.file_type == REGULAR_FILE)
+        vfs_forget(&image_fs_ops, dentry.inode_idx);
+    else
+        dcache_forget_dir(dentry.inode_idx);
+    dcache_invalidate(dir, name);
+
+    if(dir != FS_ROOT_DIR) {
+        last_index = dir_num_entries(dir) - 1;
+        if(index != last_index) {
+            if(dir_read_entry(dir, last_index, &last) == -1 ||
+               write_data(dir, index * sizeof(dentry_t), (const uint8_t *)&last, sizeof(dentry_t)) != sizeof(dentry_t))
+                return -1;
+        }
+        return truncate_data(dir, last_index * sizeof(dentry_t));
+    }
+
+    last_index = boot_block->num_dentry - 1;
+    if(!is_dir_hashed()) {
+        for(i = index; i < last_index; ++i)
+            memcpy(&boot_block->dentry[i], &boot_block->dentry[i + 1], sizeof(dentry_t));
+    }
+    else {
+        if(dir_relink(dir_hash(dentry.file_name), index, dentry.hash_next) == -1)
+            return -1;
+        if(index != last_index) {
+            if(read_dentry_by_index(last_index, &last) == -1 ||
+               dir_relink(dir_hash(last.file_name), last_index, index) == -1 ||
+               dir_write_entry(index, &last) == -1)
+                return -1;
+        }
+        if(last_index >= VAL_63)
+            (void)truncate_data(boot_block->dir_inode, dir_entry_offset(last_index));
+    }
+    boot_block->num_dentry--;
+    boot_block_dirty();
+
+    return 0;
+}
+
 // Stuffs for file operations.
 dentry_t dentry_opened_file;
 int32_t has_file_opened;
@@ -173,7 +1304,8 @@ int32_t file_close(int32_t fd) {
 int32_t file_read(int32_t fd, void *buf, int32_t nbytes) {
     pcb_t *pcb = get_current_pcb();
     
-    int ret = read_data(pcb->file_array[fd].inode, pcb->file_array[fd].file_position, buf, nbytes);
+    int ret = read_data_cached(pcb->file_array[fd].inode, pcb->file_array[fd].file_position, buf, nbytes,
+                               &pcb->file_array[fd].block_run);
 
     
     if(ret == -1)
@@ -185,23 +1317,45 @@ int32_t file_read(int32_t fd, void *buf, int32_t nbytes) {
 }
 
 /*file_write
-* DISCRIPTION: perform type-specific write on file operations jump table.
+* DISCRIPTION: perform type-specific write on file operations jump table. Writes at the current
+               position and extends the file when going past its end.
 * INPUT:    int32_t fd
             int32_t nbytes
             void* buf
 * OUTPUT: NONE
-* RETURN VALUE: -1 if write operation is unsuccessful, 0 if writing operation is successful
+* RETURN VALUE: -1 if write operation is unsuccessful, number of bytes written otherwise
 * SIDE EFFECTS: write data to file table
 */
 
 int32_t file_write(int32_t fd, void *buf, int32_t nbytes) {
-    return -1;
+    pcb_t *pcb = get_current_pcb();
+
+    if(buf == NULL || nbytes < 0)
+        return -1;
+
+    int ret = write_data(pcb->file_array[fd].inode, pcb->file_array[fd].file_position, buf, nbytes);
+
+    if(ret == -1)
+        return -1;
+
+    pcb->file_array[fd].file_position += ret;
+
+    return ret;
+}
+
+// Backend operations of the image, the inode number of a file is the one of its dentry.
+static int32_t image_lookup(const uint8_t *name, uint32_t *type, uint32_t *ino) {
+    dentry_t dentry;
+
+    if(read_dentry_by_name(name, &dentry) == -1)
+        return -1;
+    *type = dentry.file_type;
+    *ino = dentry.inode_idx;
+    return 0;
 }
 
-// Stuffs for directory operations.
-dentry_t dentry_opened_directory;
-int32_t has_directory_opened;
-uint32_t opened_directory_offset;
+fs_ops_t image_fs_ops = {image_lookup, file_create, file_mkdir, file_unlink, read_data_cached, write_data,
+                         truncate_data, get_file_length, get_data_block_address};
 
 int32_t directory_open(const uint8_t *filename) {
     if(filename == NULL)
@@ -215,17 +1369,13 @@ int32_t directory_open(const uint8_t *filename) {
     if(dentry.file_type != DIRECTORY_FILE)
         return -1;
     
-    memcpy(&dentry_opened_directory, &dentry, sizeof(dentry_t));
-
-    opened_directory_offset = 0;
-
-    has_directory_opened = 1;
-    
     return 0;
 }
 
 /*directroy_read
-* DISCRIPTION:  read files filename by filename, including “.”
+* DISCRIPTION:  read files filename by filename, including “.” in the root. The directory
+                is the inode of fd, FS_ROOT_DIR for the root, and the index of the next
+                dentry to return is kept in file_position of fd.
 * INPUT:    int32_t fd
             int32_t nbytes
             void* buf
@@ -235,15 +1385,18 @@ int32_t directory_open(const uint8_t *filename) {
 */
 
 int32_t directory_read(int32_t fd, void *buf, int32_t nbytes) {
-    if(!has_directory_opened)
+    if(fd < 0 || fd >= MAX_FD_SIZE)
         return -1;
-    
+
+    file_desc_t *file = &get_current_pcb()->file_array[fd];
+
     // Return 0 represents EOI.
-    if(opened_directory_offset >= boot_block->num_dentry)
+    if(file->file_position >= dir_num_entries(file->inode))
         return 0;
 
     dentry_t dentry;
-    read_dentry_by_index(opened_directory_offset, &dentry);
+    if(dir_read_entry(file->inode, file->file_position, &dentry) == -1)
+        return -1;
 
     int i = 0;
     // Maximum filename length is 32 according to filesystem specification.
@@ -256,25 +1409,75 @@ int32_t directory_read(int32_t fd, void *buf, int32_t nbytes) {
         i++;
     }
 
-    opened_directory_offset++;
+    file->file_position++;
 
     return i;
 }
 
+/*directory_getdents
+* DISCRIPTION:  fill buf with as many directory records as fit, starting at the dentry
+                after the last one returned for fd. Each record is a dirent_t followed
+                by the NUL-terminated name, padded to a multiple of 4 bytes.
+* INPUT:    int32_t fd
+            void* buf
+            int32_t nbytes
+* OUTPUT: NONE
+* RETURN VALUE: number of bytes filled, 0 at the end of the directory, -1 on failure
+                or if buf cannot hold a single record.
+* SIDE EFFECTS: advances the directory cursor of fd
+*/
+
+int32_t directory_getdents(int32_t fd, void *buf, int32_t nbytes) {
+    if(fd < 0 || fd >= MAX_FD_SIZE || buf == NULL || nbytes < 0)
+        return -1;
+
+    file_desc_t *file = &get_current_pcb()->file_array[fd];
+    uint32_t num_entries = dir_num_entries(file->inode);
+    int32_t used = 0;
+
+    while(file->file_position < num_entries) {
+        dentry_t dentry;
+        if(dir_read_entry(file->inode, file->file_position, &dentry) == -1)
+            return -1;
+
+        uint32_t name_len = 0;
+        while(name_len < FILE_NAME_MAX_LENGTH && dentry.file_name[name_len] != '\0')
+            name_len++;
+
+        uint32_t rec_len = (sizeof(dirent_t) + name_len + 1 + DIRENT_ALIGN - 1) & ~(DIRENT_ALIGN - 1);
+        if(used + rec_len > nbytes)
+            break;
+
+        dirent_t *record = (dirent_t *)((uint8_t *)buf + used);
+        record->inode = dentry.inode_idx;
+        record->size = 0;
+        if(dentry.file_type == REGULAR_FILE)
+            record->size = get_file_length(dentry.inode_idx);
+        record->type = dentry.file_type;
+        record->name_len = name_len;
+        record->rec_len = rec_len;
+        memcpy(record->name, dentry.file_name, name_len);
+        record->name[name_len] = '\0';
+
+        used += rec_len;
+        file->file_position++;
+    }
+
+    if(used == 0 && file->file_position < num_entries)
+        return -1;
+
+    return used;
+}
+
 /*directroy_close
 * DISCRIPTION:  close directory and return 0;
 * INPUT:    int32_t fd
 * OUTPUT: NONE
-* RETURN VALUE: -1 if write operation is unsuccessful, index of data in dentry if read is successful.
-* SIDE EFFECTS: return -1 if directory is already closed, return 0 if closed later manually.
+* RETURN VALUE: 0
+* SIDE EFFECTS: NONE
 */
 
 int32_t directory_close(int32_t fd) {
-    if(!has_directory_opened)
-        return -1;
-    
-    has_directory_opened = 0;
-
     return 0;
 }
 
@@ -292,22 +1495,171 @@ int32_t directory_write(int32_t fd, void *buf, int32_t nbytes) {
     return -1;
 }
 
+static void mark_data_block(uint32_t idx) {
+    if(idx < FS_MAX_DATA_BLOCKS)
+        bitmap_set(data_block_bitmap, idx);
+}
+
+// Mark an inode, its data blocks and its pointer blocks as in use. Return its number of blocks.
+static uint32_t mark_inode(uint32_t inode_index) {
+    uint32_t i, j, num_blocks, num_tables;
+    inode_t *inode;
+    buffer_t *handle, *outer_handle;
+    const uint32_t *outer;
+    block_run_t run;
+
+    if(inode_index >= boot_block->num_inode || inode_index >= FS_MAX_INODES)
+        return 0;
+    bitmap_set(inode_bitmap, inode_index);
+
+    inode = get_inode(inode_index, &handle);
+    if(inode == NULL)
+        return 0;
+    num_blocks = num_file_blocks(inode->length);
+    for(i = 0; map_block(inode, i, num_blocks, &run) == 0; i += run.count) {
+        for(j = 0; j < run.count; ++j)
+            mark_data_block(run.data_block + j);
+    }
+
+    if(is_indirect() && num_blocks > FS_DIRECT_BLOCKS)
+        mark_data_block(inode->date_block_idx[FS_SINGLE_INDIRECT]);
+    if(is_indirect() && num_blocks > FS_DIRECT_BLOCKS + FS_INDIRECT_ENTRIES) {
+        mark_data_block(inode->date_block_idx[FS_DOUBLE_INDIRECT]);
+        num_tables = num_blocks - FS_DIRECT_BLOCKS - FS_INDIRECT_ENTRIES;
+        num_tables = num_tables / FS_INDIRECT_ENTRIES + (num_tables % FS_INDIRECT_ENTRIES != 0);
+        outer = (const uint32_t *)get_data_block(inode->date_block_idx[FS_DOUBLE_INDIRECT], &outer_handle);
+        for(j = 0; outer != NULL && j < num_tables; ++j)
+            mark_data_block(outer[j]);
+        put_fs_block(outer_handle, 0);
+    }
+    put_fs_block(handle, 0);
+
+    return num_blocks;
+}
+
+// Mark every file of directory dir and of the directories below it. Return the largest
+//  number of blocks of any of them.
+static uint32_t mark_dir(uint32_t dir, uint32_t depth) {
+    uint32_t i, max_blocks = 0, num_blocks, sub_blocks, num_entries = dir_num_entries(dir);
+    dentry_t dentry;
+
+    for(i = 0; i < num_entries; ++i) {
+        if(dir_read_entry(dir, i, &dentry) == -1)
+            break;
+        num_blocks = 0;
+        if(dentry.file_type == REGULAR_FILE)
+            num_blocks = mark_inode(dentry.inode_idx);
+        // A directory already marked is reachable twice, do not walk it again.
+        if(is_subdir(dir, &dentry) && depth < FS_MAX_DEPTH && dentry.inode_idx < FS_MAX_INODES &&
+           !bitmap_test(inode_bitmap, dentry.inode_idx)) {
+            num_blocks = mark_inode(dentry.inode_idx);
+            sub_blocks = mark_dir(dentry.inode_idx, depth + 1);
+            if(sub_blocks > num_blocks)
+                num_blocks = sub_blocks;
+        }
+        if(num_blocks > max_blocks)
+            max_blocks = num_blocks;
+    }
+
+    return max_blocks;
+}
+
+// Rebuild the allocation bitmaps of the mounted file system. Everything not
+//  reachable from a dentry, or the directory itself, is free. An image from before
+//  indirect blocks is switched over to them unless one of its files uses the last
+//  entries of its inode as data blocks. The dentry cache starts out empty.
+static void build_bitmaps() {
+    uint32_t i, max_blocks = 0, num_blocks;
+
+    memset(inode_bitmap, 0, sizeof(inode_bitmap));
+    memset(data_block_bitmap, 0, sizeof(data_block_bitmap));
+    for(i = FS_MAX_INODES; i < boot_block->num_inode; ++i)
+        bitmap_set(inode_bitmap, i);
+    memset(dcache, 0, sizeof(dcache));
+    memset(&dcache_stats, 0, sizeof(dcache_stats));
+
+    if(is_dir_hashed())
+        max_blocks = mark_inode(boot_block->dir_inode);
+    num_blocks = mark_dir(FS_ROOT_DIR, 0);
+    if(num_blocks > max_blocks)
+        max_blocks = num_blocks;
+
+    if(!is_indirect() && max_blocks <= FS_DIRECT_BLOCKS) {
+        boot_block->inode_flags |= INODE_FLAG_INDIRECT;
+        boot_block_dirty();
+    }
+    block_map_generation++;
+}
+
 /*file_system_init
 * DISCRIPTION:  initialize file system
 * INPUT:        uint32_t base_address
 * OUTPUT: NONE
 * RETURN VALUE: 0
-* SIDE EFFECTS: initialize file system.
+* SIDE EFFECTS: initialize file system and build the inode and data block bitmaps. The data
+                blocks of a compressed image are decompressed as they are used.
 */
 int file_system_init(uint32_t base_address) {
+    uint32_t i;
+
     if(base_address == NULL)
         return -1;
 
     file_system_base_address = base_address;
+    fs_device = -1;
     boot_block = (boot_block_t *)file_system_base_address;
+    for(i = 0; i < PACK_CACHE_SIZE; ++i)
+        pack_cache_block[i] = NO_DATA_BLOCK;
 
     has_file_opened = 0;
-    has_directory_opened = 0;
+
+    build_bitmaps();
+    vfs_flush(&image_fs_ops);
+
+    return 0;
+}
+
+/*file_system_mount
+* DISCRIPTION:  switch the file system over to an image stored on a block device. All
+                blocks are then read and written through the buffer cache.
+* INPUT:        int32_t dev -- id of the block device
+* OUTPUT: NONE
+* RETURN VALUE: 0 on success, -1 if the device does not hold a file system image
+* SIDE EFFECTS: the file system in memory, if any, is no longer used.
+*/
+int32_t file_system_mount(int32_t dev) {
+    block_device_t *device = get_block_device(dev);
+    buffer_t *buf;
+    boot_block_t *image;
+
+    if(device == NULL)
+        return -1;
+    buf = bread(dev, 0);
+    if(buf == NULL)
+        return -1;
+
+    // Expect a sane boot block whose first dentry is ".", and the whole image on the device.
+    //  Compressed images can only be used from memory.
+    image = (boot_block_t *)buf->data;
+    if(image->num_dentry == 0 || image->pack_magic == PACK_MAGIC || (image->num_dentry > VAL_63 && image->dir_magic != DIR_EXT_MAGIC) ||
+       (image->dir_magic == DIR_EXT_MAGIC &&
+        (image->dir_hash_size == 0 || (image->dir_hash_size & (image->dir_hash_size - 1)) != 0)) ||
+       image->dentry[0].file_type != DIRECTORY_FILE ||
+       strncmp((int8_t *)image->dentry[0].file_name, ".", FILE_NAME_MAX_LENGTH) != 0 ||
+       1 + image->num_inode + image->num_data_block > device->num_sectors / BCACHE_SECTORS_PER_BLOCK) {
+        brelse(buf);
+        return -1;
+    }
+
+    if(boot_block_buffer != NULL)
+        brelse(boot_block_buffer);
+    boot_block_buffer = buf;
+    boot_block = image;
+    file_system_base_address = NULL;
+    fs_device = dev;
+
+    build_bitmaps();
+    vfs_flush(&image_fs_ops);
 
     return 0;
 }
@@ -10,12 +10,59 @@
 // Constants that actually make no sense but just to
 //  eliminate magic numbers.
 #define VAL_32 32
-#define VAL_24 24
-#define VAL_52 52
+#define VAL_20 20
+#define VAL_28 28
+#define VAL_40 40
 #define VAL_63 63
 #define VAL_1023 1023
 #define VAL_4096 4096
 
+// Limits of the allocation bitmaps, and of a single file. A file of an image without
+//  INODE_FLAG_INDIRECT has at most one inode worth of blocks, otherwise its length is only
+//  limited to 32 bits.
+#define FS_MAX_INODES 1024
+#define FS_MAX_DATA_BLOCKS 8192
+#define FS_LEGACY_MAX_FILE_SIZE (VAL_1023 * VAL_4096)
+#define FS_MAX_FILE_SIZE 0xfffff000
+
+// Indirect blocks. With INODE_FLAG_INDIRECT set in the boot block, only the first
+//  FS_DIRECT_BLOCKS entries of an inode point to data. Entry FS_SINGLE_INDIRECT points to a
+//  block of FS_INDIRECT_ENTRIES data block indices, and entry FS_DOUBLE_INDIRECT to a block
+//  of indices of such blocks. Pointer blocks are allocated from the data blocks.
+#define INODE_FLAG_INDIRECT 0x1
+#define FS_DIRECT_BLOCKS 1021
+#define FS_SINGLE_INDIRECT 1021
+#define FS_DOUBLE_INDIRECT 1022
+#define FS_INDIRECT_ENTRIES 1024
+
+// Compressed images, boot block field pack_magic set to PACK_MAGIC. The inodes are stored
+//  as usual. They are followed by pack_index_blocks blocks holding num_data_block + 1 byte
+//  offsets into the packed area that comes next: data block i is stored in bytes
+//  [offset i, offset i + 1) of it. A block of 0 bytes is all zeros, one of VAL_4096 bytes is
+//  stored as is, anything else is LZ4 compressed. Only used for images in memory.
+#define PACK_MAGIC 0x4b434150
+
+// Directory extension. Dentries past the VAL_63 held by the boot block live in the data of
+//  inode dir_inode, after a hash table of dir_hash_size bucket heads (dentry indices). Every
+//  dentry, including those in the boot block, is chained into the bucket of its name. Images
+//  without DIR_EXT_MAGIC have at most VAL_63 dentries and are searched linearly.
+#define DIR_EXT_MAGIC 0x48534944
+#define DIR_HASH_SIZE 1024
+#define DIR_NO_ENTRY 0xffffffff
+#define DIR_HASH_OFFSET_BASIS 2166136261U
+#define DIR_HASH_PRIME 16777619U
+
+// Subdirectories. A dentry of type DIRECTORY_FILE other than "." of the root points to an
+//  inode whose data is the array of its dentries, in no particular order. Paths name them
+//  with '/' between components, empty components are skipped. Directories are identified
+//  by their inode number, or FS_ROOT_DIR for the root.
+#define FS_ROOT_DIR 0xffffffff
+#define FS_MAX_PATH_LENGTH 128
+// Deeper directories are not reachable, which also stops a cycle on a corrupt image.
+#define FS_MAX_DEPTH 16
+// Slots of the dentry cache, a power of 2.
+#define DCACHE_SIZE 128
+
 // Constants for file types.
 #define RTC_FILE 0
 #define DIRECTORY_FILE 1
@@ -26,14 +73,21 @@ typedef struct dentry {
     uint8_t file_name[VAL_32];
     uint32_t file_type;
     uint32_t inode_idx;
-    uint8_t reserved[VAL_24];
+    uint32_t hash_next;         // next dentry in the same bucket, DIR_NO_ENTRY at the end
+    uint8_t reserved[VAL_20];
 } dentry_t;
 
 typedef struct boot_block {
-    uint32_t num_dentry;
+    uint32_t num_dentry;        // including the dentries of the directory extension
     uint32_t num_inode;
     uint32_t num_data_block;
-    uint8_t reserved[VAL_52];
+    uint32_t dir_magic;         // DIR_EXT_MAGIC if the fields below are valid
+    uint32_t dir_inode;
+    uint32_t dir_hash_size;     // a power of 2
+    uint32_t inode_flags;       // INODE_FLAG_INDIRECT
+    uint32_t pack_magic;        // PACK_MAGIC if data blocks are compressed
+    uint32_t pack_index_blocks;
+    uint8_t reserved[VAL_28];
     dentry_t dentry[VAL_63];
 } boot_block_t;
 
@@ -46,14 +100,77 @@ typedef struct data_block {
     uint8_t data[VAL_4096];
 } data_block_t;
 
+// Record filled in by directory_getdents(), same layout as ece391_dirent_t in
+//  ece391syscall.h. The name follows the header and records are padded to DIRENT_ALIGN.
+#define DIRENT_ALIGN 4
+typedef struct dirent {
+    uint32_t inode;
+    uint32_t size;          // file length in bytes, 0 if not a regular file
+    uint8_t type;           // RTC_FILE, DIRECTORY_FILE or REGULAR_FILE
+    uint8_t name_len;       // not counting the terminating NUL
+    uint16_t rec_len;       // offset of the next record
+    uint8_t name[0];
+} dirent_t;
+
+// File information returned by fstat, same layout as ece391_stat_t in ece391syscall.h.
+#define TERMINAL_FILE 3
+typedef struct stat {
+    uint32_t type;          // RTC_FILE, DIRECTORY_FILE, REGULAR_FILE or TERMINAL_FILE
+    uint32_t size;          // length in bytes, 0 if not a regular file
+    uint32_t blocks;        // number of 4KB data blocks
+    uint32_t inode;
+} stat_t;
+
+// Counters of the dentry cache since the file system was mounted.
+typedef struct dcache_stats {
+    uint32_t hits;
+    uint32_t misses;
+} dcache_stats_t;
+
+// Run of file blocks of inode that sit next to each other on the image, starting at
+//  file block file_block in data block data_block. Kept per open file so that sequential
+//  reads do not walk the indirect blocks again. Only valid while generation matches the
+//  file system, which changes whenever blocks are freed. Empty if count is 0.
+typedef struct block_run {
+    uint32_t inode;
+    uint32_t generation;
+    uint32_t file_block;
+    uint32_t data_block;
+    uint32_t count;
+} block_run_t;
+
 // Three helper routines that actually interacts with file system.
 extern int32_t read_dentry_by_name(const uint8_t* fname, dentry_t* dentry);
 extern int32_t read_dentry_by_index (uint32_t index, dentry_t* dentry);
 extern int32_t read_data (uint32_t inode, uint32_t offset, 
                                 uint8_t* buf, uint32_t length);
+// Same as read_data(), starting from and updating the block run cached in *run.
+extern int32_t read_data_cached(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length,
+                                block_run_t* run);
+
+// Write to a file, growing it as needed. Return number of bytes written or -1.
+extern int32_t write_data(uint32_t inode, uint32_t offset, const uint8_t* buf, uint32_t length);
+// Shrink a file, or grow it with zeros. Return 0 on success, -1 on failure.
+extern int32_t truncate_data(uint32_t inode, uint32_t length);
+// Create an empty regular file or directory, or remove a regular file or an empty
+//  directory. Return 0 on success, -1 on failure.
+extern int32_t file_create(const uint8_t* fname);
+extern int32_t file_mkdir(const uint8_t* fname);
+extern int32_t file_unlink(const uint8_t* fname);
+// Copy the dentry cache counters into stats.
+extern void get_dcache_stats(dcache_stats_t* stats);
+
+// Length in bytes of a file, -1 on failure.
+extern int32_t get_file_length(uint32_t inode);
+// Address of the data block holding byte offset of a file inside the image, 0 on failure
+//  or when the file system is mounted from a disk.
+extern uint32_t get_data_block_address(uint32_t inode, uint32_t offset);
 
 // File system interfaces.
 extern int file_system_init(uint32_t base_address);
+// Use the image on block device dev through the buffer cache. Return 0 on success, -1 if
+//  the device holds no file system.
+extern int32_t file_system_mount(int32_t dev);
 
 // File open/close/read/write
 extern int32_t file_open(const uint8_t *filename);
@@ -66,6 +183,8 @@ extern int32_t directory_open(const uint8_t *filename);
 extern int32_t directory_close(int32_t fd);
 extern int32_t directory_read(int32_t fd, void *buf, int32_t nbytes);
 extern int32_t directory_write(int32_t fd, void *buf, int32_t nbytes);
+// Fill buf with as many dirent_t records as fit. Return bytes filled, 0 at end, -1 on error.
+extern int32_t directory_getdents(int32_t fd, void *buf, int32_t nbytes);
 
 // Check if an executable exists and has correct magic number.
 // Return value: 0 not exist or magic number is not correct.
@@ -0,0 +1,344 @@
+#include "fpu.h"
+#include "lib.h"
+#include "process.h"
+
+#define CR0_MP 0x2
+#define CR0_EM 0x4
+#define CR0_TS 0x8
+#define CR0_NE 0x20
+#define CR4_OSFXSR 0x200
+#define CR4_OSXMMEXCPT 0x400
+
+#define CPUID_FEATURES 1
+#define CPUID_FXSR (1 << 24)
+#define CPUID_SSE (1 << 25)
+#define CPUID_SSE2 (1 << 26)
+
+// All SIMD floating-point exceptions masked, round to nearest.
+#define MXCSR_DEFAULT 0x1f80
+
+// Stores of movntdq are 16-byte aligned, the loops move 64 bytes per round.
+#define STREAM_ALIGN 16
+#define STREAM_BLOCK 64
+
+// Whether fxsave/fxrstor and SSE are enabled, and SSE2 on top of them.
+static int32_t fpu_enabled = 0;
+static int32_t sse2_enabled = 0;
+// Process whose state is in the FPU registers, FPU_NO_OWNER if none.
+static int32_t fpu_owner = FPU_NO_OWNER;
+// Nonzero while the kernel holds the SSE registers.
+static int32_t kernel_fpu_depth = 0;
+// State right after fninit, loaded for a process on its first FPU instruction.
+static fpu_state_t fpu_initial_state;
+
+// Clear and set CR0.TS.
+static inline void clts() {
+    asm volatile("clts" : : : "memory");
+}
+
+static inline void stts() {
+    uint32_t cr0;
+    asm volatile("movl %%cr0, %0" : "=r"(cr0));
+    asm volatile("movl %0, %%cr0" : : "r"(cr0 | CR0_TS) : "memory");
+}
+
+static inline void fxsave(fpu_state_t *state) {
+    asm volatile("fxsave %0" : "=m"(*state));
+}
+
+static inline void fxrstor(const fpu_state_t *state) {
+    asm volatile("fxrstor %0" : : "m"(*state));
+}
+
+/*
+ *   fpu_init
+ *   DESCRIPTION: Enable the FPU with native error reporting and SSE with fxsave/fxrstor,
+ *                and record the initial state given to every process. Without fxsave
+ *                or SSE, CR0.EM is set and FPU instructions keep raising #NM.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies CR0 and CR4, CR0.TS is left set
+ */
+void fpu_init() {
+    uint32_t eax, ebx, ecx, edx, cr0, cr4;
+    uint32_t mxcsr = MXCSR_DEFAULT;
+
+    cpuid(CPUID_FEATURES, 0, &eax, &ebx, &ecx, &edx);
+
+    asm volatile("movl %%cr0, %0" : "=r"(cr0));
+    if((edx & (CPUID_FXSR | CPUID_SSE)) != (CPUID_FXSR | CPUID_SSE)) {
+        asm volatile("movl %0, %%cr0" : : "r"(cr0 | CR0_EM) : "memory");
+        return;
+    }
+    cr0 = (cr0 & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE;
+    asm volatile("movl %0, %%cr0" : : "r"(cr0) : "memory");
+
+    asm volatile("movl %%cr4, %0" : "=r"(cr4));
+    asm volatile("movl %0, %%cr4" : : "r"(cr4 | CR4_OSFXSR | CR4_OSXMMEXCPT) : "memory");
+
+    asm volatile("fninit");
+    asm volatile("ldmxcsr %0" : : "m"(mxcsr));
+    fxsave(&fpu_initial_state);
+
+    fpu_enabled = 1;
+    sse2_enabled = (edx & CPUID_SSE2) != 0;
+    fpu_owner = FPU_NO_OWNER;
+    stts();
+}
+
+/*
+ *   fpu_has_sse2
+ *   DESCRIPTION: Check whether the kernel may use SSE2 instructions.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if SSE2 is enabled, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t fpu_has_sse2() {
+    return sse2_enabled;
+}
+
+/*
+ *   fpu_handle_nm
+ *   DESCRIPTION: Device not available handler. CR0.TS is set whenever a process other
+ *                than the owner of the FPU registers runs, so its first FPU or SSE
+ *                instruction lands here. The registers of the owner are saved to its
+ *                PCB and those of the current process loaded, fresh ones on its first use.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if there is no FPU or no process to give it to
+ *   SIDE EFFECTS: clears CR0.TS, the current process owns the FPU
+ */
+int32_t fpu_handle_nm() {
+    uint32_t flags;
+
+    if(!fpu_enabled || get_process_count() == 0)
+        return -1;
+
+    cli_and_save(flags);
+    pcb_t *pcb = get_current_pcb();
+    clts();
+    if(fpu_owner != pcb->pid) {
+        if(fpu_owner != FPU_NO_OWNER)
+            fxsave(&get_pcb(fpu_owner)->fpu_state);
+        fxrstor(pcb->fpu_used ? &pcb->fpu_state : &fpu_initial_state);
+        pcb->fpu_used = 1;
+        fpu_owner = pcb->pid;
+    }
+    restore_flags(flags);
+
+    return 0;
+}
+
+/*
+ *   fpu_switch
+ *   DESCRIPTION: Prepare the FPU for a process that is about to run. Its registers are
+ *                only loaded when it uses them, until then CR0.TS traps FPU instructions.
+ *   INPUTS: pid -- process that is about to run
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies CR0.TS
+ */
+void fpu_switch(uint32_t pid) {
+    if(!fpu_enabled)
+        return;
+    if(fpu_owner == pid)
+        clts();
+    else
+        stts();
+}
+
+/*
+ *   fpu_release
+ *   DESCRIPTION: Drop the FPU state of a process that halts, so that its registers are
+ *                not saved into the PCB of whoever gets its pid next.
+ *   INPUTS: pid -- halting process
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void fpu_release(uint32_t pid) {
+    if(fpu_owner == pid)
+        fpu_owner = FPU_NO_OWNER;
+}
+
+/*
+ *   kernel_fpu_begin
+ *   DESCRIPTION: Take the SSE registers for kernel code, with interrupts off until
+ *                kernel_fpu_end(). The state of their owner is saved, it gets reloaded
+ *                on its next FPU instruction.
+ *   INPUTS: flags -- where to store the flags for kernel_fpu_end()
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 without SSE2 or if the kernel already holds the
+ *                 registers, e.g. in a page fault taken in between
+ *   SIDE EFFECTS: disables interrupts, clears CR0.TS
+ */
+int32_t kernel_fpu_begin(uint32_t *flags) {
+    if(!sse2_enabled || kernel_fpu_depth > 0)
+        return -1;
+
+    cli_and_save(*flags);
+    clts();
+    if(fpu_owner != FPU_NO_OWNER) {
+        fxsave(&get_pcb(fpu_owner)->fpu_state);
+        fpu_owner = FPU_NO_OWNER;
+    }
+    kernel_fpu_depth++;
+    return 0;
+}
+
+/*
+ *   kernel_fpu_end
+ *   DESCRIPTION: Give back the SSE registers taken by kernel_fpu_begin().
+ *   INPUTS: flags -- as stored by kernel_fpu_begin()
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets CR0.TS, restores the interrupt flag
+ */
+void kernel_fpu_end(uint32_t flags) {
+    kernel_fpu_depth--;
+    stts();
+    restore_flags(flags);
+}
+
+/*
+ *   kernel_fpu_abort
+ *   DESCRIPTION: Give back the SSE registers of a kernel_fpu_begin() that never reaches
+ *                kernel_fpu_end(), because a fault in between halts the process, e.g. a
+ *                streaming copy into a bad user buffer. Nothing else can hold them then,
+ *                as interrupts stay off for the whole bracket.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets CR0.TS if the registers were held
+ */
+void kernel_fpu_abort() {
+    if(kernel_fpu_depth == 0)
+        return;
+    kernel_fpu_depth = 0;
+    stts();
+}
+
+// Copy n bytes, a multiple of STREAM_BLOCK, to a STREAM_ALIGN aligned dest.
+static void stream_copy_blocks(uint8_t *dest, const uint8_t *src, uint32_t n) {
+    asm volatile ("                         \n\
+            1:                              \n\
+            movdqu  (%%esi), %%xmm0         \n\
+            movdqu  16(%%esi), %%xmm1       \n\
+            movdqu  32(%%esi), %%xmm2       \n\
+            movdqu  48(%%esi), %%xmm3       \n\
+            movntdq %%xmm0, (%%edi)         \n\
+            movntdq %%xmm1, 16(%%edi)       \n\
+            movntdq %%xmm2, 32(%%edi)       \n\
+            movntdq %%xmm3, 48(%%edi)       \n\
+            addl    $64, %%esi              \n\
+            addl    $64, %%edi              \n\
+            subl    $64, %%ecx              \n\
+            jnz     1b                      \n\
+            sfence                          \n\
+            "
+            : "+S"(src), "+D"(dest), "+c"(n)
+            :
+            : "memory", "cc"
+    );
+}
+
+// Clear n bytes, a multiple of STREAM_BLOCK, at a STREAM_ALIGN aligned s.
+static void stream_clear_blocks(uint8_t *s, uint32_t n) {
+    asm volatile ("                         \n\
+            pxor    %%xmm0, %%xmm0          \n\
+            1:                              \n\
+            movntdq %%xmm0, (%%edi)         \n\
+            movntdq %%xmm0, 16(%%edi)       \n\
+            movntdq %%xmm0, 32(%%edi)       \n\
+            movntdq %%xmm0, 48(%%edi)       \n\
+            addl    $64, %%edi              \n\
+            subl    $64, %%ecx              \n\
+            jnz     1b                      \n\
+            sfence                          \n\
+            "
+            : "+D"(s), "+c"(n)
+            :
+            : "memory", "cc"
+    );
+}
+
+// Bytes to skip from p to the next STREAM_ALIGN boundary, at most n.
+static uint32_t stream_head(const void *p, uint32_t n) {
+    uint32_t head = (STREAM_ALIGN - ((uint32_t)p & (STREAM_ALIGN - 1))) & (STREAM_ALIGN - 1);
+    return head < n ? head : n;
+}
+
+/*
+ *   memcpy_stream
+ *   DESCRIPTION: Copy memory with non-temporal stores, for large copies whose destination
+ *                is not read again soon, e.g. video memory and program images. The
+ *                unaligned head and tail are copied with memcpy().
+ *   INPUTS: dest -- destination of copy
+ *           src -- source of copy
+ *           n -- number of bytes to copy
+ *   OUTPUTS: none
+ *   RETURN VALUE: dest
+ *   SIDE EFFECTS: may save the FPU state of a process
+ */
+void* memcpy_stream(void* dest, const void* src, uint32_t n) {
+    uint32_t flags;
+
+    if(n < STREAM_COPY_MIN)
+        return memcpy(dest, src, n);
+
+    uint8_t *d = (uint8_t *)dest;
+    const uint8_t *s = (const uint8_t *)src;
+    uint32_t head = stream_head(d, n);
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    while(n >= STREAM_BLOCK && kernel_fpu_begin(&flags) == 0) {
+        uint32_t chunk = (n < KERNEL_FPU_CHUNK ? n : KERNEL_FPU_CHUNK) & ~(STREAM_BLOCK - 1);
+        stream_copy_blocks(d, s, chunk);
+        kernel_fpu_end(flags);
+        d += chunk;
+        s += chunk;
+        n -= chunk;
+    }
+    memcpy(d, s, n);
+
+    return dest;
+}
+
+/*
+ *   memclear_stream
+ *   DESCRIPTION: Zero memory with non-temporal stores, e.g. fresh page frames. The
+ *                unaligned head and tail are cleared with memset().
+ *   INPUTS: s -- memory to clear
+ *           n -- number of bytes to clear
+ *   OUTPUTS: none
+ *   RETURN VALUE: s
+ *   SIDE EFFECTS: may save the FPU state of a process
+ */
+void* memclear_stream(void* s, uint32_t n) {
+    uint32_t flags;
+
+    if(n < STREAM_COPY_MIN)
+        return memset(s, 0, n);
+
+    uint8_t *d = (uint8_t *)s;
+    uint32_t head = stream_head(d, n);
+    memset(d, 0, head);
+    d += head;
+    n -= head;
+
+    while(n >= STREAM_BLOCK && kernel_fpu_begin(&flags) == 0) {
+        uint32_t chunk = (n < KERNEL_FPU_CHUNK ? n : KERNEL_FPU_CHUNK) & ~(STREAM_BLOCK - 1);
+        stream_clear_blocks(d, chunk);
+        kernel_fpu_end(flags);
+        d += chunk;
+        n -= chunk;
+    }
+    memset(d, 0, n);
+
+    return s;
+}
@@ -0,0 +1,51 @@
+#ifndef _FPU_H
+#define _FPU_H
+
+#include "types.h"
+
+// Size of the area written by fxsave, which has to be 16-byte aligned.
+#define FXSAVE_SIZE 512
+#define FXSAVE_ALIGN 16
+// No process has its state in the FPU registers.
+#define FPU_NO_OWNER -1
+// Copies and clears shorter than this are not worth the streaming stores.
+#define STREAM_COPY_MIN 4096
+// Kernel code moves at most this many bytes between kernel_fpu_begin() and
+//  kernel_fpu_end(), so that interrupts are not held off for long.
+#define KERNEL_FPU_CHUNK 0x10000
+
+#ifndef ASM
+
+// FPU, MMX and SSE registers of a process as saved by fxsave.
+typedef struct fpu_state {
+    uint8_t data[FXSAVE_SIZE];
+} __attribute__((aligned(FXSAVE_ALIGN))) fpu_state_t;
+
+// Turn on the FPU and SSE if the processor has them, with CR0.TS set.
+extern void fpu_init();
+// Return 1 if SSE2 is usable by the kernel, 0 otherwise.
+extern int32_t fpu_has_sse2();
+
+// Device not available exception. Hand the FPU to the current process, saving the state
+//  of the process that used it last. Return 0, or -1 if there is no FPU to hand out.
+extern int32_t fpu_handle_nm();
+// Called whenever pid is about to run, sets CR0.TS unless pid owns the FPU.
+extern void fpu_switch(uint32_t pid);
+// Forget the FPU state of a halted process.
+extern void fpu_release(uint32_t pid);
+
+// Take the SSE registers for kernel code, with interrupts off until kernel_fpu_end().
+//  Return 0, or -1 if they cannot be used and integer code has to do the work.
+extern int32_t kernel_fpu_begin(uint32_t *flags);
+extern void kernel_fpu_end(uint32_t flags);
+// Drop the registers of a bracket cut short by halting the process in a fault.
+extern void kernel_fpu_abort();
+
+// Copy or clear n bytes with SSE2 non-temporal stores that bypass the cache. Falls back to
+//  memcpy() and memset() without SSE2. The areas must not overlap.
+extern void* memcpy_stream(void* dest, const void* src, uint32_t n);
+extern void* memclear_stream(void* s, uint32_t n);
+
+#endif
+
+#endif
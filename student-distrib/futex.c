@@ -0,0 +1,131 @@
+#include "futex.h"
+#include "memory.h"
+#include "process.h"
+#include "lib.h"
+
+#define VAL_2 2
+#define VAL_12 12
+#define WORD_ALIGN_MASK 0x3
+
+/*
+    A process blocked in futex_wait(). The node lives on the waiter's own kernel
+    stack, which stays mapped in every address space while it sleeps.
+        key - physical address of the futex word, so that processes sharing a
+              page wait on the same queue no matter where it is mapped
+        pid - the waiting process
+        woken - set by futex_wake() once the node is taken off the queue
+*/
+typedef struct futex_waiter {
+    uint32_t key;
+    uint32_t pid;
+    volatile int32_t woken;
+    struct futex_waiter *next;
+} futex_waiter_t;
+
+// Hashed wait queues, each a FIFO singly linked list.
+static futex_waiter_t *futex_queue[FUTEX_HASH_SIZE];
+
+// Map a futex key to its wait queue.
+static uint32_t futex_hash(uint32_t key) {
+    return ((key >> VAL_2) ^ (key >> VAL_12)) & (FUTEX_HASH_SIZE - 1);
+}
+
+// Translate a user futex word into its key, 0 if addr is not usable.
+static uint32_t futex_key(uint32_t *addr) {
+    uint32_t pid = get_current_pcb()->pid;
+
+    // Also gives a reserved page its frame, so the key stays the same afterwards.
+    if(((uint32_t)addr & WORD_ALIGN_MASK) || !is_user_range_mapped(pid, addr, sizeof(uint32_t)))
+        return 0;
+    return user_virt_to_phys(pid, (uint32_t)addr);
+}
+
+/*
+ *   futex_init
+ *   DESCRIPTION: reset all futex wait queues
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void futex_init() {
+    int32_t i;
+    for(i = 0; i < FUTEX_HASH_SIZE; ++i)
+        futex_queue[i] = NULL;
+}
+
+/*
+ *   futex_wait
+ *   DESCRIPTION: atomically check that *addr == val and go to sleep on addr
+ *   INPUTS: addr -- user futex word, 4-byte aligned
+ *           val -- value the caller last saw in *addr
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 when woken up, -1 if *addr != val or addr is invalid
+ *   SIDE EFFECTS: blocks the current process
+ */
+int32_t futex_wait(uint32_t *addr, uint32_t val) {
+    futex_waiter_t waiter;
+    futex_waiter_t **tail;
+
+    uint32_t key = futex_key(addr);
+    if(key == 0)
+        return -1;
+
+    // Nobody can run futex_wake() between the check and going to sleep.
+    cli();
+    if(*addr != val) {
+        sti();
+        return -1;
+    }
+
+    waiter.key = key;
+    waiter.pid = get_current_pcb()->pid;
+    waiter.woken = 0;
+    waiter.next = NULL;
+    for(tail = &futex_queue[futex_hash(key)]; *tail != NULL; tail = &(*tail)->next);
+    *tail = &waiter;
+
+    while(!waiter.woken) {
+        sleep_current_process();
+        cli();
+    }
+    sti();
+
+    return 0;
+}
+
+/*
+ *   futex_wake
+ *   DESCRIPTION: wake up processes waiting on addr, oldest first
+ *   INPUTS: addr -- user futex word
+ *           n -- maximum number of processes to wake
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of processes woken, -1 if addr is invalid
+ *   SIDE EFFECTS: none
+ */
+int32_t futex_wake(uint32_t *addr, int32_t n) {
+    uint32_t flags;
+    futex_waiter_t **curr;
+    int32_t count = 0;
+
+    uint32_t key = futex_key(addr);
+    if(key == 0)
+        return -1;
+
+    cli_and_save(flags);
+    curr = &futex_queue[futex_hash(key)];
+    while(*curr != NULL && count < n) {
+        futex_waiter_t *waiter = *curr;
+        if(waiter->key != key) {
+            curr = &waiter->next;
+            continue;
+        }
+        *curr = waiter->next;
+        waiter->woken = 1;
+        wake_process(waiter->pid);
+        count++;
+    }
+    restore_flags(flags);
+
+    return count;
+}
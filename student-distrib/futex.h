@@ -0,0 +1,23 @@
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+#include "types.h"
+
+// Number of hash buckets for futex wait queues, must be a power of 2.
+#define FUTEX_HASH_SIZE 16
+
+#ifndef ASM
+
+// Reset all futex wait queues.
+extern void futex_init();
+
+// Block the current process if *addr still equals val, until futex_wake() on the same word.
+//  Return 0 when woken up, -1 if the value did not match or addr is invalid.
+extern int32_t futex_wait(uint32_t *addr, uint32_t val);
+
+// Wake up to n processes waiting on addr. Return number of processes woken, -1 on error.
+extern int32_t futex_wake(uint32_t *addr, int32_t n);
+
+#endif
+
+#endif
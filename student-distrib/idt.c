@@ -2,10 +2,14 @@
 #include "lib.h"
 #include "interrupt_linkage.h"
 #include "syscall.h"
+#include "process.h"
+#include "memory.h"
+#include "fpu.h"
 
 #define SYSCALL_VEC_NUM 0x80
 
-#define HALT_STATUS_ON_EXCEPTION 256
+// Page fault error code bit, set when the fault is a protection violation on a present page.
+#define PF_ERROR_PRESENT 0x1
 
 // Jump table for all interrupt hanlders. Last one is default handler.
 void (*interrupt_handler[NUM_VEC + 1])();
@@ -26,7 +30,6 @@ exception(exc_bp,"Breakpoint Exception");
 exception(exc_of,"Overflow Exception");
 exception(exc_br,"BOUND Range Exceeded Exception");
 exception(exc_ud,"Invalid Opcode Exception");
-exception(exc_nm,"Device Not Available Exception");
 exception(exc_df,"Double Fault Exception");
 exception(exc_cso,"Coprocessor Segment Overrun");
 exception(exc_ts,"Invalid TSS Exception");
@@ -34,18 +37,51 @@ exception(exc_np,"Segment Not Present");
 exception(exc_ss,"Stack Full Exception");
 exception(exc_gp,"General Protection Exception");
 
-void exc_pf() {
+/*
+ *   exc_pf
+ *   DESCRIPTION: page fault handler. A fault on a page reserved by mmap is resolved
+ *                by giving it a zero-filled frame, any other fault halts the process.
+ *   INPUTS: error_code -- error code pushed by the processor
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may map a page into the current process
+ */
+void exc_pf(uint32_t error_code) {
     cli();
     uint32_t address;
     asm volatile("movl %%cr2, %0" \
                  :"=r"(address)   \
                  :                \
                  :"memory");
+    // Returning retries the faulting instruction, iret restores the interrupt flag.
+    if(!(error_code & PF_ERROR_PRESENT) && get_process_count() > 0 &&
+       handle_user_page_fault(get_current_pcb()->pid, address) == 0)
+        return;
     printf("Page-Fault Exception. Address accessed: 0x%#x\n", address);
     sti();
     halt_current_process(HALT_STATUS_ON_EXCEPTION);
 }
 
+/*
+ *   exc_nm
+ *   DESCRIPTION: device not available handler. CR0.TS makes the first FPU or SSE
+ *                instruction after a process switch land here, the state of the
+ *                process is loaded and the instruction retried. Without an FPU the
+ *                process is halted.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may switch the FPU registers to the current process
+ */
+void exc_nm() {
+    if(fpu_handle_nm() == 0)
+        return;
+    cli();
+    printf("%s\n", "Device Not Available Exception");
+    sti();
+    halt_current_process(HALT_STATUS_ON_EXCEPTION);
+}
+
 exception(exc_15,"INT 15 Handler!"); // Not exist in Intel manual.
 exception(exc_mf,"x87 FPU Floating_Point Error");
 exception(exc_ac,"Alignment Check Exception");
@@ -144,5 +180,10 @@ void idt_init(){
     SET_IDT_ENTRY(idt[PIT_VEC_NUM],ir_linkage_32);
     SET_IDT_ENTRY(idt[KEYBOARD_VEC_NUM],ir_linkage_33);
     SET_IDT_ENTRY(idt[RTC_VEC_NUM],ir_linkage_40);
+    SET_IDT_ENTRY(idt[ATA_VEC_NUM],ir_linkage_46);
+    SET_IDT_ENTRY(idt[IRQ_VEC_BASE + PCI_IRQ_5],ir_linkage_37);
+    SET_IDT_ENTRY(idt[IRQ_VEC_BASE + PCI_IRQ_9],ir_linkage_41);
+    SET_IDT_ENTRY(idt[IRQ_VEC_BASE + PCI_IRQ_10],ir_linkage_42);
+    SET_IDT_ENTRY(idt[IRQ_VEC_BASE + PCI_IRQ_11],ir_linkage_43);
     SET_IDT_ENTRY(idt[SYSCALL_VEC_NUM],syscall_linkage);
 }
@@ -6,6 +6,18 @@
 #define PIT_VEC_NUM 0x20
 #define KEYBOARD_VEC_NUM 0x21
 #define RTC_VEC_NUM 0x28
+#define ATA_VEC_NUM 0x2E
+
+// IRQ n is delivered on vector IRQ_VEC_BASE + n. The PCI interrupt pins are routed
+//  to one of IRQ 5, 9, 10 or 11, which have their own linkage for PCI drivers.
+#define IRQ_VEC_BASE 0x20
+#define PCI_IRQ_5 5
+#define PCI_IRQ_9 9
+#define PCI_IRQ_10 10
+#define PCI_IRQ_11 11
+
+// Status a process halted by an exception returns to its parent.
+#define HALT_STATUS_ON_EXCEPTION 256
 
 #ifndef ASM
 
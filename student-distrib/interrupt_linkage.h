@@ -25,7 +25,12 @@ extern void ir_linkage_18();
 extern void ir_linkage_19();
 extern void ir_linkage_32();
 extern void ir_linkage_33();
+extern void ir_linkage_37();
 extern void ir_linkage_40();
+extern void ir_linkage_41();
+extern void ir_linkage_42();
+extern void ir_linkage_43();
+extern void ir_linkage_46();
 extern void syscall_linkage();
 extern void ir_linkage_default();
 
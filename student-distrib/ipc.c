@@ -0,0 +1,371 @@
+#include "ipc.h"
+#include "process.h"
+#include "lib.h"
+
+// Ways a staged payload is held by the kernel.
+#define IPC_MODE_SHORT 0    // copied into short_buf
+#define IPC_MODE_COPY 1     // copied into frames allocated for the message
+#define IPC_MODE_PAGES 2    // frames unmapped from the sender, will be mapped to the receiver
+
+/*
+    Per-process IPC state.
+        state - one of IPC_IDLE, IPC_SEND_BLOCKED, IPC_REPLY_BLOCKED, IPC_RECEIVE_BLOCKED
+        partner - pid of the process we are sending to
+        seq - send order, so that a receiver serves its senders first come first served
+        result - reply length (or -1) handed back to a blocked sender
+        mode, len, frames, num_frames, short_buf - the staged payload
+        orig_buf - where moved pages came from, so they can be given back on failure
+*/
+typedef struct ipc_state {
+    int32_t state;
+    int32_t partner;
+    uint32_t seq;
+    int32_t result;
+    int32_t mode;
+    uint32_t len;
+    uint32_t frames[IPC_MAX_PAGES];
+    uint32_t num_frames;
+    uint32_t orig_buf;
+    uint8_t short_buf[IPC_SHORT_MSG_SIZE];
+} ipc_state_t;
+
+static ipc_state_t ipc_state[MAX_PROCESS_NUMBER];
+static uint32_t ipc_seq;
+
+/*
+ *   ipc_init
+ *   DESCRIPTION: reset IPC state of all processes
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void ipc_init() {
+    int32_t i;
+    for(i = 0; i < MAX_PROCESS_NUMBER; ++i) {
+        ipc_state[i].state = IPC_IDLE;
+        ipc_state[i].partner = -1;
+        ipc_state[i].num_frames = 0;
+    }
+    ipc_seq = 0;
+}
+
+/*
+ *   ipc_stage
+ *   DESCRIPTION: take a message out of the current process's address space and hold
+ *                it in slot until some other process delivers it into its own.
+ *   INPUTS: slot -- where to stage the payload
+ *           msg -- user message descriptor in current address space
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: with IPC_FLAG_PAGES the pages are unmapped from the current process
+ */
+static int32_t ipc_stage(ipc_state_t *slot, const ipc_msg_t *msg) {
+    uint32_t pid = get_current_pcb()->pid;
+    uint32_t i, offset, chunk;
+
+    slot->num_frames = 0;
+    slot->len = 0;
+    slot->mode = IPC_MODE_SHORT;
+
+    if(msg == NULL)
+        return 0;
+    if(msg->len < 0 || msg->len > IPC_MAX_MSG_SIZE)
+        return -1;
+    if(msg->len > 0 && !is_user_range_mapped(pid, msg->buf, msg->len))
+        return -1;
+
+    uint32_t buf = (uint32_t)msg->buf;
+    uint32_t num_pages = (msg->len + PAGE_SIZE - 1) / PAGE_SIZE;
+    slot->len = msg->len;
+
+    // Fast path for small messages.
+    if(msg->len <= IPC_SHORT_MSG_SIZE) {
+        memcpy(slot->short_buf, msg->buf, msg->len);
+        return 0;
+    }
+
+    // Page-aligned payload living in pool-owned 4KB pages can change hands by remapping.
+    if((msg->flags & IPC_FLAG_PAGES) && !(buf & ~PAGE_MASK)) {
+        for(i = 0; i < num_pages; ++i) {
+            if(!is_user_page_owned(pid, buf + i * PAGE_SIZE))
+                break;
+        }
+        if(i == num_pages) {
+            for(i = 0; i < num_pages; ++i)
+                slot->frames[i] = unmap_user_page(pid, buf + i * PAGE_SIZE);
+            slot->num_frames = num_pages;
+            slot->orig_buf = buf;
+            slot->mode = IPC_MODE_PAGES;
+            return 0;
+        }
+    }
+
+    // Otherwise copy into frames held by the kernel.
+    for(i = 0, offset = 0; i < num_pages; ++i, offset += chunk) {
+        slot->frames[i] = alloc_page_frame();
+        if(slot->frames[i] == 0) {
+            while(i > 0)
+                free_page_frame(slot->frames[--i]);
+            return -1;
+        }
+        chunk = msg->len - offset < PAGE_SIZE ? msg->len - offset : PAGE_SIZE;
+        memcpy((void *)slot->frames[i], (uint8_t *)msg->buf + offset, chunk);
+    }
+    slot->num_frames = num_pages;
+    slot->mode = IPC_MODE_COPY;
+
+    return 0;
+}
+
+/*
+ *   ipc_discard
+ *   DESCRIPTION: drop a staged payload that will never be delivered. Moved pages
+ *                are mapped back to where they came from in process owner.
+ *   INPUTS: slot -- staged payload
+ *           owner -- process the payload was taken from
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void ipc_discard(ipc_state_t *slot, uint32_t owner) {
+    uint32_t i;
+    for(i = 0; i < slot->num_frames; ++i) {
+        if(slot->mode == IPC_MODE_PAGES
+                && map_user_page(owner, slot->orig_buf + i * PAGE_SIZE, slot->frames[i], 1, 1) == 0)
+            continue;
+        free_page_frame(slot->frames[i]);
+    }
+    slot->num_frames = 0;
+}
+
+/*
+ *   ipc_deliver
+ *   DESCRIPTION: move a staged payload into the current process's address space.
+ *   INPUTS: slot -- staged payload
+ *           msg -- user message descriptor. buf/len give the destination buffer and
+ *                  its capacity, and are updated to describe what was received.
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes delivered, -1 on failure
+ *   SIDE EFFECTS: frames of the payload are either mapped or freed
+ */
+static int32_t ipc_deliver(ipc_state_t *slot, ipc_msg_t *msg) {
+    uint32_t pid = get_current_pcb()->pid;
+    uint32_t i, offset, chunk;
+
+    // Caller is not interested in the payload, just drop it.
+    if(msg == NULL) {
+        for(i = 0; i < slot->num_frames; ++i)
+            free_page_frame(slot->frames[i]);
+        slot->num_frames = 0;
+        return 0;
+    }
+
+    // Moved pages are mapped at a fresh address, ignoring the receive buffer.
+    if(slot->mode == IPC_MODE_PAGES) {
+        uint32_t virt = find_free_user_range(pid, slot->num_frames);
+        for(i = 0; virt != 0 && i < slot->num_frames; ++i) {
+            if(map_user_page(pid, virt + i * PAGE_SIZE, slot->frames[i], 1, 1) != 0)
+                break;
+        }
+        if(virt == 0 || i < slot->num_frames) {
+            while(virt != 0 && i > 0)
+                (void) unmap_user_page(pid, virt + --i * PAGE_SIZE);
+            for(i = 0; i < slot->num_frames; ++i)
+                free_page_frame(slot->frames[i]);
+            slot->num_frames = 0;
+            return -1;
+        }
+        slot->num_frames = 0;
+        msg->buf = (void *)virt;
+        msg->len = slot->len;
+        msg->flags = IPC_FLAG_PAGES;
+        return slot->len;
+    }
+
+    uint32_t len = slot->len;
+    if(msg->len < 0 || !is_user_range_mapped(pid, msg->buf, msg->len))
+        len = 0;
+    else if(len > msg->len)
+        len = msg->len;
+
+    if(slot->mode == IPC_MODE_SHORT) {
+        memcpy(msg->buf, slot->short_buf, len);
+    }
+    else {
+        for(i = 0, offset = 0; i < slot->num_frames; ++i, offset += chunk) {
+            chunk = len > offset ? len - offset : 0;
+            if(chunk > PAGE_SIZE)
+                chunk = PAGE_SIZE;
+            memcpy((uint8_t *)msg->buf + offset, (void *)slot->frames[i], chunk);
+            free_page_frame(slot->frames[i]);
+        }
+        slot->num_frames = 0;
+    }
+
+    msg->len = len;
+    msg->flags = 0;
+    return len;
+}
+
+/*
+ *   ipc_send
+ *   DESCRIPTION: synchronously send a message to process pid and wait for its reply.
+ *                If the receiver is already waiting, the CPU is handed to it directly.
+ *   INPUTS: pid -- receiver
+ *           msg -- message to send
+ *           reply -- where to store the reply, may be NULL
+ *   OUTPUTS: none
+ *   RETURN VALUE: length of the reply, -1 on failure
+ *   SIDE EFFECTS: blocks the current process
+ */
+int32_t ipc_send(int32_t pid, ipc_msg_t *msg, ipc_msg_t *reply) {
+    pcb_t *pcb = get_current_pcb();
+    ipc_state_t *self = &ipc_state[pcb->pid];
+
+    if(pid < 0 || pid >= MAX_PROCESS_NUMBER || pid == pcb->pid || !process_exist[pid])
+        return -1;
+
+    if(ipc_stage(self, msg) != 0)
+        return -1;
+
+    cli();
+    self->state = IPC_SEND_BLOCKED;
+    self->partner = pid;
+    self->seq = ipc_seq++;
+    self->result = -1;
+
+    int32_t handoff = -1;
+    if(ipc_state[pid].state == IPC_RECEIVE_BLOCKED) {
+        wake_process(pid);
+        handoff = pid;
+    }
+
+    // Wait until the receiver has replied (or gone away).
+    while(self->state != IPC_IDLE) {
+        sleep_and_switch_to(handoff);
+        handoff = -1;
+        cli();
+    }
+    sti();
+
+    if(self->result < 0)
+        return -1;
+
+    return ipc_deliver(self, reply);
+}
+
+/*
+ *   ipc_receive
+ *   DESCRIPTION: wait for a message from any process. The sender stays blocked
+ *                until ipc_reply() is called on it.
+ *   INPUTS: msg -- receive buffer descriptor, updated with what was received
+ *   OUTPUTS: none
+ *   RETURN VALUE: sender pid, -1 on failure
+ *   SIDE EFFECTS: may block the current process
+ */
+int32_t ipc_receive(ipc_msg_t *msg) {
+    pcb_t *pcb = get_current_pcb();
+    ipc_state_t *self = &ipc_state[pcb->pid];
+    int32_t i, sender;
+
+    cli();
+    while(1) {
+        // Serve the sender that has been waiting the longest.
+        sender = -1;
+        for(i = 0; i < MAX_PROCESS_NUMBER; ++i) {
+            if(ipc_state[i].state == IPC_SEND_BLOCKED && ipc_state[i].partner == pcb->pid
+                    && (sender == -1 || ipc_state[i].seq < ipc_state[sender].seq))
+                sender = i;
+        }
+        if(sender != -1)
+            break;
+
+        self->state = IPC_RECEIVE_BLOCKED;
+        sleep_current_process();
+        cli();
+    }
+    self->state = IPC_IDLE;
+    ipc_state[sender].state = IPC_REPLY_BLOCKED;
+    sti();
+
+    if(ipc_deliver(&ipc_state[sender], msg) < 0) {
+        // Nothing can be done with the message, let the sender know.
+        cli();
+        ipc_state[sender].state = IPC_IDLE;
+        wake_process(sender);
+        sti();
+        return -1;
+    }
+
+    return sender;
+}
+
+/*
+ *   ipc_reply
+ *   DESCRIPTION: reply to a sender whose message we have received and switch
+ *                to it right away.
+ *   INPUTS: pid -- sender to reply to
+ *           reply -- reply message
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+int32_t ipc_reply(int32_t pid, ipc_msg_t *reply) {
+    pcb_t *pcb = get_current_pcb();
+
+    if(pid < 0 || pid >= MAX_PROCESS_NUMBER)
+        return -1;
+
+    ipc_state_t *sender = &ipc_state[pid];
+    if(sender->state != IPC_REPLY_BLOCKED || sender->partner != pcb->pid)
+        return -1;
+
+    int32_t ret = ipc_stage(sender, reply);
+
+    cli();
+    sender->result = ret == 0 ? (int32_t)sender->len : -1;
+    sender->partner = pcb->pid;
+    sender->state = IPC_IDLE;
+    wake_process(pid);
+    // Direct handoff, we stay runnable and get the CPU back from the scheduler.
+    switch_process(pid);
+    sti();
+
+    return ret;
+}
+
+/*
+ *   ipc_release
+ *   DESCRIPTION: clean up IPC state of a halting process and fail every process
+ *                blocked sending to it.
+ *   INPUTS: pid -- halting process
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void ipc_release(uint32_t pid) {
+    uint32_t flags;
+    int32_t i;
+
+    if(pid >= MAX_PROCESS_NUMBER)
+        return;
+
+    cli_and_save(flags);
+    for(i = 0; i < MAX_PROCESS_NUMBER; ++i) {
+        if(ipc_state[i].state != IPC_SEND_BLOCKED && ipc_state[i].state != IPC_REPLY_BLOCKED)
+            continue;
+        if(ipc_state[i].partner != pid)
+            continue;
+        if(ipc_state[i].state == IPC_SEND_BLOCKED)
+            ipc_discard(&ipc_state[i], i);
+        ipc_state[i].result = -1;
+        ipc_state[i].state = IPC_IDLE;
+        wake_process(i);
+    }
+
+    ipc_discard(&ipc_state[pid], pid);
+    ipc_state[pid].state = IPC_IDLE;
+    ipc_state[pid].partner = -1;
+    restore_flags(flags);
+}
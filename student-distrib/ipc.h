@@ -0,0 +1,50 @@
+#ifndef _IPC_H_
+#define _IPC_H_
+
+#include "types.h"
+#include "memory.h"
+
+// Messages up to this size are copied through a short buffer in the kernel.
+#define IPC_SHORT_MSG_SIZE 64
+// Larger messages are staged in (or moved as) whole pages.
+#define IPC_MAX_PAGES 16
+#define IPC_MAX_MSG_SIZE (IPC_MAX_PAGES * PAGE_SIZE)
+
+// Message flags. Set IPC_FLAG_PAGES on a send/reply to move a page-aligned payload
+//  by remapping instead of copying. Set on receive when the payload arrived that way,
+//  in which case buf points to freshly mapped pages owned by the receiver.
+#define IPC_FLAG_PAGES 0x1
+
+// IPC states of a process.
+#define IPC_IDLE 0
+#define IPC_SEND_BLOCKED 1      // message staged, waiting for the receiver to take it
+#define IPC_REPLY_BLOCKED 2     // message taken, waiting for the reply
+#define IPC_RECEIVE_BLOCKED 3   // waiting for any sender
+
+#ifndef ASM
+
+// Message descriptor passed by user programs, same layout as in ece391syscall.h.
+typedef struct ipc_msg {
+    void *buf;
+    int32_t len;
+    int32_t flags;
+} ipc_msg_t;
+
+// Reset IPC state of all processes.
+extern void ipc_init();
+
+// Send msg to process pid and block until it replies into reply. Return reply length or -1.
+extern int32_t ipc_send(int32_t pid, ipc_msg_t *msg, ipc_msg_t *reply);
+
+// Block until a message arrives, store it into msg. Return the sender pid or -1.
+extern int32_t ipc_receive(ipc_msg_t *msg);
+
+// Reply to process pid whose message has been received. Return 0 on success, -1 on failure.
+extern int32_t ipc_reply(int32_t pid, ipc_msg_t *reply);
+
+// Fail every pending exchange involving pid, called when it halts.
+extern void ipc_release(uint32_t pid);
+
+#endif
+
+#endif
@@ -13,13 +13,25 @@
 #include "keyboard.h"
 #include "rtc.h"
 #include "file_system.h"
+#include "vfs.h"
 #include "process.h"
 #include "syscall.h"
 #include "terminal.h"
 #include "pit.h"
+#include "memory.h"
+#include "fpu.h"
+#include "ipc.h"
+#include "futex.h"
+#include "ata.h"
+#include "virtio_blk.h"
+#include "block_device.h"
+#include "bcache.h"
 
 #define RUN_TESTS
 #define FREQ_50 50
+#define KB 1024
+// mem_upper counts memory from 1MB on.
+#define UPPER_MEMORY_START 0x100000
 
 /* Macros. */
 /* Check if the bit BIT in FLAGS is set. */
@@ -158,10 +170,23 @@ void entry(unsigned long magic, unsigned long addr) {
 
     terminal_init();
 
-    // Extract file system image base address from multiboot information
-    //  and initialize file system driver.
+    // Extract file system image location from multiboot information.
     module_t *fs_mod =(module_t *) mbi->mods_addr;
-    file_system_init(fs_mod->mod_start);
+    uint32_t fs_start = fs_mod->mod_start;
+    uint32_t fs_length = fs_mod->mod_end - fs_mod->mod_start;
+
+    // Program pages and the frame pool would overwrite a large image, move it above
+    //  them while paging is still off.
+    if(fs_start + fs_length > KERNEL_MEMORY_BOT && fs_start < FRAME_POOL_END) {
+        if(CHECK_FLAG(mbi->flags, 0) && FRAME_POOL_END + fs_length <= UPPER_MEMORY_START + mbi->mem_upper * KB) {
+            memmove((void *)FRAME_POOL_END, (void *)fs_start, fs_length);
+            fs_start = FRAME_POOL_END;
+        }
+        else {
+            printf("Not enough memory for a %d KB file system image\n", fs_length / KB);
+            fs_length = 0;
+        }
+    }
 
     /* Enable interrupts */
     /* Do not enable the following until after you have set up your
@@ -172,14 +197,51 @@ void entry(unsigned long magic, unsigned long addr) {
     idt_init();
     // Load idt into idtr register
     lidt(idt_desc_ptr);
+    // Enable the FPU and SSE, processes get their FPU state lazily through #NM.
+    fpu_init();
+    // Pick the memory and string routines for this processor.
+    lib_init();
     // Enable interrupt.
     printf("Enabling Interrupts\n");
     sti();
 
+    memory_init();
+
+    // The image is only reachable through its window once paging is on.
+    uint32_t fs_base = map_fs_window(fs_start, fs_length);
+
     paging_init();
+    // The whole VGA text window is mapped now, scroll the screen through it.
+    vga_ring_init();
+
+    // Mount the boot image, the RAM file system and devices.
+    vfs_init();
+
+    // Initialize file system driver.
+    if(file_system_init(fs_base) == -1)
+        printf("No file system image mapped\n");
 
     process_init();
 
+    ipc_init();
+
+    futex_init();
+
+    ata_init();
+
+    virtio_blk_init();
+
+    bcache_init();
+
+    // Prefer a file system image on a disk over the boot module, the first one found wins.
+    int32_t dev;
+    for(dev = 0; get_block_device(dev) != NULL; ++dev) {
+        if(file_system_mount(dev) == 0) {
+            printf("File system mounted from %s\n", get_block_device(dev)->name);
+            break;
+        }
+    }
+
     pit_init(FREQ_50);
 
 #ifdef RUN_TESTS
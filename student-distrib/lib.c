@@ -4,32 +4,76 @@
 #include "lib.h"
 #include "process.h"
 #include "terminal.h"
+#include "syscall.h"
+#include "fpu.h"
 
-// This virtual address is not always mapped to physical video memory.
-//  When process on background terminal is running, it is mapped to the
-//  backstorage space for that terminal.
+// Physical VGA text window, used as is until paging is on.
 #define VIDEO       0xB8000
-// This virtual address is set up in all user program page
-//  tables such that it is always mapped to physical video memory.
-//  We can always use it to modify physical video memory (what is 
-//  really shown on screen) no matter which process is running.
-#define VIDEO_ALWAYS_TO_PHYSICAL 0xB9000
+
+// Each terminal owns TERMINAL_VGA_PAGES pages of the VGA text window and shows NUM_ROWS rows of
+//  them, starting at its own cell. The displayed terminal is the one the CRTC start address
+//  points at. Scrolling moves the start of a terminal down a row, only when the last row of its
+//  pages is reached the screen is copied back to their beginning.
+#define TERMINAL_VGA_CELLS (TERMINAL_VGA_PAGES * VAL_4096 / 2)
+#define SCREEN_CELLS (NUM_ROWS * NUM_COLS)
+#define SCREEN_BYTES (SCREEN_CELLS * 2)
 
 static void scroll();
+static void scroll_terminal(int32_t terminal_id);
 
 static int screen_x;
 static int screen_y;
-static char* video_mem = (char *)VIDEO;
-static char* video_mem_always_to_physical = (char *)(VIDEO_ALWAYS_TO_PHYSICAL);
+// VGA text window, only reachable at VGA_WINDOW once paging is on. Until then it is used at
+//  VIDEO and the screens do not move.
+static char* vga_window = (char *)VIDEO;
+static int32_t vga_ring_enabled = 0;
+// First cell of the screen of each terminal within its pages, a multiple of NUM_COLS.
+static uint32_t vga_start[TERMINAL_NUM];
+
+// First cell of the screen of a terminal in the VGA text window.
+static uint32_t screen_cell(int32_t terminal_id) {
+    return terminal_id * TERMINAL_VGA_CELLS + vga_start[terminal_id];
+}
+
+// Memory of the screen of a terminal.
+static char* terminal_mem(int32_t terminal_id) {
+    return vga_window + (screen_cell(terminal_id) << 1);
+}
+
+// Terminal of the current process. Before the first process, the kernel prints to the
+//  displayed terminal.
+static int32_t current_terminal() {
+    return get_process_count() == 0 ? get_display_terminal() : get_current_pcb()->terminal_id;
+}
+
+// Whether the current process runs on the displayed terminal.
+static int32_t on_display_terminal() {
+    return current_terminal() == get_display_terminal();
+}
+
+// Memory of the screen of the current process.
+static char* screen_mem() {
+    return terminal_mem(current_terminal());
+}
 
-// Load content from buf into video memory.
-void load_video_memory(const char *buf) {
-    memcpy(video_mem_always_to_physical, buf, 4 * 1024);
+// Memory of the displayed screen.
+static char* display_mem() {
+    return terminal_mem(get_display_terminal());
 }
 
-// Backup the content in video memory into buf.
-void backup_video_memory(char *buf) {
-    memcpy(buf, video_mem_always_to_physical, 4 * 1024);
+// Clear cells [from, to) of a screen.
+static void clear_cells(char* mem, int32_t from, int32_t to) {
+    for (; from < to; from++) {
+        *(uint8_t *)(mem + (from << 1)) = ' ';
+        *(uint8_t *)(mem + (from << 1) + 1) = ATTRIB;
+    }
+}
+
+// Move the screen of a terminal to cell start of its pages, and show it there if it is displayed.
+static void set_screen_start(int32_t terminal_id, uint32_t start) {
+    vga_start[terminal_id] = start;
+    if(terminal_id == get_display_terminal())
+        vga_show_terminal(terminal_id);
 }
 
 // Load screen position.
@@ -49,14 +93,11 @@ void backup_screen_position(int *x, int *y) {
  * Return Value: none
  * Function: Clears video memory */
 void clear(void) {
-    int32_t i;
-    for (i = 0; i < NUM_ROWS * NUM_COLS; i++) {
-        *(uint8_t *)(video_mem + (i << 1)) = ' ';
-        *(uint8_t *)(video_mem + (i << 1) + 1) = ATTRIB;
-    }
+    set_screen_start(current_terminal(), 0);
+    clear_cells(screen_mem(), 0, SCREEN_CELLS);
     screen_x = 0;
     screen_y = 0;
-    if(get_current_pcb()->terminal_id == get_display_terminal())
+    if(on_display_terminal())
         update_cursor(screen_x, screen_y);
 }
 
@@ -65,16 +106,13 @@ void clear(void) {
  * Return Value: none
  * Function: Clears display terminal's video memory */
 void clear_display_terminal(void) {
-    if(get_current_pcb()->terminal_id == get_display_terminal()) {
+    if(on_display_terminal()) {
         clear();
         return;
     }
-    
-    int32_t i;
-    for (i = 0; i < NUM_ROWS * NUM_COLS; i++) {
-        *(uint8_t *)(video_mem_always_to_physical + (i << 1)) = ' ';
-        *(uint8_t *)(video_mem_always_to_physical + (i << 1) + 1) = ATTRIB;
-    }
+
+    set_screen_start(get_display_terminal(), 0);
+    clear_cells(display_mem(), 0, SCREEN_CELLS);
 
     screen_x_backstore[get_display_terminal()] = 0;
     screen_y_backstore[get_display_terminal()] = 0;
@@ -86,6 +124,8 @@ void clear_display_terminal(void) {
 #define PORT_0x3D4 0x3D4
 #define PORT_0x3D5 0x3D5
 #define ALL_MASK 0xFF
+#define CMD_0x0C 0x0C
+#define CMD_0x0D 0x0D
 #define CMD_0x0E 0x0E
 #define CMD_0x0F 0x0F
 #define VAL_8 8
@@ -94,10 +134,10 @@ void clear_display_terminal(void) {
 /* update_cursor
  * Inputs: screen position for cursor
  * Return Value: none
- * Function: Update cursor position*/
+ * Function: Update cursor position on the displayed terminal*/
 void update_cursor(int x, int y)
 {
-	uint16_t pos = y * NUM_COLS + x;
+	uint16_t pos = screen_cell(get_display_terminal()) + y * NUM_COLS + x;
  
 	outb(CMD_0x0F, PORT_0x3D4);
 	outb((uint8_t) (pos & ALL_MASK), PORT_0x3D5);
@@ -105,6 +145,92 @@ void update_cursor(int x, int y)
 	outb((uint8_t) ((pos >> VAL_8) & ALL_MASK),PORT_0x3D5);
 }
 
+/* vga_set_start
+ * Inputs: cell of the VGA text window shown at the top left of the screen
+ * Return Value: none
+ * Function: Program the CRTC start address registers */
+void vga_set_start(uint32_t cell)
+{
+	outb(CMD_0x0C, PORT_0x3D4);
+	outb((uint8_t) ((cell >> VAL_8) & ALL_MASK), PORT_0x3D5);
+	outb(CMD_0x0D, PORT_0x3D4);
+	outb((uint8_t) (cell & ALL_MASK), PORT_0x3D5);
+}
+
+/* vga_ring_init
+ * Inputs: none
+ * Return Value: none
+ * Function: Start scrolling the terminals through their pages of the VGA
+ *           text window, which needs its mapping at VGA_WINDOW. */
+void vga_ring_init(void)
+{
+	vga_window = (char *)VGA_WINDOW;
+	vga_ring_enabled = 1;
+}
+
+/* vga_show_terminal
+ * Inputs: terminal_id -- the displayed terminal
+ * Return Value: none
+ * Function: Point the CRTC start address and the cursor at the screen of
+ *           the displayed terminal. Nothing is copied. */
+void vga_show_terminal(int32_t terminal_id)
+{
+	vga_set_start(screen_cell(terminal_id));
+	if(on_display_terminal())
+		update_cursor(screen_x, screen_y);
+	else
+		update_cursor(screen_x_backstore[terminal_id], screen_y_backstore[terminal_id]);
+}
+
+/* vga_clear_terminal
+ * Inputs: terminal_id -- terminal that is not displayed
+ * Return Value: none
+ * Function: Clear the screen of a terminal and move it to the start of its
+ *           pages. */
+void vga_clear_terminal(int32_t terminal_id)
+{
+	vga_start[terminal_id] = 0;
+	clear_cells(terminal_mem(terminal_id), 0, SCREEN_CELLS);
+}
+
+/* vga_home
+ * Inputs: terminal_id -- terminal whose screen is moved
+ * Return Value: none
+ * Function: Move the screen of a terminal back to the start of its pages,
+ *           the only part a user program can map with vidmap. */
+void vga_home(int32_t terminal_id)
+{
+	if(vga_start[terminal_id] == 0)
+		return;
+	memmove(vga_window + ((terminal_id * TERMINAL_VGA_CELLS) << 1), terminal_mem(terminal_id), SCREEN_BYTES);
+	set_screen_start(terminal_id, 0);
+}
+
+/*
+*   scroll_terminal
+*   Inputs: terminal_id -- terminal to scroll
+*   Return Value: void
+*   Function: scroll the screen of a terminal up a line. Its start moves
+*             down a row and only the new last row is cleared. While a
+*             program on the terminal uses vidmap, the screen stays at the
+*             start of its pages and is copied up instead.
+*/
+static void scroll_terminal(int32_t terminal_id)
+{
+    if(!vga_ring_enabled || vidmap_in_use(terminal_id) ||
+       vga_start[terminal_id] + SCREEN_CELLS + NUM_COLS > TERMINAL_VGA_CELLS) {
+        // Out of pages, or the screen has to stay where vidmap maps it.
+        memmove(vga_window + ((terminal_id * TERMINAL_VGA_CELLS) << 1), terminal_mem(terminal_id) + (NUM_COLS << 1),
+                SCREEN_BYTES - (NUM_COLS << 1));
+        vga_start[terminal_id] = 0;
+    } else {
+        vga_start[terminal_id] += NUM_COLS;
+    }
+    clear_cells(terminal_mem(terminal_id), SCREEN_CELLS - NUM_COLS, SCREEN_CELLS);
+    if(terminal_id == get_display_terminal())
+        vga_set_start(screen_cell(terminal_id));
+}
+
 /*
 *   scroll
 *   Inputs: scroll screen
@@ -113,31 +239,8 @@ void update_cursor(int x, int y)
 */
 static void scroll()
 {
-    int x, y;
-    int new_pos, old_pos;
-
-    // For each row, we copy row x+1 to row x
-    for(x = 0; x < NUM_ROWS - 1; x++)
-    {
-        for(y = 0; y < NUM_COLS; y++)
-        {
-            new_pos = NUM_COLS * x + y;
-            old_pos = NUM_COLS * x + y + NUM_COLS;
-            *(uint8_t *)(video_mem + (new_pos << 1)) = *(video_mem + (old_pos << 1));           
-            *(uint8_t *)(video_mem + (new_pos << 1) + 1) = ATTRIB;
-        }
-    }
-    
-    x = NUM_ROWS-1;
-    
-    // clear last row
-    for(y = 0; y < NUM_COLS; y++)
-    {   
-        new_pos = NUM_COLS * x + y;
-        *(uint8_t *)(video_mem + (new_pos << 1)) = ' ';           
-        *(uint8_t *)(video_mem + (new_pos << 1) + 1) = ATTRIB;
-    }
-    
+    scroll_terminal(current_terminal());
+
     // set screen position to beginning of last row
     screen_x = 0;
     screen_y = NUM_ROWS - 1;
@@ -151,35 +254,12 @@ static void scroll()
 */
 static void scroll_display_terminal()
 {
-    if(get_current_pcb()->terminal_id == get_display_terminal()) {
+    if(on_display_terminal()) {
         scroll();
         return;
     }
 
-    int x, y;
-    int new_pos, old_pos;
-
-    // For each row, we copy row x+1 to row x
-    for(x = 0; x < NUM_ROWS - 1; x++)
-    {
-        for(y = 0; y < NUM_COLS; y++)
-        {
-            new_pos = NUM_COLS * x + y;
-            old_pos = NUM_COLS * x + y + NUM_COLS;
-            *(uint8_t *)(video_mem_always_to_physical + (new_pos << 1)) = *(video_mem_always_to_physical + (old_pos << 1));           
-            *(uint8_t *)(video_mem_always_to_physical + (new_pos << 1) + 1) = ATTRIB;
-        }
-    }
-    
-    x = NUM_ROWS-1;
-    
-    // clear last row
-    for(y = 0; y < NUM_COLS; y++)
-    {   
-        new_pos = NUM_COLS * x + y;
-        *(uint8_t *)(video_mem_always_to_physical + (new_pos << 1)) = ' ';           
-        *(uint8_t *)(video_mem_always_to_physical + (new_pos << 1) + 1) = ATTRIB;
-    }
+    scroll_terminal(get_display_terminal());
 
     screen_x_backstore[get_display_terminal()] = 0;
     screen_y_backstore[get_display_terminal()] = NUM_ROWS - 1;
@@ -208,11 +288,10 @@ void backspace_delete() {
     }                    
 
     // change registers 
-    *(uint8_t *)(video_mem+ ((NUM_COLS * screen_y + screen_x) << 1)) = ' ';
-    *(uint8_t *)(video_mem + ((NUM_COLS * screen_y + screen_x) << 1) + 1) = ATTRIB;  
+    clear_cells(screen_mem(), NUM_COLS * screen_y + screen_x, NUM_COLS * screen_y + screen_x + 1);
     
     //update the cursor
-    if(get_current_pcb()->terminal_id == get_display_terminal())
+    if(on_display_terminal())
         update_cursor(screen_x, screen_y);                                                                                          
 }
 
@@ -224,7 +303,7 @@ void backspace_delete() {
 */
 
 void backspace_delete_display_terminal() {
-    if(get_current_pcb()->terminal_id == get_display_terminal()) {
+    if(on_display_terminal()) {
         backspace_delete();
         return;
     }
@@ -244,8 +323,8 @@ void backspace_delete_display_terminal() {
     }                    
 
     // change registers 
-    *(uint8_t *)(video_mem_always_to_physical + ((NUM_COLS * screen_y_backstore[get_display_terminal()] + screen_x_backstore[get_display_terminal()]) << 1)) = ' ';
-    *(uint8_t *)(video_mem_always_to_physical + ((NUM_COLS * screen_y_backstore[get_display_terminal()] + screen_x_backstore[get_display_terminal()]) << 1) + 1) = ATTRIB;  
+    int32_t pos = NUM_COLS * screen_y_backstore[get_display_terminal()] + screen_x_backstore[get_display_terminal()];
+    clear_cells(display_mem(), pos, pos + 1);
     
     update_cursor(screen_x_backstore[get_display_terminal()], screen_y_backstore[get_display_terminal()]);                                                                                            
 }
@@ -509,7 +588,7 @@ int32_t puts(int8_t* s) {
  *   Return Value: Number of bytes written
  *   Function: Output a string to the console on display terminal */
 int32_t puts_display_terminal(int8_t* s) {
-    if(get_current_pcb()->terminal_id == get_display_terminal()) {
+    if(on_display_terminal()) {
         return puts(s);
     }
     
@@ -530,8 +609,9 @@ void putc(uint8_t c) {
         screen_x = 0;
         screen_y++;
     } else {
-        *(uint8_t *)(video_mem + ((NUM_COLS * screen_y + screen_x) << 1)) = c;
-        *(uint8_t *)(video_mem + ((NUM_COLS * screen_y + screen_x) << 1) + 1) = ATTRIB;
+        char* mem = screen_mem();
+        *(uint8_t *)(mem + ((NUM_COLS * screen_y + screen_x) << 1)) = c;
+        *(uint8_t *)(mem + ((NUM_COLS * screen_y + screen_x) << 1) + 1) = ATTRIB;
         screen_x++;
         if(screen_x == NUM_COLS) {
             screen_x = 0;
@@ -540,7 +620,7 @@ void putc(uint8_t c) {
     }
     if(screen_y == NUM_ROWS)
         scroll();
-    if(get_current_pcb()->terminal_id == get_display_terminal())
+    if(on_display_terminal())
         update_cursor(screen_x, screen_y);
 }
 
@@ -549,7 +629,7 @@ void putc(uint8_t c) {
  * Return Value: void
  *  Function: Output a character to the console on display terminal*/
 void putc_display_terminal(uint8_t c) {
-    if(get_current_pcb()->terminal_id == get_display_terminal()) {
+    if(on_display_terminal()) {
         putc(c);
         return;
     }
@@ -558,8 +638,8 @@ void putc_display_terminal(uint8_t c) {
         screen_x_backstore[get_display_terminal()] = 0;
         screen_y_backstore[get_display_terminal()]++;
     } else {
-        *(uint8_t *)(video_mem_always_to_physical + ((NUM_COLS * screen_y_backstore[get_display_terminal()] + screen_x_backstore[get_display_terminal()]) << 1)) = c;
-        *(uint8_t *)(video_mem_always_to_physical + ((NUM_COLS * screen_y_backstore[get_display_terminal()] + screen_x_backstore[get_display_terminal()]) << 1) + 1) = ATTRIB;
+        *(uint8_t *)(display_mem() + ((NUM_COLS * screen_y_backstore[get_display_terminal()] + screen_x_backstore[get_display_terminal()]) << 1)) = c;
+        *(uint8_t *)(display_mem() + ((NUM_COLS * screen_y_backstore[get_display_terminal()] + screen_x_backstore[get_display_terminal()]) << 1) + 1) = ATTRIB;
         screen_x_backstore[get_display_terminal()]++;
         if(screen_x_backstore[get_display_terminal()] == NUM_COLS) {
             screen_x_backstore[get_display_terminal()] = 0;
@@ -629,17 +709,225 @@ int8_t* strrev(int8_t* s) {
     return s;
 }
 
+/*
+ * Memory and string routines. Each has a base variant that runs on any processor,
+ * and some have faster ones for processor features found by lib_init(): rep movsb
+ * and rep stosb with ERMS, SSE2 and SSE4.2 loops. The public function calls the
+ * variant selected for the processor. SSE variants only take the SSE registers
+ * through kernel_fpu_begin() for long copies and long strings, short ones take
+ * the base path, as do any started while the kernel already holds the registers.
+ */
+
+// Copies shorter than this are not worth taking the SSE registers.
+#define SSE_COPY_MIN 512
+// Strings are scanned byte by byte up to this length before taking the SSE registers.
+#define SSE_STRING_MIN 64
+// Width of an SSE register and bytes moved per round of the SSE loops.
+#define SSE_WIDTH 16
+#define SSE_BLOCK 64
+// Offset in a page after which an unaligned SSE load runs into the next page,
+//  which may not be mapped.
+#define SSE_LAST_LOAD_OFFSET 0xff0
+#define PAGE_OFFSET_MASK 0xfff
+
+#define CPUID_MAX_LEAF 0
+#define CPUID_FEATURES 1
+#define CPUID_EXT_FEATURES 7
+#define CPUID_SSE42 (1 << 20)       // ecx of CPUID_FEATURES
+#define CPUID_ERMS (1 << 9)         // ebx of CPUID_EXT_FEATURES
+
+// pcmpistri mode: unsigned bytes, compare each pair, index of the first pair that differs.
+#define PCMPISTRI_MISMATCH 0x18
+
+static uint32_t cpu_features = 0;
+
+static void* memcpy_base(void* dest, const void* src, uint32_t n);
+static void* memcpy_erms(void* dest, const void* src, uint32_t n);
+static void* memcpy_sse2(void* dest, const void* src, uint32_t n);
+static void* memset_base(void* s, int32_t c, uint32_t n);
+static void* memset_erms(void* s, int32_t c, uint32_t n);
+static void* memset_sse2(void* s, int32_t c, uint32_t n);
+static void* memmove_back_base(void* dest, const void* src, uint32_t n);
+static void* memmove_back_sse2(void* dest, const void* src, uint32_t n);
+static uint32_t strlen_base(const int8_t* s);
+static uint32_t strlen_sse2(const int8_t* s);
+static int32_t strncmp_base(const int8_t* s1, const int8_t* s2, uint32_t n);
+static int32_t strncmp_sse42(const int8_t* s1, const int8_t* s2, uint32_t n);
+
+// Variants in use. memmove() only needs one to copy backwards, forward moves are done
+//  by the memcpy variant, which all copy from low to high addresses.
+static void* (*memcpy_func)(void* dest, const void* src, uint32_t n) = memcpy_base;
+static void* (*memset_func)(void* s, int32_t c, uint32_t n) = memset_base;
+static void* (*memmove_back_func)(void* dest, const void* src, uint32_t n) = memmove_back_base;
+static uint32_t (*strlen_func)(const int8_t* s) = strlen_base;
+static int32_t (*strncmp_func)(const int8_t* s1, const int8_t* s2, uint32_t n) = strncmp_base;
+static int32_t lib_variant[LIB_NUM_ROUTINES];
+
+// Implementations of each routine by LIB_VARIANT_*, NULL where there is none.
+static void* const lib_variants[LIB_NUM_ROUTINES][LIB_NUM_VARIANTS] = {
+    {memcpy_base, memcpy_erms, memcpy_sse2, NULL},
+    {memset_base, memset_erms, memset_sse2, NULL},
+    {memmove_back_base, NULL, memmove_back_sse2, NULL},
+    {strlen_base, NULL, strlen_sse2, NULL},
+    {strncmp_base, NULL, NULL, strncmp_sse42},
+};
+
+// Features needed by each variant.
+static const uint32_t lib_variant_features[LIB_NUM_VARIANTS] = {
+    0, CPU_ERMS, CPU_SSE2, CPU_SSE2 | CPU_SSE42
+};
+
+// Order in which lib_init() tries the variants. rep movsb and rep stosb of ERMS beat
+//  SSE, which has to save the FPU state of a process first.
+static const int32_t lib_preference[LIB_NUM_VARIANTS] = {
+    LIB_VARIANT_ERMS, LIB_VARIANT_SSE42, LIB_VARIANT_SSE2, LIB_VARIANT_BASE
+};
+
+/* void lib_init(void);
+ * Inputs: void
+ * Return Value: none
+ * Function: probe the processor with cpuid and select the best variant of
+ *           each routine. SSE is only used if fpu_init() enabled it. */
+void lib_init(void) {
+    uint32_t eax, ebx, ecx, edx, max_leaf;
+    int32_t routine, i;
+
+    cpuid(CPUID_MAX_LEAF, 0, &max_leaf, &ebx, &ecx, &edx);
+    cpu_features = 0;
+    if(max_leaf >= CPUID_EXT_FEATURES) {
+        cpuid(CPUID_EXT_FEATURES, 0, &eax, &ebx, &ecx, &edx);
+        if(ebx & CPUID_ERMS)
+            cpu_features |= CPU_ERMS;
+    }
+    if(fpu_has_sse2()) {
+        cpu_features |= CPU_SSE2;
+        cpuid(CPUID_FEATURES, 0, &eax, &ebx, &ecx, &edx);
+        if(ecx & CPUID_SSE42)
+            cpu_features |= CPU_SSE42;
+    }
+
+    for(routine = 0; routine < LIB_NUM_ROUTINES; ++routine) {
+        for(i = 0; i < LIB_NUM_VARIANTS; ++i) {
+            if(lib_select(routine, lib_preference[i]) == 0)
+                break;
+        }
+    }
+}
+
+/* uint32_t get_cpu_features(void);
+ * Inputs: void
+ * Return Value: CPU_* bits of the features found by lib_init()
+ * Function: return the processor features */
+uint32_t get_cpu_features(void) {
+    return cpu_features;
+}
+
+/* int32_t lib_select(int32_t routine, int32_t variant);
+ * Inputs: int32_t routine = LIB_MEMCPY, LIB_MEMSET, ...
+ *         int32_t variant = LIB_VARIANT_BASE, LIB_VARIANT_ERMS, ...
+ * Return Value: 0 on success, -1 if the variant does not exist or the
+ *               processor lacks its feature
+ * Function: make routine use variant from now on */
+int32_t lib_select(int32_t routine, int32_t variant) {
+    if(routine < 0 || routine >= LIB_NUM_ROUTINES || variant < 0 || variant >= LIB_NUM_VARIANTS)
+        return -1;
+
+    void* func = lib_variants[routine][variant];
+    uint32_t needed = lib_variant_features[variant];
+    if(func == NULL || (cpu_features & needed) != needed)
+        return -1;
+
+    switch(routine) {
+        case LIB_MEMCPY:
+            memcpy_func = func;
+            break;
+        case LIB_MEMSET:
+            memset_func = func;
+            break;
+        case LIB_MEMMOVE:
+            memmove_back_func = func;
+            break;
+        case LIB_STRLEN:
+            strlen_func = func;
+            break;
+        case LIB_STRNCMP:
+            strncmp_func = func;
+            break;
+    }
+    lib_variant[routine] = variant;
+    return 0;
+}
+
+/* int32_t lib_get_variant(int32_t routine);
+ * Inputs: int32_t routine = LIB_MEMCPY, LIB_MEMSET, ...
+ * Return Value: LIB_VARIANT_* in use, -1 for an invalid routine
+ * Function: return the variant selected for routine */
+int32_t lib_get_variant(int32_t routine) {
+    if(routine < 0 || routine >= LIB_NUM_ROUTINES)
+        return -1;
+    return lib_variant[routine];
+}
+
+// Bytes from p up to the next SSE_WIDTH boundary, at most n.
+static uint32_t sse_head(const void* p, uint32_t n) {
+    uint32_t head = (SSE_WIDTH - ((uint32_t)p & (SSE_WIDTH - 1))) & (SSE_WIDTH - 1);
+    return head < n ? head : n;
+}
+
+// Whether an unaligned SSE_WIDTH load at p stays in its page.
+static int32_t sse_load_in_page(const void* p) {
+    return ((uint32_t)p & PAGE_OFFSET_MASK) <= SSE_LAST_LOAD_OFFSET;
+}
+
 /* uint32_t strlen(const int8_t* s);
  * Inputs: const int8_t* s = string to take length of
  * Return Value: length of string s
  * Function: return length of string s */
 uint32_t strlen(const int8_t* s) {
+    return strlen_func(s);
+}
+
+// strlen(), one byte at a time.
+static uint32_t strlen_base(const int8_t* s) {
     register uint32_t len = 0;
     while (s[len] != '\0')
         len++;
     return len;
 }
 
+// strlen(), 16 bytes at a time with pcmpeqb once past SSE_STRING_MIN bytes. Aligned
+//  loads never cross into the next page.
+static uint32_t strlen_sse2(const int8_t* s) {
+    uint32_t len, scanned, mask, flags;
+
+    for(len = 0; len < SSE_STRING_MIN || ((uint32_t)(s + len) & (SSE_WIDTH - 1)); ++len) {
+        if(s[len] == '\0')
+            return len;
+    }
+
+    while(kernel_fpu_begin(&flags) == 0) {
+        for(scanned = 0; scanned < KERNEL_FPU_CHUNK; scanned += SSE_WIDTH) {
+            asm volatile ("                         \n\
+                    pxor     %%xmm0, %%xmm0         \n\
+                    pcmpeqb  (%1), %%xmm0           \n\
+                    pmovmskb %%xmm0, %0             \n\
+                    "
+                    : "=r"(mask)
+                    : "r"(s + len)
+                    : "memory"
+            );
+            if(mask != 0) {
+                kernel_fpu_end(flags);
+                return len + __builtin_ctz(mask);
+            }
+            len += SSE_WIDTH;
+        }
+        kernel_fpu_end(flags);
+    }
+
+    return len + strlen_base(s + len);
+}
+
 /* void* memset(void* s, int32_t c, uint32_t n);
  * Inputs:    void* s = pointer to memory
  *          int32_t c = value to set memory to
@@ -647,18 +935,24 @@ uint32_t strlen(const int8_t* s) {
  * Return Value: new string
  * Function: set n consecutive bytes of pointer s to value c */
 void* memset(void* s, int32_t c, uint32_t n) {
+    return memset_func(s, c, n);
+}
+
+// memset(), bytes up to a 4-byte boundary, then rep stosl.
+static void* memset_base(void* s, int32_t c, uint32_t n) {
+    void* d = s;
     c &= 0xFF;
     asm volatile ("                 \n\
-            .memset_top:            \n\
+            1:                      \n\
             testl   %%ecx, %%ecx    \n\
-            jz      .memset_done    \n\
+            jz      4f              \n\
             testl   $0x3, %%edi     \n\
-            jz      .memset_aligned \n\
+            jz      2f              \n\
             movb    %%al, (%%edi)   \n\
             addl    $1, %%edi       \n\
             subl    $1, %%ecx       \n\
-            jmp     .memset_top     \n\
-            .memset_aligned:        \n\
+            jmp     1b              \n\
+            2:                      \n\
             movw    %%ds, %%dx      \n\
             movw    %%dx, %%es      \n\
             movl    %%ecx, %%edx    \n\
@@ -666,22 +960,82 @@ void* memset(void* s, int32_t c, uint32_t n) {
             andl    $0x3, %%edx     \n\
             cld                     \n\
             rep     stosl           \n\
-            .memset_bottom:         \n\
+            3:                      \n\
             testl   %%edx, %%edx    \n\
-            jz      .memset_done    \n\
+            jz      4f              \n\
             movb    %%al, (%%edi)   \n\
             addl    $1, %%edi       \n\
             subl    $1, %%edx       \n\
-            jmp     .memset_bottom  \n\
-            .memset_done:           \n\
+            jmp     3b              \n\
+            4:                      \n\
             "
-            :
-            : "a"(c << 24 | c << 16 | c << 8 | c), "D"(s), "c"(n)
+            : "+D"(d), "+c"(n)
+            : "a"(c << 24 | c << 16 | c << 8 | c)
             : "edx", "memory", "cc"
     );
     return s;
 }
 
+// memset(), a single rep stosb.
+static void* memset_erms(void* s, int32_t c, uint32_t n) {
+    void* d = s;
+    asm volatile ("                 \n\
+            movw    %%ds, %%dx      \n\
+            movw    %%dx, %%es      \n\
+            cld                     \n\
+            rep     stosb           \n\
+            "
+            : "+D"(d), "+c"(n)
+            : "a"(c)
+            : "edx", "memory", "cc"
+    );
+    return s;
+}
+
+// memset(), 64 bytes per round with SSE2 aligned stores.
+static void* memset_sse2(void* s, int32_t c, uint32_t n) {
+    uint8_t* d = (uint8_t*)s;
+    uint32_t pattern[SSE_WIDTH / sizeof(uint32_t)];
+    uint32_t head, chunk, count, flags, i;
+
+    if(n < SSE_COPY_MIN)
+        return memset_base(s, c, n);
+
+    c &= 0xFF;
+    for(i = 0; i < SSE_WIDTH / sizeof(uint32_t); ++i)
+        pattern[i] = c << 24 | c << 16 | c << 8 | c;
+
+    head = sse_head(d, n);
+    memset_base(d, c, head);
+    d += head;
+    n -= head;
+
+    while(n >= SSE_BLOCK && kernel_fpu_begin(&flags) == 0) {
+        chunk = (n < KERNEL_FPU_CHUNK ? n : KERNEL_FPU_CHUNK) & ~(SSE_BLOCK - 1);
+        count = chunk;
+        asm volatile ("                     \n\
+                movdqu  (%2), %%xmm0        \n\
+                1:                          \n\
+                movdqa  %%xmm0, (%0)        \n\
+                movdqa  %%xmm0, 16(%0)      \n\
+                movdqa  %%xmm0, 32(%0)      \n\
+                movdqa  %%xmm0, 48(%0)      \n\
+                addl    $64, %0             \n\
+                subl    $64, %1             \n\
+                jnz     1b                  \n\
+                "
+                : "+r"(d), "+r"(count)
+                : "r"(pattern)
+                : "memory", "cc"
+        );
+        kernel_fpu_end(flags);
+        n -= chunk;
+    }
+    memset_base(d, c, n);
+
+    return s;
+}
+
 /* void* memset_word(void* s, int32_t c, uint32_t n);
  * Description: Optimized memset_word
  * Inputs:    void* s = pointer to memory
@@ -730,19 +1084,25 @@ void* memset_dword(void* s, int32_t c, uint32_t n) {
  * Return Value: pointer to dest
  * Function: copy n bytes of src to dest */
 void* memcpy(void* dest, const void* src, uint32_t n) {
+    return memcpy_func(dest, src, n);
+}
+
+// memcpy(), bytes up to a 4-byte boundary of dest, then rep movsl.
+static void* memcpy_base(void* dest, const void* src, uint32_t n) {
+    void* d = dest;
     asm volatile ("                 \n\
-            .memcpy_top:            \n\
+            1:                      \n\
             testl   %%ecx, %%ecx    \n\
-            jz      .memcpy_done    \n\
+            jz      4f              \n\
             testl   $0x3, %%edi     \n\
-            jz      .memcpy_aligned \n\
+            jz      2f              \n\
             movb    (%%esi), %%al   \n\
             movb    %%al, (%%edi)   \n\
             addl    $1, %%edi       \n\
             addl    $1, %%esi       \n\
             subl    $1, %%ecx       \n\
-            jmp     .memcpy_top     \n\
-            .memcpy_aligned:        \n\
+            jmp     1b              \n\
+            2:                      \n\
             movw    %%ds, %%dx      \n\
             movw    %%dx, %%es      \n\
             movl    %%ecx, %%edx    \n\
@@ -750,24 +1110,86 @@ void* memcpy(void* dest, const void* src, uint32_t n) {
             andl    $0x3, %%edx     \n\
             cld                     \n\
             rep     movsl           \n\
-            .memcpy_bottom:         \n\
+            3:                      \n\
             testl   %%edx, %%edx    \n\
-            jz      .memcpy_done    \n\
+            jz      4f              \n\
             movb    (%%esi), %%al   \n\
             movb    %%al, (%%edi)   \n\
             addl    $1, %%edi       \n\
             addl    $1, %%esi       \n\
             subl    $1, %%edx       \n\
-            jmp     .memcpy_bottom  \n\
-            .memcpy_done:           \n\
+            jmp     3b              \n\
+            4:                      \n\
             "
+            : "+S"(src), "+D"(d), "+c"(n)
             :
-            : "S"(src), "D"(dest), "c"(n)
             : "eax", "edx", "memory", "cc"
     );
     return dest;
 }
 
+// memcpy(), a single rep movsb.
+static void* memcpy_erms(void* dest, const void* src, uint32_t n) {
+    void* d = dest;
+    asm volatile ("                 \n\
+            movw    %%ds, %%dx      \n\
+            movw    %%dx, %%es      \n\
+            cld                     \n\
+            rep     movsb           \n\
+            "
+            : "+S"(src), "+D"(d), "+c"(n)
+            :
+            : "edx", "memory", "cc"
+    );
+    return dest;
+}
+
+// memcpy(), 64 bytes per round with SSE2 unaligned loads and aligned stores. Each round
+//  loads before it stores, so this still works for memmove() with dest below src.
+static void* memcpy_sse2(void* dest, const void* src, uint32_t n) {
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+    uint32_t head, chunk, count, flags;
+
+    if(n < SSE_COPY_MIN)
+        return memcpy_base(dest, src, n);
+
+    head = sse_head(d, n);
+    memcpy_base(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    while(n >= SSE_BLOCK && kernel_fpu_begin(&flags) == 0) {
+        chunk = (n < KERNEL_FPU_CHUNK ? n : KERNEL_FPU_CHUNK) & ~(SSE_BLOCK - 1);
+        count = chunk;
+        asm volatile ("                     \n\
+                1:                          \n\
+                movdqu  (%1), %%xmm0        \n\
+                movdqu  16(%1), %%xmm1      \n\
+                movdqu  32(%1), %%xmm2      \n\
+                movdqu  48(%1), %%xmm3      \n\
+                movdqa  %%xmm0, (%0)        \n\
+                movdqa  %%xmm1, 16(%0)      \n\
+                movdqa  %%xmm2, 32(%0)      \n\
+                movdqa  %%xmm3, 48(%0)      \n\
+                addl    $64, %1             \n\
+                addl    $64, %0             \n\
+                subl    $64, %2             \n\
+                jnz     1b                  \n\
+                "
+                : "+r"(d), "+r"(s), "+r"(count)
+                :
+                : "memory", "cc"
+        );
+        kernel_fpu_end(flags);
+        n -= chunk;
+    }
+    memcpy_base(d, s, n);
+
+    return dest;
+}
+
 /* void* memmove(void* dest, const void* src, uint32_t n);
  * Description: Optimized memmove (used for overlapping memory areas)
  * Inputs:      void* dest = destination of move
@@ -776,25 +1198,79 @@ void* memcpy(void* dest, const void* src, uint32_t n) {
  * Return Value: pointer to dest
  * Function: move n bytes of src to dest */
 void* memmove(void* dest, const void* src, uint32_t n) {
+    // Copying forwards is only wrong if dest starts inside the source.
+    if((uint32_t)dest <= (uint32_t)src || (uint32_t)dest >= (uint32_t)src + n)
+        return memcpy_func(dest, src, n);
+    return memmove_back_func(dest, src, n);
+}
+
+// memmove() from high to low addresses, a single rep movsb with the direction flag set.
+static void* memmove_back_base(void* dest, const void* src, uint32_t n) {
+    void* d = dest;
+    if(n == 0)
+        return dest;
     asm volatile ("                             \n\
             movw    %%ds, %%dx                  \n\
             movw    %%dx, %%es                  \n\
-            cld                                 \n\
-            cmp     %%edi, %%esi                \n\
-            jae     .memmove_go                 \n\
             leal    -1(%%esi, %%ecx), %%esi     \n\
             leal    -1(%%edi, %%ecx), %%edi     \n\
             std                                 \n\
-            .memmove_go:                        \n\
             rep     movsb                       \n\
+            cld                                 \n\
             "
+            : "+D"(d), "+S"(src), "+c"(n)
             :
-            : "D"(dest), "S"(src), "c"(n)
             : "edx", "memory", "cc"
     );
     return dest;
 }
 
+// memmove() from high to low addresses, 64 bytes per round with SSE2 once the end of
+//  dest is aligned. Each round loads before it stores.
+static void* memmove_back_sse2(void* dest, const void* src, uint32_t n) {
+    uint8_t* d = (uint8_t*)dest + n;
+    const uint8_t* s = (const uint8_t*)src + n;
+    uint32_t tail, chunk, count, flags;
+
+    if(n < SSE_COPY_MIN)
+        return memmove_back_base(dest, src, n);
+
+    tail = (uint32_t)d & (SSE_WIDTH - 1);
+    d -= tail;
+    s -= tail;
+    n -= tail;
+    memmove_back_base(d, s, tail);
+
+    while(n >= SSE_BLOCK && kernel_fpu_begin(&flags) == 0) {
+        chunk = (n < KERNEL_FPU_CHUNK ? n : KERNEL_FPU_CHUNK) & ~(SSE_BLOCK - 1);
+        count = chunk;
+        asm volatile ("                     \n\
+                1:                          \n\
+                subl    $64, %1             \n\
+                subl    $64, %0             \n\
+                movdqu  48(%1), %%xmm3      \n\
+                movdqu  32(%1), %%xmm2      \n\
+                movdqu  16(%1), %%xmm1      \n\
+                movdqu  (%1), %%xmm0        \n\
+                movdqa  %%xmm3, 48(%0)      \n\
+                movdqa  %%xmm2, 32(%0)      \n\
+                movdqa  %%xmm1, 16(%0)      \n\
+                movdqa  %%xmm0, (%0)        \n\
+                subl    $64, %2             \n\
+                jnz     1b                  \n\
+                "
+                : "+r"(d), "+r"(s), "+r"(count)
+                :
+                : "memory", "cc"
+        );
+        kernel_fpu_end(flags);
+        n -= chunk;
+    }
+    memmove_back_base(d - n, s - n, n);
+
+    return dest;
+}
+
 /* int32_t strncmp(const int8_t* s1, const int8_t* s2, uint32_t n)
  * Inputs: const int8_t* s1 = first string to compare
  *         const int8_t* s2 = second string to compare
@@ -807,6 +1283,11 @@ void* memmove(void* dest, const void* src, uint32_t n) {
  *               indicates the opposite.
  * Function: compares string 1 and string 2 for equality */
 int32_t strncmp(const int8_t* s1, const int8_t* s2, uint32_t n) {
+    return strncmp_func(s1, s2, n);
+}
+
+// strncmp(), one byte at a time.
+static int32_t strncmp_base(const int8_t* s1, const int8_t* s2, uint32_t n) {
     int32_t i;
     for (i = 0; i < n; i++) {
         if ((s1[i] != s2[i]) || (s1[i] == '\0') /* || s2[i] == '\0' */) {
@@ -822,6 +1303,55 @@ int32_t strncmp(const int8_t* s1, const int8_t* s2, uint32_t n) {
     return 0;
 }
 
+// strncmp(), 16 bytes at a time with pcmpistri once past SSE_STRING_MIN bytes. A load
+//  that would run into the next page compares a single byte instead.
+static int32_t strncmp_sse42(const int8_t* s1, const int8_t* s2, uint32_t n) {
+    uint32_t i, scanned, index, flags;
+    uint8_t differ, ended;
+
+    for(i = 0; i < n && i < SSE_STRING_MIN; ++i) {
+        if(s1[i] != s2[i] || s1[i] == '\0')
+            return s1[i] - s2[i];
+    }
+
+    while(i < n && kernel_fpu_begin(&flags) == 0) {
+        for(scanned = 0; scanned < KERNEL_FPU_CHUNK && i < n; scanned += SSE_WIDTH) {
+            if(!sse_load_in_page(s1 + i) || !sse_load_in_page(s2 + i)) {
+                if(s1[i] != s2[i] || s1[i] == '\0') {
+                    kernel_fpu_end(flags);
+                    return s1[i] - s2[i];
+                }
+                ++i;
+                continue;
+            }
+            // CF: the strings differ at index, ZF: s2 ends in these 16 bytes.
+            asm volatile ("                             \n\
+                    movdqu    (%3), %%xmm1              \n\
+                    pcmpistri %5, (%4), %%xmm1          \n\
+                    setc      %1                        \n\
+                    setz      %2                        \n\
+                    "
+                    : "=c"(index), "=&q"(differ), "=&q"(ended)
+                    : "r"(s1 + i), "r"(s2 + i), "i"(PCMPISTRI_MISMATCH)
+                    : "cc", "memory"
+            );
+            if(differ) {
+                kernel_fpu_end(flags);
+                i += index;
+                return i < n ? s1[i] - s2[i] : 0;
+            }
+            if(ended) {
+                kernel_fpu_end(flags);
+                return 0;
+            }
+            i += SSE_WIDTH;
+        }
+        kernel_fpu_end(flags);
+    }
+
+    return i < n ? strncmp_base(s1 + i, s2 + i, n - i) : 0;
+}
+
 /* int8_t* strcpy(int8_t* dest, const int8_t* src)
  * Inputs:      int8_t* dest = destination string of copy
  *         const int8_t* src = source string of copy
@@ -863,6 +1393,6 @@ int8_t* strncpy(int8_t* dest, const int8_t* src, uint32_t n) {
 void test_interrupts(void) {
     int32_t i;
     for (i = 0; i < NUM_ROWS * NUM_COLS; i++) {
-        video_mem[i << 1]++;
+        screen_mem()[i << 1]++;
     }
 }
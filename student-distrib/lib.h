@@ -11,12 +11,41 @@
 #define NUM_ROWS    25
 #define ATTRIB      0x7
 
+// Processor features probed by lib_init().
+#define CPU_ERMS    0x1
+#define CPU_SSE2    0x2
+#define CPU_SSE42   0x4
+
+// Routines of lib.c with an implementation per processor feature, and the implementations.
+//  Not every routine has every variant, LIB_VARIANT_BASE runs on any processor.
+#define LIB_MEMCPY          0
+#define LIB_MEMSET          1
+#define LIB_MEMMOVE         2
+#define LIB_STRLEN          3
+#define LIB_STRNCMP         4
+#define LIB_NUM_ROUTINES    5
+#define LIB_VARIANT_BASE    0
+#define LIB_VARIANT_ERMS    1
+#define LIB_VARIANT_SSE2    2
+#define LIB_VARIANT_SSE42   3
+#define LIB_NUM_VARIANTS    4
+
 #ifndef ASM
 
 int32_t printf(int8_t *format, ...);
 void putc(uint8_t c);
 int32_t puts(int8_t *s);
 
+// Probe the processor and pick the best variant of each routine. Needs fpu_init() first.
+void lib_init(void);
+// CPU_* features found by lib_init().
+uint32_t get_cpu_features(void);
+// Use variant of routine from now on. Return 0, or -1 if there is no such variant or the
+//  processor lacks its feature.
+int32_t lib_select(int32_t routine, int32_t variant);
+// Variant of routine in use.
+int32_t lib_get_variant(int32_t routine);
+
 int8_t *itoa(uint32_t value, int8_t* buf, int32_t radix);
 int8_t *strrev(int8_t* s);
 uint32_t strlen(const int8_t* s);
@@ -33,6 +62,14 @@ int8_t* strncpy(int8_t* dest, const int8_t*src, uint32_t n);
 
 /* Update Curosr Position */
 void update_cursor(int x, int y);
+/* Show the VGA text window from cell on, and hardware scrolling through it */
+void vga_set_start(uint32_t cell);
+void vga_ring_init(void);
+/* Show the screen of the displayed terminal, clear the screen of another one */
+void vga_show_terminal(int32_t terminal_id);
+void vga_clear_terminal(int32_t terminal_id);
+/* Move the screen of a terminal back to the start of its VGA pages */
+void vga_home(int32_t terminal_id);
 extern void backspace_delete();
 
 /* Userspace address-check functions */
@@ -41,10 +78,6 @@ int32_t safe_strncpy(int8_t* dest, const int8_t* src, int32_t n);
 
 extern void test_interrupts(void);
 
-// Load content from buf into video memory.
-extern void load_video_memory(const char *buf);
-// Backup the content in video memory into buf.
-extern void backup_video_memory(char *buf);
 // Load screen position.
 extern void load_screen_position(int x, int y);
 // Backup screen position.
@@ -102,6 +135,15 @@ static inline uint32_t inl(port) {
     return val;
 }
 
+/* Executes cpuid for leaf and subleaf, returning the four registers */
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t* eax, uint32_t* ebx,
+                         uint32_t* ecx, uint32_t* edx) {
+    asm volatile ("cpuid"
+            : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+            : "a"(leaf), "c"(subleaf)
+    );
+}
+
 /* Writes a byte to a port */
 #define outb(data, port)                \
 do {                                    \
@@ -125,7 +167,7 @@ do {                                    \
 /* Writes four bytes to four consecutive ports */
 #define outl(data, port)                \
 do {                                    \
-    asm volatile ("outl %l1, (%w0)"     \
+    asm volatile ("outl %k1, (%w0)"     \
             :                           \
             : "d"(port), "a"(data)      \
             : "memory", "cc"            \
@@ -0,0 +1,85 @@
+#include "lz4.h"
+#include "lib.h"
+
+// A sequence starts with a token: literal length in the high nibble, match length minus
+//  LZ4_MIN_MATCH in the low one. A nibble of LZ4_MORE_LENGTH continues in the bytes that
+//  follow, each adding up to LZ4_BYTE_MAX, until one is smaller.
+#define LZ4_TOKEN_SHIFT 4
+#define LZ4_LENGTH_MASK 0xf
+#define LZ4_MORE_LENGTH 15
+#define LZ4_BYTE_MAX 255
+#define LZ4_MIN_MATCH 4
+#define LZ4_OFFSET_SIZE 2
+#define VAL_8 8
+
+// Add the length bytes following a LZ4_MORE_LENGTH nibble to *length. Return 0, -1 if the
+//  input ends first.
+static int32_t read_length(const uint8_t **ip, const uint8_t *end, uint32_t *length) {
+    uint32_t byte;
+
+    do {
+        if(*ip >= end)
+            return -1;
+        byte = *(*ip)++;
+        *length += byte;
+    } while(byte == LZ4_BYTE_MAX);
+
+    return 0;
+}
+
+/*
+ *   lz4_decompress
+ *   DESCRIPTION: decompress one LZ4 block. Every offset and length is checked, so corrupt
+ *                input never reads or writes out of bounds.
+ *   INPUTS: src -- compressed data
+ *           src_len -- its length in bytes
+ *           dst -- buffer for the result
+ *           dst_len -- size of dst
+ *   OUTPUTS: decompressed data in dst
+ *   RETURN VALUE: number of bytes produced, -1 on corrupt input or if dst is too small
+ *   SIDE EFFECTS: none
+ */
+int32_t lz4_decompress(const uint8_t *src, uint32_t src_len, uint8_t *dst, uint32_t dst_len) {
+    const uint8_t *ip = src;
+    const uint8_t *end = src + src_len;
+    uint32_t op = 0;
+    uint32_t token, length, offset, i;
+
+    while(ip < end) {
+        token = *ip++;
+
+        length = token >> LZ4_TOKEN_SHIFT;
+        if(length == LZ4_MORE_LENGTH && read_length(&ip, end, &length) == -1)
+            return -1;
+        if(length > (uint32_t)(end - ip) || length > dst_len - op)
+            return -1;
+        memcpy(dst + op, ip, length);
+        ip += length;
+        op += length;
+
+        // The last sequence has no match.
+        if(ip == end)
+            break;
+
+        if(end - ip < LZ4_OFFSET_SIZE)
+            return -1;
+        offset = ip[0] | (ip[1] << VAL_8);
+        ip += LZ4_OFFSET_SIZE;
+        if(offset == 0 || offset > op)
+            return -1;
+
+        length = token & LZ4_LENGTH_MASK;
+        if(length == LZ4_MORE_LENGTH && read_length(&ip, end, &length) == -1)
+            return -1;
+        length += LZ4_MIN_MATCH;
+        if(length > dst_len - op)
+            return -1;
+
+        // Byte by byte, a match may overlap the bytes it produces.
+        for(i = 0; i < length; ++i)
+            dst[op + i] = dst[op - offset + i];
+        op += length;
+    }
+
+    return op;
+}
@@ -0,0 +1,14 @@
+#ifndef _LZ4_H_
+#define _LZ4_H_
+
+#include "types.h"
+
+#ifndef ASM
+
+// Decompress an LZ4 block, as written by mkfs -z, of src_len bytes at src into at most dst_len
+//  bytes at dst. Return the number of bytes produced, -1 if the input is corrupt or too large.
+extern int32_t lz4_decompress(const uint8_t *src, uint32_t src_len, uint8_t *dst, uint32_t dst_len);
+
+#endif
+
+#endif
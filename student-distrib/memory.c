@@ -0,0 +1,519 @@
+#include "memory.h"
+#include "paging.h"
+#include "lib.h"
+#include "fpu.h"
+
+#define VAL_22 22
+#define VAL_12 12
+#define VAL_32 32
+#define FOUR_MB_MASK 0x003fffff
+#define PT_INDEX_MASK 0x3ff
+#define NUM_BITMAP_WORDS (NUM_FRAMES / VAL_32)
+#define ALL_USED 0xffffffff
+
+// Set in the "available" bits of a PTE when the frame belongs to the frame pool.
+#define PTE_AVAILABLE_OWNED 1
+// Set in the "available" bits of a non-present PTE reserved by reserve_user_range(),
+//  the page gets a zero-filled frame on first touch.
+#define PTE_AVAILABLE_DEMAND_ZERO 2
+
+// One bit per frame in the pool, 1 means in use.
+static uint32_t frame_bitmap[NUM_BITMAP_WORDS];
+// Word index to start searching from, so allocations don't rescan the used prefix.
+static uint32_t frame_search_hint;
+static uint32_t free_frame_count;
+
+// Map the 4MB kernel page at directory index pde to physical 4MB page number page.
+static void map_kernel_4mb_page(uint32_t pde, uint32_t page) {
+    page_directory_initial[pde].entry_page.present = 1;
+    page_directory_initial[pde].entry_page.read_write = 1;
+    page_directory_initial[pde].entry_page.user_supervisor = 0; // kernel only
+    page_directory_initial[pde].entry_page.write_through = 0;
+    page_directory_initial[pde].entry_page.cache_disabled = 0;
+    page_directory_initial[pde].entry_page.accessed = 0;
+    page_directory_initial[pde].entry_page.dirty = 0;
+    page_directory_initial[pde].entry_page.page_size = 1; // 4MB page
+    page_directory_initial[pde].entry_page.global_page = 0;
+    page_directory_initial[pde].entry_page.available = 0;
+    page_directory_initial[pde].entry_page.page_table_attribute_index = 0;
+    page_directory_initial[pde].entry_page.reserved = 0;
+    page_directory_initial[pde].entry_page.page_base_address = page;
+}
+
+/*
+ *   memory_init
+ *   DESCRIPTION: Initialize the frame allocator and identity-map the frame
+ *                pool into kernel space with 4MB supervisor pages.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Modifies page_directory_initial, must be called before any
+ *                 process is created since user page directories are copied from it.
+ */
+void memory_init() {
+    uint32_t i;
+
+    for(i = 0; i < NUM_BITMAP_WORDS; ++i)
+        frame_bitmap[i] = 0;
+    frame_search_hint = 0;
+    free_frame_count = NUM_FRAMES;
+
+    for(i = FRAME_POOL_START >> VAL_22; i < FRAME_POOL_END >> VAL_22; ++i)
+        map_kernel_4mb_page(i, i);
+}
+
+/*
+ *   map_fs_window
+ *   DESCRIPTION: map the physical memory holding the file system module into the
+ *                file system window with 4MB pages
+ *   INPUTS: phys -- physical start of the module, must not overlap the program
+ *                   pages or the frame pool
+ *           length -- size of the module in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: kernel virtual address of phys, 0 if the module does not fit
+ *   SIDE EFFECTS: Modifies page_directory_initial, must be called before any
+ *                 process is created.
+ */
+uint32_t map_fs_window(uint32_t phys, uint32_t length) {
+    uint32_t first, last, i;
+
+    if(length == 0 || phys + length < phys)
+        return 0;
+    first = phys >> VAL_22;
+    last = (phys + length - 1) >> VAL_22;
+    if(last - first >= (FS_WINDOW_END - FS_WINDOW_START) >> VAL_22)
+        return 0;
+
+    for(i = first; i <= last; ++i)
+        map_kernel_4mb_page((FS_WINDOW_START >> VAL_22) + i - first, i);
+
+    return FS_WINDOW_START + (phys & FOUR_MB_MASK);
+}
+
+/*
+ *   kernel_virt_to_phys
+ *   DESCRIPTION: translate a kernel virtual address through the initial page directory
+ *   INPUTS: virt -- kernel virtual address
+ *   OUTPUTS: none
+ *   RETURN VALUE: physical address, 0 if virt is not mapped
+ *   SIDE EFFECTS: none
+ */
+uint32_t kernel_virt_to_phys(uint32_t virt) {
+    pdt_entry_t *pde = &page_directory_initial[virt >> VAL_22];
+
+    if(!pde->entry_page.present)
+        return 0;
+    // The first 4MB go through a page table that maps everything it maps one to one.
+    if(!pde->entry_page.page_size)
+        return virt;
+    return (pde->entry_page.page_base_address << VAL_22) | (virt & FOUR_MB_MASK);
+}
+
+/*
+ *   alloc_page_frame
+ *   DESCRIPTION: Allocate one zero-filled 4KB physical frame from the pool.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: physical address of the frame, 0 if the pool is exhausted
+ *   SIDE EFFECTS: none
+ */
+uint32_t alloc_page_frame() {
+    uint32_t flags;
+    uint32_t i, word, bit;
+
+    cli_and_save(flags);
+    for(i = 0; i < NUM_BITMAP_WORDS; ++i) {
+        word = (frame_search_hint + i) % NUM_BITMAP_WORDS;
+        if(frame_bitmap[word] == ALL_USED)
+            continue;
+        for(bit = 0; bit < VAL_32; ++bit) {
+            if(!(frame_bitmap[word] & (1 << bit)))
+                break;
+        }
+        frame_bitmap[word] |= 1 << bit;
+        frame_search_hint = word;
+        free_frame_count--;
+        restore_flags(flags);
+
+        uint32_t phys = FRAME_POOL_START + (word * VAL_32 + bit) * PAGE_SIZE;
+        memclear_stream((void *)phys, PAGE_SIZE);
+        return phys;
+    }
+    restore_flags(flags);
+
+    return 0;
+}
+
+/*
+ *   free_page_frame
+ *   DESCRIPTION: Return a frame to the pool.
+ *   INPUTS: phys -- physical address returned by alloc_page_frame()
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void free_page_frame(uint32_t phys) {
+    uint32_t flags;
+
+    if(phys < FRAME_POOL_START || phys >= FRAME_POOL_END)
+        return;
+
+    uint32_t frame = (phys - FRAME_POOL_START) / PAGE_SIZE;
+
+    cli_and_save(flags);
+    if(frame_bitmap[frame / VAL_32] & (1 << (frame % VAL_32))) {
+        frame_bitmap[frame / VAL_32] &= ~(1 << (frame % VAL_32));
+        free_frame_count++;
+        if(frame / VAL_32 < frame_search_hint)
+            frame_search_hint = frame / VAL_32;
+    }
+    restore_flags(flags);
+}
+
+/*
+ *   get_free_frame_count
+ *   DESCRIPTION: Get the number of frames still available.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of free frames
+ *   SIDE EFFECTS: none
+ */
+uint32_t get_free_frame_count() {
+    return free_frame_count;
+}
+
+/*
+ *   flush_tlb
+ *   DESCRIPTION: Reload CR3 so that modified page tables take effect.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Flushes all non-global TLB entries.
+ */
+void flush_tlb() {
+    asm volatile("movl %%cr3, %%eax \n\
+                  movl %%eax, %%cr3 "
+                :
+                :
+                :"eax", "memory");
+}
+
+// Check whether virt lies in the 4KB-mapped part of user space.
+static int32_t is_dynamic_user_address(uint32_t virt) {
+    if(virt < USER_DYNAMIC_START || virt >= USER_DYNAMIC_END)
+        return 0;
+    if(virt >= USER_VIDMAP_START && virt < USER_VIDMAP_END)
+        return 0;
+    return 1;
+}
+
+// Get the PTE mapping virt in process pid, or NULL if its page table doesn't exist.
+static pt_entry_t* get_user_pte(uint32_t pid, uint32_t virt) {
+    pdt_entry_t *pde = &page_directory_program[pid][virt >> VAL_22];
+
+    if(!pde->entry_PT.present || pde->entry_PT.page_size)
+        return NULL;
+
+    pt_entry_t *page_table = (pt_entry_t *)(pde->entry_PT.pt_base_address << VAL_12);
+    return &page_table[(virt >> VAL_12) & PT_INDEX_MASK];
+}
+
+// Get the PTE mapping virt in process pid, allocating its page table if needed. NULL if out of memory.
+static pt_entry_t* alloc_user_pte(uint32_t pid, uint32_t virt) {
+    pdt_entry_t *pde = &page_directory_program[pid][virt >> VAL_22];
+
+    if(!pde->entry_PT.present) {
+        uint32_t page_table = alloc_page_frame();
+        if(page_table == 0)
+            return NULL;
+
+        pde->entry_PT.present = 1;
+        pde->entry_PT.read_write = 1;
+        pde->entry_PT.user_supervisor = 1; // user privilege
+        pde->entry_PT.write_through = 0;
+        pde->entry_PT.cache_disabled = 0;
+        pde->entry_PT.accessed = 0;
+        pde->entry_PT.reserved = 0;
+        pde->entry_PT.page_size = 0; // 4KB page table
+        pde->entry_PT.global_page = 0;
+        pde->entry_PT.available = 0;
+        pde->entry_PT.pt_base_address = page_table >> VAL_12;
+    }
+
+    return get_user_pte(pid, virt);
+}
+
+/*
+ *   map_user_page
+ *   DESCRIPTION: Map a 4KB page into the dynamic user region of process pid.
+ *   INPUTS: pid -- process whose page directory is modified
+ *           virt -- page-aligned user virtual address
+ *           phys -- page-aligned physical address
+ *           writable -- whether user may write to the page
+ *           owned -- whether the frame belongs to the frame pool
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure (bad address, already mapped or reserved,
+ *                 out of memory)
+ *   SIDE EFFECTS: May allocate a page table frame.
+ */
+int32_t map_user_page(uint32_t pid, uint32_t virt, uint32_t phys, int32_t writable, int32_t owned) {
+    if(pid >= MAX_PROCESS_NUMBER || !is_dynamic_user_address(virt) || (virt & ~PAGE_MASK))
+        return -1;
+
+    pt_entry_t *pte = alloc_user_pte(pid, virt);
+    if(pte == NULL || *(uint32_t *)pte != 0)
+        return -1;
+
+    pte->read_write = writable ? 1 : 0;
+    pte->user_supervisor = 1;
+    pte->write_through = 0;
+    pte->cache_disabled = 0;
+    pte->accessed = 0;
+    pte->dirty = 0;
+    pte->pt_attribute_index = 0;
+    pte->global_page = 0;
+    pte->available = owned ? PTE_AVAILABLE_OWNED : 0;
+    pte->page_base_address = phys >> VAL_12;
+    pte->present = 1;
+
+    flush_tlb();
+
+    return 0;
+}
+
+/*
+ *   unmap_user_page
+ *   DESCRIPTION: Remove a 4KB page, or its reservation, from the dynamic user region of process pid.
+ *   INPUTS: pid -- process whose page table is modified
+ *           virt -- page-aligned user virtual address
+ *   OUTPUTS: none
+ *   RETURN VALUE: physical address that was mapped, 0 if nothing was mapped
+ *   SIDE EFFECTS: The frame is not freed, the caller owns it afterwards.
+ */
+uint32_t unmap_user_page(uint32_t pid, uint32_t virt) {
+    if(pid >= MAX_PROCESS_NUMBER || !is_dynamic_user_address(virt))
+        return 0;
+
+    pt_entry_t *pte = get_user_pte(pid, virt);
+    if(pte == NULL)
+        return 0;
+    if(!pte->present) {
+        // Drop a reservation that was never touched.
+        *(uint32_t *)pte = 0;
+        return 0;
+    }
+
+    uint32_t phys = pte->page_base_address << VAL_12;
+    *(uint32_t *)pte = 0;
+
+    flush_tlb();
+
+    return phys;
+}
+
+/*
+ *   user_virt_to_phys
+ *   DESCRIPTION: Walk page tables of process pid to translate a user address.
+ *   INPUTS: pid -- process to look up
+ *           virt -- user virtual address
+ *   OUTPUTS: none
+ *   RETURN VALUE: physical address, 0 if virt is not a present user page
+ *   SIDE EFFECTS: none
+ */
+uint32_t user_virt_to_phys(uint32_t pid, uint32_t virt) {
+    if(pid >= MAX_PROCESS_NUMBER)
+        return 0;
+
+    pdt_entry_t *pde = &page_directory_program[pid][virt >> VAL_22];
+    if(!pde->entry_page.present || !pde->entry_page.user_supervisor)
+        return 0;
+
+    if(pde->entry_page.page_size)
+        return (pde->entry_page.page_base_address << VAL_22) | (virt & FOUR_MB_MASK);
+
+    pt_entry_t *pte = get_user_pte(pid, virt);
+    if(pte == NULL || !pte->present || !pte->user_supervisor)
+        return 0;
+
+    return (pte->page_base_address << VAL_12) | (virt & ~PAGE_MASK);
+}
+
+/*
+ *   is_user_range_mapped
+ *   DESCRIPTION: Check that a user buffer is entirely mapped in process pid.
+ *   INPUTS: pid -- process to look up
+ *           addr -- start of the buffer
+ *           len -- length of the buffer in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if mapped, 0 otherwise
+ *   SIDE EFFECTS: Reserved pages in the buffer that were never touched get their frames.
+ */
+int32_t is_user_range_mapped(uint32_t pid, const void *addr, uint32_t len) {
+    uint32_t start = (uint32_t)addr;
+    uint32_t virt;
+
+    if(len == 0)
+        return 1;
+    if(start + len < start)
+        return 0;
+
+    for(virt = start & PAGE_MASK; virt < start + len; virt += PAGE_SIZE) {
+        if(user_virt_to_phys(pid, virt) == 0 && handle_user_page_fault(pid, virt) == -1)
+            return 0;
+        // Guard against wrap around at the top of address space.
+        if(virt + PAGE_SIZE < virt)
+            break;
+    }
+
+    return 1;
+}
+
+/*
+ *   is_user_page_owned
+ *   DESCRIPTION: Check if the 4KB page containing virt is backed by a pool frame.
+ *   INPUTS: pid -- process to look up
+ *           virt -- user virtual address
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if owned, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t is_user_page_owned(uint32_t pid, uint32_t virt) {
+    if(pid >= MAX_PROCESS_NUMBER || !is_dynamic_user_address(virt))
+        return 0;
+
+    pt_entry_t *pte = get_user_pte(pid, virt);
+    if(pte == NULL || !pte->present)
+        return 0;
+
+    return pte->available == PTE_AVAILABLE_OWNED;
+}
+
+/*
+ *   find_free_user_range
+ *   DESCRIPTION: Find a run of unmapped and unreserved pages in the mmap region of process pid.
+ *   INPUTS: pid -- process to look up
+ *           npages -- number of consecutive 4KB pages wanted
+ *   OUTPUTS: none
+ *   RETURN VALUE: start address of the run, 0 if there is no such run
+ *   SIDE EFFECTS: none
+ */
+uint32_t find_free_user_range(uint32_t pid, uint32_t npages) {
+    uint32_t virt, start = USER_MMAP_START, count = 0;
+
+    if(npages == 0)
+        return 0;
+
+    for(virt = USER_MMAP_START; virt < USER_MMAP_END; virt += PAGE_SIZE) {
+        pt_entry_t *pte = get_user_pte(pid, virt);
+        if(pte != NULL && *(uint32_t *)pte != 0) {
+            count = 0;
+            start = virt + PAGE_SIZE;
+            continue;
+        }
+        if(++count == npages)
+            return start;
+    }
+
+    return 0;
+}
+
+/*
+ *   reserve_user_range
+ *   DESCRIPTION: Reserve pages in the dynamic user region of process pid without backing
+ *                them. Each page gets a zero-filled frame the first time it is touched.
+ *   INPUTS: pid -- process whose page tables are modified
+ *           virt -- page-aligned start of the range
+ *           npages -- number of 4KB pages
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if any page is already in use or out of memory
+ *   SIDE EFFECTS: May allocate page table frames.
+ */
+int32_t reserve_user_range(uint32_t pid, uint32_t virt, uint32_t npages) {
+    uint32_t i;
+    pt_entry_t *pte;
+
+    if(pid >= MAX_PROCESS_NUMBER || (virt & ~PAGE_MASK))
+        return -1;
+
+    for(i = 0; i < npages; ++i) {
+        pte = NULL;
+        if(is_dynamic_user_address(virt + i * PAGE_SIZE))
+            pte = alloc_user_pte(pid, virt + i * PAGE_SIZE);
+        if(pte == NULL || *(uint32_t *)pte != 0) {
+            // Undo the reservations made so far.
+            while(i-- > 0)
+                *(uint32_t *)get_user_pte(pid, virt + i * PAGE_SIZE) = 0;
+            return -1;
+        }
+        pte->available = PTE_AVAILABLE_DEMAND_ZERO;
+    }
+
+    return 0;
+}
+
+/*
+ *   handle_user_page_fault
+ *   DESCRIPTION: Give a reserved page of process pid a zero-filled frame.
+ *   INPUTS: pid -- process that faulted
+ *           virt -- faulting user virtual address
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if the page is now mapped, -1 if virt was not reserved or out of memory
+ *   SIDE EFFECTS: none
+ */
+int32_t handle_user_page_fault(uint32_t pid, uint32_t virt) {
+    if(pid >= MAX_PROCESS_NUMBER || !is_dynamic_user_address(virt))
+        return -1;
+
+    pt_entry_t *pte = get_user_pte(pid, virt);
+    if(pte == NULL || pte->present || pte->available != PTE_AVAILABLE_DEMAND_ZERO)
+        return -1;
+
+    uint32_t phys = alloc_page_frame();
+    if(phys == 0)
+        return -1;
+
+    *(uint32_t *)pte = 0;
+    if(map_user_page(pid, virt & PAGE_MASK, phys, 1, 1) == -1) {
+        free_page_frame(phys);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ *   release_user_memory
+ *   DESCRIPTION: Unmap everything in the dynamic user region of process pid and
+ *                give pool frames and page tables back to the allocator.
+ *   INPUTS: pid -- process being torn down
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void release_user_memory(uint32_t pid) {
+    uint32_t i, j;
+
+    if(pid >= MAX_PROCESS_NUMBER)
+        return;
+
+    for(i = USER_DYNAMIC_START >> VAL_22; i < USER_DYNAMIC_END >> VAL_22; ++i) {
+        if(i == USER_VIDMAP_START >> VAL_22)
+            continue;
+
+        pdt_entry_t *pde = &page_directory_program[pid][i];
+        if(!pde->entry_PT.present || pde->entry_PT.page_size)
+            continue;
+
+        pt_entry_t *page_table = (pt_entry_t *)(pde->entry_PT.pt_base_address << VAL_12);
+        for(j = 0; j < NUM_PT_SIZE; ++j) {
+            if(page_table[j].present && page_table[j].available == PTE_AVAILABLE_OWNED)
+                free_page_frame(page_table[j].page_base_address << VAL_12);
+        }
+
+        free_page_frame((uint32_t)page_table);
+        pde->entry_PT.present = 0;
+        pde->entry_PT.pt_base_address = 0;
+    }
+
+    flush_tlb();
+}
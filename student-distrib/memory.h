@@ -0,0 +1,97 @@
+#ifndef _MEMORY_H_
+#define _MEMORY_H_
+
+#include "types.h"
+
+// Size of a small (4KB) page.
+#define PAGE_SIZE 0x1000
+#define PAGE_MASK 0xfffff000
+
+// Physical page frames handed out by the frame allocator live in [32MB, 64MB).
+//  User programs occupy 8MB + pid * 4MB, so the pool starts right after the
+//  last possible user program page. The pool is identity-mapped into kernel
+//  space (supervisor only) so that the kernel can touch any frame directly.
+#define FRAME_POOL_START 0x02000000
+#define FRAME_POOL_END 0x04000000
+#define NUM_FRAMES ((FRAME_POOL_END - FRAME_POOL_START) / PAGE_SIZE)
+
+// Kernel virtual window for the file system module, right after the frame pool and
+//  below the user program page at 128MB. Mapped with 4MB supervisor pages, so any
+//  image up to 64MB fits no matter where the boot loader put it.
+#define FS_WINDOW_START 0x04000000
+#define FS_WINDOW_END 0x08000000
+
+// Virtual address range in every process that is mapped with 4KB pages on demand.
+//  It starts right after the 4MB program page at 128MB. The 4MB region starting
+//  at 140MB is reserved for syscall_vidmap() and is never touched here.
+#define USER_DYNAMIC_START 0x08400000
+#define USER_DYNAMIC_END 0x10000000
+#define USER_VIDMAP_START 0x08c00000
+#define USER_VIDMAP_END 0x09000000
+
+// Region grown and shrunk by syscall_brk(), between the program page and the vidmap page.
+#define USER_HEAP_START USER_DYNAMIC_START
+#define USER_HEAP_END USER_VIDMAP_START
+
+// Region used to place mappings the kernel picks an address for, e.g. pages
+//  received through IPC.
+#define USER_MMAP_START 0x09000000
+#define USER_MMAP_END USER_DYNAMIC_END
+
+#ifndef ASM
+
+// Initialize the frame allocator and map the frame pool into kernel space.
+extern void memory_init();
+
+// Allocate a zero-filled physical page frame. Return its physical address, or 0 if none left.
+extern uint32_t alloc_page_frame();
+
+// Return a frame obtained from alloc_page_frame() to the pool.
+extern void free_page_frame(uint32_t phys);
+
+// Number of frames still available in the pool.
+extern uint32_t get_free_frame_count();
+
+// Map length bytes of physical memory at phys into the file system window. Return the
+//  virtual address of phys, or 0 if it does not fit. Must be called before any process exists.
+extern uint32_t map_fs_window(uint32_t phys, uint32_t length);
+
+// Physical address behind a kernel virtual address, 0 if it is not mapped.
+extern uint32_t kernel_virt_to_phys(uint32_t virt);
+
+// Map one 4KB user page of process pid. Page tables are allocated on demand.
+//  owned - whether the frame belongs to the frame pool and should be freed on unmap.
+extern int32_t map_user_page(uint32_t pid, uint32_t virt, uint32_t phys, int32_t writable, int32_t owned);
+
+// Remove one 4KB user page of process pid. Return the physical frame it mapped, or 0.
+//  Frames owned by the pool are NOT freed here, the caller decides what to do with them.
+extern uint32_t unmap_user_page(uint32_t pid, uint32_t virt);
+
+// Translate a user virtual address of process pid into a physical address, 0 if unmapped.
+extern uint32_t user_virt_to_phys(uint32_t pid, uint32_t virt);
+
+// Whether every byte of [addr, addr + len) is a present user page of process pid.
+//  Reserved pages in the range are filled in on the way.
+extern int32_t is_user_range_mapped(uint32_t pid, const void *addr, uint32_t len);
+
+// Whether the 4KB user page containing virt is mapped with a pool-owned frame.
+extern int32_t is_user_page_owned(uint32_t pid, uint32_t virt);
+
+// Find npages consecutive unmapped pages in [USER_MMAP_START, USER_MMAP_END). Return 0 if none.
+extern uint32_t find_free_user_range(uint32_t pid, uint32_t npages);
+
+// Reserve npages pages starting at virt, to be zero-filled on first touch. Return 0 or -1.
+extern int32_t reserve_user_range(uint32_t pid, uint32_t virt, uint32_t npages);
+
+// Back the reserved page containing virt with a zero-filled frame. Return 0, or -1 if not reserved.
+extern int32_t handle_user_page_fault(uint32_t pid, uint32_t virt);
+
+// Free every 4KB user page and page table of process pid, called when it halts.
+extern void release_user_memory(uint32_t pid);
+
+// Flush TLB entries of current address space after page tables have been modified.
+extern void flush_tlb();
+
+#endif
+
+#endif
@@ -0,0 +1,153 @@
+#include "pci.h"
+#include "lib.h"
+
+#define PCI_ENABLE 0x80000000
+#define PCI_NUM_BUSES 256
+#define PCI_NUM_SLOTS 32
+#define PCI_NUM_FUNCS 8
+#define PCI_BUS_SHIFT 16
+#define PCI_SLOT_SHIFT 11
+#define PCI_FUNC_SHIFT 8
+#define PCI_OFFSET_MASK 0xfc
+#define PCI_VENDOR_MASK 0xffff
+#define PCI_ID_MASK 0xffffffff
+#define PCI_DEVICE_SHIFT 16
+#define PCI_CLASS_MASK 0xffff0000
+#define PCI_CLASS_SHIFT 24
+#define PCI_SUBCLASS_SHIFT 16
+// Bit of the header type byte (bits 16-23 of register 0x0C) set for multi-function devices.
+#define PCI_MULTI_FUNCTION 0x00800000
+
+// Select a configuration register of dev through the address port.
+static void pci_select(pci_device_t *dev, uint8_t offset) {
+    outl(PCI_ENABLE | ((uint32_t)dev->bus << PCI_BUS_SHIFT) | ((uint32_t)dev->slot << PCI_SLOT_SHIFT)
+            | ((uint32_t)dev->func << PCI_FUNC_SHIFT) | (offset & PCI_OFFSET_MASK), PCI_CONFIG_ADDRESS);
+}
+
+/*
+ *   pci_config_read
+ *   DESCRIPTION: read a register from the configuration space of a PCI function
+ *   INPUTS: dev -- the function
+ *           offset -- register offset, 4-byte aligned
+ *   OUTPUTS: none
+ *   RETURN VALUE: register value, all ones if there is no such function
+ *   SIDE EFFECTS: none
+ */
+uint32_t pci_config_read(pci_device_t *dev, uint8_t offset) {
+    uint32_t flags, value;
+
+    cli_and_save(flags);
+    pci_select(dev, offset);
+    value = inl(PCI_CONFIG_DATA);
+    restore_flags(flags);
+
+    return value;
+}
+
+/*
+ *   pci_config_write
+ *   DESCRIPTION: write a register in the configuration space of a PCI function
+ *   INPUTS: dev -- the function
+ *           offset -- register offset, 4-byte aligned
+ *           value -- value to write
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void pci_config_write(pci_device_t *dev, uint8_t offset, uint32_t value) {
+    uint32_t flags;
+
+    cli_and_save(flags);
+    pci_select(dev, offset);
+    outl(value, PCI_CONFIG_DATA);
+    restore_flags(flags);
+}
+
+/*
+ *   pci_find
+ *   DESCRIPTION: enumerate every function on every bus and return the first one
+ *                whose configuration register reg, masked with mask, equals value
+ *   INPUTS: reg -- register offset, 4-byte aligned
+ *           mask, value -- what to compare
+ *   OUTPUTS: dev -- location of the first match
+ *   RETURN VALUE: 0 if found, -1 otherwise
+ *   SIDE EFFECTS: none
+ */
+static int32_t pci_find(uint8_t reg, uint32_t mask, uint32_t value, pci_device_t *dev) {
+    pci_device_t curr;
+    uint32_t bus, slot, func, num_funcs;
+
+    for(bus = 0; bus < PCI_NUM_BUSES; ++bus) {
+        for(slot = 0; slot < PCI_NUM_SLOTS; ++slot) {
+            curr.bus = bus;
+            curr.slot = slot;
+            curr.func = 0;
+            if((pci_config_read(&curr, PCI_VENDOR_ID) & PCI_VENDOR_MASK) == PCI_NO_DEVICE)
+                continue;
+            num_funcs = (pci_config_read(&curr, PCI_HEADER_TYPE) & PCI_MULTI_FUNCTION) ? PCI_NUM_FUNCS : 1;
+
+            for(func = 0; func < num_funcs; ++func) {
+                curr.func = func;
+                if((pci_config_read(&curr, PCI_VENDOR_ID) & PCI_VENDOR_MASK) == PCI_NO_DEVICE)
+                    continue;
+                if((pci_config_read(&curr, reg) & mask) == value) {
+                    *dev = curr;
+                    return 0;
+                }
+            }
+        }
+    }
+
+    return -1;
+}
+
+/*
+ *   pci_find_class
+ *   DESCRIPTION: find a function by class code
+ *   INPUTS: class_code -- base class, e.g. 0x01 for mass storage
+ *           subclass -- subclass, e.g. 0x01 for IDE
+ *   OUTPUTS: dev -- location of the first match
+ *   RETURN VALUE: 0 if found, -1 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t pci_find_class(uint8_t class_code, uint8_t subclass, pci_device_t *dev) {
+    return pci_find(PCI_CLASS_REVISION, PCI_CLASS_MASK,
+                    ((uint32_t)class_code << PCI_CLASS_SHIFT) | ((uint32_t)subclass << PCI_SUBCLASS_SHIFT), dev);
+}
+
+/*
+ *   pci_find_device
+ *   DESCRIPTION: find a function by vendor and device id
+ *   INPUTS: vendor_id, device_id -- ids to look for
+ *   OUTPUTS: dev -- location of the first match
+ *   RETURN VALUE: 0 if found, -1 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t pci_find_device(uint16_t vendor_id, uint16_t device_id, pci_device_t *dev) {
+    return pci_find(PCI_VENDOR_ID, PCI_ID_MASK, ((uint32_t)device_id << PCI_DEVICE_SHIFT) | vendor_id, dev);
+}
+
+/*
+ *   pci_enable_bus_master
+ *   DESCRIPTION: turn on I/O space decoding and bus mastering of a PCI function
+ *   INPUTS: dev -- the function
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the device may now perform DMA
+ */
+void pci_enable_bus_master(pci_device_t *dev) {
+    uint32_t command = pci_config_read(dev, PCI_COMMAND);
+    pci_config_write(dev, PCI_COMMAND, command | PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+}
+
+/*
+ *   pci_irq_line
+ *   DESCRIPTION: get the legacy IRQ a PCI function interrupts on
+ *   INPUTS: dev -- the function
+ *   OUTPUTS: none
+ *   RETURN VALUE: IRQ number from the interrupt line register
+ *   SIDE EFFECTS: none
+ */
+uint32_t pci_irq_line(pci_device_t *dev) {
+    return pci_config_read(dev, PCI_INTERRUPT_LINE) & PCI_IRQ_LINE_MASK;
+}
@@ -0,0 +1,56 @@
+#ifndef _PCI_H_
+#define _PCI_H_
+
+#include "types.h"
+
+// Configuration mechanism #1 ports.
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+// Offsets into the configuration space header.
+#define PCI_VENDOR_ID 0x00
+#define PCI_COMMAND 0x04
+#define PCI_CLASS_REVISION 0x08
+#define PCI_HEADER_TYPE 0x0C
+#define PCI_BAR0 0x10
+#define PCI_BAR4 0x20
+#define PCI_INTERRUPT_LINE 0x3C
+
+// Bits of the command register.
+#define PCI_COMMAND_IO 0x1
+#define PCI_COMMAND_BUS_MASTER 0x4
+
+// An I/O space BAR has bit 0 set, the port base is in the remaining bits.
+#define PCI_BAR_IO 0x1
+#define PCI_BAR_IO_MASK 0xfffffffc
+
+#define PCI_NO_DEVICE 0xffff
+#define PCI_IRQ_LINE_MASK 0xff
+
+#ifndef ASM
+
+// Location of a function on the PCI bus.
+typedef struct pci_device {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t func;
+} pci_device_t;
+
+// Read or write a 32-bit register in the configuration space of dev. offset is 4-byte aligned.
+extern uint32_t pci_config_read(pci_device_t *dev, uint8_t offset);
+extern void pci_config_write(pci_device_t *dev, uint8_t offset, uint32_t value);
+
+// Find the first function with the given class and subclass, or vendor and device id.
+//  Return 0 and fill in dev, -1 if none.
+extern int32_t pci_find_class(uint8_t class_code, uint8_t subclass, pci_device_t *dev);
+extern int32_t pci_find_device(uint16_t vendor_id, uint16_t device_id, pci_device_t *dev);
+
+// IRQ line the BIOS routed the interrupt pin of dev to.
+extern uint32_t pci_irq_line(pci_device_t *dev);
+
+// Let dev access I/O ports and master the bus for DMA.
+extern void pci_enable_bus_master(pci_device_t *dev);
+
+#endif
+
+#endif
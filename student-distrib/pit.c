@@ -6,6 +6,8 @@
 #include "terminal.h"
 #include "paging.h"
 #include "syscall.h"
+#include "block_device.h"
+#include "bcache.h"
 
 #define TOTAL_CLOCK_FREQ 1193182
 #define PIT_COMMAND_REGISTER 0x43
@@ -53,6 +55,10 @@ void pit_init(int32_t freq){
 void pit_handler(){
 	send_eoi(PIT_IRQ);
 
+    // Back from a shell launched below, if any, so processes can sleep on disk I/O again.
+    block_set_polling(0);
+    bcache_tick();
+
     if(!is_scheduling_started())
         return;
 
@@ -79,6 +85,8 @@ void pit_handler(){
 
         // Set the initial cursor for next shell to origin.
         load_screen_position(0, 0);
+        // Loading the shell runs inside this handler, where nothing can sleep.
+        block_set_polling(1);
         (void) syscall_execute((uint8_t*)"shell");
 
         // We will never really reach here.
@@ -86,5 +94,10 @@ void pit_handler(){
     }
 
     // If all terminals are active, switch to next scheduled process.
-    switch_process(next_scheduled_process());
+    //  Keep running the current one if nothing else is runnable, e.g. when
+    //  every other process is blocked.
+    int32_t next_pid = next_scheduled_process();
+    if(next_pid == -1)
+        return;
+    switch_process(next_pid);
 }
@@ -2,6 +2,7 @@
 #include "terminal.h"
 #include "paging.h"
 #include "x86_desc.h"
+#include "lib.h"
 
 // Current number of processes.
 uint32_t process_count;
@@ -146,6 +147,8 @@ void switch_process(uint32_t pid) {
 
     // Switch paging
     load_page_directory(page_directory_program[next_pcb->pid]);
+    // The FPU registers are switched lazily, on the first FPU instruction of next process.
+    fpu_switch(next_pcb->pid);
 
     // The kernel space of a process in physical memory starts at 8MB - 8KB - 8KB * pid.
     uint32_t kernel_space_base_address = KERNEL_MEMORY_BOT - KERNEL_STACK_SIZE - KERNEL_STACK_SIZE * next_pcb->pid;
@@ -200,3 +203,53 @@ int32_t is_scheduling_started() {
  }
 
 
+
+/*
+ *   sleep_current_process
+ *   DESCRIPTION: block the current process until wake_process() is called on it.
+ *   INPUTS: NONE
+ *   OUTPUTS: NONE
+ *   SIDE EFFECTS: enables interrupts
+ */
+void sleep_current_process() {
+    sleep_and_switch_to(-1);
+}
+
+/*
+ *   sleep_and_switch_to
+ *   DESCRIPTION: block the current process until wake_process() is called on it.
+ *                The process is marked inactive so the scheduler skips it. If pid
+ *                is runnable the CPU is handed to it right away (direct handoff),
+ *                otherwise we halt until the scheduler switches away from us.
+ *   INPUTS: pid -- process to switch to, -1 for no preference
+ *   OUTPUTS: NONE
+ *   SIDE EFFECTS: enables interrupts
+ */
+void sleep_and_switch_to(int32_t pid) {
+    pcb_t *pcb = get_current_pcb();
+
+    cli();
+    pcb->active = 0;
+    if(pid >= 0 && pid < MAX_PROCESS_NUMBER && pid != pcb->pid
+                && process_exist[pid] && get_pcb(pid)->active)
+        switch_process(pid);
+
+    while(!pcb->active) {
+        // sti takes effect after the next instruction, so no wakeup is lost in between.
+        asm volatile("sti; hlt; cli" : : : "memory");
+    }
+    sti();
+}
+
+/*
+ *   wake_process
+ *   DESCRIPTION: mark a process blocked in sleep_current_process() runnable
+ *   INPUTS: pid -- process to wake
+ *   OUTPUTS: NONE
+ *   SIDE EFFECTS: none
+ */
+void wake_process(uint32_t pid) {
+    if(pid >= MAX_PROCESS_NUMBER || !process_exist[pid])
+        return;
+    get_pcb(pid)->active = 1;
+}
@@ -6,6 +6,9 @@
 #ifndef ASM
 
 #include "types.h"
+#include "file_system.h"
+#include "vfs.h"
+#include "fpu.h"
 
 #define MAX_FD_SIZE 8
 #define MIN_FD_SIZE 2
@@ -39,6 +42,8 @@ typedef struct file_desc {
     int32_t inode;
     int32_t file_position;
     int32_t flag;
+    block_run_t block_run;      // last run of blocks read through this file
+    vnode_t* vnode;             // cached inode of the file, NULL for the terminal
 } file_desc_t;
 
 /*
@@ -51,6 +56,9 @@ typedef struct file_desc {
         active - whether this process is active for scheduling
         esp - the latest esp when the process became inactive (e.g. switch out by the scheduler)
         ebp - the latest esp when the process became inactive (e.g. switch out by the scheduler)
+        heap_break - end of the heap grown by brk
+        fpu_state - FPU and SSE registers, saved when another process takes the FPU
+        fpu_used - whether fpu_state holds anything, 0 until the first FPU instruction
 */
 typedef struct pcb {
     uint32_t pid;
@@ -61,6 +69,9 @@ typedef struct pcb {
     int32_t active;
     uint32_t esp;
     uint32_t ebp;
+    uint32_t heap_break;
+    fpu_state_t fpu_state;
+    int32_t fpu_used;
 } pcb_t;
 
 // Flags showing whether a process exists.
@@ -90,6 +101,12 @@ extern void start_scheduling();
 extern int32_t is_scheduling_started();
 //get the process count
 extern uint32_t get_process_count();
+// Block the current process until another process wakes it up.
+extern void sleep_current_process();
+// Block the current process and hand the CPU straight to pid, -1 to let the scheduler pick.
+extern void sleep_and_switch_to(int32_t pid);
+// Mark a blocked process runnable again.
+extern void wake_process(uint32_t pid);
 
 #endif
 
@@ -7,6 +7,10 @@
 #include "process.h"
 #include "rtc.h"
 #include "terminal.h"
+#include "memory.h"
+#include "ipc.h"
+#include "futex.h"
+#include "vfs.h"
 
 #define VAL_2 2
 #define VAL_22 22
@@ -20,15 +24,31 @@
 #define PD_ENTRY_IDX 35
 #define PT_ENTRY_IDX 512
 #define PT_IDX_VIDEO_MEM 184
-#define PT_IDX_ALWAY_TO_PHYSICAL_VIDEO_MEM 185
 #define PD_IDX_FIRST_4MB 0
+#define MAX_FILE_MAPPINGS 8
+
+// A file mapped by syscall_mmap(), its blocks may be mapped straight from the image.
+typedef struct file_mapping {
+    uint32_t start;
+    uint32_t npages;
+    vnode_t *vnode;
+} file_mapping_t;
+
+static file_mapping_t file_mappings[MAX_PROCESS_NUMBER][MAX_FILE_MAPPINGS];
 
 // jump table for various system calls
 uint32_t syscall_jump_table[NUM_SYSCALL] =   {   0,
                                         (uint32_t)syscall_halt, (uint32_t)syscall_execute, (uint32_t)syscall_read,
                                         (uint32_t)syscall_write, (uint32_t)syscall_open, (uint32_t)syscall_close,
                                         (uint32_t)syscall_getargs, (uint32_t)syscall_vidmap, (uint32_t)syscall_set_handler,
-                                        (uint32_t)syscall_sigreturn
+                                        (uint32_t)syscall_sigreturn, (uint32_t)syscall_ipc_send, (uint32_t)syscall_ipc_receive,
+                                        (uint32_t)syscall_ipc_reply, (uint32_t)syscall_futex_wait, (uint32_t)syscall_futex_wake,
+                                        (uint32_t)syscall_brk, (uint32_t)syscall_mmap, (uint32_t)syscall_munmap,
+                                        (uint32_t)syscall_sendfile, (uint32_t)syscall_getdents,
+                                        (uint32_t)syscall_lseek, (uint32_t)syscall_pread, (uint32_t)syscall_fstat,
+                                        (uint32_t)syscall_readv, (uint32_t)syscall_writev,
+                                        (uint32_t)syscall_create, (uint32_t)syscall_unlink, (uint32_t)syscall_truncate,
+                                        (uint32_t)syscall_mkdir
                                     };
 
 
@@ -36,9 +56,31 @@ uint32_t syscall_jump_table[NUM_SYSCALL] =   {   0,
 fops_t stdin = {(read_t)terminal_read, (write_t)terminal_write, (open_t)terminal_open, (close_t)terminal_close};
 fops_t stdout = {(read_t)terminal_read, (write_t)terminal_write, (open_t)terminal_open, (close_t)terminal_close};
 fops_t rtc_ops = {(read_t)rtc_read, (write_t)rtc_write, (open_t)rtc_open, (close_t)rtc_close};
-fops_t file_ops = {(read_t)file_read, (write_t)file_write, (open_t)file_open, (close_t)file_close};
+fops_t file_ops = {(read_t)vfs_file_read, (write_t)vfs_file_write, (open_t)vfs_file_open, (close_t)vfs_file_close};
 fops_t dir_ops = {(read_t)directory_read, (write_t)directory_write, (open_t)directory_open, (close_t)directory_close}; 
 
+// Drop the file mappings of process pid that overlap the range and have no page left mapped,
+//  so that their files may be truncated or unlinked again.
+static void release_file_mappings(uint32_t pid, uint32_t start, uint32_t npages) {
+    file_mapping_t *mapping;
+    uint32_t i, virt;
+
+    for(i = 0; i < MAX_FILE_MAPPINGS; ++i) {
+        mapping = &file_mappings[pid][i];
+        if(mapping->vnode == NULL || mapping->start >= start + npages * PAGE_SIZE ||
+           start >= mapping->start + mapping->npages * PAGE_SIZE)
+            continue;
+        for(virt = mapping->start; virt < mapping->start + mapping->npages * PAGE_SIZE; virt += PAGE_SIZE) {
+            if(user_virt_to_phys(pid, virt) != 0)
+                break;
+        }
+        if(virt < mapping->start + mapping->npages * PAGE_SIZE)
+            continue;
+        vfs_unmap(mapping->vnode);
+        mapping->vnode = NULL;
+    }
+}
+
 
 // This function actually implements syscall_halt(). The reason to 
 //  create another function is just to support return status greater
@@ -59,12 +101,21 @@ int32_t halt_current_process(uint32_t status) {
 
     pcb_t *pcb = get_current_pcb();
 
+    // A fault in a streaming copy halts us with the SSE registers still taken.
+    kernel_fpu_abort();
+
     for(i=VAL_2;i<MAX_FD_SIZE;i++){
         if(pcb -> file_array[i].flag != 0){
              syscall_close(i);
         }
     }
 
+    // Wake up anyone waiting on us and give back 4KB pages of this process.
+    ipc_release(pcb->pid);
+    release_user_memory(pcb->pid);
+    release_file_mappings(pcb->pid, USER_MMAP_START, (USER_MMAP_END - USER_MMAP_START) / PAGE_SIZE);
+    fpu_release(pcb->pid);
+
     if(pcb->parent_pid == -1) {
         // If the first shell on any terminal is halted, restart it automatically.
         (void) release_pid(pcb->pid);
@@ -88,6 +139,7 @@ int32_t halt_current_process(uint32_t status) {
 
     // Restore page directory for parent process.
     load_page_directory(page_directory_program[pcb->parent_pid]);
+    fpu_switch(pcb->parent_pid);
 
     // Release the pid of current process.
     (void) release_pid(pcb->pid);
@@ -138,7 +190,7 @@ int32_t syscall_execute (const uint8_t* command) {
     int j;
     // Parse the executable name.
     // TODO: Parse remaining arguments.
-    uint8_t filename[FILE_NAME_MAX_LENGTH + 1];
+    uint8_t filename[FS_MAX_PATH_LENGTH + 1];
     uint8_t args[MAX_ARG_SIZE];
     for(i = 0; i < strlen((int8_t*)command) + 1; ++i) {
         if(command[i] == ' ' || command[i] == '\0') {
@@ -147,7 +199,7 @@ int32_t syscall_execute (const uint8_t* command) {
             break;
         }
         
-        if(i >= FILE_NAME_MAX_LENGTH)
+        if(i >= FS_MAX_PATH_LENGTH)
             return -1;
     }
 
@@ -200,25 +252,8 @@ int32_t syscall_execute (const uint8_t* command) {
         page_table_terminal_video_memory[pcb->terminal_id][PT_IDX_VIDEO_MEM].pt_attribute_index = 0;
         page_table_terminal_video_memory[pcb->terminal_id][PT_IDX_VIDEO_MEM].global_page = 0;
         page_table_terminal_video_memory[pcb->terminal_id][PT_IDX_VIDEO_MEM].available = 0;
-        // If this terminal is currently displayed, map video memory addresses to physical video memory.
-        //  Otherwise map to video memory backstorage
-        if(pcb->terminal_id == get_display_terminal())
-            page_table_terminal_video_memory[pcb->terminal_id][PT_IDX_VIDEO_MEM].page_base_address = VIDEO >> VAL_12;
-        else
-            page_table_terminal_video_memory[pcb->terminal_id][PT_IDX_VIDEO_MEM].page_base_address = (uint32_t)(video_mem_backstore[pcb->terminal_id]) >> VAL_12;
-
-        // Always map the next 4KB page to physical video memory so that each process still has access.
-        page_table_terminal_video_memory[pcb->terminal_id][PT_IDX_ALWAY_TO_PHYSICAL_VIDEO_MEM].present = 1;
-        page_table_terminal_video_memory[pcb->terminal_id][PT_IDX_ALWAY_TO_PHYSICAL_VIDEO_MEM].read_write = 1;
-        page_table_terminal_video_memory[pcb->terminal_id][PT_IDX_ALWAY_TO_PHYSICAL_VIDEO_MEM].user_supervisor = 1;
-        page_table_terminal_video_memory[pcb->terminal_id][PT_IDX_ALWAY_TO_PHYSICAL_VIDEO_MEM].write_through = 0;
-        page_table_terminal_video_memory[pcb->terminal_id][PT_IDX_ALWAY_TO_PHYSICAL_VIDEO_MEM].cache_disabled = 0;
-        page_table_terminal_video_memory[pcb->terminal_id][PT_IDX_ALWAY_TO_PHYSICAL_VIDEO_MEM].accessed = 0;
-        page_table_terminal_video_memory[pcb->terminal_id][PT_IDX_ALWAY_TO_PHYSICAL_VIDEO_MEM].dirty = 0;
-        page_table_terminal_video_memory[pcb->terminal_id][PT_IDX_ALWAY_TO_PHYSICAL_VIDEO_MEM].pt_attribute_index = 0;
-        page_table_terminal_video_memory[pcb->terminal_id][PT_IDX_ALWAY_TO_PHYSICAL_VIDEO_MEM].global_page = 0;
-        page_table_terminal_video_memory[pcb->terminal_id][PT_IDX_ALWAY_TO_PHYSICAL_VIDEO_MEM].available = 0;
-        page_table_terminal_video_memory[pcb->terminal_id][PT_IDX_ALWAY_TO_PHYSICAL_VIDEO_MEM].page_base_address = VIDEO >> VAL_12;
+        // Map video memory addresses to the VGA page of this terminal, whether it is displayed or not.
+        page_table_terminal_video_memory[pcb->terminal_id][PT_IDX_VIDEO_MEM].page_base_address = TERMINAL_VGA_PAGE(pcb->terminal_id) >> VAL_12;
     }
     else {
         pcb->terminal_id = get_current_pcb()->terminal_id;
@@ -271,6 +306,13 @@ int32_t syscall_execute (const uint8_t* command) {
 
     pcb->file_array[0].flag = 1;
     pcb->file_array[1].flag = 1;
+    pcb->file_array[0].vnode = NULL;
+    pcb->file_array[1].vnode = NULL;
+
+    // Heap starts out empty.
+    pcb->heap_break = USER_HEAP_START;
+    // FPU state starts out as left by fninit, on the first FPU instruction.
+    pcb->fpu_used = 0;
 
     for(i = 2; i < MAX_FD_SIZE; i++)
         pcb -> file_array[i].flag = 0; 
@@ -308,6 +350,7 @@ int32_t syscall_execute (const uint8_t* command) {
     tss.ss0 = KERNEL_DS;
     // Kernel stacks begins at highest address of kernel space and grows towards lower address.
     tss.esp0 = kernel_space_base_address + KERNEL_STACK_SIZE - 1;
+    fpu_switch(pid);
 
     // PUSH IRET context and switch to user mode.
     switch_to_user(USER_DS, USER_STACK_BOTTOM_VIRTUAL, USER_CS, entry_address);
@@ -394,7 +437,8 @@ int32_t syscall_write (int32_t fd, const void* buf, int32_t nbytes) {
 
 /*
  *   syscall_open
- *   DESCRIPTION: open a file
+ *   DESCRIPTION: open a file. The name is looked up through the VFS in the file system
+ *                it is mounted on, a file that is already open shares its cached inode.
  *   INPUTS: filename  --  file to be opened
  *   OUTPUTS: none
  *   RETURN VALUE: file descriptor index
@@ -404,12 +448,11 @@ int32_t syscall_write (int32_t fd, const void* buf, int32_t nbytes) {
 int32_t syscall_open(const uint8_t* filename) {
 
     int32_t i = 0;
-    dentry_t fileopen;
+    vnode_t *vnode;
     
     // error handling
-    if (filename == NULL || read_dentry_by_name(filename, &fileopen) == -1){
+    if (filename == NULL)
         return -1;
-    }
 
     //create current pcb
     pcb_t * curr_pcb = get_current_pcb();
@@ -426,34 +469,40 @@ int32_t syscall_open(const uint8_t* filename) {
     // when pcd arry is full
     if(i == MAX_FD_SIZE) return -1;
 
-    // set current pcb in use
-    curr_pcb->file_array[i].flag = 1;
+    vnode = vfs_open(filename);
+    if (vnode == NULL)
+        return -1;
 
     // determine file type
-    switch(fileopen.file_type){
+    switch(vnode->type){
 
         case RTC_TYPE:
         curr_pcb -> file_array[i].fops = &rtc_ops;
-        curr_pcb -> file_array[i].inode = fileopen.inode_idx;
-        curr_pcb -> file_array[i].fops->open_func(filename);
-        return i;
+        break;
 
         case DIR_TYPE:
         curr_pcb -> file_array[i].fops = &dir_ops;
-        curr_pcb -> file_array[i].inode = fileopen.inode_idx;
-        curr_pcb -> file_array[i].fops->open_func(filename);
-        return i;
+        break;
 
         case FILE_TYPE:
         curr_pcb -> file_array[i].fops = &file_ops;
-        curr_pcb -> file_array[i].inode = fileopen.inode_idx;
-        curr_pcb -> file_array[i].fops->open_func(filename);
-        return i;
+        break;
 
         default:
+        vfs_close(vnode);
         return -1;
 
     }
+
+    // set current pcb in use
+    curr_pcb->file_array[i].flag = 1;
+    curr_pcb->file_array[i].file_position = 0;
+    curr_pcb->file_array[i].block_run.count = 0;
+    curr_pcb->file_array[i].vnode = vnode;
+    curr_pcb->file_array[i].inode = vnode->ino;
+    curr_pcb->file_array[i].fops->open_func(filename);
+
+    return i;
 }
 
 /*
@@ -485,6 +534,8 @@ int32_t syscall_close(int32_t fd) {
     curr_pcb -> file_array[fd].file_position = 0;
     curr_pcb -> file_array[fd].inode = 0;
     curr_pcb -> file_array[fd].fops = NULL;
+    vfs_close(curr_pcb -> file_array[fd].vnode);
+    curr_pcb -> file_array[fd].vnode = NULL;
 
     return 0;
 }
@@ -559,7 +610,7 @@ int32_t syscall_vidmap (uint8_t** screen_start) {
         page_table_program_vidmap[terminal_id][PT_ENTRY_IDX].pt_attribute_index = 0;
         page_table_program_vidmap[terminal_id][PT_ENTRY_IDX].global_page = 0;
         page_table_program_vidmap[terminal_id][PT_ENTRY_IDX].available = 0;
-        page_table_program_vidmap[terminal_id][PT_ENTRY_IDX].page_base_address = VIDEO >> VAL_12;
+        page_table_program_vidmap[terminal_id][PT_ENTRY_IDX].page_base_address = TERMINAL_VGA_PAGE(terminal_id) >> VAL_12;
 
         // Modify processs page directory.
         uint32_t pid = get_current_pcb()->pid;
@@ -577,6 +628,9 @@ int32_t syscall_vidmap (uint8_t** screen_start) {
 
         load_page_directory(page_directory_program[pid]);
 
+        // The mapping shows the first VGA page of the terminal, where the screen has to stay.
+        vga_home(terminal_id);
+
         // Calculate address.
         *screen_start = (uint8_t*)(PD_ENTRY_IDX * VAL_4 * VAL_1024 * VAL_1024 + PT_ENTRY_IDX * VAL_4 * VAL_1024);
 
@@ -584,6 +638,24 @@ int32_t syscall_vidmap (uint8_t** screen_start) {
     }
 }
 
+/*
+ *   vidmap_in_use
+ *   DESCRIPTION: check whether a process on a terminal has the video memory mapped by vidmap
+ *   INPUTS: terminal_id -- terminal to check
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if one has, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t vidmap_in_use (int32_t terminal_id) {
+    uint32_t pid;
+    for(pid = 0; pid < MAX_PROCESS_NUMBER; ++pid) {
+        if(process_exist[pid] && get_pcb(pid)->terminal_id == terminal_id &&
+           page_directory_program[pid][PD_ENTRY_IDX].entry_PT.present)
+            return 1;
+    }
+    return 0;
+}
+
 // TODO for signal extra credit
 int32_t syscall_set_handler (int32_t signum, void* handler) {
     return -1;
@@ -593,3 +665,632 @@ int32_t syscall_set_handler (int32_t signum, void* handler) {
 int32_t syscall_sigreturn (void) {
     return -1;
 }
+
+/*
+ *   syscall_ipc_send
+ *   DESCRIPTION: send a message to another process and wait for its reply
+ *   INPUTS: pid -- receiver process
+ *           msg -- message to send
+ *           reply -- buffer for the reply, may be NULL
+ *   OUTPUTS: none
+ *   RETURN VALUE: length of the reply on success, -1 on failure
+ *   SIDE EFFECTS: blocks until the receiver replies
+ */
+int32_t syscall_ipc_send (int32_t pid, ipc_msg_t* msg, ipc_msg_t* reply) {
+    uint32_t curr_pid = get_current_pcb()->pid;
+
+    if(msg == NULL || !is_user_range_mapped(curr_pid, msg, sizeof(ipc_msg_t)))
+        return -1;
+    if(reply != NULL && !is_user_range_mapped(curr_pid, reply, sizeof(ipc_msg_t)))
+        return -1;
+
+    return ipc_send(pid, msg, reply);
+}
+
+/*
+ *   syscall_ipc_receive
+ *   DESCRIPTION: wait for a message from any process
+ *   INPUTS: msg -- receive buffer, updated with the received message
+ *   OUTPUTS: none
+ *   RETURN VALUE: pid of the sender on success, -1 on failure
+ *   SIDE EFFECTS: blocks until a message arrives
+ */
+int32_t syscall_ipc_receive (ipc_msg_t* msg) {
+    if(msg == NULL || !is_user_range_mapped(get_current_pcb()->pid, msg, sizeof(ipc_msg_t)))
+        return -1;
+
+    return ipc_receive(msg);
+}
+
+/*
+ *   syscall_ipc_reply
+ *   DESCRIPTION: reply to a process whose message has been received
+ *   INPUTS: pid -- sender to reply to
+ *           reply -- reply message, may be NULL for an empty reply
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: switches to the sender right away
+ */
+int32_t syscall_ipc_reply (int32_t pid, ipc_msg_t* reply) {
+    if(reply != NULL && !is_user_range_mapped(get_current_pcb()->pid, reply, sizeof(ipc_msg_t)))
+        return -1;
+
+    return ipc_reply(pid, reply);
+}
+
+/*
+ *   syscall_futex_wait
+ *   DESCRIPTION: sleep on a user-space word as long as it holds val
+ *   INPUTS: addr -- 4-byte aligned user-space word
+ *           val -- expected value of *addr
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 when woken up, -1 if *addr != val or on failure
+ *   SIDE EFFECTS: blocks until syscall_futex_wake() is called on addr
+ */
+int32_t syscall_futex_wait (uint32_t* addr, uint32_t val) {
+    return futex_wait(addr, val);
+}
+
+/*
+ *   syscall_futex_wake
+ *   DESCRIPTION: wake up processes sleeping on a user-space word
+ *   INPUTS: addr -- 4-byte aligned user-space word
+ *           n -- maximum number of processes to wake
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of processes woken, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+int32_t syscall_futex_wake (uint32_t* addr, int32_t n) {
+    if(n < 0)
+        return -1;
+
+    return futex_wake(addr, n);
+}
+
+/*
+ *   syscall_brk
+ *   DESCRIPTION: move the end of the heap (the break) of the current process. Pages
+ *                covering [USER_HEAP_START, break) are mapped zero-filled 4KB at a time.
+ *   INPUTS: addr -- new break, or NULL to query the current one
+ *   OUTPUTS: none
+ *   RETURN VALUE: the new break on success, -1 on failure
+ *   SIDE EFFECTS: maps or unmaps heap pages of the current process
+ */
+int32_t syscall_brk (void* addr) {
+    pcb_t *curr_pcb = get_current_pcb();
+    uint32_t new_break = (uint32_t)addr;
+    uint32_t old_top, new_top, virt, phys;
+
+    if(addr == NULL)
+        return curr_pcb->heap_break;
+    if(new_break < USER_HEAP_START || new_break > USER_HEAP_END)
+        return -1;
+
+    // First unmapped page above the old and the new break.
+    old_top = (curr_pcb->heap_break + PAGE_SIZE - 1) & PAGE_MASK;
+    new_top = (new_break + PAGE_SIZE - 1) & PAGE_MASK;
+
+    for(virt = old_top; virt < new_top; virt += PAGE_SIZE) {
+        phys = alloc_page_frame();
+        if(phys == 0 || map_user_page(curr_pcb->pid, virt, phys, 1, 1) == -1) {
+            if(phys != 0)
+                free_page_frame(phys);
+            // Roll back the pages mapped so far.
+            while(virt > old_top) {
+                virt -= PAGE_SIZE;
+                free_page_frame(unmap_user_page(curr_pcb->pid, virt));
+            }
+            flush_tlb();
+            return -1;
+        }
+    }
+
+    for(virt = new_top; virt < old_top; virt += PAGE_SIZE) {
+        phys = unmap_user_page(curr_pcb->pid, virt);
+        if(phys != 0)
+            free_page_frame(phys);
+    }
+
+    flush_tlb();
+    curr_pcb->heap_break = new_break;
+
+    return new_break;
+}
+
+// Unmap npages pages starting at start from process pid, freeing the frames it owns.
+static void unmap_user_range(uint32_t pid, uint32_t start, uint32_t npages) {
+    uint32_t virt, phys;
+    int32_t owned;
+
+    for(virt = start; virt < start + npages * PAGE_SIZE; virt += PAGE_SIZE) {
+        owned = is_user_page_owned(pid, virt);
+        phys = unmap_user_page(pid, virt);
+        if(owned && phys != 0)
+            free_page_frame(phys);
+    }
+}
+
+// Map file pages of vnode read-only at start, then reserve the rest of npages as zero pages.
+//  Whole data blocks are mapped straight from the file system image, a partial last block is
+//  copied into a fresh frame so that the bytes after the end of file read as zero. Without an
+//  image in memory, i.e. mounted from a disk, or for files of other backends, every page is a copy.
+static int32_t map_file_range(uint32_t pid, uint32_t start, uint32_t npages, vnode_t *vnode) {
+    uint32_t length = vnode->length;
+    uint32_t i, block, phys;
+
+    for(i = 0; i < npages && i * PAGE_SIZE < length; ++i) {
+        block = vfs_get_block_address(vnode, i * PAGE_SIZE);
+        if(block != 0 && (i + 1) * PAGE_SIZE <= length) {
+            if(map_user_page(pid, start + i * PAGE_SIZE, kernel_virt_to_phys(block), 0, 0) == -1)
+                break;
+            continue;
+        }
+        phys = alloc_page_frame();
+        if(phys == 0)
+            break;
+        if(vfs_read(vnode, i * PAGE_SIZE, (uint8_t *)phys, PAGE_SIZE, NULL) == -1) {
+            free_page_frame(phys);
+            break;
+        }
+        if(map_user_page(pid, start + i * PAGE_SIZE, phys, 0, 1) == -1) {
+            free_page_frame(phys);
+            break;
+        }
+    }
+
+    if((i < npages && i * PAGE_SIZE < length) ||
+       reserve_user_range(pid, start + i * PAGE_SIZE, npages - i) == -1) {
+        unmap_user_range(pid, start, i);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ *   syscall_mmap
+ *   DESCRIPTION: map a range of pages into the mmap region of the current process.
+ *                Anonymous memory (fd == -1) is only reserved, each page gets a
+ *                zero-filled frame the first time it is touched. With an open file,
+ *                the file is mapped read-only from its start without copying, bytes
+ *                past the end of the file read as zero. A mapped file cannot be
+ *                truncated or unlinked until all of its pages are unmapped.
+ *   INPUTS: addr -- page-aligned address wanted, NULL to let the kernel pick one
+ *           length -- length in bytes, rounded up to whole pages
+ *           fd -- open regular file, or -1 for anonymous memory
+ *   OUTPUTS: none
+ *   RETURN VALUE: start address of the mapping on success, -1 on failure
+ *   SIDE EFFECTS: may allocate page tables
+ */
+int32_t syscall_mmap (void* addr, uint32_t length, int32_t fd) {
+    pcb_t *curr_pcb = get_current_pcb();
+    file_mapping_t *mapping = NULL;
+    uint32_t start = (uint32_t)addr;
+    uint32_t npages, i;
+
+    if(fd != -1 && (fd < 0 || fd >= MAX_FD_SIZE || curr_pcb->file_array[fd].flag == 0 ||
+                    curr_pcb->file_array[fd].fops != &file_ops))
+        return -1;
+    if(length == 0 || length > USER_MMAP_END - USER_MMAP_START)
+        return -1;
+    npages = (length + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    if(addr == NULL)
+        start = find_free_user_range(curr_pcb->pid, npages);
+    else if((start & ~PAGE_MASK) || start < USER_MMAP_START || start > USER_MMAP_END - npages * PAGE_SIZE)
+        return -1;
+    if(start == 0)
+        return -1;
+
+    if(fd == -1) {
+        if(reserve_user_range(curr_pcb->pid, start, npages) == -1)
+            return -1;
+    }
+    else {
+        for(i = 0; i < MAX_FILE_MAPPINGS && mapping == NULL; ++i) {
+            if(file_mappings[curr_pcb->pid][i].vnode == NULL)
+                mapping = &file_mappings[curr_pcb->pid][i];
+        }
+        if(mapping == NULL)
+            return -1;
+        if(map_file_range(curr_pcb->pid, start, npages, curr_pcb->file_array[fd].vnode) == -1)
+            return -1;
+        // The file must outlive its descriptor while any of these pages is mapped.
+        mapping->start = start;
+        mapping->npages = npages;
+        mapping->vnode = curr_pcb->file_array[fd].vnode;
+        vfs_map(mapping->vnode);
+    }
+
+    return start;
+}
+
+/*
+ *   syscall_munmap
+ *   DESCRIPTION: unmap a range of pages from the mmap region of the current process
+ *   INPUTS: addr -- page-aligned start of the range
+ *           length -- length in bytes, rounded up to whole pages
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: frames that belong to the process are freed, fully unmapped files
+ *                 can be truncated or unlinked again
+ */
+int32_t syscall_munmap (void* addr, uint32_t length) {
+    uint32_t start = (uint32_t)addr;
+    uint32_t npages = (length + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    if((start & ~PAGE_MASK) || length == 0 || start < USER_MMAP_START || length > USER_MMAP_END - start)
+        return -1;
+
+    unmap_user_range(get_current_pcb()->pid, start, npages);
+    release_file_mappings(get_current_pcb()->pid, start, npages);
+
+    return 0;
+}
+
+/*
+ *   syscall_sendfile
+ *   DESCRIPTION: copy part of a regular file to another file descriptor without going
+ *                through user space. Data is handed to the write function of out_fd
+ *                straight from the file system image, one data block at a time. When
+ *                the file system is on a disk, blocks are staged in a kernel frame.
+ *   INPUTS: out_fd -- file descriptor to write to, e.g. the terminal
+ *           in_fd -- regular file to read from
+ *           offset -- byte offset in the file to start from, or -1 to start from the
+ *                     current position of in_fd and advance it
+ *           count -- maximum number of bytes to copy
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes copied on success, -1 on failure
+ *   SIDE EFFECTS: advances the position of in_fd when offset is -1
+ */
+int32_t syscall_sendfile (int32_t out_fd, int32_t in_fd, int32_t offset, int32_t count) {
+    pcb_t *curr_pcb = get_current_pcb();
+    int32_t length, position, chunk, written, total = 0;
+    uint32_t block, bounce = 0;
+
+    if(out_fd < 0 || out_fd >= MAX_FD_SIZE || curr_pcb->file_array[out_fd].flag == 0)
+        return -1;
+    if(in_fd < 0 || in_fd >= MAX_FD_SIZE || curr_pcb->file_array[in_fd].flag == 0 ||
+       curr_pcb->file_array[in_fd].fops != &file_ops)
+        return -1;
+    if(offset < -1 || count < 0)
+        return -1;
+
+    length = curr_pcb->file_array[in_fd].vnode->length;
+    position = (offset == -1) ? curr_pcb->file_array[in_fd].file_position : offset;
+
+    while(total < count && position < length) {
+        // Stay within the current data block, the next one may be anywhere in the image.
+        chunk = PAGE_SIZE - position % PAGE_SIZE;
+        if(chunk > length - position)
+            chunk = length - position;
+        if(chunk > count - total)
+            chunk = count - total;
+
+        block = vfs_get_block_address(curr_pcb->file_array[in_fd].vnode, position);
+        if(block != 0) {
+            block += position % PAGE_SIZE;
+        }
+        else {
+            if(bounce == 0 && (bounce = alloc_page_frame()) == 0)
+                break;
+            if(vfs_read(curr_pcb->file_array[in_fd].vnode, position, (uint8_t *)bounce, chunk, NULL) != chunk)
+                break;
+            block = bounce;
+        }
+
+        written = curr_pcb->file_array[out_fd].fops->write_func(out_fd, (void *)block, chunk);
+        if(written <= 0)
+            break;
+        position += written;
+        total += written;
+        if(written < chunk)
+            break;
+    }
+
+    if(bounce != 0)
+        free_page_frame(bounce);
+    if(offset == -1)
+        curr_pcb->file_array[in_fd].file_position = position;
+
+    if(total == 0 && count > 0 && position < length)
+        return -1;
+
+    return total;
+}
+
+/*
+ *   syscall_getdents
+ *   DESCRIPTION: read as many directory records as fit into a user buffer
+ *   INPUTS: fd -- open directory
+ *           buf -- user buffer to fill with packed records
+ *           nbytes -- size of buf
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes filled, 0 at the end of the directory, -1 on failure
+ *   SIDE EFFECTS: advances the directory cursor of fd
+ */
+int32_t syscall_getdents (int32_t fd, void* buf, int32_t nbytes) {
+    pcb_t *curr_pcb = get_current_pcb();
+
+    if(fd < 0 || fd >= MAX_FD_SIZE || curr_pcb->file_array[fd].flag == 0 ||
+       curr_pcb->file_array[fd].fops != &dir_ops)
+        return -1;
+    if(buf == NULL || nbytes < 0 || !is_user_range_mapped(curr_pcb->pid, buf, nbytes))
+        return -1;
+
+    return directory_getdents(fd, buf, nbytes);
+}
+
+/*
+ *   syscall_lseek
+ *   DESCRIPTION: move the position of a regular file or the cursor of a directory
+ *   INPUTS: fd -- open regular file or directory
+ *           offset -- new position relative to whence
+ *           whence -- SEEK_SET (start), SEEK_CUR (current position) or SEEK_END
+ *                     (end of file, regular files only)
+ *   OUTPUTS: none
+ *   RETURN VALUE: the new position on success, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+int32_t syscall_lseek (int32_t fd, int32_t offset, int32_t whence) {
+    pcb_t *curr_pcb = get_current_pcb();
+    int32_t base;
+
+    if(fd < 0 || fd >= MAX_FD_SIZE || curr_pcb->file_array[fd].flag == 0)
+        return -1;
+    if(curr_pcb->file_array[fd].fops != &file_ops && curr_pcb->file_array[fd].fops != &dir_ops)
+        return -1;
+
+    switch(whence) {
+        case SEEK_SET:
+        base = 0;
+        break;
+
+        case SEEK_CUR:
+        base = curr_pcb->file_array[fd].file_position;
+        break;
+
+        case SEEK_END:
+        if(curr_pcb->file_array[fd].fops != &file_ops)
+            return -1;
+        base = curr_pcb->file_array[fd].vnode->length;
+        break;
+
+        default:
+        return -1;
+    }
+
+    if(base + offset < 0)
+        return -1;
+
+    curr_pcb->file_array[fd].file_position = base + offset;
+
+    return base + offset;
+}
+
+/*
+ *   syscall_pread
+ *   DESCRIPTION: read a regular file from a given offset, leaving its position alone
+ *   INPUTS: fd -- open regular file
+ *           buf -- user buffer
+ *           nbytes -- maximum number of bytes to read
+ *           offset -- byte offset in the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes read, 0 at or past the end of file, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+int32_t syscall_pread (int32_t fd, void* buf, int32_t nbytes, int32_t offset) {
+    pcb_t *curr_pcb = get_current_pcb();
+
+    if(fd < 0 || fd >= MAX_FD_SIZE || curr_pcb->file_array[fd].flag == 0 ||
+       curr_pcb->file_array[fd].fops != &file_ops)
+        return -1;
+    if(buf == NULL || nbytes < 0 || offset < 0 || !is_user_range_mapped(curr_pcb->pid, buf, nbytes))
+        return -1;
+
+    return vfs_read(curr_pcb->file_array[fd].vnode, offset, buf, nbytes, NULL);
+}
+
+/*
+ *   syscall_fstat
+ *   DESCRIPTION: get the type, size and block count of an open file
+ *   INPUTS: fd -- open file descriptor
+ *           buf -- user buffer to fill
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+int32_t syscall_fstat (int32_t fd, stat_t* buf) {
+    pcb_t *curr_pcb = get_current_pcb();
+    file_desc_t *file;
+    int32_t length;
+
+    if(fd < 0 || fd >= MAX_FD_SIZE || curr_pcb->file_array[fd].flag == 0)
+        return -1;
+    if(buf == NULL || !is_user_range_mapped(curr_pcb->pid, buf, sizeof(stat_t)))
+        return -1;
+
+    file = &curr_pcb->file_array[fd];
+    buf->size = 0;
+    buf->blocks = 0;
+    buf->inode = file->inode;
+
+    if(file->fops == &file_ops) {
+        length = file->vnode->length;
+        buf->type = REGULAR_FILE;
+        buf->size = length;
+        buf->blocks = (length + sizeof(data_block_t) - 1) / sizeof(data_block_t);
+    }
+    else if(file->fops == &dir_ops)
+        buf->type = DIRECTORY_FILE;
+    else if(file->fops == &rtc_ops)
+        buf->type = RTC_FILE;
+    else
+        buf->type = TERMINAL_FILE;
+
+    return 0;
+}
+
+// Check fd and every buffer of an iovec array passed by the current process. Return 0 if usable.
+static int32_t check_iovec (int32_t fd, const iovec_t* iov, int32_t iovcnt) {
+    pcb_t *curr_pcb = get_current_pcb();
+    int32_t i;
+
+    if(fd < 0 || fd >= MAX_FD_SIZE || curr_pcb->file_array[fd].flag == 0)
+        return -1;
+    if(iov == NULL || iovcnt < 0 || iovcnt > IOV_MAX ||
+       !is_user_range_mapped(curr_pcb->pid, iov, iovcnt * sizeof(iovec_t)))
+        return -1;
+
+    for(i = 0; i < iovcnt; ++i) {
+        if(iov[i].base == NULL || iov[i].len < 0 ||
+           !is_user_range_mapped(curr_pcb->pid, iov[i].base, iov[i].len))
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ *   syscall_readv
+ *   DESCRIPTION: read into several buffers in one call, filling each before the next
+ *   INPUTS: fd -- file descriptor
+ *           iov -- array of buffers
+ *           iovcnt -- number of buffers, at most IOV_MAX
+ *   OUTPUTS: none
+ *   RETURN VALUE: total number of bytes read on success, -1 on failure
+ *   SIDE EFFECTS: stops at the first buffer that is not filled completely
+ */
+int32_t syscall_readv (int32_t fd, const iovec_t* iov, int32_t iovcnt) {
+    fops_t *fops;
+    int32_t i, ret, total = 0;
+
+    if(check_iovec(fd, iov, iovcnt) == -1)
+        return -1;
+
+    sti();
+
+    fops = get_current_pcb()->file_array[fd].fops;
+    for(i = 0; i < iovcnt; ++i) {
+        ret = fops->read_func(fd, iov[i].base, iov[i].len);
+        if(ret < 0) {
+            if(total == 0)
+                total = -1;
+            break;
+        }
+        total += ret;
+        if(ret < iov[i].len)
+            break;
+    }
+
+    return total;
+}
+
+/*
+ *   syscall_writev
+ *   DESCRIPTION: write several buffers in one call. Terminal output of the whole vector
+ *                is emitted at once, so it is never interleaved with other output.
+ *   INPUTS: fd -- file descriptor
+ *           iov -- array of buffers
+ *           iovcnt -- number of buffers, at most IOV_MAX
+ *   OUTPUTS: none
+ *   RETURN VALUE: total number of bytes written on success, -1 on failure
+ *   SIDE EFFECTS: interrupts are disabled while writing to the terminal
+ */
+int32_t syscall_writev (int32_t fd, const iovec_t* iov, int32_t iovcnt) {
+    fops_t *fops;
+    uint32_t flags;
+    int32_t i, ret, atomic, total = 0;
+
+    if(check_iovec(fd, iov, iovcnt) == -1)
+        return -1;
+
+    fops = get_current_pcb()->file_array[fd].fops;
+
+    // Neither the scheduler nor keyboard echo can get in between the pieces.
+    atomic = (fops == &stdout || fops == &stdin);
+    if(atomic)
+        cli_and_save(flags);
+
+    for(i = 0; i < iovcnt; ++i) {
+        ret = fops->write_func(fd, iov[i].base, iov[i].len);
+        if(ret < 0) {
+            if(total == 0)
+                total = -1;
+            break;
+        }
+        total += ret;
+        if(ret < iov[i].len)
+            break;
+    }
+
+    if(atomic)
+        restore_flags(flags);
+
+    return total;
+}
+
+/*
+ *   syscall_create
+ *   DESCRIPTION: create an empty regular file, in RAM if the name starts with TMPFS_PREFIX
+ *   INPUTS: filename -- path of the new file, whose directory must exist
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the name is invalid or taken, or the file system is full
+ *   SIDE EFFECTS: none
+ */
+int32_t syscall_create (const uint8_t* filename) {
+    if(filename == NULL)
+        return -1;
+
+    return vfs_create(filename);
+}
+
+/*
+ *   syscall_mkdir
+ *   DESCRIPTION: create an empty directory on the file system image
+ *   INPUTS: dirname -- path of the new directory, whose parent must exist
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the name is invalid or taken, or the file system is full
+ *   SIDE EFFECTS: none
+ */
+int32_t syscall_mkdir (const uint8_t* dirname) {
+    if(dirname == NULL)
+        return -1;
+
+    return vfs_mkdir(dirname);
+}
+
+/*
+ *   syscall_unlink
+ *   DESCRIPTION: remove a regular file or an empty directory that no process has open
+ *   INPUTS: filename -- name of the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: frees the data blocks of the file
+ */
+int32_t syscall_unlink (const uint8_t* filename) {
+    if(filename == NULL)
+        return -1;
+
+    return vfs_unlink(filename);
+}
+
+/*
+ *   syscall_truncate
+ *   DESCRIPTION: set the length of an open regular file, new bytes read as zero
+ *   INPUTS: fd -- open regular file
+ *           length -- new length in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: the file position is left alone, even if it is now past the end
+ */
+int32_t syscall_truncate (int32_t fd, int32_t length) {
+    pcb_t *curr_pcb = get_current_pcb();
+
+    if(fd < 0 || fd >= MAX_FD_SIZE || curr_pcb->file_array[fd].flag == 0 || length < 0)
+        return -1;
+
+    if(curr_pcb->file_array[fd].fops != &file_ops)
+        return -1;
+    return vfs_truncate(curr_pcb->file_array[fd].vnode, length);
+}
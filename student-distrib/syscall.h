@@ -1,17 +1,20 @@
 #ifndef _SYSCALL_H_
 #define _SYSCALL_H_
 
+// Number of entries in syscall jump table, entry 0 is unused.
+#define NUM_SYSCALL 30
+
 #ifndef ASM
 
 #include "types.h"
+#include "ipc.h"
+#include "file_system.h"
 
 #define RTC_TYPE        0
 #define DIR_TYPE        1
 #define FILE_TYPE       2
 #define MIN_FD_SIZE     2
 
-#define NUM_SYSCALL 11
-
 // Use regular integer array to store function addresses directly.
 // Cannot use function pointer array because parameter lists are different.
 extern uint32_t syscall_jump_table[NUM_SYSCALL];
@@ -30,11 +33,58 @@ extern int32_t syscall_close (int32_t fd);
 extern int32_t syscall_getargs (uint8_t* buf, int32_t nbytes);
 // maps the video memory into user space
 extern int32_t syscall_vidmap (uint8_t** screen_start);
+// Whether a process on terminal_id has the video memory mapped by vidmap.
+extern int32_t vidmap_in_use (int32_t terminal_id);
 
 // TODO for signal extra credit
 extern int32_t syscall_set_handler (int32_t signum, void* handler);
 extern int32_t syscall_sigreturn (void);
 
+// synchronous message passing between processes
+extern int32_t syscall_ipc_send (int32_t pid, ipc_msg_t* msg, ipc_msg_t* reply);
+extern int32_t syscall_ipc_receive (ipc_msg_t* msg);
+extern int32_t syscall_ipc_reply (int32_t pid, ipc_msg_t* reply);
+
+// wait/wake on a user-space word, building block for user-space locks
+extern int32_t syscall_futex_wait (uint32_t* addr, uint32_t val);
+extern int32_t syscall_futex_wake (uint32_t* addr, int32_t n);
+
+// moves the end of the user heap
+extern int32_t syscall_brk (void* addr);
+
+// maps and unmaps memory in the mmap region
+extern int32_t syscall_mmap (void* addr, uint32_t length, int32_t fd);
+extern int32_t syscall_munmap (void* addr, uint32_t length);
+
+// copies a file to another file descriptor inside the kernel
+extern int32_t syscall_sendfile (int32_t out_fd, int32_t in_fd, int32_t offset, int32_t count);
+
+// reads many directory entries at once
+extern int32_t syscall_getdents (int32_t fd, void* buf, int32_t nbytes);
+
+// file position, positional read and file information
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+extern int32_t syscall_lseek (int32_t fd, int32_t offset, int32_t whence);
+extern int32_t syscall_pread (int32_t fd, void* buf, int32_t nbytes, int32_t offset);
+extern int32_t syscall_fstat (int32_t fd, stat_t* buf);
+
+// scatter/gather read and write
+#define IOV_MAX 16
+typedef struct iovec {
+    void* base;
+    int32_t len;
+} iovec_t;
+extern int32_t syscall_readv (int32_t fd, const iovec_t* iov, int32_t iovcnt);
+extern int32_t syscall_writev (int32_t fd, const iovec_t* iov, int32_t iovcnt);
+
+// creating, removing and resizing regular files
+extern int32_t syscall_create (const uint8_t* filename);
+extern int32_t syscall_unlink (const uint8_t* filename);
+extern int32_t syscall_truncate (int32_t fd, int32_t length);
+extern int32_t syscall_mkdir (const uint8_t* dirname);
+
 // helper function for syscall_halt
 extern int32_t halt_current_process(uint32_t status);
 
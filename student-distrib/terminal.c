@@ -5,9 +5,6 @@
 unsigned char terminal_buffer[TERMINAL_NUM][TERMINAL_BUFFER_CAPACITY];
 int terminal_buffer_size[TERMINAL_NUM];
 
-// Must align to 4KB boundary since it would be used in page table.
-uint8_t video_mem_backstore[TERMINAL_NUM][VAL_4 * VAL_1024] __attribute__((aligned(VAL_4096)));
-
 int screen_x_backstore[TERMINAL_NUM];
 int screen_y_backstore[TERMINAL_NUM];
 
@@ -63,20 +60,17 @@ extern int32_t get_next_inactive_terminal() {
 
 void terminal_init() {
   int i;
+  display_terminal = 0;
   for (i = 0 ; i < TERMINAL_NUM; i++) {
     terminal_buffer_size[i] = 0;
     terminal_state[i] = TERMINAL_INACTIVE;
     screen_x_backstore[i] = 0;
     screen_y_backstore[i] = 0;
 
-    int32_t j;
-    for (j = 0; j < NUM_COLS * NUM_ROWS; j++) {
-        *(uint8_t *)(video_mem_backstore[i] + (j << 1)) = ' ';
-        *(uint8_t *)(video_mem_backstore[i] + (j << 1) + 1) = ATTRIB;
-    }
+    // The displayed terminal keeps the messages of the kernel.
+    if(i != display_terminal)
+      vga_clear_terminal(i);
   }
-
-  display_terminal = 0;
 }
 
 /* terminal_buffer_write
@@ -127,25 +121,15 @@ int terminal_buffer_move(int size)
 
 
 /* switch_terminal
-* Switch the terminal based on the terminal id 
+* Switch the terminal based on the terminal id. Every terminal has its own
+*  VGA pages, so only the CRTC start address and the cursor change.
 * Input: terminal id
 * Output: none
 * Side Effects: none
 */
 void switch_terminal(uint32_t terminal_id) {
-  
-  backup_video_memory((char *)(video_mem_backstore[display_terminal]));
-  load_video_memory((char *)(video_mem_backstore[terminal_id]));
-
-  page_table_terminal_video_memory[display_terminal][VAL_184].page_base_address = (uint32_t)video_mem_backstore[display_terminal] >> 12;
-  page_table_terminal_video_memory[terminal_id][VAL_184].page_base_address = VIDEO >> 12;
-
-  page_table_program_vidmap[display_terminal][VAL_512].page_base_address = (uint32_t)video_mem_backstore[display_terminal] >> 12;
-  page_table_program_vidmap[terminal_id][VAL_512].page_base_address = VIDEO >> 12;
-
-  load_page_directory(page_directory_program[get_current_pcb()->pid]);
-
   display_terminal = terminal_id;
+  vga_show_terminal(terminal_id);
 }
 
 /* terminal_open
@@ -10,6 +10,13 @@
 #define TERMINAL_INACTIVE 0
 #define TERMINAL_ACTIVE 1
 
+// The whole VGA text window, physical 0xB8000 to 0xBFFFF, is mapped for the kernel at
+//  VGA_WINDOW by every page table of the first 4MB.
+#define VGA_WINDOW 0xC0000
+#define VGA_WINDOW_PAGES 8
+// Pages of the window owned by each terminal, TERMINAL_NUM of them have to fit in it.
+#define TERMINAL_VGA_PAGES 2
+
 #ifndef ASM
 
 #define _4KB 4 * 1024
@@ -20,8 +27,9 @@
 #define VAL_1024    1024
 #define VAL_4       4
 #define VIDEO       0xB8000
-// Video memory backstorage space for background terminals.
-extern uint8_t video_mem_backstore[TERMINAL_NUM][_4KB];
+// Physical address of the first VGA page of a terminal, mapped at VIDEO for its processes
+//  and by vidmap.
+#define TERMINAL_VGA_PAGE(terminal_id) (VIDEO + (terminal_id) * TERMINAL_VGA_PAGES * VAL_4096)
 
 // Screen position backstorage for background terminals.
 extern int screen_x_backstore[TERMINAL_NUM];
@@ -6,6 +6,16 @@
 #include "keyboard.h"
 #include "rtc.h"
 #include "terminal.h"
+#include "process.h"
+#include "syscall.h"
+#include "block_device.h"
+#include "bcache.h"
+#include "tmpfs.h"
+#include "vfs.h"
+#include "memory.h"
+#include "lz4.h"
+#include "fpu.h"
+#include "idt.h"
 
 #define PASS 1
 #define FAIL 0
@@ -17,12 +27,71 @@
 #define STRING_SIZE 10
 #define LARGER_STRING_SIZE (STRING_SIZE + 10)
 #define FILE_READ_BUF_SIZE 10000
+// Sequential read benchmark: 8MB per device, 64KB per read. Too slow to run on every
+//  boot, define RUN_BENCHMARKS to include it.
+// #define RUN_BENCHMARKS
+#define BENCH_SECTORS 16384
+#define BENCH_CHUNK_SECTORS 128
+// Elevator test: requests of 4 sectors within the first 64 sectors of the drive.
+#define ATA_QUEUE_REQUESTS 6
+#define ATA_QUEUE_SECTORS 64
+#define ATA_QUEUE_COUNT 4
+#define RTC_TICKS_PER_SECOND 1024
+// More files than the boot block can hold.
+#define HASH_TEST_FILES 100
+// Data blocks written by the block run test.
+#define RUN_TEST_BLOCKS 3
+#define LZ4_TEST_OUT_SIZE 64
+// Streaming copy test: a copy of a few blocks plus odd head and tail bytes.
+#define STREAM_TEST_SIZE (2 * VAL_4096 + 100)
+#define STREAM_TEST_FILL 0xa5
+#define CR0_TS 0x8
+// Image file mapped by test_mmap_image_file, at least one whole data block long so that
+//  its first page is mapped without a copy.
+#define MMAP_TEST_FILE "verylargetextwithverylongname.tx"
+// Sendfile test: a range of MMAP_TEST_FILE across its first block boundary.
+#define SENDFILE_TEST_OFFSET 4000
+#define SENDFILE_TEST_COUNT 1000
+// System call number of sendfile, as user programs pass it in eax.
+#define SYSCALL_SENDFILE 19
+// Getdents test: buffer sizes of the two descriptors, one or two records and a few more.
+#define GETDENTS_TEST_SMALL 64
+#define GETDENTS_TEST_LARGE 160
+// Seek test: positions and lengths within frame0.txt.
+#define SEEK_TEST_OFFSET 10
+#define SEEK_TEST_COUNT 20
+#define PREAD_TEST_OFFSET 100
+#define PREAD_TEST_COUNT 16
+// Scatter/gather test: iovecs per call, lengths of the readv ones, where the buffers start.
+#define IOV_TEST_COUNT 3
+#define IOV_TEST_LEN0 5
+#define IOV_TEST_LEN1 100
+#define IOV_TEST_LEN2 7
+#define IOV_TEST_DATA 256
+#define EFLAGS_IF 0x200
+// CRTC registers holding the first cell shown on the screen.
+#define CRTC_INDEX_PORT 0x3D4
+#define CRTC_DATA_PORT 0x3D5
+#define CRTC_START_HIGH 0x0C
+#define CRTC_START_LOW 0x0D
+// Variant test: buffers, sizes and alignments tried for each routine.
+#define VARIANT_TEST_SIZE (3 * VAL_4096)
+#define VARIANT_TEST_SIZES 8
+#define VARIANT_TEST_SHIFTS 3
+#define VARIANT_TEST_CASES (VARIANT_TEST_SIZES * VARIANT_TEST_SHIFTS * VAL_4)
 
 // Constants that actually make no sense but just to
 //  eliminate magic numbers.
 #define VAL_10 10
 #define VAL_5 5
+#define VAL_6 6
+#define VAL_2 2
+#define VAL_4 4
+#define VAL_8 8
 #define VAL_184 184
+#define VAL_22 22
+#define VAL_12 12
+#define VAL_3 3
 
 // global variable defined in rtc.c that increment per rtc interrupt handler
 extern int rtc_counter;
@@ -197,7 +266,7 @@ int deref_null_address(){
 * Outputs: PASS/FAIL
 * Coverage: Test whether values in page directory table
 			and page table are correct.
-* Files: paging.S
+* Files: paging.S, memory.c
 */
 int pdt_and_pt_test(){
     TEST_HEADER;
@@ -221,6 +290,17 @@ int pdt_and_pt_test(){
 				result = FAIL;
 			}
 		}
+		else if(i >= FRAME_POOL_START >> VAL_22 && i < FS_WINDOW_END >> VAL_22) {
+			// Frame pool always, file system window as far as the image goes:
+			//  4MB kernel pages only.
+			if((i < FRAME_POOL_END >> VAL_22 && page_directory_initial[i].entry_page.present != 1)
+			|| (page_directory_initial[i].entry_page.present == 1
+				&& (page_directory_initial[i].entry_page.page_size != 1
+				|| page_directory_initial[i].entry_page.user_supervisor != 0))) {
+				assertion_failure();
+				result = FAIL;
+			}
+		}
 		else {
 			if(page_directory_initial[i].entry_PT.present != 0) {
 				assertion_failure();
@@ -231,7 +311,16 @@ int pdt_and_pt_test(){
 
 	// Test page table.
 	for(i = 0; i < NUM_PT_SIZE; ++i) {
-		if(i == VAL_184) {
+		if(i >= (VGA_WINDOW >> 12) && i < (VGA_WINDOW >> 12) + VGA_WINDOW_PAGES) {
+			// The VGA text window, for the kernel only.
+			if(page_table_initial[i].present != 1
+				|| page_table_initial[i].user_supervisor != 0
+				|| page_table_initial[i].page_base_address != (VIDEO >> 12) + i - (VGA_WINDOW >> 12)) {
+				assertion_failure();
+				result = FAIL;
+			}
+		}
+		else if(i == VAL_184) {
 			if(page_table_initial[i].present != 1) {
 				assertion_failure();
 				result = FAIL;
@@ -264,7 +353,10 @@ int test_directory_operations(){
 
 	int result = PASS;
 	int ret;
-	int fd;
+	// The directory cursor lives in the file descriptor, use a free one of the current PCB.
+	int fd = MIN_FD_SIZE;
+	get_current_pcb()->file_array[fd].file_position = 0;
+	get_current_pcb()->file_array[fd].inode = FS_ROOT_DIR;
 
 	ret = directory_open((uint8_t*)".");
 	if(ret == -1) {
@@ -392,6 +484,1797 @@ int test_file_by_index_in_boot_block(int index){
 	return result;
 }
 
+/* test_file_write
+*
+* Test creating, writing, truncating and removing a file.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: Test that written data reads back across a block
+	boundary, that truncation zero-fills and that unlink frees the name.
+* Files: file_system.c
+*/
+int test_file_write(){
+	TEST_HEADER;
+
+	int result = PASS;
+	dentry_t dentry;
+	// Big enough to span two data blocks.
+	static uint8_t buf[VAL_4096 + VAL_10];
+	uint8_t *fname = (uint8_t*)"scratch.txt";
+	int i;
+
+	if(file_create(fname) != 0 || read_dentry_by_name(fname, &dentry) != 0 ||
+	   get_file_length(dentry.inode_idx) != 0) {
+		assertion_failure();
+		return FAIL;
+	}
+	// The name is now taken.
+	if(file_create(fname) != -1) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	for(i = 0; i < sizeof(buf); ++i)
+		buf[i] = i;
+	if(write_data(dentry.inode_idx, 0, buf, sizeof(buf)) != sizeof(buf)) {
+		assertion_failure();
+		result = FAIL;
+	}
+	// Writing past the end would leave a hole.
+	if(write_data(dentry.inode_idx, sizeof(buf) + 1, buf, 1) != -1) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	memset(buf, 0, sizeof(buf));
+	if(read_data(dentry.inode_idx, 0, buf, sizeof(buf)) != sizeof(buf)) {
+		assertion_failure();
+		result = FAIL;
+	}
+	for(i = 0; i < sizeof(buf); ++i) {
+		if(buf[i] != (uint8_t)i) {
+			assertion_failure();
+			result = FAIL;
+			break;
+		}
+	}
+
+	// Shrink, then grow again: the old bytes must not come back.
+	if(truncate_data(dentry.inode_idx, VAL_5) != 0 || truncate_data(dentry.inode_idx, VAL_10) != 0 ||
+	   read_data(dentry.inode_idx, 0, buf, sizeof(buf)) != VAL_10 || buf[VAL_5] != 0 || buf[VAL_5 - 1] != VAL_5 - 1) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	if(file_unlink(fname) != 0 || read_dentry_by_name(fname, &dentry) != -1) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	return result;
+}
+
+/* test_hashed_directory
+*
+* Test growing the directory past the boot block.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: Creating more files than the boot block holds switches to the
+	hashed directory. Every name is then found by lookup and by index, and
+	removing files in any order keeps the rest reachable.
+* Files: file_system.c
+*/
+int test_hashed_directory(){
+	TEST_HEADER;
+
+	int result = PASS;
+	uint8_t fname[FILE_NAME_MAX_LENGTH + 1];
+	dentry_t dentry;
+	int created, i, found;
+
+	// Create files until inodes run out, at most HASH_TEST_FILES.
+	strcpy((int8_t*)fname, "hash");
+	for(created = 0; created < HASH_TEST_FILES; ++created) {
+		itoa(created, (int8_t*)fname + VAL_4, VAL_10);
+		if(file_create(fname) != 0)
+			break;
+	}
+	if(read_dentry_by_index(VAL_63, &dentry) != 0) {
+		printf("Only %d files created, directory not extended.\n", created);
+		assertion_failure();
+		result = FAIL;
+	}
+
+	// Every name is found by lookup, and exactly once by index.
+	for(i = 0; i < created; ++i) {
+		itoa(i, (int8_t*)fname + VAL_4, VAL_10);
+		if(read_dentry_by_name(fname, &dentry) != 0) {
+			assertion_failure();
+			result = FAIL;
+		}
+	}
+	for(i = 0, found = 0; read_dentry_by_index(i, &dentry) == 0; ++i) {
+		if(strncmp((int8_t*)dentry.file_name, "hash", VAL_4) == 0)
+			found++;
+	}
+	if(found != created) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	// Remove the even ones, then the odd ones.
+	for(i = 0; i < created; i += 2) {
+		itoa(i, (int8_t*)fname + VAL_4, VAL_10);
+		if(file_unlink(fname) != 0) {
+			assertion_failure();
+			result = FAIL;
+		}
+	}
+	for(i = 0; i < created; ++i) {
+		itoa(i, (int8_t*)fname + VAL_4, VAL_10);
+		if((read_dentry_by_name(fname, &dentry) == 0) != (i % 2 == 1)) {
+			assertion_failure();
+			result = FAIL;
+		}
+	}
+	for(i = 1; i < created; i += 2) {
+		itoa(i, (int8_t*)fname + VAL_4, VAL_10);
+		if(file_unlink(fname) != 0) {
+			assertion_failure();
+			result = FAIL;
+		}
+	}
+
+	if(read_dentry_by_name((uint8_t*)"frame1.txt", &dentry) != 0 || read_dentry_by_name((uint8_t*)".", &dentry) != 0) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	return result;
+}
+
+/* test_nested_directories
+*
+* Test subdirectories and the dentry cache.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: A file two directories down is found by its path, a second
+	lookup of the path and of a missing name is answered by the dentry
+	cache alone, a directory that is not empty cannot be removed, and
+	removing everything leaves the names unreachable.
+* Files: file_system.c
+*/
+int test_nested_directories(){
+	TEST_HEADER;
+
+	int result = PASS;
+	uint8_t *fname = (uint8_t*)"nest/sub/leaf";
+	dcache_stats_t before, after;
+	dentry_t dentry;
+
+	if(file_mkdir((uint8_t*)"nest") != 0 || file_mkdir((uint8_t*)"nest/sub") != 0 || file_create(fname) != 0) {
+		assertion_failure();
+		return FAIL;
+	}
+	if(read_dentry_by_name((uint8_t*)"/nest//sub/leaf", &dentry) != 0 || dentry.file_type != REGULAR_FILE ||
+	   write_data(dentry.inode_idx, 0, (uint8_t*)"leaf", VAL_4) != VAL_4 ||
+	   read_dentry_by_name((uint8_t*)"nest/sub", &dentry) != 0 || dentry.file_type != DIRECTORY_FILE ||
+	   file_create((uint8_t*)"frame1.txt/leaf") != -1) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	// Both lookups were done before, so no directory is searched again.
+	(void)read_dentry_by_name((uint8_t*)"nest/sub/none", &dentry);
+	get_dcache_stats(&before);
+	if(read_dentry_by_name(fname, &dentry) != 0 || get_file_length(dentry.inode_idx) != VAL_4 ||
+	   read_dentry_by_name((uint8_t*)"nest/sub/none", &dentry) != -1) {
+		assertion_failure();
+		result = FAIL;
+	}
+	get_dcache_stats(&after);
+	if(after.misses != before.misses || after.hits == before.hits) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	if(file_unlink((uint8_t*)"nest/sub") != -1 || file_unlink(fname) != 0 ||
+	   file_unlink((uint8_t*)"nest/sub") != 0 || file_unlink((uint8_t*)"nest") != 0 ||
+	   read_dentry_by_name(fname, &dentry) != -1 || read_dentry_by_name((uint8_t*)"nest", &dentry) != -1) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	return result;
+}
+
+/* test_block_run_cache
+*
+* Test reading through a cached block run.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: Sequential reads keep the run of blocks they found, a read
+	across several blocks of a run is copied correctly, and a run cached
+	before the file was truncated and rewritten is not used again.
+* Files: file_system.c
+*/
+int test_block_run_cache(){
+	TEST_HEADER;
+
+	int result = PASS;
+	dentry_t dentry;
+	block_run_t run;
+	static uint8_t buf[RUN_TEST_BLOCKS * VAL_4096];
+	uint8_t byte;
+	uint8_t *fname = (uint8_t*)"runs.txt";
+	int pass, i;
+
+	if(file_create(fname) != 0 || read_dentry_by_name(fname, &dentry) != 0) {
+		assertion_failure();
+		return FAIL;
+	}
+
+	run.count = 0;
+	for(pass = 0; pass < 2; ++pass) {
+		for(i = 0; i < sizeof(buf); ++i)
+			buf[i] = (i % VAL_4096 == 0) ? 'a' + pass : i;
+		if(truncate_data(dentry.inode_idx, 0) != 0 ||
+		   write_data(dentry.inode_idx, 0, buf, sizeof(buf)) != sizeof(buf)) {
+			assertion_failure();
+			result = FAIL;
+			break;
+		}
+		// One byte per block, in order, through the same run.
+		for(i = 0; i < RUN_TEST_BLOCKS; ++i) {
+			if(read_data_cached(dentry.inode_idx, i * VAL_4096, &byte, 1, &run) != 1 || byte != 'a' + pass) {
+				assertion_failure();
+				result = FAIL;
+			}
+		}
+		if(run.count == 0 || run.inode != dentry.inode_idx) {
+			assertion_failure();
+			result = FAIL;
+		}
+		// All but the first byte in one call, across every block.
+		memset(buf, 0, sizeof(buf));
+		if(read_data_cached(dentry.inode_idx, 1, buf + 1, sizeof(buf), &run) != sizeof(buf) - 1) {
+			assertion_failure();
+			result = FAIL;
+		}
+		for(i = 1; i < sizeof(buf); ++i) {
+			if(buf[i] != ((i % VAL_4096 == 0) ? 'a' + pass : (uint8_t)i)) {
+				assertion_failure();
+				result = FAIL;
+				break;
+			}
+		}
+	}
+
+	if(file_unlink(fname) != 0) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	return result;
+}
+
+/* test_lz4_decompress
+*
+* Test the decompressor of compressed file system images.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: A block with literals and an overlapping match expands
+	correctly, a match reaching before the output and an output buffer
+	that is too small are both rejected.
+* Files: lz4.c
+*/
+int test_lz4_decompress(){
+	TEST_HEADER;
+
+	int result = PASS;
+	// "abc", then 18 bytes copied from 3 back, then "XYZ".
+	uint8_t block[] = {0x3e, 'a', 'b', 'c', 0x03, 0x00, 0x30, 'X', 'Y', 'Z'};
+	uint8_t *expected = (uint8_t*)"abcabcabcabcabcabcabcXYZ";
+	uint8_t out[LZ4_TEST_OUT_SIZE];
+
+	if(lz4_decompress(block, sizeof(block), out, sizeof(out)) != strlen((int8_t*)expected) ||
+	   strncmp((int8_t*)out, (int8_t*)expected, strlen((int8_t*)expected)) != 0) {
+		assertion_failure();
+		result = FAIL;
+	}
+	if(lz4_decompress(block, sizeof(block), out, VAL_10) != -1) {
+		assertion_failure();
+		result = FAIL;
+	}
+	block[VAL_4] = VAL_4;
+	if(lz4_decompress(block, sizeof(block), out, sizeof(out)) != -1) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	return result;
+}
+
+/* test_stream_copy
+*
+* Test the SSE2 streaming copy and clear routines.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: Copies and clears at every alignment match memcpy() and
+	memset() and stay within bounds, CR0.TS is set again afterwards so
+	that a process reloads its own FPU state.
+* Files: fpu.c
+*/
+int test_stream_copy(){
+	TEST_HEADER;
+
+	int result = PASS;
+	static uint8_t src[STREAM_TEST_SIZE + VAL_32];
+	static uint8_t dst[STREAM_TEST_SIZE + VAL_32];
+	uint32_t i, shift, cr0;
+
+	for(i = 0; i < sizeof(src); ++i)
+		src[i] = (uint8_t)(i * VAL_5 + i / VAL_184);
+
+	for(shift = 0; shift < VAL_20; shift += VAL_5) {
+		memset(dst, STREAM_TEST_FILL, sizeof(dst));
+		memcpy_stream(dst + shift, src + VAL_2 * shift + 1, STREAM_TEST_SIZE);
+		for(i = 0; i < sizeof(dst); ++i) {
+			uint8_t expected = (i < shift || i >= shift + STREAM_TEST_SIZE) ?
+				STREAM_TEST_FILL : src[i + shift + 1];
+			if(dst[i] != expected) {
+				assertion_failure();
+				result = FAIL;
+				break;
+			}
+		}
+
+		memclear_stream(dst + shift, STREAM_TEST_SIZE);
+		for(i = 0; i < sizeof(dst); ++i) {
+			uint8_t expected = (i < shift || i >= shift + STREAM_TEST_SIZE) ? STREAM_TEST_FILL : 0;
+			if(dst[i] != expected) {
+				assertion_failure();
+				result = FAIL;
+				break;
+			}
+		}
+	}
+
+	asm volatile("movl %%cr0, %0" : "=r"(cr0));
+	if(fpu_has_sse2() && !(cr0 & CR0_TS)) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	return result;
+}
+
+/* test_vga_scroll
+*
+* Test scrolling the displayed screen through the VGA text window.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: A full screen of lines scrolled by moving the CRTC start
+	address reads back in order, with an empty last row, once the screen
+	is moved back to the first VGA page of the terminal where vidmap maps it.
+* Files: lib.c
+*/
+int test_vga_scroll(){
+	TEST_HEADER;
+
+	int result = PASS;
+	uint8_t *video = (uint8_t *)VGA_WINDOW + TERMINAL_VGA_PAGE(get_display_terminal()) - VIDEO;
+	int32_t i;
+
+	putc('\n');
+	for(i = 0; i < NUM_ROWS; ++i)
+		printf("%c\n", 'A' + i);
+	vga_home(get_display_terminal());
+
+	// The first line scrolled off, the cursor sits on the empty last row.
+	for(i = 0; i < NUM_ROWS - 1; ++i) {
+		if(video[i * NUM_COLS * VAL_2] != 'A' + i + 1 || video[i * NUM_COLS * VAL_2 + 1] != ATTRIB
+			|| video[i * NUM_COLS * VAL_2 + VAL_2] != ' ') {
+			assertion_failure();
+			result = FAIL;
+		}
+	}
+	for(i = 0; i < NUM_COLS; ++i) {
+		if(video[((NUM_ROWS - 1) * NUM_COLS + i) * VAL_2] != ' ') {
+			assertion_failure();
+			result = FAIL;
+		}
+	}
+
+	return result;
+}
+
+// Read the CRTC start address registers.
+static uint32_t read_vga_start() {
+	uint32_t cell;
+	outb(CRTC_START_HIGH, CRTC_INDEX_PORT);
+	cell = inb(CRTC_DATA_PORT) << VAL_8;
+	outb(CRTC_START_LOW, CRTC_INDEX_PORT);
+	return cell | inb(CRTC_DATA_PORT);
+}
+
+/* test_terminal_switch
+*
+* Test switching the displayed terminal.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: The CRTC start address moves to the VGA pages of the other
+	terminal and back, and the screen left behind is not touched.
+* Files: terminal.c, lib.c
+*/
+int test_terminal_switch(){
+	TEST_HEADER;
+
+	int result = PASS;
+	int32_t from = get_display_terminal();
+	int32_t to = (from + 1) % TERMINAL_NUM;
+	uint32_t start = read_vga_start();
+	uint8_t *video = (uint8_t *)VGA_WINDOW + start * VAL_2;
+	uint8_t first = video[0];
+
+	switch_terminal(to);
+	if(get_display_terminal() != to
+		|| read_vga_start() / (TERMINAL_VGA_PAGES * VAL_4096 / VAL_2) != to) {
+		assertion_failure();
+		result = FAIL;
+	}
+	switch_terminal(from);
+	if(read_vga_start() != start || video[0] != first) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	return result;
+}
+
+static uint8_t variant_test_src[VARIANT_TEST_SIZE];
+
+/* run_variant_case
+*
+* Run one case of a lib.c routine with the variant currently selected.
+* Inputs: routine -- LIB_MEMCPY, LIB_MEMSET, ...
+*         c -- case number below VARIANT_TEST_CASES
+*         buf -- VARIANT_TEST_SIZE bytes, filled in by the case
+* Outputs: the return value of the routine, relative to buf for pointers
+*/
+static int32_t run_variant_case(int32_t routine, uint32_t c, uint8_t *buf){
+	static const uint32_t sizes[VARIANT_TEST_SIZES] = {0, 1, 15, 64, 100, 513, 4096, 5000};
+	uint32_t size = sizes[c % VARIANT_TEST_SIZES];
+	uint32_t shift = (c / VARIANT_TEST_SIZES) % VARIANT_TEST_SHIFTS * VAL_5;
+	uint32_t kind = c / (VARIANT_TEST_SIZES * VARIANT_TEST_SHIFTS);
+	uint32_t i;
+	int8_t *s1 = (int8_t*)buf + shift;
+	int8_t *s2 = (int8_t*)buf + VARIANT_TEST_SIZE / VAL_2 + kind;
+
+	for(i = 0; i < VARIANT_TEST_SIZE; ++i)
+		buf[i] = (uint8_t)(i * VAL_5 + i / VAL_184);
+
+	switch(routine) {
+		case LIB_MEMCPY:
+			return (uint8_t*)memcpy(buf + shift, variant_test_src + kind, size) - buf;
+		case LIB_MEMSET:
+			return (uint8_t*)memset(buf + shift, c, size) - buf;
+		case LIB_MEMMOVE:
+			// Overlapping by all but kind + 1 bytes, in both directions.
+			if(c % VAL_2)
+				return (uint8_t*)memmove(buf + shift, buf + shift + kind + 1, size) - buf;
+			return (uint8_t*)memmove(buf + shift + kind + 1, buf + shift, size) - buf;
+		case LIB_STRLEN:
+			for(i = 0; i < size; ++i)
+				s1[i] = 'a' + i % VAL_20;
+			s1[size] = '\0';
+			return strlen(s1);
+		case LIB_STRNCMP:
+			for(i = 0; i < size; ++i)
+				s1[i] = s2[i] = 'a' + i % VAL_20;
+			s1[size] = s2[size] = '\0';
+			// Equal, differing in the middle, s2 shorter, compared up to the middle.
+			if(kind == 1 && size > 0)
+				s1[size / VAL_2] = 'A';
+			if(kind == VAL_2 && size > 0)
+				s2[size - 1] = '\0';
+			return strncmp(s1, s2, kind == VAL_4 - 1 ? size / VAL_2 : size + 1);
+	}
+	return 0;
+}
+
+/* test_lib_variants
+*
+* Test every variant of the lib.c routines the processor supports against
+	the base one.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: memcpy, memset, memmove, strlen and strncmp give the same
+	results and leave the same bytes with ERMS, SSE2 and SSE4.2, for
+	several sizes, alignments and overlaps. The selection made by
+	lib_init() is restored afterwards.
+* Files: lib.c
+*/
+int test_lib_variants(){
+	TEST_HEADER;
+
+	int result = PASS;
+	static uint8_t expected[VARIANT_TEST_SIZE];
+	static uint8_t actual[VARIANT_TEST_SIZE];
+	int32_t routine, variant, selected;
+	uint32_t c, i;
+
+	for(i = 0; i < VARIANT_TEST_SIZE; ++i)
+		variant_test_src[i] = (uint8_t)(i * VAL_22 + 1);
+
+	for(routine = 0; routine < LIB_NUM_ROUTINES; ++routine) {
+		selected = lib_get_variant(routine);
+		for(variant = LIB_VARIANT_BASE + 1; variant < LIB_NUM_VARIANTS; ++variant) {
+			for(c = 0; c < VARIANT_TEST_CASES; ++c) {
+				lib_select(routine, LIB_VARIANT_BASE);
+				int32_t expected_ret = run_variant_case(routine, c, expected);
+				if(lib_select(routine, variant) == -1)
+					break;
+				int32_t actual_ret = run_variant_case(routine, c, actual);
+				for(i = 0; i < VARIANT_TEST_SIZE && expected[i] == actual[i]; ++i);
+				if(expected_ret != actual_ret || i < VARIANT_TEST_SIZE) {
+					printf("routine %d variant %d case %d differs\n", routine, variant, c);
+					assertion_failure();
+					result = FAIL;
+					break;
+				}
+			}
+		}
+		lib_select(routine, selected);
+	}
+
+	return result;
+}
+
+// Test run as a process by run_as_process().
+static int32_t (*test_process_body)();
+
+// First code of the process, which ends like a program does, with its result as status.
+static void test_process_main() {
+	halt_current_process(test_process_body());
+}
+
+// Save the frame of the parent and jump onto the kernel stack of the process, the way
+//  syscall_execute() starts a program. halt_current_process() comes back here through
+//  syscall_execute_return with the status. Only caller-saved registers may be used, the
+//  return through syscall_execute_return skips the epilogue.
+static int32_t __attribute__((noinline)) enter_test_process(pcb_t *parent, uint32_t stack) {
+	asm volatile("movl %%esp, %0" : "=r"(parent->esp) : : "memory");
+	asm volatile("movl %%ebp, %0" : "=r"(parent->ebp) : : "memory");
+	asm volatile("                          \n\
+			movl    %0, %%esp               \n\
+			call    *%1                     \n\
+			"
+			:
+			: "c"(stack), "d"(test_process_main)
+			: "memory"
+	);
+	// Never reached.
+	return FAIL;
+}
+
+// Set up pid as a process with no program, no open files and an empty heap.
+static void init_test_pcb(int32_t pid, int32_t parent_pid) {
+	pcb_t *pcb = get_pcb(pid);
+	int32_t i;
+
+	pcb->pid = pid;
+	pcb->parent_pid = parent_pid;
+	pcb->terminal_id = get_display_terminal();
+	pcb->active = parent_pid != -1;
+	pcb->heap_break = USER_HEAP_START;
+	pcb->fpu_used = 0;
+	for(i = 0; i < MAX_FD_SIZE; ++i)
+		pcb->file_array[i].flag = 0;
+	for(i = 0; i < NUM_PDT_SIZE; ++i)
+		page_directory_program[pid][i] = page_directory_initial[i];
+}
+
+/* run_as_process
+ * Run test as a process, child of another one that stands for the kernel
+ * running the tests, so that system calls work on it and it can be halted.
+ * Inputs: test -- body of the process
+ * Outputs: what test returns, HALT_STATUS_ON_EXCEPTION if it faulted, FAIL
+ *          if there are not two free pids
+ */
+static int32_t run_as_process(int32_t (*test)()) {
+	int32_t parent, child, status;
+
+	if((parent = request_pid()) == -1)
+		return FAIL;
+	if((child = request_pid()) == -1) {
+		release_pid(parent);
+		return FAIL;
+	}
+	init_test_pcb(parent, -1);
+	init_test_pcb(child, parent);
+
+	test_process_body = test;
+	load_page_directory(page_directory_program[child]);
+	status = enter_test_process(get_pcb(parent), (uint32_t)get_pcb(child) + KERNEL_STACK_SIZE);
+
+	release_pid(parent);
+	load_page_directory(page_directory_initial);
+	return status;
+}
+
+// Body of test_ipc_errors.
+static int32_t ipc_errors_process() {
+	int result = PASS;
+	pcb_t *pcb = get_current_pcb();
+	ipc_msg_t *msg = (ipc_msg_t *)USER_HEAP_START;
+	ipc_msg_t *unmapped = (ipc_msg_t *)USER_MMAP_START;
+	int32_t free_pid;
+
+	for(free_pid = 0; free_pid < MAX_PROCESS_NUMBER && process_exist[free_pid]; ++free_pid);
+
+	if(syscall_brk((void *)(USER_HEAP_START + PAGE_SIZE)) == -1) {
+		assertion_failure();
+		return FAIL;
+	}
+	msg->buf = (void *)(USER_HEAP_START + sizeof(ipc_msg_t));
+	msg->len = VAL_4;
+	msg->flags = 0;
+
+	// Bad messages, no receiver, or nobody to reply to: nothing may block.
+	if(syscall_ipc_send(pcb->parent_pid, NULL, NULL) != -1 ||
+	   syscall_ipc_send(pcb->parent_pid, unmapped, NULL) != -1 ||
+	   syscall_ipc_send(pcb->parent_pid, msg, unmapped) != -1 ||
+	   syscall_ipc_send(-1, msg, NULL) != -1 ||
+	   syscall_ipc_send(MAX_PROCESS_NUMBER, msg, NULL) != -1 ||
+	   syscall_ipc_send(pcb->pid, msg, NULL) != -1 ||
+	   (free_pid < MAX_PROCESS_NUMBER && syscall_ipc_send(free_pid, msg, NULL) != -1) ||
+	   syscall_ipc_receive(NULL) != -1 ||
+	   syscall_ipc_receive(unmapped) != -1 ||
+	   syscall_ipc_reply(pcb->parent_pid, msg) != -1 ||
+	   syscall_ipc_reply(-1, NULL) != -1 ||
+	   syscall_ipc_reply(pcb->pid, unmapped) != -1) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	return result;
+}
+
+/* test_ipc_errors
+*
+* Test the error paths of the IPC system calls.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: Sending to a bad, missing or own pid, unmapped message
+	buffers, and replying to a process that is not waiting for a reply
+	all fail right away, and the pages of the process go back to the
+	pool when it halts.
+* Files: ipc.c, syscall.c
+*/
+int test_ipc_errors(){
+	TEST_HEADER;
+
+	uint32_t free_frames = get_free_frame_count();
+	int result = run_as_process(ipc_errors_process);
+
+	if(get_free_frame_count() != free_frames) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	return result;
+}
+
+// Body of test_futex_errors.
+static int32_t futex_errors_process() {
+	int result = PASS;
+	uint32_t *word = (uint32_t *)USER_HEAP_START;
+
+	if(syscall_brk((void *)(USER_HEAP_START + PAGE_SIZE)) == -1) {
+		assertion_failure();
+		return FAIL;
+	}
+	*word = VAL_5;
+
+	// Bad words, or a value that already changed: nothing may block.
+	if(syscall_futex_wait(NULL, 0) != -1 ||
+	   syscall_futex_wait((uint32_t *)((uint32_t)word + 1), 0) != -1 ||
+	   syscall_futex_wait((uint32_t *)USER_MMAP_START, 0) != -1 ||
+	   syscall_futex_wait(word, VAL_5 + 1) != -1 ||
+	   syscall_futex_wake(word, -1) != -1 ||
+	   syscall_futex_wake((uint32_t *)USER_MMAP_START, 1) != -1 ||
+	   syscall_futex_wake(word, 1) != 0) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	return result;
+}
+
+/* test_futex_errors
+*
+* Test the error paths of the futex system calls.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: Waiting on a NULL, unaligned or unmapped word, or on a word
+	that no longer holds the value, returns -1 at once, waking takes no
+	negative count, and waking a word without waiters wakes nobody.
+* Files: futex.c, syscall.c
+*/
+int test_futex_errors(){
+	TEST_HEADER;
+
+	return run_as_process(futex_errors_process);
+}
+
+// Body of test_brk.
+static int32_t brk_process() {
+	int result = PASS;
+	uint32_t pid = get_current_pcb()->pid;
+	uint8_t *heap = (uint8_t *)USER_HEAP_START;
+	uint32_t free_frames;
+
+	// The break cannot go below the start of the heap or into the vidmap region.
+	if(syscall_brk(NULL) != USER_HEAP_START ||
+	   syscall_brk(heap - 1) != -1 ||
+	   syscall_brk((void *)(USER_HEAP_END + 1)) != -1 ||
+	   syscall_brk(NULL) != USER_HEAP_START) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	// The first page also brings a page table with it.
+	if(syscall_brk(heap + 1) != (int32_t)(heap + 1)) {
+		assertion_failure();
+		return FAIL;
+	}
+	free_frames = get_free_frame_count();
+
+	if(syscall_brk(heap + VAL_2 * PAGE_SIZE + VAL_5) != (int32_t)(heap + VAL_2 * PAGE_SIZE + VAL_5) ||
+	   !is_user_range_mapped(pid, heap, VAL_2 * PAGE_SIZE + VAL_5) ||
+	   heap[VAL_2 * PAGE_SIZE + VAL_4] != 0) {
+		assertion_failure();
+		return FAIL;
+	}
+	heap[0] = VAL_5;
+	heap[VAL_2 * PAGE_SIZE + VAL_4] = VAL_5;
+
+	// Shrinking gives the pages above the break back, the rest stays as it was.
+	if(syscall_brk(heap + 1) != (int32_t)(heap + 1) ||
+	   is_user_range_mapped(pid, heap + PAGE_SIZE, 1) ||
+	   heap[0] != VAL_5 ||
+	   get_free_frame_count() != free_frames) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	return result;
+}
+
+/* test_brk
+*
+* Test moving the break of a process.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: A break below the start of the heap or past its end is
+	refused and leaves the break alone, growing maps zeroed pages, and
+	shrinking unmaps them and gives their frames back.
+* Files: syscall.c, memory.c
+*/
+int test_brk(){
+	TEST_HEADER;
+
+	uint32_t free_frames = get_free_frame_count();
+	int result = run_as_process(brk_process);
+
+	if(get_free_frame_count() != free_frames) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	return result;
+}
+
+// Body of test_mmap_errors.
+static int32_t mmap_errors_process() {
+	int result = PASS;
+	uint32_t pid = get_current_pcb()->pid;
+	uint32_t free_frames;
+	int32_t start;
+
+	// No such file, no length, or an address outside of the mmap region.
+	if(syscall_mmap(NULL, PAGE_SIZE, VAL_2) != -1 ||
+	   syscall_mmap(NULL, PAGE_SIZE, MAX_FD_SIZE) != -1 ||
+	   syscall_mmap(NULL, PAGE_SIZE, -VAL_2) != -1 ||
+	   syscall_mmap(NULL, 0, -1) != -1 ||
+	   syscall_mmap((void *)(USER_MMAP_START + 1), PAGE_SIZE, -1) != -1 ||
+	   syscall_mmap((void *)USER_HEAP_START, PAGE_SIZE, -1) != -1 ||
+	   syscall_mmap((void *)(USER_MMAP_END - PAGE_SIZE), VAL_2 * PAGE_SIZE, -1) != -1 ||
+	   syscall_munmap((void *)(USER_MMAP_START + 1), PAGE_SIZE) != -1 ||
+	   syscall_munmap((void *)USER_MMAP_START, 0) != -1 ||
+	   syscall_munmap((void *)USER_HEAP_START, PAGE_SIZE) != -1) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	// Anonymous pages read as zero once touched.
+	start = syscall_mmap(NULL, VAL_2 * PAGE_SIZE, -1);
+	if(start == -1 || *(uint32_t *)start != 0) {
+		assertion_failure();
+		return FAIL;
+	}
+	*(uint32_t *)start = VAL_5;
+
+	// Unmapping twice gives the frame back once, the second time there is nothing left.
+	if(syscall_munmap((void *)start, VAL_2 * PAGE_SIZE) != 0) {
+		assertion_failure();
+		return FAIL;
+	}
+	free_frames = get_free_frame_count();
+	if(syscall_munmap((void *)start, VAL_2 * PAGE_SIZE) != 0 ||
+	   get_free_frame_count() != free_frames ||
+	   is_user_range_mapped(pid, (void *)start, 1)) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	return result;
+}
+
+/* test_mmap_errors
+*
+* Test the error paths of mmap and munmap.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: Descriptors that are not open files, zero lengths, and
+	unaligned or out-of-region addresses are refused, anonymous pages
+	read as zero, and unmapping a range twice frees its frames once.
+* Files: syscall.c, memory.c
+*/
+int test_mmap_errors(){
+	TEST_HEADER;
+
+	uint32_t free_frames = get_free_frame_count();
+	int result = run_as_process(mmap_errors_process);
+
+	if(get_free_frame_count() != free_frames) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	return result;
+}
+
+// Body of test_halt_in_stream_copy, faults in the middle of a streaming copy.
+static int32_t stream_copy_fault_process() {
+	static uint8_t src[VAL_2 * PAGE_SIZE];
+
+	memcpy_stream((void *)USER_MMAP_START, src, sizeof(src));
+	return PASS;
+}
+
+/* test_halt_in_stream_copy
+*
+* Test halting a process in the middle of a streaming copy.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: A copy into an unmapped user page halts the process with
+	the SSE registers taken, the kernel can take them again afterwards.
+* Files: fpu.c, syscall.c
+*/
+int test_halt_in_stream_copy(){
+	TEST_HEADER;
+
+	int result = PASS;
+	uint32_t flags;
+
+	if(run_as_process(stream_copy_fault_process) != HALT_STATUS_ON_EXCEPTION) {
+		assertion_failure();
+		return FAIL;
+	}
+
+	if(fpu_has_sse2()) {
+		if(kernel_fpu_begin(&flags) != 0) {
+			assertion_failure();
+			result = FAIL;
+		}
+		else {
+			kernel_fpu_end(flags);
+		}
+	}
+
+	return result;
+}
+
+/* test_tmpfs
+*
+* Test the RAM file system.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: Data written across a page boundary reads back, and
+	unlinking returns every page to the frame pool.
+* Files: tmpfs.c
+*/
+int test_tmpfs(){
+	TEST_HEADER;
+
+	int result = PASS;
+	static uint8_t buf[PAGE_SIZE + VAL_10];
+	uint8_t *fname = (uint8_t*)"tmp/scratch";
+	uint32_t free_frames = get_free_frame_count();
+	int32_t index;
+	int i;
+
+	if(tmpfs_create((uint8_t*)"scratch") != -1 || tmpfs_create(fname) != 0 ||
+	   tmpfs_create(fname) != -1 || (index = tmpfs_lookup(fname)) == -1) {
+		assertion_failure();
+		return FAIL;
+	}
+
+	for(i = 0; i < sizeof(buf); ++i)
+		buf[i] = i;
+	if(tmpfs_write_data(index, 0, buf, sizeof(buf)) != sizeof(buf) ||
+	   tmpfs_get_length(index) != sizeof(buf)) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	memset(buf, 0, sizeof(buf));
+	if(tmpfs_read_data(index, 0, buf, sizeof(buf)) != sizeof(buf)) {
+		assertion_failure();
+		result = FAIL;
+	}
+	for(i = 0; i < sizeof(buf); ++i) {
+		if(buf[i] != (uint8_t)i) {
+			assertion_failure();
+			result = FAIL;
+			break;
+		}
+	}
+
+	// Shrink, then grow again: the old bytes must not come back.
+	if(tmpfs_truncate(index, VAL_5) != 0 || tmpfs_truncate(index, VAL_10) != 0 ||
+	   tmpfs_read_data(index, 0, buf, sizeof(buf)) != VAL_10 || buf[VAL_5] != 0 || buf[VAL_5 - 1] != VAL_5 - 1) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	if(tmpfs_unlink(fname) != 0 || tmpfs_lookup(fname) != -1 || get_free_frame_count() != free_frames) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	return result;
+}
+
+/* test_vfs_inode_cache
+*
+* Test the inode cache of the VFS.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: A second open of a file hits the cached vnode, an open file
+	cannot be unlinked, writes through one backend update the cached
+	length, and device names resolve through their own mount.
+* Files: vfs.c
+*/
+int test_vfs_inode_cache(){
+	TEST_HEADER;
+
+	int result = PASS;
+	uint8_t *fname = (uint8_t*)"tmp/vfs";
+	vfs_stats_t before, after;
+	vnode_t *first, *second;
+
+	vfs_get_stats(&before);
+	first = vfs_open((uint8_t*)"frame1.txt");
+	second = vfs_open((uint8_t*)"frame1.txt");
+	vfs_get_stats(&after);
+	if(first == NULL || first != second || first->refcount < VAL_2 || after.hits <= before.hits ||
+	   first->type != REGULAR_FILE || first->length != get_file_length(first->ino)) {
+		assertion_failure();
+		result = FAIL;
+	}
+	vfs_close(second);
+	vfs_close(first);
+
+	if(vfs_create(fname) != 0 || (first = vfs_open(fname)) == NULL) {
+		assertion_failure();
+		return FAIL;
+	}
+	if(vfs_write(first, 0, (uint8_t*)"vnode", VAL_5) != VAL_5 || first->length != VAL_5 ||
+	   vfs_unlink(fname) != -1) {
+		assertion_failure();
+		result = FAIL;
+	}
+	vfs_close(first);
+	if(vfs_unlink(fname) != 0 || vfs_open(fname) != NULL) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	first = vfs_open((uint8_t*)DEVFS_PREFIX "rtc");
+	if(first == NULL || first->type != RTC_FILE) {
+		assertion_failure();
+		result = FAIL;
+	}
+	vfs_close(first);
+
+	return result;
+}
+
+// Map a RAM file, check that it stays pinned until unmapped, and halt with it mapped again.
+static int32_t mmap_pins_file_process() {
+	int result = PASS;
+	uint8_t *fname = (uint8_t*)"tmp/mapped";
+	int32_t fd, start;
+
+	if(syscall_create(fname) != 0 || (fd = syscall_open(fname)) == -1) {
+		assertion_failure();
+		return FAIL;
+	}
+	if(syscall_write(fd, "mapped", VAL_6) != VAL_6 ||
+	   (start = syscall_mmap(NULL, PAGE_SIZE, fd)) == -1 ||
+	   strncmp((int8_t*)start, (int8_t*)"mapped", VAL_6) != 0) {
+		assertion_failure();
+		return FAIL;
+	}
+
+	// The mapping outlives the descriptor, its blocks must not be freed.
+	syscall_close(fd);
+	fd = syscall_open(fname);
+	if(syscall_unlink(fname) != -1 || syscall_truncate(fd, 0) != -1) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	if(syscall_munmap((void *)start, PAGE_SIZE) != 0 || syscall_truncate(fd, VAL_6) != 0) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	if(syscall_mmap(NULL, PAGE_SIZE, fd) == -1) {
+		assertion_failure();
+		result = FAIL;
+	}
+	syscall_close(fd);
+
+	return result;
+}
+
+/* test_mmap_pins_file
+*
+* Test that mapped files keep their blocks.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: A file mapped by mmap cannot be unlinked or truncated, even
+	after its descriptor is closed, until it is unmapped or the process
+	that maps it halts.
+* Files: syscall.c, vfs.c
+*/
+int test_mmap_pins_file(){
+	TEST_HEADER;
+
+	uint32_t free_frames = get_free_frame_count();
+	int result = run_as_process(mmap_pins_file_process);
+
+	if(vfs_unlink((uint8_t*)"tmp/mapped") != 0 || get_free_frame_count() != free_frames) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	return result;
+}
+
+// Body of test_mmap_image_file, maps two pages of MMAP_TEST_FILE and checks them.
+static int32_t mmap_image_file_process() {
+	static uint8_t expected[VAL_2 * PAGE_SIZE];
+	int result = PASS;
+	uint32_t pid = get_current_pcb()->pid;
+	uint32_t length, block, i;
+	dentry_t dentry;
+	pdt_entry_t *pde;
+	pt_entry_t *pte;
+	int32_t fd, start;
+
+	if(read_dentry_by_name((uint8_t*)MMAP_TEST_FILE, &dentry) != 0 ||
+	   (fd = syscall_open((uint8_t*)MMAP_TEST_FILE)) == -1) {
+		assertion_failure();
+		return FAIL;
+	}
+	length = get_file_length(dentry.inode_idx);
+	if(length < PAGE_SIZE || length > sizeof(expected)) {
+		printf("%s is not between one and two pages long.\n", MMAP_TEST_FILE);
+		assertion_failure();
+		return FAIL;
+	}
+	memset(expected, 0, sizeof(expected));
+	if(read_data(dentry.inode_idx, 0, expected, length) != length ||
+	   (start = syscall_mmap(NULL, sizeof(expected), fd)) == -1) {
+		assertion_failure();
+		return FAIL;
+	}
+
+	// The file, then zeros up to the end of the second page.
+	for(i = 0; i < sizeof(expected); ++i) {
+		if(((uint8_t *)start)[i] != expected[i]) {
+			assertion_failure();
+			result = FAIL;
+			break;
+		}
+	}
+
+	// The whole first block is the page of the image itself, as long as the image is in memory.
+	block = get_data_block_address(dentry.inode_idx, 0);
+	pde = &page_directory_program[pid][start >> VAL_22];
+	pte = &((pt_entry_t *)(pde->entry_PT.pt_base_address << VAL_12))[(start >> VAL_12) & (NUM_PT_SIZE - 1)];
+	if(pte->present != 1 || pte->user_supervisor != 1 || pte->read_write != 0 ||
+	   (block != 0 && pte->page_base_address != kernel_virt_to_phys(block) >> VAL_12)) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	if(syscall_munmap((void *)start, sizeof(expected)) != 0) {
+		assertion_failure();
+		result = FAIL;
+	}
+	syscall_close(fd);
+
+	return result;
+}
+
+// Body of test_mmap_image_file, writes to a read-only mapping of MMAP_TEST_FILE.
+static int32_t mmap_image_write_process() {
+	int32_t fd, start;
+
+	if((fd = syscall_open((uint8_t*)MMAP_TEST_FILE)) == -1 ||
+	   (start = syscall_mmap(NULL, PAGE_SIZE, fd)) == -1)
+		return FAIL;
+	// The mapping keeps the file, halting does not close descriptors below 2.
+	syscall_close(fd);
+	*(volatile uint8_t *)start = ~*(volatile uint8_t *)start;
+
+	return FAIL;
+}
+
+/* test_mmap_image_file
+*
+* Test mapping a file of the in-memory image.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: The mapped bytes match read_data with zeros after the end of
+	file, a whole block is mapped present, user and read-only straight
+	from the image, and writing to it halts the process and leaves the
+	image alone.
+* Files: syscall.c, memory.c, paging.S
+*/
+int test_mmap_image_file(){
+	TEST_HEADER;
+
+	uint32_t free_frames = get_free_frame_count();
+	int result = run_as_process(mmap_image_file_process);
+	dentry_t dentry;
+	uint8_t before, after;
+
+	if(read_dentry_by_name((uint8_t*)MMAP_TEST_FILE, &dentry) != 0 ||
+	   read_data(dentry.inode_idx, 0, &before, 1) != 1) {
+		assertion_failure();
+		return FAIL;
+	}
+	if(run_as_process(mmap_image_write_process) != HALT_STATUS_ON_EXCEPTION ||
+	   read_data(dentry.inode_idx, 0, &after, 1) != 1 || after != before) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	if(get_free_frame_count() != free_frames) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	return result;
+}
+
+// Make a system call through int $0x80 with up to four arguments, as user programs do.
+static int32_t int80_syscall(int32_t num, int32_t arg1, int32_t arg2, int32_t arg3, int32_t arg4) {
+	int32_t ret;
+
+	asm volatile("int $0x80"
+		: "=a"(ret)
+		: "a"(num), "b"(arg1), "c"(arg2), "d"(arg3), "S"(arg4)
+		: "memory", "cc");
+	return ret;
+}
+
+// Body of test_sendfile, copies MMAP_TEST_FILE into a tmpfs file.
+static int32_t sendfile_process() {
+	static uint8_t expected[SENDFILE_TEST_COUNT];
+	static uint8_t copied[SENDFILE_TEST_COUNT];
+	int result = PASS;
+	uint8_t *fname = (uint8_t*)"tmp/sendfile";
+	pcb_t *pcb = get_current_pcb();
+	dentry_t dentry;
+	int32_t in, out, dir, length, i;
+
+	if(read_dentry_by_name((uint8_t*)MMAP_TEST_FILE, &dentry) != 0 || syscall_create(fname) != 0 ||
+	   (in = syscall_open((uint8_t*)MMAP_TEST_FILE)) == -1 || (out = syscall_open(fname)) == -1 ||
+	   (dir = syscall_open((uint8_t*)".")) == -1) {
+		assertion_failure();
+		return FAIL;
+	}
+	length = get_file_length(dentry.inode_idx);
+
+	// Descriptors that are not open, a directory to read from, a bad offset or count.
+	if(syscall_sendfile(out, MAX_FD_SIZE - 1, 0, 1) != -1 || syscall_sendfile(out, -1, 0, 1) != -1 ||
+	   syscall_sendfile(MAX_FD_SIZE - 1, in, 0, 1) != -1 || syscall_sendfile(MAX_FD_SIZE, in, 0, 1) != -1 ||
+	   syscall_sendfile(out, dir, 0, 1) != -1 || syscall_sendfile(out, in, -VAL_2, 1) != -1 ||
+	   syscall_sendfile(out, in, 0, -1) != -1) {
+		assertion_failure();
+		result = FAIL;
+	}
+	// Nothing is left to copy at or past the end of file.
+	if(syscall_sendfile(out, in, length, 1) != 0 || syscall_sendfile(out, in, length + 1, 1) != 0 ||
+	   pcb->file_array[out].vnode->length != 0) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	// The count goes in esi, check that it gets through the system call linkage.
+	if(int80_syscall(SYSCALL_SENDFILE, out, in, SENDFILE_TEST_OFFSET, SENDFILE_TEST_COUNT) != SENDFILE_TEST_COUNT ||
+	   pcb->file_array[in].file_position != 0 ||
+	   read_data(dentry.inode_idx, SENDFILE_TEST_OFFSET, expected, SENDFILE_TEST_COUNT) != SENDFILE_TEST_COUNT ||
+	   vfs_read(pcb->file_array[out].vnode, 0, copied, SENDFILE_TEST_COUNT, NULL) != SENDFILE_TEST_COUNT) {
+		assertion_failure();
+		return FAIL;
+	}
+	for(i = 0; i < SENDFILE_TEST_COUNT; ++i) {
+		if(copied[i] != expected[i]) {
+			assertion_failure();
+			result = FAIL;
+			break;
+		}
+	}
+
+	// Without an offset, the whole file is copied from the position of in_fd, which advances.
+	if(syscall_sendfile(out, in, -1, length + 1) != length || pcb->file_array[in].file_position != length ||
+	   syscall_sendfile(out, in, -1, 1) != 0 ||
+	   pcb->file_array[out].vnode->length != SENDFILE_TEST_COUNT + length) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	syscall_close(dir);
+	syscall_close(out);
+	syscall_close(in);
+	if(syscall_unlink(fname) != 0) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	return result;
+}
+
+/* test_sendfile
+*
+* Test the sendfile system call.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: Descriptors that are not open or not regular files and bad
+	offsets or counts are refused, nothing is copied past the end of
+	file, a range across a block boundary arrives intact through
+	int $0x80 with the count in esi, and copying from the current
+	position advances it.
+* Files: syscall.c, interrupt_linkage.S
+*/
+int test_sendfile(){
+	TEST_HEADER;
+
+	uint32_t free_frames = get_free_frame_count();
+	int result = run_as_process(sendfile_process);
+
+	if(get_free_frame_count() != free_frames) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	return result;
+}
+
+// Check the used bytes of records getdents put in buf against the root directory, starting
+//  at dentry index *next. *next is moved past the records checked.
+static int32_t check_dirents(const uint8_t *buf, int32_t used, uint32_t *next) {
+	const dirent_t *record;
+	dentry_t dentry;
+	int32_t pos, name_len;
+
+	for(pos = 0; pos < used; pos += record->rec_len) {
+		record = (const dirent_t *)(buf + pos);
+		if(read_dentry_by_index((*next)++, &dentry) != 0)
+			return FAIL;
+		for(name_len = 0; name_len < FILE_NAME_MAX_LENGTH && dentry.file_name[name_len] != '\0'; ++name_len);
+
+		// Packed: each record is as long as its name needs, rounded up to DIRENT_ALIGN.
+		if(record->rec_len != ((sizeof(dirent_t) + name_len + 1 + DIRENT_ALIGN - 1) & ~(DIRENT_ALIGN - 1)) ||
+		   record->name_len != name_len || record->name[name_len] != '\0' ||
+		   strncmp((const int8_t*)record->name, (const int8_t*)dentry.file_name, name_len) != 0 ||
+		   record->type != dentry.file_type || record->inode != dentry.inode_idx ||
+		   record->size != ((dentry.file_type == REGULAR_FILE) ? get_file_length(dentry.inode_idx) : 0))
+			return FAIL;
+	}
+
+	return (pos == used) ? PASS : FAIL;
+}
+
+// Body of test_getdents, lists the root directory through two descriptors in turn.
+static int32_t getdents_process() {
+	uint8_t *buf = (uint8_t *)USER_HEAP_START;
+	static const int32_t sizes[VAL_2] = {GETDENTS_TEST_SMALL, GETDENTS_TEST_LARGE};
+	uint32_t next[VAL_2] = {0, 0};
+	int32_t fds[VAL_2], done[VAL_2] = {0, 0};
+	int32_t file, ret, i;
+	dentry_t dentry;
+
+	if(syscall_brk((void *)(USER_HEAP_START + PAGE_SIZE)) == -1 ||
+	   (fds[0] = syscall_open((uint8_t*)".")) == -1 || (fds[1] = syscall_open((uint8_t*)".")) == -1 ||
+	   (file = syscall_open((uint8_t*)"frame0.txt")) == -1) {
+		assertion_failure();
+		return FAIL;
+	}
+
+	// Not a directory, not open, a bad buffer, or room for no record at all.
+	if(syscall_getdents(file, buf, PAGE_SIZE) != -1 || syscall_getdents(MAX_FD_SIZE - 1, buf, PAGE_SIZE) != -1 ||
+	   syscall_getdents(fds[0], (void *)USER_MMAP_START, PAGE_SIZE) != -1 ||
+	   syscall_getdents(fds[0], buf, -1) != -1 || syscall_getdents(fds[0], buf, sizeof(dirent_t)) != -1) {
+		assertion_failure();
+		return FAIL;
+	}
+
+	// Each descriptor keeps its own cursor however the calls interleave.
+	while(!done[0] || !done[1]) {
+		for(i = 0; i < VAL_2; ++i) {
+			if(done[i])
+				continue;
+			ret = syscall_getdents(fds[i], buf, sizes[i]);
+			if(ret == 0) {
+				done[i] = 1;
+				continue;
+			}
+			if(ret < 0 || check_dirents(buf, ret, &next[i]) != PASS) {
+				assertion_failure();
+				return FAIL;
+			}
+		}
+	}
+
+	// Both reached the end of the same directory.
+	if(next[0] != next[1] || read_dentry_by_index(next[0], &dentry) == 0) {
+		assertion_failure();
+		return FAIL;
+	}
+
+	syscall_close(file);
+	syscall_close(fds[1]);
+	syscall_close(fds[0]);
+
+	return PASS;
+}
+
+/* test_getdents
+*
+* Test the getdents system call.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: Files, closed descriptors, unmapped buffers and buffers too
+	small for one record are refused. Two descriptors on "." read in
+	turn with different buffer sizes keep separate cursors, and both
+	list every dentry of the root directory. Records are packed and
+	4-byte aligned, and have the right name, type, inode and size.
+* Files: syscall.c, file_system.c
+*/
+int test_getdents(){
+	TEST_HEADER;
+
+	return run_as_process(getdents_process);
+}
+
+// Body of test_seek_pread_fstat.
+static int32_t seek_process() {
+	static uint8_t expected[SEEK_TEST_COUNT];
+	uint8_t *buf = (uint8_t *)USER_HEAP_START;
+	stat_t *st = (stat_t *)(USER_HEAP_START + PAGE_SIZE - sizeof(stat_t));
+	int result = PASS;
+	int32_t fd, dir, rtc, length, i;
+	dentry_t dentry;
+
+	if(syscall_brk((void *)(USER_HEAP_START + PAGE_SIZE)) == -1 ||
+	   read_dentry_by_name((uint8_t*)"frame0.txt", &dentry) != 0 ||
+	   (fd = syscall_open((uint8_t*)"frame0.txt")) == -1 || (dir = syscall_open((uint8_t*)".")) == -1 ||
+	   (rtc = syscall_open((uint8_t*)DEVFS_PREFIX "rtc")) == -1) {
+		assertion_failure();
+		return FAIL;
+	}
+	length = get_file_length(dentry.inode_idx);
+
+	// Every whence on a file, then offsets before the start and whence values that are refused.
+	if(syscall_lseek(fd, SEEK_TEST_OFFSET, SEEK_SET) != SEEK_TEST_OFFSET ||
+	   syscall_lseek(fd, VAL_5, SEEK_CUR) != SEEK_TEST_OFFSET + VAL_5 ||
+	   syscall_lseek(fd, -VAL_5, SEEK_END) != length - VAL_5 ||
+	   syscall_lseek(fd, -1, SEEK_SET) != -1 || syscall_lseek(fd, -length - 1, SEEK_END) != -1 ||
+	   syscall_lseek(fd, -length, SEEK_CUR) != -1 || syscall_lseek(fd, 0, VAL_5) != -1 ||
+	   syscall_lseek(fd, 0, SEEK_CUR) != length - VAL_5) {
+		assertion_failure();
+		result = FAIL;
+	}
+	// Only regular files have an end, and the rtc has no position at all.
+	if(syscall_lseek(dir, 0, SEEK_END) != -1 || syscall_lseek(rtc, 0, SEEK_END) != -1 ||
+	   syscall_lseek(rtc, 0, SEEK_SET) != -1 || syscall_lseek(MAX_FD_SIZE - 1, 0, SEEK_SET) != -1) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	// read continues from the position set by lseek.
+	if(syscall_lseek(fd, SEEK_TEST_OFFSET, SEEK_SET) != SEEK_TEST_OFFSET ||
+	   syscall_read(fd, buf, SEEK_TEST_COUNT) != SEEK_TEST_COUNT ||
+	   read_data(dentry.inode_idx, SEEK_TEST_OFFSET, expected, SEEK_TEST_COUNT) != SEEK_TEST_COUNT) {
+		assertion_failure();
+		return FAIL;
+	}
+	for(i = 0; i < SEEK_TEST_COUNT; ++i) {
+		if(buf[i] != expected[i]) {
+			assertion_failure();
+			result = FAIL;
+			break;
+		}
+	}
+
+	// pread reads at its own offset and leaves the position alone.
+	if(syscall_pread(fd, buf, PREAD_TEST_COUNT, PREAD_TEST_OFFSET) != PREAD_TEST_COUNT ||
+	   read_data(dentry.inode_idx, PREAD_TEST_OFFSET, expected, PREAD_TEST_COUNT) != PREAD_TEST_COUNT ||
+	   syscall_lseek(fd, 0, SEEK_CUR) != SEEK_TEST_OFFSET + SEEK_TEST_COUNT) {
+		assertion_failure();
+		return FAIL;
+	}
+	for(i = 0; i < PREAD_TEST_COUNT; ++i) {
+		if(buf[i] != expected[i]) {
+			assertion_failure();
+			result = FAIL;
+			break;
+		}
+	}
+	if(syscall_pread(fd, buf, PREAD_TEST_COUNT, length) != 0 || syscall_pread(fd, buf, PREAD_TEST_COUNT, -1) != -1 ||
+	   syscall_pread(dir, buf, PREAD_TEST_COUNT, 0) != -1 ||
+	   syscall_pread(fd, (void *)USER_MMAP_START, PREAD_TEST_COUNT, 0) != -1) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	// fstat of each kind of descriptor.
+	if(syscall_fstat(fd, st) != 0 || st->type != REGULAR_FILE || st->size != length ||
+	   st->blocks != (length + sizeof(data_block_t) - 1) / sizeof(data_block_t) || st->inode != dentry.inode_idx) {
+		assertion_failure();
+		result = FAIL;
+	}
+	if(syscall_fstat(dir, st) != 0 || st->type != DIRECTORY_FILE || st->size != 0 || st->blocks != 0 ||
+	   syscall_fstat(rtc, st) != 0 || st->type != RTC_FILE ||
+	   syscall_fstat(MAX_FD_SIZE - 1, st) != -1 || syscall_fstat(fd, (stat_t *)USER_MMAP_START) != -1) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	syscall_close(rtc);
+	syscall_close(dir);
+	syscall_close(fd);
+
+	return result;
+}
+
+/* test_seek_pread_fstat
+*
+* Test the lseek, pread and fstat system calls.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: SEEK_SET, SEEK_CUR and SEEK_END move the position of a file
+	and read follows it, negative results and SEEK_END on a directory
+	or the rtc are refused, pread reads at its offset without moving
+	the position, and fstat gives the type, size, blocks and inode of
+	frame0.txt as the file system has them.
+* Files: syscall.c
+*/
+int test_seek_pread_fstat(){
+	TEST_HEADER;
+
+	return run_as_process(seek_process);
+}
+
+extern fops_t stdout;
+
+// Interrupt flag of EFLAGS, to check that writev restores it.
+static uint32_t interrupt_flag() {
+	uint32_t flags;
+
+	asm volatile("pushfl; popl %0" : "=r"(flags));
+	return flags & EFLAGS_IF;
+}
+
+// Body of test_readv_writev.
+static int32_t iovec_process() {
+	static uint8_t expected[IOV_TEST_LEN0 + IOV_TEST_LEN1 + IOV_TEST_LEN2];
+	iovec_t *iov = (iovec_t *)USER_HEAP_START;
+	uint8_t *buf = (uint8_t *)(USER_HEAP_START + IOV_TEST_DATA);
+	uint8_t *fname = (uint8_t*)"tmp/iov";
+	pcb_t *pcb = get_current_pcb();
+	int result = PASS;
+	int32_t fd, out, total, i, j;
+	dentry_t dentry;
+
+	if(syscall_brk((void *)(USER_HEAP_START + PAGE_SIZE)) == -1 ||
+	   read_dentry_by_name((uint8_t*)"frame0.txt", &dentry) != 0 || syscall_create(fname) != 0 ||
+	   (fd = syscall_open((uint8_t*)"frame0.txt")) == -1 || (out = syscall_open(fname)) == -1) {
+		assertion_failure();
+		return FAIL;
+	}
+
+	// Bad counts, and a buffer that is not mapped stops writev before it writes anything.
+	iov[0].base = buf;
+	iov[0].len = VAL_4;
+	iov[1].base = (void *)USER_MMAP_START;
+	iov[1].len = VAL_4;
+	if(syscall_writev(out, iov, 0) != 0 || syscall_readv(fd, iov, 0) != 0 ||
+	   syscall_writev(out, iov, -1) != -1 || syscall_readv(fd, iov, -1) != -1 ||
+	   syscall_writev(out, iov, IOV_MAX + 1) != -1 || syscall_readv(fd, iov, IOV_MAX + 1) != -1 ||
+	   syscall_writev(out, iov, VAL_2) != -1 || pcb->file_array[out].vnode->length != 0 ||
+	   syscall_readv(fd, iov, VAL_2) != -1 || pcb->file_array[fd].file_position != 0 ||
+	   syscall_writev(MAX_FD_SIZE - 1, iov, 1) != -1 || syscall_writev(out, (iovec_t *)USER_MMAP_START, 1) != -1) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	// readv fills each buffer in turn from the file.
+	iov[0].base = buf;
+	iov[0].len = IOV_TEST_LEN0;
+	iov[1].base = buf + IOV_TEST_LEN0 + VAL_8;
+	iov[1].len = IOV_TEST_LEN1;
+	iov[VAL_2].base = buf + IOV_TEST_LEN0 + IOV_TEST_LEN1 + VAL_4 * VAL_8;
+	iov[VAL_2].len = IOV_TEST_LEN2;
+	total = IOV_TEST_LEN0 + IOV_TEST_LEN1 + IOV_TEST_LEN2;
+	if(syscall_readv(fd, iov, IOV_TEST_COUNT) != total || pcb->file_array[fd].file_position != total ||
+	   read_data(dentry.inode_idx, 0, expected, total) != total) {
+		assertion_failure();
+		return FAIL;
+	}
+	for(i = 0, j = 0; i < IOV_TEST_COUNT; j += iov[i].len, ++i) {
+		if(strncmp((int8_t *)iov[i].base, (int8_t *)expected + j, iov[i].len) != 0) {
+			assertion_failure();
+			result = FAIL;
+			break;
+		}
+	}
+
+	// writev appends the buffers one after another.
+	memcpy(buf, "abc", VAL_3);
+	memcpy(buf + VAL_8, "defgh", VAL_5);
+	iov[0].base = buf;
+	iov[0].len = VAL_3;
+	iov[1].base = buf + VAL_8;
+	iov[1].len = VAL_5;
+	if(syscall_writev(out, iov, VAL_2) != VAL_8 || pcb->file_array[out].vnode->length != VAL_8 ||
+	   syscall_pread(out, buf + VAL_10 * VAL_2, VAL_10, 0) != VAL_8 ||
+	   strncmp((int8_t *)buf + VAL_10 * VAL_2, "abcdefgh", VAL_8) != 0) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	// To the terminal the whole vector is written with interrupts off, and the flag is restored after.
+	pcb->file_array[1].fops = &stdout;
+	pcb->file_array[1].vnode = NULL;
+	pcb->file_array[1].flag = 1;
+	memcpy(buf + VAL_8 + VAL_5, "\n", 1);
+	iov[1].len = VAL_6;
+	cli();
+	if(syscall_writev(1, iov, VAL_2) != VAL_3 + VAL_6 || interrupt_flag() != 0) {
+		assertion_failure();
+		result = FAIL;
+	}
+	sti();
+	if(syscall_writev(1, iov, VAL_2) != VAL_3 + VAL_6 || interrupt_flag() != EFLAGS_IF) {
+		assertion_failure();
+		result = FAIL;
+	}
+	pcb->file_array[1].flag = 0;
+
+	syscall_close(out);
+	syscall_close(fd);
+	if(syscall_unlink(fname) != 0) {
+		assertion_failure();
+		result = FAIL;
+	}
+
+	return result;
+}
+
+/* test_readv_writev
+*
+* Test the readv and writev system calls.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: Counts that are negative or above IOV_MAX are refused and a
+	count of 0 does nothing, an unmapped buffer fails the call before
+	anything is written, readv fills several buffers with consecutive
+	bytes of a file, writev appends several buffers to a tmpfs file,
+	and writev to the terminal leaves the interrupt flag as it found it.
+* Files: syscall.c
+*/
+int test_readv_writev(){
+	TEST_HEADER;
+
+	return run_as_process(iovec_process);
+}
+
+// Order in which the requests of test_ata_queue completed, by index.
+static int32_t ata_queue_order[ATA_QUEUE_REQUESTS];
+static int32_t ata_queue_done;
+
+static void record_ata_completion(block_request_t *req) {
+	ata_queue_order[ata_queue_done++] = (int32_t)req->private;
+}
+
+/* test_ata_queue
+*
+* Test the ATA request queue.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: Requests queued out of order behind one the drive is busy
+	with are served in C-LOOK order, neighbouring ones as one batch,
+	and read the same data as one plain read.
+* Files: ata.c
+*/
+int test_ata_queue(){
+	TEST_HEADER;
+
+	// Word arrays, the drive moves 16 bits at a time.
+	static uint16_t whole[ATA_QUEUE_SECTORS * BLOCK_SECTOR_SIZE / 2];
+	static uint16_t parts[ATA_QUEUE_SECTORS * BLOCK_SECTOR_SIZE / 2];
+	static block_request_t reqs[ATA_QUEUE_REQUESTS];
+	// The first request keeps the drive busy and leaves the head at sector 36, the rest
+	//  go ahead of it up to sector 52, then wrap around to sector 0.
+	static const uint32_t lbas[ATA_QUEUE_REQUESTS] = {32, 48, 8, 40, 0, 44};
+	static const int32_t order[ATA_QUEUE_REQUESTS] = {0, 3, 5, 1, 4, 2};
+	block_device_t *dev = find_block_device((int8_t*)"ata0");
+	uint32_t flags;
+	int result = PASS;
+	int i, j;
+
+	if(dev == NULL) {
+		printf("No ATA drive attached, skipped.\n");
+		return PASS;
+	}
+	if(dev->num_sectors < ATA_QUEUE_SECTORS || dev->read(0, ATA_QUEUE_SECTORS, whole) != 0)
+		return FAIL;
+
+	ata_queue_done = 0;
+	for(i = 0; i < ATA_QUEUE_REQUESTS; ++i) {
+		reqs[i].lba = lbas[i];
+		reqs[i].count = ATA_QUEUE_COUNT;
+		reqs[i].buf = parts + lbas[i] * BLOCK_SECTOR_SIZE / 2;
+		reqs[i].write = 0;
+		reqs[i].done = record_ata_completion;
+		reqs[i].private = (void *)i;
+	}
+
+	// The drive is idle, so the first request starts right away. Nothing completes
+	//  until interrupts are back on, the others have to wait in the queue.
+	cli_and_save(flags);
+	for(i = 0; i < ATA_QUEUE_REQUESTS; ++i) {
+		if(dev->submit(&reqs[i]) != 0) {
+			restore_flags(flags);
+			return FAIL;
+		}
+	}
+	restore_flags(flags);
+	for(i = 0; i < ATA_QUEUE_REQUESTS; ++i) {
+		if(block_wait(dev, &reqs[i]) != 0)
+			return FAIL;
+	}
+
+	if(ata_queue_done != ATA_QUEUE_REQUESTS) {
+		assertion_failure();
+		return FAIL;
+	}
+	for(i = 0; i < ATA_QUEUE_REQUESTS; ++i) {
+		if(ata_queue_order[i] != order[i]) {
+			assertion_failure();
+			result = FAIL;
+		}
+		for(j = 0; j < ATA_QUEUE_COUNT * BLOCK_SECTOR_SIZE / 2; ++j) {
+			if(whole[lbas[i] * BLOCK_SECTOR_SIZE / 2 + j] != parts[lbas[i] * BLOCK_SECTOR_SIZE / 2 + j]) {
+				assertion_failure();
+				return FAIL;
+			}
+		}
+	}
+
+	return result;
+}
+
+#ifdef RUN_BENCHMARKS
+/* test_block_device_throughput
+*
+* Benchmark sequential reads on every block device.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: Reads up to BENCH_SECTORS sectors from each registered device
+	(ATA and virtio) in BENCH_CHUNK_SECTORS pieces and prints the rate,
+	timed with the 1024 Hz RTC.
+* Files: ata.c, virtio_blk.c
+*/
+int test_block_device_throughput(){
+	TEST_HEADER;
+
+	static uint16_t buf[BENCH_CHUNK_SECTORS * BLOCK_SECTOR_SIZE / 2];
+	block_device_t *dev;
+	uint32_t lba, total, start, ticks;
+	int id;
+
+	for(id = 0; (dev = get_block_device(id)) != NULL; ++id) {
+		total = (dev->num_sectors < BENCH_SECTORS) ? dev->num_sectors : BENCH_SECTORS;
+		total -= total % BENCH_CHUNK_SECTORS;
+
+		start = rtc_counter;
+		for(lba = 0; lba < total; lba += BENCH_CHUNK_SECTORS) {
+			if(dev->read(lba, BENCH_CHUNK_SECTORS, buf) != 0) {
+				assertion_failure();
+				return FAIL;
+			}
+		}
+		ticks = rtc_counter - start;
+		if(ticks == 0)
+			ticks = 1;
+
+		printf("%s: %d KB in %d ticks, %d KB/s\n", dev->name, total / 2, ticks,
+			total / 2 * RTC_TICKS_PER_SECOND / ticks);
+	}
+
+	return PASS;
+}
+#endif
+
+/* test_bcache_reread
+*
+* Test the buffer cache.
+* Inputs: None
+* Outputs: PASS/FAIL
+* Coverage: Reading a file a second time is served from the cache
+	without a single miss. Trivially true for the boot module image.
+* Files: bcache.c, file_system.c
+*/
+int test_bcache_reread(uint8_t *fname){
+	TEST_HEADER;
+
+	static uint8_t buf[FILE_READ_BUF_SIZE];
+	bcache_stats_t before, after;
+	dentry_t dentry;
+	int32_t length;
+
+	if(read_dentry_by_name(fname, &dentry) != 0)
+		return FAIL;
+	length = read_data(dentry.inode_idx, 0, buf, FILE_READ_BUF_SIZE);
+	if(length == -1)
+		return FAIL;
+
+	bcache_get_stats(&before);
+	if(read_data(dentry.inode_idx, 0, buf, FILE_READ_BUF_SIZE) != length)
+		return FAIL;
+	bcache_get_stats(&after);
+
+	if(after.misses != before.misses) {
+		assertion_failure();
+		return FAIL;
+	}
+	printf("bcache: %d hits, %d misses, %d evictions\n", after.hits, after.misses, after.evictions);
+
+	return PASS;
+}
+
 /* test_keyboard_read_and_terminal_write
 *
 * Test keyboard and terminal functionalities
@@ -574,6 +2457,33 @@ void launch_tests(){
 	TEST_OUTPUT("test_directory_operations", test_directory_operations());
 	TEST_OUTPUT("test_file_by_name", test_file_by_name("frame1.txt"));
 	TEST_OUTPUT("test_file_by_index_in_boot_block", test_file_by_index_in_boot_block(11));
+	TEST_OUTPUT("test_file_write", test_file_write());
+	TEST_OUTPUT("test_hashed_directory", test_hashed_directory());
+	TEST_OUTPUT("test_nested_directories", test_nested_directories());
+	TEST_OUTPUT("test_block_run_cache", test_block_run_cache());
+	TEST_OUTPUT("test_lz4_decompress", test_lz4_decompress());
+	TEST_OUTPUT("test_stream_copy", test_stream_copy());
+	TEST_OUTPUT("test_lib_variants", test_lib_variants());
+	TEST_OUTPUT("test_vga_scroll", test_vga_scroll());
+	TEST_OUTPUT("test_terminal_switch", test_terminal_switch());
+	TEST_OUTPUT("test_ipc_errors", test_ipc_errors());
+	TEST_OUTPUT("test_futex_errors", test_futex_errors());
+	TEST_OUTPUT("test_brk", test_brk());
+	TEST_OUTPUT("test_mmap_errors", test_mmap_errors());
+	TEST_OUTPUT("test_halt_in_stream_copy", test_halt_in_stream_copy());
+	TEST_OUTPUT("test_tmpfs", test_tmpfs());
+	TEST_OUTPUT("test_vfs_inode_cache", test_vfs_inode_cache());
+	TEST_OUTPUT("test_mmap_pins_file", test_mmap_pins_file());
+	TEST_OUTPUT("test_mmap_image_file", test_mmap_image_file());
+	TEST_OUTPUT("test_sendfile", test_sendfile());
+	TEST_OUTPUT("test_getdents", test_getdents());
+	TEST_OUTPUT("test_seek_pread_fstat", test_seek_pread_fstat());
+	TEST_OUTPUT("test_readv_writev", test_readv_writev());
+	TEST_OUTPUT("test_ata_queue", test_ata_queue());
+#ifdef RUN_BENCHMARKS
+	TEST_OUTPUT("test_block_device_throughput", test_block_device_throughput());
+#endif
+	TEST_OUTPUT("test_bcache_reread", test_bcache_reread((uint8_t*)"frame1.txt"));
 	// TEST_OUTPUT("rtc_freq_test",rtc_freq_test());
 	// CAUTION: Commented for cat executable file
 	// TEST_OUTPUT("test_terminal_write_size_larger_than_actual",test_terminal_write_size_larger_than_actual());
@@ -0,0 +1,285 @@
+#include "tmpfs.h"
+#include "file_system.h"
+#include "vfs.h"
+#include "lib.h"
+
+/*
+    A file of the RAM file system.
+        name - full name including TMPFS_PREFIX, not NUL-terminated when 32 characters long
+        in_use - whether the slot holds a file
+        length - length in bytes
+        pages - frames holding the data, one per started PAGE_SIZE bytes of length
+*/
+typedef struct tmpfs_file {
+    uint8_t name[FILE_NAME_MAX_LENGTH];
+    int32_t in_use;
+    uint32_t length;
+    uint32_t pages[TMPFS_MAX_PAGES];
+} tmpfs_file_t;
+
+static tmpfs_file_t tmpfs_files[TMPFS_MAX_FILES];
+
+// Number of pages needed to hold length bytes.
+static uint32_t tmpfs_num_pages(uint32_t length) {
+    return (length + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+// File at index, NULL if there is none.
+static tmpfs_file_t *tmpfs_get(uint32_t index) {
+    if(index >= TMPFS_MAX_FILES || !tmpfs_files[index].in_use)
+        return NULL;
+    return &tmpfs_files[index];
+}
+
+/*
+ *   is_tmpfs_name
+ *   DESCRIPTION: check whether a file name belongs to the RAM file system
+ *   INPUTS: fname -- file name
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if it starts with TMPFS_PREFIX, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t is_tmpfs_name(const uint8_t *fname) {
+    if(fname == NULL)
+        return 0;
+    return strncmp((int8_t *)fname, (int8_t *)TMPFS_PREFIX, TMPFS_PREFIX_LENGTH) == 0;
+}
+
+/*
+ *   tmpfs_lookup
+ *   DESCRIPTION: find a file of the RAM file system by name
+ *   INPUTS: fname -- full file name, including TMPFS_PREFIX
+ *   OUTPUTS: none
+ *   RETURN VALUE: index of the file, -1 if there is none
+ *   SIDE EFFECTS: none
+ */
+int32_t tmpfs_lookup(const uint8_t *fname) {
+    int32_t i;
+
+    if(!is_tmpfs_name(fname) || strlen((int8_t *)fname) > FILE_NAME_MAX_LENGTH)
+        return -1;
+
+    for(i = 0; i < TMPFS_MAX_FILES; ++i) {
+        if(tmpfs_files[i].in_use &&
+           strncmp((int8_t *)fname, (int8_t *)tmpfs_files[i].name, FILE_NAME_MAX_LENGTH) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/*
+ *   tmpfs_create
+ *   DESCRIPTION: create an empty file in the RAM file system
+ *   INPUTS: fname -- full file name, including TMPFS_PREFIX
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the name is invalid or taken, or all slots are used
+ *   SIDE EFFECTS: none
+ */
+int32_t tmpfs_create(const uint8_t *fname) {
+    uint32_t name_length;
+    int32_t i;
+
+    if(!is_tmpfs_name(fname))
+        return -1;
+    name_length = strlen((int8_t *)fname);
+    if(name_length == TMPFS_PREFIX_LENGTH || name_length > FILE_NAME_MAX_LENGTH)
+        return -1;
+    if(tmpfs_lookup(fname) != -1)
+        return -1;
+
+    for(i = 0; i < TMPFS_MAX_FILES; ++i) {
+        if(!tmpfs_files[i].in_use)
+            break;
+    }
+    if(i == TMPFS_MAX_FILES)
+        return -1;
+
+    memset(tmpfs_files[i].name, 0, FILE_NAME_MAX_LENGTH);
+    memcpy(tmpfs_files[i].name, fname, name_length);
+    tmpfs_files[i].length = 0;
+    tmpfs_files[i].in_use = 1;
+
+    return 0;
+}
+
+/*
+ *   tmpfs_unlink
+ *   DESCRIPTION: remove a file from the RAM file system
+ *   INPUTS: fname -- full file name, including TMPFS_PREFIX
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if there is no such file
+ *   SIDE EFFECTS: returns the pages of the file to the frame pool
+ */
+int32_t tmpfs_unlink(const uint8_t *fname) {
+    int32_t index = tmpfs_lookup(fname);
+
+    if(index == -1)
+        return -1;
+
+    (void)tmpfs_truncate(index, 0);
+    tmpfs_files[index].in_use = 0;
+    vfs_forget(&tmpfs_fs_ops, index);
+
+    return 0;
+}
+
+/*
+ *   tmpfs_read_data
+ *   DESCRIPTION: read up to length bytes starting at offset of a file
+ *   INPUTS: index -- file index
+ *           offset -- byte offset in the file
+ *           buf -- destination
+ *           length -- maximum number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes read, 0 at the end of file, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+int32_t tmpfs_read_data(uint32_t index, uint32_t offset, uint8_t *buf, uint32_t length) {
+    tmpfs_file_t *file = tmpfs_get(index);
+    uint32_t count = 0, position, chunk;
+
+    if(file == NULL)
+        return -1;
+
+    while(count < length && offset + count < file->length) {
+        position = offset + count;
+        chunk = PAGE_SIZE - position % PAGE_SIZE;
+        if(chunk > length - count)
+            chunk = length - count;
+        if(chunk > file->length - position)
+            chunk = file->length - position;
+
+        memcpy(buf + count, (uint8_t *)file->pages[position / PAGE_SIZE] + position % PAGE_SIZE, chunk);
+        count += chunk;
+    }
+
+    return count;
+}
+
+/*
+ *   tmpfs_write_data
+ *   DESCRIPTION: write length bytes to a file starting at offset, growing it as needed
+ *   INPUTS: index -- file index
+ *           offset -- byte offset in the file, must not be past the end of file
+ *           buf -- source
+ *           length -- number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes written, -1 on failure
+ *   SIDE EFFECTS: may take frames from the frame pool
+ */
+int32_t tmpfs_write_data(uint32_t index, uint32_t offset, const uint8_t *buf, uint32_t length) {
+    tmpfs_file_t *file = tmpfs_get(index);
+    uint32_t written = 0, position, chunk, phys;
+
+    if(file == NULL || offset > file->length || offset >= TMPFS_MAX_FILE_SIZE)
+        return -1;
+    if(length > TMPFS_MAX_FILE_SIZE - offset)
+        length = TMPFS_MAX_FILE_SIZE - offset;
+
+    while(written < length) {
+        position = offset + written;
+
+        // Past the last page of the file, append a new one.
+        if(position / PAGE_SIZE >= tmpfs_num_pages(file->length)) {
+            phys = alloc_page_frame();
+            if(phys == 0)
+                break;
+            file->pages[position / PAGE_SIZE] = phys;
+        }
+
+        chunk = PAGE_SIZE - position % PAGE_SIZE;
+        if(chunk > length - written)
+            chunk = length - written;
+
+        memcpy((uint8_t *)file->pages[position / PAGE_SIZE] + position % PAGE_SIZE, buf + written, chunk);
+        written += chunk;
+        if(position + chunk > file->length)
+            file->length = position + chunk;
+    }
+
+    vfs_set_length(&tmpfs_fs_ops, index, file->length);
+    if(written == 0 && length > 0)
+        return -1;
+
+    return written;
+}
+
+/*
+ *   tmpfs_truncate
+ *   DESCRIPTION: set the length of a file. Pages past the new end are freed, growing
+ *                the file fills it with zeros.
+ *   INPUTS: index -- file index
+ *           length -- new length in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: may take frames from or return frames to the frame pool
+ */
+int32_t tmpfs_truncate(uint32_t index, uint32_t length) {
+    tmpfs_file_t *file = tmpfs_get(index);
+    uint32_t old_pages, new_pages, i;
+
+    if(file == NULL || length > TMPFS_MAX_FILE_SIZE)
+        return -1;
+
+    old_pages = tmpfs_num_pages(file->length);
+    new_pages = tmpfs_num_pages(length);
+
+    if(length <= file->length) {
+        for(i = new_pages; i < old_pages; ++i)
+            free_page_frame(file->pages[i]);
+        // Keep the rest of the last page zero, a later grow relies on it.
+        if(length % PAGE_SIZE != 0)
+            memset((uint8_t *)file->pages[new_pages - 1] + length % PAGE_SIZE, 0, PAGE_SIZE - length % PAGE_SIZE);
+        file->length = length;
+        vfs_set_length(&tmpfs_fs_ops, index, length);
+        return 0;
+    }
+
+    for(i = old_pages; i < new_pages; ++i) {
+        file->pages[i] = alloc_page_frame();
+        if(file->pages[i] == 0) {
+            // Give back what was added so far.
+            while(i-- > old_pages)
+                free_page_frame(file->pages[i]);
+            return -1;
+        }
+    }
+    file->length = length;
+    vfs_set_length(&tmpfs_fs_ops, index, length);
+
+    return 0;
+}
+
+/*
+ *   tmpfs_get_length
+ *   DESCRIPTION: get the length of a file
+ *   INPUTS: index -- file index
+ *   OUTPUTS: none
+ *   RETURN VALUE: length in bytes, -1 if there is no such file
+ *   SIDE EFFECTS: none
+ */
+int32_t tmpfs_get_length(uint32_t index) {
+    tmpfs_file_t *file = tmpfs_get(index);
+
+    if(file == NULL)
+        return -1;
+    return file->length;
+}
+
+// Backend operations, the inode number of a file is its index.
+static int32_t tmpfs_vfs_lookup(const uint8_t *name, uint32_t *type, uint32_t *ino) {
+    int32_t index = tmpfs_lookup(name);
+
+    if(index == -1)
+        return -1;
+    *type = REGULAR_FILE;
+    *ino = index;
+    return 0;
+}
+
+static int32_t tmpfs_vfs_read(uint32_t ino, uint32_t offset, uint8_t *buf, uint32_t length, block_run_t *run) {
+    return tmpfs_read_data(ino, offset, buf, length);
+}
+
+fs_ops_t tmpfs_fs_ops = {tmpfs_vfs_lookup, tmpfs_create, NULL, tmpfs_unlink, tmpfs_vfs_read, tmpfs_write_data,
+                         tmpfs_truncate, tmpfs_get_length, NULL};
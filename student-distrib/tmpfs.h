@@ -0,0 +1,35 @@
+#ifndef _TMPFS_H_
+#define _TMPFS_H_
+
+#include "types.h"
+#include "memory.h"
+
+// Names starting with this prefix live in the RAM file system instead of the image.
+#define TMPFS_PREFIX "tmp/"
+#define TMPFS_PREFIX_LENGTH 4
+#define TMPFS_MAX_FILES 32
+// A file holds at most this many pages, taken from the frame pool as it grows.
+#define TMPFS_MAX_PAGES 256
+#define TMPFS_MAX_FILE_SIZE (TMPFS_MAX_PAGES * PAGE_SIZE)
+
+#ifndef ASM
+
+// Whether fname names a file of the RAM file system.
+extern int32_t is_tmpfs_name(const uint8_t *fname);
+
+// Index of the file named fname, -1 if there is none.
+extern int32_t tmpfs_lookup(const uint8_t *fname);
+
+// Create an empty file, or remove one and free its pages. Return 0 on success, -1 on failure.
+extern int32_t tmpfs_create(const uint8_t *fname);
+extern int32_t tmpfs_unlink(const uint8_t *fname);
+
+// Same as read_data(), write_data(), truncate_data() and get_file_length() for file index.
+extern int32_t tmpfs_read_data(uint32_t index, uint32_t offset, uint8_t *buf, uint32_t length);
+extern int32_t tmpfs_write_data(uint32_t index, uint32_t offset, const uint8_t *buf, uint32_t length);
+extern int32_t tmpfs_truncate(uint32_t index, uint32_t length);
+extern int32_t tmpfs_get_length(uint32_t index);
+
+#endif
+
+#endif
@@ -0,0 +1,503 @@
+#include "vfs.h"
+#include "process.h"
+#include "tmpfs.h"
+#include "lib.h"
+
+#define DEVFS_PREFIX_LENGTH 4
+
+/*
+    A mounted file system.
+        prefix - names it holds start with it, NUL-terminated
+        prefix_length - strlen(prefix)
+        fs - its backend, NULL if the slot is free
+*/
+typedef struct mount {
+    int8_t prefix[VFS_MAX_PREFIX_LENGTH + 1];
+    uint32_t prefix_length;
+    fs_ops_t *fs;
+} mount_t;
+
+static mount_t mount_table[VFS_MAX_MOUNTS];
+static vnode_t vnode_cache[VFS_MAX_VNODES];
+// Stamp of the latest vnode use, to find the least recently used one.
+static uint32_t vnode_clock;
+static vfs_stats_t vfs_stats;
+
+// Devices reachable under DEVFS_PREFIX, the inode number is the index in this table.
+typedef struct device_entry {
+    const int8_t *name;
+    uint32_t type;
+} device_entry_t;
+
+static const device_entry_t devices[] = {
+    {"rtc", RTC_FILE},
+};
+
+#define NUM_DEVICES (sizeof(devices) / sizeof(device_entry_t))
+
+static int32_t dev_lookup(const uint8_t *name, uint32_t *type, uint32_t *ino) {
+    uint32_t i;
+
+    for(i = 0; i < NUM_DEVICES; ++i) {
+        if(strncmp((int8_t *)name + DEVFS_PREFIX_LENGTH, devices[i].name, FILE_NAME_MAX_LENGTH) == 0) {
+            *type = devices[i].type;
+            *ino = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Devices are read and written through their own file operations, not through the VFS.
+fs_ops_t dev_fs_ops = {dev_lookup, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+
+// File system holding name, NULL if nothing is mounted there.
+static fs_ops_t *find_fs(const uint8_t *name) {
+    mount_t *best = NULL;
+    uint32_t i;
+
+    for(i = 0; i < VFS_MAX_MOUNTS; ++i) {
+        if(mount_table[i].fs == NULL)
+            continue;
+        if(strncmp((int8_t *)name, mount_table[i].prefix, mount_table[i].prefix_length) != 0)
+            continue;
+        if(best == NULL || mount_table[i].prefix_length > best->prefix_length)
+            best = &mount_table[i];
+    }
+
+    return (best == NULL) ? NULL : best->fs;
+}
+
+// Cached vnode of (fs, type, ino), NULL if there is none.
+static vnode_t *find_vnode(fs_ops_t *fs, uint32_t type, uint32_t ino) {
+    uint32_t i;
+
+    for(i = 0; i < VFS_MAX_VNODES; ++i) {
+        if(vnode_cache[i].last_used != 0 && vnode_cache[i].fs == fs &&
+           vnode_cache[i].type == type && vnode_cache[i].ino == ino)
+            return &vnode_cache[i];
+    }
+    return NULL;
+}
+
+// Vnode of (fs, type, ino) with one more reference, filled in from the backend on a miss
+//  into a free slot or the least recently used unreferenced one. NULL if none is left.
+static vnode_t *get_vnode(fs_ops_t *fs, uint32_t type, uint32_t ino) {
+    vnode_t *vnode = find_vnode(fs, type, ino);
+    int32_t length = 0;
+    uint32_t i;
+
+    if(vnode != NULL) {
+        vfs_stats.hits++;
+    }
+    else {
+        vfs_stats.misses++;
+        if(type == REGULAR_FILE && (length = fs->get_length(ino)) == -1)
+            return NULL;
+
+        for(i = 0; i < VFS_MAX_VNODES; ++i) {
+            if(vnode_cache[i].refcount != 0)
+                continue;
+            if(vnode == NULL || vnode_cache[i].last_used < vnode->last_used)
+                vnode = &vnode_cache[i];
+        }
+        if(vnode == NULL)
+            return NULL;
+
+        vnode->fs = fs;
+        vnode->type = type;
+        vnode->ino = ino;
+        vnode->length = length;
+    }
+
+    vnode->refcount++;
+    vnode->last_used = ++vnode_clock;
+
+    return vnode;
+}
+
+/*
+ *   vfs_init
+ *   DESCRIPTION: empty the inode cache and mount the file systems: the RAM file system at
+ *                TMPFS_PREFIX, devices at DEVFS_PREFIX and the boot image everywhere else
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void vfs_init() {
+    memset(mount_table, 0, sizeof(mount_table));
+    memset(vnode_cache, 0, sizeof(vnode_cache));
+    memset(&vfs_stats, 0, sizeof(vfs_stats));
+    vnode_clock = 0;
+
+    (void)vfs_mount("", &image_fs_ops);
+    (void)vfs_mount(TMPFS_PREFIX, &tmpfs_fs_ops);
+    (void)vfs_mount(DEVFS_PREFIX, &dev_fs_ops);
+}
+
+/*
+ *   vfs_mount
+ *   DESCRIPTION: make a file system hold every name starting with prefix, unless a longer
+ *                prefix is mounted as well
+ *   INPUTS: prefix -- at most VFS_MAX_PREFIX_LENGTH characters, "" for the root
+ *           fs -- backend operations
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the prefix is too long, taken or the table is full
+ *   SIDE EFFECTS: none
+ */
+int32_t vfs_mount(const int8_t *prefix, fs_ops_t *fs) {
+    uint32_t length = strlen(prefix);
+    uint32_t i;
+
+    if(fs == NULL || length > VFS_MAX_PREFIX_LENGTH)
+        return -1;
+    for(i = 0; i < VFS_MAX_MOUNTS; ++i) {
+        if(mount_table[i].fs != NULL && strncmp(mount_table[i].prefix, prefix, VFS_MAX_PREFIX_LENGTH) == 0)
+            return -1;
+    }
+
+    for(i = 0; i < VFS_MAX_MOUNTS; ++i) {
+        if(mount_table[i].fs == NULL) {
+            strcpy(mount_table[i].prefix, prefix);
+            mount_table[i].prefix_length = length;
+            mount_table[i].fs = fs;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ *   vfs_open
+ *   DESCRIPTION: look up a file in the file system it is mounted on and take a reference
+ *                to its vnode. A file that is already cached is not read from its backend.
+ *   INPUTS: name -- full file name
+ *   OUTPUTS: none
+ *   RETURN VALUE: the vnode, NULL if there is no such file or the inode cache is full
+ *   SIDE EFFECTS: none
+ */
+vnode_t *vfs_open(const uint8_t *name) {
+    fs_ops_t *fs;
+    uint32_t type, ino;
+
+    if(name == NULL || (fs = find_fs(name)) == NULL)
+        return NULL;
+    if(fs->lookup(name, &type, &ino) == -1)
+        return NULL;
+
+    return get_vnode(fs, type, ino);
+}
+
+/*
+ *   vfs_close
+ *   DESCRIPTION: drop a reference to a vnode, which stays cached until its slot is needed
+ *   INPUTS: vnode -- from vfs_open()
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void vfs_close(vnode_t *vnode) {
+    if(vnode != NULL && vnode->refcount > 0)
+        vnode->refcount--;
+}
+
+/*
+ *   vfs_map
+ *   DESCRIPTION: take a reference to a regular file for a mapping of its blocks. The file
+ *                cannot be unlinked or truncated until vfs_unmap() is called.
+ *   INPUTS: vnode -- open regular file
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void vfs_map(vnode_t *vnode) {
+    if(vnode == NULL)
+        return;
+    vnode->refcount++;
+    vnode->map_count++;
+}
+
+/*
+ *   vfs_unmap
+ *   DESCRIPTION: drop a reference taken by vfs_map()
+ *   INPUTS: vnode -- mapped regular file
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void vfs_unmap(vnode_t *vnode) {
+    if(vnode == NULL || vnode->map_count <= 0)
+        return;
+    vnode->map_count--;
+    vfs_close(vnode);
+}
+
+/*
+ *   vfs_create
+ *   DESCRIPTION: create an empty regular file in the file system its name is mounted on
+ *   INPUTS: name -- full name of the new file
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+int32_t vfs_create(const uint8_t *name) {
+    fs_ops_t *fs;
+
+    if(name == NULL || (fs = find_fs(name)) == NULL || fs->create == NULL)
+        return -1;
+    return fs->create(name);
+}
+
+/*
+ *   vfs_mkdir
+ *   DESCRIPTION: create an empty directory in the file system its name is mounted on
+ *   INPUTS: name -- full name of the new directory
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+int32_t vfs_mkdir(const uint8_t *name) {
+    fs_ops_t *fs;
+
+    if(name == NULL || (fs = find_fs(name)) == NULL || fs->mkdir == NULL)
+        return -1;
+    return fs->mkdir(name);
+}
+
+/*
+ *   vfs_unlink
+ *   DESCRIPTION: remove a regular file or an empty directory that no descriptor refers to
+ *   INPUTS: name -- full file name
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if there is no such file, it is open or cannot be removed
+ *   SIDE EFFECTS: frees the data of the file
+ */
+int32_t vfs_unlink(const uint8_t *name) {
+    fs_ops_t *fs;
+    vnode_t *vnode;
+    uint32_t type, ino;
+
+    if(name == NULL || (fs = find_fs(name)) == NULL || fs->unlink == NULL)
+        return -1;
+    if(fs->lookup(name, &type, &ino) == -1 || type == RTC_FILE)
+        return -1;
+
+    // Its inode may be reused right away, so no open descriptor or mapping may refer to it.
+    vnode = find_vnode(fs, type, ino);
+    if(vnode != NULL && vnode->refcount != 0)
+        return -1;
+
+    return fs->unlink(name);
+}
+
+/*
+ *   vfs_read
+ *   DESCRIPTION: read up to length bytes of a regular file starting at offset
+ *   INPUTS: vnode -- open regular file
+ *           offset -- byte offset in the file
+ *           buf -- destination
+ *           length -- maximum number of bytes
+ *           run -- block run cache of the descriptor, NULL if there is none
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes read, 0 at the end of file, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+int32_t vfs_read(vnode_t *vnode, uint32_t offset, uint8_t *buf, uint32_t length, block_run_t *run) {
+    block_run_t local_run;
+
+    if(vnode == NULL || vnode->type != REGULAR_FILE)
+        return -1;
+    if(run == NULL) {
+        local_run.count = 0;
+        run = &local_run;
+    }
+    return vnode->fs->read(vnode->ino, offset, buf, length, run);
+}
+
+/*
+ *   vfs_write
+ *   DESCRIPTION: write length bytes to a regular file starting at offset, growing it as needed
+ *   INPUTS: vnode -- open regular file
+ *           offset -- byte offset in the file, must not be past the end of file
+ *           buf -- source
+ *           length -- number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes written, -1 on failure
+ *   SIDE EFFECTS: the backend updates the cached length
+ */
+int32_t vfs_write(vnode_t *vnode, uint32_t offset, const uint8_t *buf, uint32_t length) {
+    if(vnode == NULL || vnode->type != REGULAR_FILE)
+        return -1;
+    return vnode->fs->write(vnode->ino, offset, buf, length);
+}
+
+/*
+ *   vfs_truncate
+ *   DESCRIPTION: set the length of a regular file, new bytes read as zero
+ *   INPUTS: vnode -- open regular file
+ *           length -- new length in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: the backend updates the cached length
+ */
+int32_t vfs_truncate(vnode_t *vnode, uint32_t length) {
+    // Freed blocks could be handed to another file while still mapped.
+    if(vnode == NULL || vnode->type != REGULAR_FILE || vnode->map_count > 0)
+        return -1;
+    return vnode->fs->truncate(vnode->ino, length);
+}
+
+/*
+ *   vfs_get_block_address
+ *   DESCRIPTION: find the page-aligned block of a regular file holding offset, for mapping
+ *                it without a copy
+ *   INPUTS: vnode -- open regular file
+ *           offset -- byte offset in the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: kernel address of the block, 0 if the backend cannot provide one
+ *   SIDE EFFECTS: none
+ */
+uint32_t vfs_get_block_address(vnode_t *vnode, uint32_t offset) {
+    if(vnode == NULL || vnode->type != REGULAR_FILE || vnode->fs->get_block_address == NULL)
+        return 0;
+    return vnode->fs->get_block_address(vnode->ino, offset);
+}
+
+/*
+ *   vfs_set_length
+ *   DESCRIPTION: update the cached length of a regular file after its backend changed it
+ *   INPUTS: fs -- backend
+ *           ino -- inode number of the file
+ *           length -- new length in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void vfs_set_length(fs_ops_t *fs, uint32_t ino, uint32_t length) {
+    vnode_t *vnode = find_vnode(fs, REGULAR_FILE, ino);
+
+    if(vnode != NULL)
+        vnode->length = length;
+}
+
+/*
+ *   vfs_forget
+ *   DESCRIPTION: drop the cached vnode of a regular file whose inode was freed
+ *   INPUTS: fs -- backend
+ *           ino -- inode number of the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void vfs_forget(fs_ops_t *fs, uint32_t ino) {
+    vnode_t *vnode = find_vnode(fs, REGULAR_FILE, ino);
+
+    if(vnode != NULL && vnode->refcount == 0)
+        vnode->last_used = 0;
+}
+
+/*
+ *   vfs_flush
+ *   DESCRIPTION: drop every unreferenced vnode of a file system
+ *   INPUTS: fs -- backend
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void vfs_flush(fs_ops_t *fs) {
+    uint32_t i;
+
+    for(i = 0; i < VFS_MAX_VNODES; ++i) {
+        if(vnode_cache[i].fs == fs && vnode_cache[i].refcount == 0)
+            vnode_cache[i].last_used = 0;
+    }
+}
+
+/*
+ *   vfs_get_stats
+ *   DESCRIPTION: copy the inode cache counters
+ *   INPUTS: stats -- where to copy them
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void vfs_get_stats(vfs_stats_t *stats) {
+    memcpy(stats, &vfs_stats, sizeof(vfs_stats_t));
+}
+
+/*
+ *   vfs_file_open
+ *   DESCRIPTION: open a regular file. The vnode was already looked up by syscall_open().
+ *   INPUTS: filename -- file name
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0
+ *   SIDE EFFECTS: none
+ */
+int32_t vfs_file_open(const uint8_t *filename) {
+    return 0;
+}
+
+/*
+ *   vfs_file_close
+ *   DESCRIPTION: close a regular file, syscall_close() drops the vnode reference
+ *   INPUTS: fd -- file descriptor
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0
+ *   SIDE EFFECTS: none
+ */
+int32_t vfs_file_close(int32_t fd) {
+    return 0;
+}
+
+/*
+ *   vfs_file_read
+ *   DESCRIPTION: read from the current position of fd and advance it
+ *   INPUTS: fd -- file descriptor of a regular file
+ *           buf -- destination
+ *           nbytes -- maximum number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes read, 0 at the end of file, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+int32_t vfs_file_read(int32_t fd, void *buf, int32_t nbytes) {
+    file_desc_t *file = &get_current_pcb()->file_array[fd];
+    int32_t ret;
+
+    if(buf == NULL || nbytes < 0)
+        return -1;
+
+    ret = vfs_read(file->vnode, file->file_position, buf, nbytes, &file->block_run);
+    if(ret == -1)
+        return -1;
+    file->file_position += ret;
+
+    return ret;
+}
+
+/*
+ *   vfs_file_write
+ *   DESCRIPTION: write at the current position of fd and advance it, extending the file
+ *                when going past its end
+ *   INPUTS: fd -- file descriptor of a regular file
+ *           buf -- source
+ *           nbytes -- number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes written, -1 on failure
+ *   SIDE EFFECTS: none
+ */
+int32_t vfs_file_write(int32_t fd, const void *buf, int32_t nbytes) {
+    file_desc_t *file = &get_current_pcb()->file_array[fd];
+    int32_t ret;
+
+    if(buf == NULL || nbytes < 0)
+        return -1;
+
+    ret = vfs_write(file->vnode, file->file_position, buf, nbytes);
+    if(ret == -1)
+        return -1;
+    file->file_position += ret;
+
+    return ret;
+}
@@ -0,0 +1,119 @@
+#ifndef _VFS_H_
+#define _VFS_H_
+
+#include "types.h"
+#include "file_system.h"
+
+// A file system is mounted at a name prefix, the longest matching prefix wins.
+#define VFS_MAX_MOUNTS 4
+#define VFS_MAX_PREFIX_LENGTH 8
+// Enough for every descriptor of every process, plus a few unreferenced ones kept cached.
+#define VFS_MAX_VNODES 48
+// Devices are named DEVFS_PREFIX followed by the device, e.g. "dev/rtc".
+#define DEVFS_PREFIX "dev/"
+
+#ifndef ASM
+
+/*
+    Operations of a file system backend. Names are passed in full, including the prefix
+    the file system is mounted at. Inode numbers only need to be unique within a backend.
+    Backends keep cached vnodes up to date through vfs_set_length() and vfs_forget().
+        lookup - fill type and inode number of a name, return 0 or -1 if there is none
+        create, mkdir, unlink - create an empty regular file or directory, or remove a
+                         regular file or an empty directory, return 0 or -1. NULL if the
+                         file system cannot do it
+        read, write, truncate, get_length - same as read_data_cached(), write_data(),
+                         truncate_data() and get_file_length() for regular files
+        get_block_address - address of the page-aligned block holding offset, which can be
+                         mapped instead of copied. NULL, or returning 0, if there is none
+*/
+typedef struct fs_ops {
+    int32_t (*lookup)(const uint8_t *name, uint32_t *type, uint32_t *ino);
+    int32_t (*create)(const uint8_t *name);
+    int32_t (*mkdir)(const uint8_t *name);
+    int32_t (*unlink)(const uint8_t *name);
+    int32_t (*read)(uint32_t ino, uint32_t offset, uint8_t *buf, uint32_t length, block_run_t *run);
+    int32_t (*write)(uint32_t ino, uint32_t offset, const uint8_t *buf, uint32_t length);
+    int32_t (*truncate)(uint32_t ino, uint32_t length);
+    int32_t (*get_length)(uint32_t ino);
+    uint32_t (*get_block_address)(uint32_t ino, uint32_t offset);
+} fs_ops_t;
+
+/*
+    In-memory inode, cached by (fs, type, inode number) and shared by all descriptors
+    open on the file.
+        fs - backend the file belongs to
+        type - RTC_FILE, DIRECTORY_FILE or REGULAR_FILE
+        ino - inode number within the backend
+        length - length in bytes of a regular file
+        refcount - number of open descriptors and mappings, the vnode is only replaced when 0
+        map_count - number of mmap mappings, blocks of a mapped file are never freed
+        last_used - when the vnode was last opened, 0 if the slot is free
+*/
+typedef struct vnode {
+    fs_ops_t *fs;
+    uint32_t type;
+    uint32_t ino;
+    uint32_t length;
+    int32_t refcount;
+    int32_t map_count;
+    uint32_t last_used;
+} vnode_t;
+
+// Counters since boot.
+typedef struct vfs_stats {
+    uint32_t hits;
+    uint32_t misses;
+} vfs_stats_t;
+
+// Backends.
+extern fs_ops_t image_fs_ops;
+extern fs_ops_t tmpfs_fs_ops;
+extern fs_ops_t dev_fs_ops;
+
+// Empty the inode cache and mount the boot image, the RAM file system and devices.
+extern void vfs_init();
+
+// Mount fs at names starting with prefix, "" for everything else. Return 0 or -1 if full.
+extern int32_t vfs_mount(const int8_t *prefix, fs_ops_t *fs);
+
+// Look up a name and take a reference to its vnode. Return NULL if there is no such file.
+extern vnode_t *vfs_open(const uint8_t *name);
+// Drop a reference taken by vfs_open().
+extern void vfs_close(vnode_t *vnode);
+// Take or drop a reference for a mapping of a regular file. A mapped file can neither be
+//  unlinked nor truncated, so that its blocks cannot end up in another file.
+extern void vfs_map(vnode_t *vnode);
+extern void vfs_unmap(vnode_t *vnode);
+
+// Create an empty regular file or directory, or remove a regular file or an empty directory
+//  that is not open. Return 0 or -1.
+extern int32_t vfs_create(const uint8_t *name);
+extern int32_t vfs_mkdir(const uint8_t *name);
+extern int32_t vfs_unlink(const uint8_t *name);
+
+// Regular file access, same as the operations of the backend. run may be NULL.
+extern int32_t vfs_read(vnode_t *vnode, uint32_t offset, uint8_t *buf, uint32_t length, block_run_t *run);
+extern int32_t vfs_write(vnode_t *vnode, uint32_t offset, const uint8_t *buf, uint32_t length);
+extern int32_t vfs_truncate(vnode_t *vnode, uint32_t length);
+extern uint32_t vfs_get_block_address(vnode_t *vnode, uint32_t offset);
+
+// Called by backends when the length of a regular file changes, or when an inode is freed
+//  and its number may be reused.
+extern void vfs_set_length(fs_ops_t *fs, uint32_t ino, uint32_t length);
+extern void vfs_forget(fs_ops_t *fs, uint32_t ino);
+// Drop every unreferenced vnode of fs, called when it switches to another image.
+extern void vfs_flush(fs_ops_t *fs);
+
+// Copy the counters into stats.
+extern void vfs_get_stats(vfs_stats_t *stats);
+
+// Operations on descriptors of regular files of any backend.
+extern int32_t vfs_file_open(const uint8_t *filename);
+extern int32_t vfs_file_close(int32_t fd);
+extern int32_t vfs_file_read(int32_t fd, void *buf, int32_t nbytes);
+extern int32_t vfs_file_write(int32_t fd, const void *buf, int32_t nbytes);
+
+#endif
+
+#endif
@@ -0,0 +1,440 @@
+#include "virtio_blk.h"
+#include "block_device.h"
+#include "pci.h"
+#include "i8259.h"
+#include "idt.h"
+#include "memory.h"
+#include "process.h"
+#include "lib.h"
+
+// Transitional virtio block device, driven through the legacy I/O interface.
+#define VIRTIO_VENDOR_ID 0x1AF4
+#define VIRTIO_BLK_DEVICE_ID 0x1001
+
+// Legacy registers, relative to BAR0.
+#define VIRTIO_DEVICE_FEATURES 0x00
+#define VIRTIO_GUEST_FEATURES 0x04
+#define VIRTIO_QUEUE_ADDRESS 0x08
+#define VIRTIO_QUEUE_SIZE 0x0C
+#define VIRTIO_QUEUE_SELECT 0x0E
+#define VIRTIO_QUEUE_NOTIFY 0x10
+#define VIRTIO_DEVICE_STATUS 0x12
+#define VIRTIO_ISR_STATUS 0x13
+// Device specific configuration: capacity in sectors, 64 bits.
+#define VIRTIO_BLK_CAPACITY_LOW 0x14
+#define VIRTIO_BLK_CAPACITY_HIGH 0x18
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER 0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_ISR_QUEUE 0x01
+
+// The device interrupts only when the used index passes used_event.
+#define VIRTIO_RING_F_EVENT_IDX (1 << 29)
+
+#define VRING_DESC_F_NEXT 0x1
+#define VRING_DESC_F_WRITE 0x2
+
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_S_OK 0
+#define VIRTIO_BLK_S_UNSET 0xFF
+
+// Requests use one descriptor each for the header, the data and the status byte.
+#define VIRTIO_DESCS_PER_REQUEST 3
+#define VIRTIO_REQUEST_QUEUE 0
+#define VIRTIO_MAX_QUEUE_SIZE 256
+// Room for the largest legacy ring: descriptors and available ring, then the used ring
+//  on its own page boundary.
+#define VIRTIO_RING_PAGES 3
+// Requests virtio_blk_read()/virtio_blk_write() keep in flight at once.
+#define VIRTIO_SYNC_DEPTH 8
+
+// Request header read by the device, the sector is 64 bits.
+typedef struct virtio_blk_header {
+    uint32_t type;
+    uint32_t reserved;
+    uint32_t sector_low;
+    uint32_t sector_high;
+} virtio_blk_header_t;
+
+typedef struct vring_desc {
+    uint32_t addr_low;
+    uint32_t addr_high;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} vring_desc_t;
+
+typedef struct vring_avail {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[0];
+} vring_avail_t;
+
+typedef struct vring_used_elem {
+    uint32_t id;
+    uint32_t len;
+} vring_used_elem_t;
+
+typedef struct vring_used {
+    uint16_t flags;
+    uint16_t idx;
+    vring_used_elem_t ring[0];
+} vring_used_t;
+
+static uint8_t vring[VIRTIO_RING_PAGES * PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+static int32_t device_present = 0;
+static uint32_t io_base;
+static uint32_t irq;
+static int32_t event_idx;
+
+// Split virtqueue, laid out in vring by virtio_blk_init().
+static uint32_t queue_size;
+static volatile vring_desc_t *desc;
+static volatile vring_avail_t *avail;
+static volatile vring_used_t *used;
+static volatile uint16_t *used_event;
+
+// Free descriptors are chained through next.
+static uint16_t free_head;
+static uint32_t num_free;
+// Used ring entries consumed so far, and requests the device has not returned yet.
+static uint16_t last_used;
+static uint32_t in_flight;
+// Request owning each descriptor chain, with the header and status byte the device
+//  reads and writes for it, by head descriptor.
+static block_request_t *inflight[VIRTIO_MAX_QUEUE_SIZE];
+static virtio_blk_header_t headers[VIRTIO_MAX_QUEUE_SIZE];
+static volatile uint8_t device_status[VIRTIO_MAX_QUEUE_SIZE];
+// Requests waiting for free descriptors, oldest first.
+static block_request_t *pending_head = NULL;
+static block_request_t *pending_tail = NULL;
+
+static block_device_t virtio_device = {(int8_t *)"virtio0", 0, virtio_blk_read, virtio_blk_write,
+                                       virtio_blk_submit, virtio_blk_poll};
+
+// Keep the compiler from reordering ring accesses, x86 does not reorder stores.
+#define barrier() asm volatile("" : : : "memory")
+
+// Put req on the ring as header, data and status descriptors. num_free must allow it.
+static void virtio_add(block_request_t *req) {
+    uint16_t head = free_head;
+    uint16_t data = desc[head].next;
+    uint16_t status = desc[data].next;
+
+    free_head = desc[status].next;
+    num_free -= VIRTIO_DESCS_PER_REQUEST;
+
+    headers[head].type = req->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    headers[head].reserved = 0;
+    headers[head].sector_low = req->lba;
+    headers[head].sector_high = 0;
+    device_status[head] = VIRTIO_BLK_S_UNSET;
+
+    desc[head].addr_low = (uint32_t)&headers[head];
+    desc[head].addr_high = 0;
+    desc[head].len = sizeof(virtio_blk_header_t);
+    desc[head].flags = VRING_DESC_F_NEXT;
+    desc[data].addr_low = (uint32_t)req->buf;
+    desc[data].addr_high = 0;
+    desc[data].len = req->count * BLOCK_SECTOR_SIZE;
+    desc[data].flags = VRING_DESC_F_NEXT | (req->write ? 0 : VRING_DESC_F_WRITE);
+    desc[status].addr_low = (uint32_t)&device_status[head];
+    desc[status].addr_high = 0;
+    desc[status].len = sizeof(uint8_t);
+    desc[status].flags = VRING_DESC_F_WRITE;
+
+    inflight[head] = req;
+    avail->ring[avail->idx % queue_size] = head;
+    // The entry must be visible before the index that publishes it.
+    barrier();
+    avail->idx++;
+    in_flight++;
+}
+
+// Start as many waiting requests as there are descriptors for. Return whether any was started.
+static int32_t virtio_start_pending() {
+    int32_t started = 0;
+
+    while(pending_head != NULL && num_free >= VIRTIO_DESCS_PER_REQUEST) {
+        block_request_t *req = pending_head;
+        pending_head = req->next;
+        if(pending_head == NULL)
+            pending_tail = NULL;
+        req->next = NULL;
+        virtio_add(req);
+        started = 1;
+    }
+    return started;
+}
+
+/*
+ *   virtio_drain
+ *   DESCRIPTION: complete every request on the used ring, refill the ring from the
+ *                waiting list, and ask for the next interrupt only once everything
+ *                in flight is done, so a burst of completions costs one interrupt
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: must be called with interrupts disabled, wakes up waiting processes
+ */
+static void virtio_drain() {
+    do {
+        while(last_used != used->idx) {
+            uint16_t head = used->ring[last_used % queue_size].id;
+            uint16_t status = desc[desc[head].next].next;
+            block_request_t *req = inflight[head];
+            int32_t result = (device_status[head] == VIRTIO_BLK_S_OK) ? 0 : -1;
+
+            inflight[head] = NULL;
+            desc[status].next = free_head;
+            free_head = head;
+            num_free += VIRTIO_DESCS_PER_REQUEST;
+            last_used++;
+            in_flight--;
+
+            block_complete(req, result);
+        }
+
+        if(virtio_start_pending())
+            outw(VIRTIO_REQUEST_QUEUE, io_base + VIRTIO_QUEUE_NOTIFY);
+
+        if(event_idx && in_flight > 0)
+            *used_event = last_used + in_flight - 1;
+        barrier();
+        // Whatever completed before used_event was written did not raise an interrupt.
+    } while(last_used != used->idx);
+}
+
+// Check a request and put it on the ring, or on the waiting list if the ring is full.
+static int32_t virtio_queue(block_request_t *req) {
+    if(!device_present || req == NULL || req->count == 0 || req->count > VIRTIO_MAX_SECTORS)
+        return -1;
+    if(req->lba >= virtio_device.num_sectors || req->count > virtio_device.num_sectors - req->lba)
+        return -1;
+    if(!is_dma_buffer(req->buf, req->count * BLOCK_SECTOR_SIZE))
+        return -1;
+
+    req->status = BLOCK_REQUEST_PENDING;
+    req->waiters = 0;
+    req->next = NULL;
+
+    if(pending_head == NULL && num_free >= VIRTIO_DESCS_PER_REQUEST) {
+        virtio_add(req);
+    }
+    else if(pending_tail == NULL) {
+        pending_head = pending_tail = req;
+    }
+    else {
+        pending_tail->next = req;
+        pending_tail = req;
+    }
+    return 0;
+}
+
+// Tell the device about new requests on the ring.
+static void virtio_kick() {
+    outw(VIRTIO_REQUEST_QUEUE, io_base + VIRTIO_QUEUE_NOTIFY);
+    virtio_drain();
+}
+
+/*
+ *   virtio_blk_init
+ *   DESCRIPTION: find a virtio block device, set up its request queue and register it
+ *                as "virtio0"
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: enables the IRQ of the device if one is found
+ */
+void virtio_blk_init() {
+    pci_device_t dev;
+    uint32_t bar0, features, i;
+
+    if(pci_find_device(VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID, &dev) == -1)
+        return;
+    bar0 = pci_config_read(&dev, PCI_BAR0);
+    if(!(bar0 & PCI_BAR_IO))
+        return;
+    io_base = bar0 & PCI_BAR_IO_MASK;
+    irq = pci_irq_line(&dev);
+    // Only these IRQs have linkage in the IDT.
+    if(irq != PCI_IRQ_5 && irq != PCI_IRQ_9 && irq != PCI_IRQ_10 && irq != PCI_IRQ_11)
+        return;
+    pci_enable_bus_master(&dev);
+
+    // Reset, then tell the device a driver has found it.
+    outb(0, io_base + VIRTIO_DEVICE_STATUS);
+    outb(VIRTIO_STATUS_ACKNOWLEDGE, io_base + VIRTIO_DEVICE_STATUS);
+    outb(VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER, io_base + VIRTIO_DEVICE_STATUS);
+
+    features = inl(io_base + VIRTIO_DEVICE_FEATURES);
+    event_idx = (features & VIRTIO_RING_F_EVENT_IDX) != 0;
+    outl(features & VIRTIO_RING_F_EVENT_IDX, io_base + VIRTIO_GUEST_FEATURES);
+
+    outw(VIRTIO_REQUEST_QUEUE, io_base + VIRTIO_QUEUE_SELECT);
+    queue_size = inw(io_base + VIRTIO_QUEUE_SIZE);
+    if(queue_size < VIRTIO_DESCS_PER_REQUEST || queue_size > VIRTIO_MAX_QUEUE_SIZE)
+        return;
+
+    // Legacy layout: descriptors, available ring with used_event at its end, then the
+    //  used ring aligned to a page.
+    memset(vring, 0, sizeof(vring));
+    desc = (vring_desc_t *)vring;
+    avail = (vring_avail_t *)(vring + queue_size * sizeof(vring_desc_t));
+    used_event = &avail->ring[queue_size];
+    used = (vring_used_t *)(((uint32_t)(used_event + 1) + PAGE_SIZE - 1) & PAGE_MASK);
+    for(i = 0; i < queue_size; ++i)
+        desc[i].next = i + 1;
+    free_head = 0;
+    num_free = queue_size;
+    last_used = 0;
+    in_flight = 0;
+    outl((uint32_t)vring / PAGE_SIZE, io_base + VIRTIO_QUEUE_ADDRESS);
+
+    // Capacities beyond 32 bits of sectors are cut down, requests only carry 32-bit sectors.
+    virtio_device.num_sectors = inl(io_base + VIRTIO_BLK_CAPACITY_HIGH) ? 0xFFFFFFFF :
+                                inl(io_base + VIRTIO_BLK_CAPACITY_LOW);
+    if(virtio_device.num_sectors == 0)
+        return;
+
+    interrupt_handler[IRQ_VEC_BASE + irq] = virtio_blk_handler;
+    enable_irq(irq);
+    outb(VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK,
+         io_base + VIRTIO_DEVICE_STATUS);
+    device_present = 1;
+
+    register_block_device(&virtio_device);
+}
+
+/*
+ *   virtio_blk_handler
+ *   DESCRIPTION: interrupt handler of the virtio block device
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: wakes up processes whose requests are done
+ */
+void virtio_blk_handler() {
+    // Reading the ISR status lowers the interrupt line.
+    uint8_t isr = inb(io_base + VIRTIO_ISR_STATUS);
+    send_eoi(irq);
+
+    if(isr & VIRTIO_ISR_QUEUE)
+        virtio_drain();
+}
+
+/*
+ *   virtio_blk_present
+ *   DESCRIPTION: whether a virtio block device was found
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if present, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t virtio_blk_present() {
+    return device_present;
+}
+
+/*
+ *   virtio_blk_submit
+ *   DESCRIPTION: hand a request to the device without waiting for it
+ *   INPUTS: req -- request with lba, count, buf and write filled in
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if there is no device or the request is invalid
+ *   SIDE EFFECTS: none
+ */
+int32_t virtio_blk_submit(block_request_t *req) {
+    uint32_t flags;
+    int32_t ret;
+
+    cli_and_save(flags);
+    ret = virtio_queue(req);
+    if(ret == 0)
+        virtio_kick();
+    restore_flags(flags);
+
+    return ret;
+}
+
+/*
+ *   virtio_blk_poll
+ *   DESCRIPTION: complete finished requests, for callers that cannot take the interrupt
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may complete requests
+ */
+void virtio_blk_poll() {
+    uint32_t flags;
+
+    cli_and_save(flags);
+    virtio_drain();
+    restore_flags(flags);
+}
+
+// Split a transfer into requests, queue up to VIRTIO_SYNC_DEPTH of them with a single
+//  notification and wait for all of them.
+static int32_t virtio_transfer(uint32_t lba, uint32_t count, uint8_t *buf, int32_t write) {
+    block_request_t reqs[VIRTIO_SYNC_DEPTH];
+    uint32_t flags;
+    int32_t i, n, ret = 0;
+
+    while(count > 0 && ret == 0) {
+        cli_and_save(flags);
+        for(n = 0; n < VIRTIO_SYNC_DEPTH && count > 0; ++n) {
+            reqs[n].lba = lba;
+            reqs[n].count = (count > VIRTIO_MAX_SECTORS) ? VIRTIO_MAX_SECTORS : count;
+            reqs[n].buf = buf;
+            reqs[n].write = write;
+            reqs[n].done = NULL;
+            if(virtio_queue(&reqs[n]) == -1) {
+                ret = -1;
+                break;
+            }
+            lba += reqs[n].count;
+            count -= reqs[n].count;
+            buf += reqs[n].count * BLOCK_SECTOR_SIZE;
+        }
+        if(n > 0)
+            virtio_kick();
+        restore_flags(flags);
+
+        for(i = 0; i < n; ++i) {
+            if(block_wait(&virtio_device, &reqs[i]) == -1)
+                ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ *   virtio_blk_read
+ *   DESCRIPTION: read sectors from the device
+ *   INPUTS: lba -- first sector
+ *           count -- number of sectors
+ *           buf -- kernel buffer of count * BLOCK_SECTOR_SIZE bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: may block the current process
+ */
+int32_t virtio_blk_read(uint32_t lba, uint32_t count, void *buf) {
+    return virtio_transfer(lba, count, buf, 0);
+}
+
+/*
+ *   virtio_blk_write
+ *   DESCRIPTION: write sectors to the device
+ *   INPUTS: lba -- first sector
+ *           count -- number of sectors
+ *           buf -- kernel buffer of count * BLOCK_SECTOR_SIZE bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: may block the current process
+ */
+int32_t virtio_blk_write(uint32_t lba, uint32_t count, const void *buf) {
+    return virtio_transfer(lba, count, (uint8_t *)buf, 1);
+}
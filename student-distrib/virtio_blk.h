@@ -0,0 +1,33 @@
+#ifndef _VIRTIO_BLK_H_
+#define _VIRTIO_BLK_H_
+
+#include "types.h"
+#include "block_device.h"
+
+// Largest request handed to the device, transfers are split into requests of this size.
+#define VIRTIO_MAX_SECTORS 128
+
+#ifndef ASM
+
+// Find a virtio block device on the PCI bus and register it as block device "virtio0".
+extern void virtio_blk_init();
+
+// Interrupt handler, completes every request the device has finished.
+extern void virtio_blk_handler();
+
+// Whether a device was found by virtio_blk_init().
+extern int32_t virtio_blk_present();
+
+// Hand req to the device. Return 0, or -1 if the request is invalid.
+extern int32_t virtio_blk_submit(block_request_t *req);
+
+// Complete finished requests without waiting for the interrupt.
+extern void virtio_blk_poll();
+
+// Synchronous transfers of any length, used as the block device interface.
+extern int32_t virtio_blk_read(uint32_t lba, uint32_t count, void *buf);
+extern int32_t virtio_blk_write(uint32_t lba, uint32_t count, const void *buf);
+
+#endif
+
+#endif
@@ -4,60 +4,53 @@
 #include "ece391syscall.h"
 
 #define BUFSIZE 1024
-#define SBUFSIZE 33
 
 int32_t
 do_one_file (const char* s, const char* fname) 
 {
-    int32_t fd, cnt, last, line_start, line_end, check, s_len;
-    uint8_t data[BUFSIZE+1];
+    int32_t fd, line_start, line_end, check, s_len, len;
+    ece391_stat_t st;
+    ece391_iovec_t out[4];
+    uint8_t* data;
 
     s_len = ece391_strlen ((uint8_t*)s);
     if (-1 == (fd = ece391_open ((uint8_t*)fname))) {
         ece391_fdputs (1, (uint8_t*)"file open failed\n");
         return -1;
     }
-    last = 0;
-    while (1) {
-        cnt = ece391_read (fd, data + last, BUFSIZE - last);
-	if (-1 == cnt) {
-            ece391_fdputs (1, (uint8_t*)"file read failed\n");
-            return -1;
-	}
-	last += cnt;
-	line_start = 0;
-	while (1) {
-	    line_end = line_start;
-	    while (line_end < last && '\n' != data[line_end])
-		line_end++;
-	    if ('\n' != data[line_end] && 0 != cnt && line_start != 0) {
-		/* copy from line_start to last down to 0 and fix last */
-		data[line_end] = '\0';
-		ece391_strcpy (data, data + line_start);
-		last -= line_start;
-		break;
-	    }
-	    /* search the line */
-	    data[line_end] = '\0';
-	    for (check = line_start; check < line_end; check++) {
-		if (s[0] == data[check] && 
-		    0 == ece391_strncmp ((uint8_t*)(data + check), (uint8_t*)s, s_len)) {
-		    ece391_fdputs (1, (uint8_t*)fname);
-		    ece391_fdputs (1, (uint8_t*)":");
-		    ece391_fdputs (1, data + line_start);
-		    ece391_fdputs (1, (uint8_t*)"\n");
-		    break;
-		}
-	    }
-	    line_start = line_end + 1;
-	    if (line_start >= last) {
-	        last = 0;
+    /* map the whole file instead of copying it, one byte more so that
+       a zero always follows the data */
+    if (-1 == ece391_fstat (fd, &st) ||
+        (void*)-1 == (data = ece391_mmap (0, st.size + 1, fd))) {
+        ece391_fdputs (1, (uint8_t*)"file read failed\n");
+        (void)ece391_close (fd);
+        return -1;
+    }
+    for (line_start = 0; line_start < st.size; line_start = line_end + 1) {
+	line_end = line_start;
+	while (line_end < st.size && '\n' != data[line_end])
+	    line_end++;
+	/* search the line */
+	for (check = line_start; check < line_end; check++) {
+	    if (s[0] == data[check] && 
+		0 == ece391_strncmp ((uint8_t*)(data + check), (uint8_t*)s, s_len)) {
+		/* print up to the end of the line or the first NUL */
+		for (len = 0; line_start + len < line_end &&
+		     '\0' != data[line_start + len]; len++);
+		out[0].base = (void*)fname;
+		out[0].len = ece391_strlen ((uint8_t*)fname);
+		out[1].base = ":";
+		out[1].len = 1;
+		out[2].base = data + line_start;
+		out[2].len = len;
+		out[3].base = "\n";
+		out[3].len = 1;
+		(void)ece391_writev (1, out, 4);
 		break;
 	    }
 	}
-	if (0 == cnt)
-	    break;
     }
+    (void)ece391_munmap (data, st.size + 1);
     if (-1 == ece391_close (fd)) {
         ece391_fdputs (1, (uint8_t*)"file close failed\n");
         return -1;
@@ -67,9 +60,10 @@ do_one_file (const char* s, const char* fname)
 
 int main ()
 {
-    int32_t fd, cnt;
-    uint8_t buf[SBUFSIZE];
+    int32_t fd, cnt, off;
+    uint32_t buf[BUFSIZE / 4];
     uint8_t search[BUFSIZE];
+    ece391_dirent_t* de;
 
     if (0 != ece391_getargs (search, BUFSIZE)) {
         ece391_fdputs (1, (uint8_t*)"could not read argument\n");
@@ -81,16 +75,18 @@ int main ()
 	return 2;
     }
 
-    while (0 != (cnt = ece391_read (fd, buf, SBUFSIZE-1))) {
+    while (0 != (cnt = ece391_getdents (fd, buf, BUFSIZE))) {
         if (-1 == cnt) {
 	    ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
 	    return 3;
 	}
-	if ('.' == buf[0]) /* a directory... */
-	    continue;
-	buf[cnt] = '\0';
-	if (0 != do_one_file ((char*)search, (char*)buf))
-	    return 3;
+	for (off = 0; off < cnt; off += de->rec_len) {
+	    de = (ece391_dirent_t*)((uint8_t*)buf + off);
+	    if (ECE391_TYPE_FILE != de->type) /* a directory or the RTC... */
+	        continue;
+	    if (0 != do_one_file ((char*)search, (char*)de->name))
+	        return 3;
+	}
     }
 
     return 0;
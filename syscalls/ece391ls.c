@@ -3,26 +3,31 @@
 #include "ece391support.h"
 #include "ece391syscall.h"
 
-#define SBUFSIZE 33
+#define DBUFSIZE 1024
 
 int main ()
 {
-    int32_t fd, cnt;
-    uint8_t buf[SBUFSIZE];
+    int32_t fd, cnt, off;
+    uint32_t buf[DBUFSIZE / 4];
+    ece391_dirent_t* de;
 
     if (-1 == (fd = ece391_open ((uint8_t*)"."))) {
         ece391_fdputs (1, (uint8_t*)"directory open failed\n");
         return 2;
     }
 
-    while (0 != (cnt = ece391_read (fd, buf, SBUFSIZE-1))) {
+    /* fetch as many entries per call as fit in buf */
+    while (0 != (cnt = ece391_getdents (fd, buf, DBUFSIZE))) {
         if (-1 == cnt) {
 	        ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
 	        return 3;
 	    }
-	    buf[cnt] = '\n';
-	    if (-1 == ece391_write (1, buf, cnt + 1))
-	        return 3;
+	    for (off = 0; off < cnt; off += de->rec_len) {
+	        de = (ece391_dirent_t*)((uint8_t*)buf + off);
+	        de->name[de->name_len] = '\n';
+	        if (-1 == ece391_write (1, de->name, de->name_len + 1))
+	            return 3;
+	    }
     }
 
     return 0;
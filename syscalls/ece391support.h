@@ -9,5 +9,46 @@ extern int32_t ece391_strncmp(const uint8_t* s1, const uint8_t* s2, uint32_t n);
 extern uint8_t *ece391_itoa(uint32_t value, uint8_t* buf, int32_t radix);
 extern uint8_t *ece391_strrev(uint8_t* s);
 
+/*
+ * Mutex and condition variable built on futexes.  Lock/unlock only trap
+ * into the kernel when another process is contending for the lock, and
+ * signal/broadcast only when somebody is actually waiting.  The objects
+ * must live in memory shared by every process using them.
+ *
+ * Mutex state: 0 unlocked, 1 locked, 2 locked with (possible) waiters.
+ */
+typedef struct ece391_mutex {
+    volatile int32_t state;
+} ece391_mutex_t;
+
+typedef struct ece391_cond {
+    volatile int32_t seq;
+    volatile int32_t waiters;
+} ece391_cond_t;
+
+#define ECE391_MUTEX_INITIALIZER { 0 }
+#define ECE391_COND_INITIALIZER { 0, 0 }
+
+extern void ece391_mutex_init(ece391_mutex_t* m);
+extern void ece391_mutex_lock(ece391_mutex_t* m);
+extern int32_t ece391_mutex_trylock(ece391_mutex_t* m);
+extern void ece391_mutex_unlock(ece391_mutex_t* m);
+extern void ece391_cond_init(ece391_cond_t* c);
+extern void ece391_cond_wait(ece391_cond_t* c, ece391_mutex_t* m);
+extern void ece391_cond_signal(ece391_cond_t* c);
+extern void ece391_cond_broadcast(ece391_cond_t* c);
+
+/*
+ * Heap.  ece391_malloc returns 0 when out of memory, and the memory it
+ * returns is not cleared.  ece391_realloc keeps the old contents and may
+ * move the block.  ece391_sbrk moves the end of the heap by increment bytes
+ * and returns the old end, or (void*)-1 on failure; don't mix it with
+ * ece391_malloc, which expects to own the end of the heap.
+ */
+extern void* ece391_sbrk(int32_t increment);
+extern void* ece391_malloc(uint32_t size);
+extern void* ece391_realloc(void* ptr, uint32_t size);
+extern void ece391_free(void* ptr);
+
 #endif /* ECE391SUPPORT_H */
 
@@ -22,6 +22,133 @@ extern int32_t ece391_vidmap (uint8_t** screen_start);
 extern int32_t ece391_set_handler (int32_t signum, void* handler);
 extern int32_t ece391_sigreturn (void);
 
+/*
+ * Synchronous message passing.  A sender blocks in ece391_ipc_send until
+ * the receiver calls ece391_ipc_reply.  Messages up to 64 bytes go through
+ * a short kernel buffer, larger ones (up to 64KB) are copied page by page.
+ * Setting IPC_FLAG_PAGES on a page-aligned buffer in memory obtained from
+ * the kernel moves the pages to the other side instead of copying them;
+ * the receiver then finds IPC_FLAG_PAGES set and buf pointing at the pages.
+ * On receive, buf/len describe the buffer and its capacity and are updated
+ * with what was received.  ece391_ipc_receive returns the sender's pid.
+ */
+#define IPC_FLAG_PAGES 0x1
+
+typedef struct ece391_ipc_msg {
+	void* buf;
+	int32_t len;
+	int32_t flags;
+} ece391_ipc_msg_t;
+
+extern int32_t ece391_ipc_send (int32_t pid, ece391_ipc_msg_t* msg, ece391_ipc_msg_t* reply);
+extern int32_t ece391_ipc_receive (ece391_ipc_msg_t* msg);
+extern int32_t ece391_ipc_reply (int32_t pid, ece391_ipc_msg_t* reply);
+
+/*
+ * Futexes.  ece391_futex_wait sleeps as long as *addr == val and returns 0
+ * once woken, or -1 right away if *addr != val.  ece391_futex_wake wakes up
+ * to n sleepers on addr and returns how many were woken.  Use the mutex and
+ * condition variable in ece391support.h rather than calling these directly.
+ */
+extern int32_t ece391_futex_wait (volatile int32_t* addr, int32_t val);
+extern int32_t ece391_futex_wake (volatile int32_t* addr, int32_t n);
+
+/*
+ * Move the end of the heap to addr and return the new end, or -1 on failure.
+ * ece391_brk (0) returns the current end.  Use ece391_malloc instead of
+ * calling this directly.
+ */
+extern int32_t ece391_brk (void* addr);
+
+/*
+ * Map length bytes at addr (0 lets the kernel choose) and return the start
+ * of the mapping, or (void*)-1 on failure.  With fd == -1 the memory is
+ * anonymous: it reads as zeros and only the pages actually touched use up
+ * physical memory.  Otherwise fd is an open file, mapped read-only from its
+ * first byte without copying; bytes past the end of the file read as zero.
+ * ece391_munmap releases whole pages of a mapping.
+ */
+extern void* ece391_mmap (void* addr, uint32_t length, int32_t fd);
+extern int32_t ece391_munmap (void* addr, uint32_t length);
+
+/*
+ * Copy up to count bytes of the file in_fd, starting at offset, to out_fd
+ * without passing them through user memory.  With offset == -1 the copy
+ * starts at the current position of in_fd and advances it.  Returns the
+ * number of bytes copied, 0 at the end of the file.
+ */
+extern int32_t ece391_sendfile (int32_t out_fd, int32_t in_fd, int32_t offset, int32_t count);
+
+/*
+ * Fill buf with as many directory records as fit and return the number of
+ * bytes used, 0 at the end of the directory.  Records are packed back to
+ * back: step to the next one with rec_len.  Each open directory keeps its
+ * own position.
+ */
+#define ECE391_TYPE_RTC  0
+#define ECE391_TYPE_DIR  1
+#define ECE391_TYPE_FILE 2
+#define ECE391_TYPE_TERMINAL 3
+
+typedef struct ece391_dirent {
+	uint32_t inode;
+	uint32_t size;		/* file length in bytes, 0 if not a file */
+	uint8_t type;		/* ECE391_TYPE_* */
+	uint8_t name_len;	/* not counting the terminating NUL */
+	uint16_t rec_len;	/* offset of the next record */
+	uint8_t name[0];
+} ece391_dirent_t;
+
+extern int32_t ece391_getdents (int32_t fd, void* buf, int32_t nbytes);
+
+/*
+ * ece391_lseek moves the position of a file (or the entry index of a
+ * directory) and returns the new position.  ece391_pread reads from a
+ * given offset without moving the position.  ece391_fstat fills in the
+ * type (ECE391_TYPE_*), size and number of 4KB blocks of an open file.
+ */
+#define ECE391_SEEK_SET 0
+#define ECE391_SEEK_CUR 1
+#define ECE391_SEEK_END 2
+
+typedef struct ece391_stat {
+	uint32_t type;
+	uint32_t size;
+	uint32_t blocks;
+	uint32_t inode;
+} ece391_stat_t;
+
+extern int32_t ece391_lseek (int32_t fd, int32_t offset, int32_t whence);
+extern int32_t ece391_pread (int32_t fd, void* buf, int32_t nbytes, int32_t offset);
+extern int32_t ece391_fstat (int32_t fd, ece391_stat_t* buf);
+
+/*
+ * Scatter/gather I/O over up to ECE391_IOV_MAX buffers in a single call.
+ * Both return the total number of bytes transferred.  Terminal output of
+ * one ece391_writev is never interleaved with output of other programs.
+ */
+#define ECE391_IOV_MAX 16
+
+typedef struct ece391_iovec {
+	void* base;
+	int32_t len;
+} ece391_iovec_t;
+
+extern int32_t ece391_readv (int32_t fd, const ece391_iovec_t* iov, int32_t iovcnt);
+extern int32_t ece391_writev (int32_t fd, const ece391_iovec_t* iov, int32_t iovcnt);
+
+/*
+ * Regular files can be created, written and resized.  ece391_write on a
+ * file writes at its position and extends the file at the end; seek to
+ * ECE391_SEEK_END first to append.  A file open anywhere cannot be unlinked.
+ * File names are paths such as "dir/sub/file"; ece391_unlink also removes
+ * empty directories.
+ */
+extern int32_t ece391_create (const uint8_t* filename);
+extern int32_t ece391_unlink (const uint8_t* filename);
+extern int32_t ece391_truncate (int32_t fd, int32_t length);
+extern int32_t ece391_mkdir (const uint8_t* dirname);
+
 enum signums {
 	DIV_ZERO = 0,
 	SEGFAULT,
@@ -11,5 +11,24 @@
 #define SYS_VIDMAP  8
 #define SYS_SET_HANDLER  9
 #define SYS_SIGRETURN  10
+#define SYS_IPC_SEND    11
+#define SYS_IPC_RECEIVE 12
+#define SYS_IPC_REPLY   13
+#define SYS_FUTEX_WAIT  14
+#define SYS_FUTEX_WAKE  15
+#define SYS_BRK         16
+#define SYS_MMAP        17
+#define SYS_MUNMAP      18
+#define SYS_SENDFILE    19
+#define SYS_GETDENTS    20
+#define SYS_LSEEK       21
+#define SYS_PREAD       22
+#define SYS_FSTAT       23
+#define SYS_READV       24
+#define SYS_WRITEV      25
+#define SYS_CREATE      26
+#define SYS_UNLINK      27
+#define SYS_TRUNCATE    28
+#define SYS_MKDIR       29
 
 #endif /* ECE391SYSNUM_H */